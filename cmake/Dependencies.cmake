@@ -10,6 +10,11 @@ list(APPEND Caffe_LINKER_LIBS ${Boost_LIBRARIES})
 find_package(Threads REQUIRED)
 list(APPEND Caffe_LINKER_LIBS ${CMAKE_THREAD_LIBS_INIT})
 
+# ---[ POSIX shared memory (shm_open lives in librt on Linux)
+if(UNIX AND NOT APPLE)
+  list(APPEND Caffe_LINKER_LIBS rt)
+endif()
+
 # ---[ Google-glog
 find_package(Glog REQUIRED)
 include_directories(SYSTEM ${GLOG_INCLUDE_DIRS})
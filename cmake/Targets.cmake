@@ -69,10 +69,12 @@ function(caffe_pickup_caffe_sources root)
   # collect files
   file(GLOB test_hdrs    ${root}/include/caffe/test/test_*.h*)
   file(GLOB test_srcs    ${root}/src/caffe/test/test_*.cpp)
+  file(GLOB benchmark_hdrs ${root}/include/caffe/benchmark/benchmark_*.h*)
+  file(GLOB benchmark_srcs ${root}/src/caffe/benchmark/benchmark_*.cpp)
   file(GLOB_RECURSE hdrs ${root}/include/caffe/*.h*)
   file(GLOB_RECURSE srcs ${root}/src/caffe/*.cpp)
-  list(REMOVE_ITEM  hdrs ${test_hdrs})
-  list(REMOVE_ITEM  srcs ${test_srcs})
+  list(REMOVE_ITEM  hdrs ${test_hdrs} ${benchmark_hdrs})
+  list(REMOVE_ITEM  srcs ${test_srcs} ${benchmark_srcs})
 
   # adding headers to make the visible in some IDEs (Qt, VS, Xcode)
   list(APPEND srcs ${hdrs} ${PROJECT_BINARY_DIR}/caffe_config.h)
@@ -0,0 +1,108 @@
+// The caffe microbenchmark harness. Benchmark sources register suites with
+// REGISTER_BENCHMARK_SUITE and are linked into the caffe_benchmarks binary.
+#ifndef CAFFE_BENCHMARK_BENCHMARK_MAIN_HPP_
+#define CAFFE_BENCHMARK_BENCHMARK_MAIN_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A timed operation.
+ *
+ * The harness calls SetUp once, then Run repeatedly, timing each call, and
+ * destroys the benchmark before setting up the next one; allocate inputs in
+ * SetUp rather than the constructor so only one benchmark holds memory.
+ * Names should be stable across commits so results can be compared.
+ */
+class Benchmark {
+ public:
+  explicit Benchmark(const string& name) : name_(name) {}
+  virtual ~Benchmark() {}
+
+  const string& name() const { return name_; }
+  virtual void SetUp() {}
+  virtual void Run() = 0;
+  /// @brief The floating point operations of one Run, or 0 if unknown.
+  virtual double Flops() const { return 0; }
+
+ protected:
+  string name_;
+
+  DISABLE_COPY_AND_ASSIGN(Benchmark);
+};
+
+/// @brief What the suites are asked to generate benchmarks for.
+struct BenchmarkConfig {
+  // The batch sizes of the batch dependent benchmarks.
+  vector<int> batch_sizes;
+};
+
+/**
+ * @brief A convolution of the models the benchmarks are sized after: the
+ *        vgps pose network of examples/vgps and the reference AlexNet.
+ */
+struct ConvShape {
+  string name;
+  int channels, height, width;
+  int num_output, kernel_size, stride, pad, group;
+
+  int height_out() const {
+    return (height + 2 * pad - kernel_size) / stride + 1;
+  }
+  int width_out() const {
+    return (width + 2 * pad - kernel_size) / stride + 1;
+  }
+  /// @brief The dimensions of the GEMM of one image and one group.
+  int gemm_m() const { return num_output / group; }
+  int gemm_n() const { return height_out() * width_out(); }
+  int gemm_k() const { return channels / group * kernel_size * kernel_size; }
+};
+
+/// @brief An inner product of the same models.
+struct InnerProductShape {
+  string name;
+  int input, output;
+};
+
+vector<ConvShape> BenchmarkConvShapes();
+vector<InnerProductShape> BenchmarkInnerProductShapes();
+
+class BenchmarkRegistry {
+ public:
+  typedef void (*Suite)(const BenchmarkConfig& config,
+      vector<shared_ptr<Benchmark> >* benchmarks);
+  typedef vector<std::pair<string, Suite> > SuiteList;
+
+  static SuiteList& Registry() {
+    static SuiteList* g_registry_ = new SuiteList();
+    return *g_registry_;
+  }
+
+  static void AddSuite(const string& name, Suite suite) {
+    Registry().push_back(std::make_pair(name, suite));
+  }
+
+ private:
+  // Benchmark registry should never be instantiated - everything is done
+  // with its static variables.
+  BenchmarkRegistry() {}
+};
+
+class BenchmarkRegisterer {
+ public:
+  BenchmarkRegisterer(const string& name, BenchmarkRegistry::Suite suite) {
+    BenchmarkRegistry::AddSuite(name, suite);
+  }
+};
+
+#define REGISTER_BENCHMARK_SUITE(name, suite)                                  \
+  static BenchmarkRegisterer g_benchmark_suite_##name(#name, suite)
+
+}  // namespace caffe
+
+#endif  // CAFFE_BENCHMARK_BENCHMARK_MAIN_HPP_
@@ -262,6 +262,13 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Replace the SyncedMemory holding this Blob's data_, e.g. with a
+   *        view into a larger arena. It must hold at least count() values.
+   */
+  void set_data(const shared_ptr<SyncedMemory>& data);
+  /// @brief Replace the SyncedMemory holding this Blob's diff_.
+  void set_diff(const shared_ptr<SyncedMemory>& diff);
 
   bool ShapeEquals(const BlobProto& other);
 
@@ -122,6 +122,10 @@ class Caffe {
 
   // Getters for boost rng, curand, and cublas handles
   inline static RNG& rng_stream() {
+    RNG* thread_rng = thread_rng_stream();
+    if (thread_rng) {
+      return *thread_rng;
+    }
     if (!Get().random_generator_) {
       Get().random_generator_.reset(new RNG());
     }
@@ -144,6 +148,10 @@ class Caffe {
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // Gives the calling thread its own boost rng, which rng_stream returns in
+  // place of the shared one, so threads running layers at the same time do
+  // not race on it.
+  static void set_thread_random_seed(const unsigned int seed);
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
@@ -160,6 +168,9 @@ class Caffe {
   Brew mode_;
   static shared_ptr<Caffe> singleton_;
 
+  // The rng of the calling thread, if set_thread_random_seed was called.
+  static RNG* thread_rng_stream();
+
  private:
   // The private constructor to avoid duplicate instantiation.
   Caffe();
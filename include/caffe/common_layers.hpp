@@ -346,6 +346,103 @@ class InnerProductLayer : public Layer<Dtype> {
   Blob<Dtype> bias_multiplier_;
 };
 
+/**
+ * @brief InnerProductLayer computed in int8 arithmetic, for CPU inference.
+ *        Selected by the INT8 engine of InnerProductParameter.
+ *
+ * The weights are quantized symmetrically with one scale per output, and the
+ * bottom with the range given by QuantizationParameter input_range (see
+ * tools/calibrate_int8). The products accumulate in int32 and are scaled back
+ * to Dtype before the bias is added. The float weights remain the layer's
+ * parameters, so models load and save as usual: they are quantized on the
+ * first Forward (on every Forward in the TRAIN phase) or by QuantizeWeights.
+ * Backward is InnerProductLayer's, and Forward_gpu runs on the CPU.
+ */
+template <typename Dtype>
+class Int8InnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit Int8InnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param), weights_quantized_(false) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Quantizes the current weights, e.g. after they were changed.
+  void QuantizeWeights();
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    Forward_cpu(bottom, top);
+  }
+
+  bool weights_quantized_;
+  /// The N_ x K_ quantized weights and the scale of each of their rows.
+  vector<int8_t> weight_q_;
+  vector<Dtype> weight_scale_;
+  /// The quantized bottom.
+  vector<int8_t> bottom_q_;
+};
+
+/**
+ * @brief InnerProductLayer with pruned weights, computed with sparse-dense
+ *        products in proportion to the weights it keeps. Selected by the
+ *        SPARSE engine of InnerProductParameter.
+ *
+ * The sparse_block x sparse_block blocks of weights that are all within
+ * sparse_threshold of zero are pruned: they are zeroed in the weight blob and
+ * the others are kept in block sparse rows (see caffe_cpu_bsrmm). The mask is
+ * set on the first Forward, after the weights are loaded, or by
+ * PruneWeights. Backward only computes the gradient of the kept weights, so
+ * training leaves the pruned weights at zero, and Forward in the TRAIN phase
+ * reads the updated values of the kept ones. The dense weights remain the
+ * layer's parameters, so models load and save as usual, including sparse
+ * blobs (BlobProto.sparse_index). Forward_gpu and Backward_gpu run on the CPU.
+ */
+template <typename Dtype>
+class SparseInnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit SparseInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param), weights_pruned_(false) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Prunes the current weights and sets the mask to those it keeps.
+  void PruneWeights();
+  /// @brief The fraction of the weights kept by the mask.
+  Dtype density() const;
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    Forward_cpu(bottom, top);
+  }
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    Backward_cpu(top, propagate_down, bottom);
+  }
+
+  /// Copies the kept weights of the weight blob into values_.
+  void GatherWeights();
+
+  bool weights_pruned_;
+  int block_;
+  /// The kept weights of the N_ x K_ weight matrix in block sparse rows,
+  /// and the gradient of their values.
+  vector<Dtype> values_, values_diff_;
+  vector<int> columns_, row_ptr_;
+  /// The transposed bottom, K_ x M_, and top, N_ x M_, as the sparse
+  /// products take the weights on the left.
+  Blob<Dtype> bottom_t_, top_t_;
+};
+
 /**
  * @brief Normalizes the input to have 0-mean and/or unit (1) variance.
  *
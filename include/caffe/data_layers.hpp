@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -20,6 +22,39 @@
 
 namespace caffe {
 
+class ImageCache;
+
+/**
+ * @brief Counters of the input pipeline of a data layer, accumulated since
+ *        the last ClearStats.
+ *
+ * The producer times are those of the prefetch thread (or of the copy, for
+ * layers that do not prefetch); wait_ms is the time Forward spent blocked on
+ * it. As the prefetch queue holds a single batch, its depth is reported as
+ * ready_batches: the number of batches that were already waiting when
+ * Forward asked for them.
+ */
+struct DataLayerStats {
+  DataLayerStats() { Clear(); }
+
+  void Clear();
+  /// @brief Adds the counts of other, e.g. of the same layer in another Net.
+  void Add(const DataLayerStats& other);
+  /// @brief The items delivered per second since start_us.
+  double ItemsPerSecond() const;
+
+  int batches;
+  int ready_batches;
+  int64_t items;
+  uint64_t bytes_read;
+  double wait_ms;
+  double read_ms;
+  double decode_ms;
+  double transform_ms;
+  // Profiler::Now() at the last Clear.
+  int64_t start_us;
+};
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -46,10 +81,20 @@ class BaseDataLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
 
+  /// @brief The input pipeline counters since the last ClearStats.
+  const DataLayerStats& stats() const { return stats_; }
+  void ClearStats() { stats_.Clear(); }
+
  protected:
+  // Adds the batch_stats_ of a delivered batch of num items to stats_.
+  void CountBatch(int num, bool ready, double wait_ms);
+
   TransformationParameter transform_param_;
   shared_ptr<DataTransformer<Dtype> > data_transformer_;
   bool output_labels_;
+  DataLayerStats stats_;
+  // The producer counters of the batch being prepared.
+  DataLayerStats batch_stats_;
 };
 
 template <typename Dtype>
@@ -76,9 +121,16 @@ class BasePrefetchingDataLayer :
   virtual void InternalThreadEntry() {}
 
  protected:
+  // Joins the prefetch thread, counting the batch it prepared.
+  void WaitForBatch();
+
   Blob<Dtype> prefetch_data_;
   Blob<Dtype> prefetch_label_;
   Blob<Dtype> transformed_data_;
+  // With transform_param.device_transform the prefetch thread fills these
+  // uint8 crops and their plans; prefetch_data_ then only carries the shape.
+  shared_ptr<SyncedMemory> prefetch_crops_;
+  shared_ptr<SyncedMemory> prefetch_plans_;
 };
 
 template <typename Dtype>
@@ -97,6 +149,8 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void InternalThreadEntry();
+  // Moves the cursor to the next datum, looping around the DB.
+  void Next();
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
@@ -165,6 +219,8 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void LoadHDF5FileData(const char* filename);
+  // Moves to the next row, looping around the files.
+  void Next();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
@@ -240,21 +296,43 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void InternalThreadEntry();
+  // Moves to the next image, shuffling the images at the end of the list.
+  void Next();
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // Decoded images, if image_data_param.cache_bytes is set.
+  shared_ptr<ImageCache> image_cache_;
 };
 
 /**
  * @brief Provides data to the Net from memory.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Reset gives the layer one array per top, each holding n samples with the
+ * shape of that top (but for the batch size). Every Forward copies the next
+ * batch_size samples into the tops, visiting them in order or, with
+ * memory_data_param.shuffle, in a random order drawn for every pass.
+ *
+ * In GPU mode a prefetch thread gathers the next batch into page-locked
+ * staging buffers owned by the layer and uploads them on their own stream
+ * while the net runs, so each sample is copied once on the host. In CPU mode
+ * Forward gathers the samples straight into the tops.
+ *
+ * The arrays are not copied: they must stay alive and unchanged until the
+ * next Reset or Release, or the destruction of the layer, as the prefetch
+ * thread reads them after Forward returns.
  */
 template <typename Dtype>
-class MemoryDataLayer : public BaseDataLayer<Dtype> {
+class MemoryDataLayer : public BaseDataLayer<Dtype>, public InternalThread {
  public:
   explicit MemoryDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param), has_new_data_(false) {}
+      : BaseDataLayer<Dtype>(param), has_new_data_(false) {
+#ifndef CPU_ONLY
+    stream_ = NULL;
+    copied_ = NULL;
+#endif
+  }
+  virtual ~MemoryDataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
@@ -271,6 +349,8 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   // Reset should accept const pointers, but can't, because the memory
   //  will be given to Blob, which is mutable
   void Reset(vector<Dtype*> data, int n);
+  /// @brief Stops reading the arrays given to Reset, which can then be freed.
+  void Release();
   // void set_batch_size(int new_size);
 
   int batch_size() { return batch_size_; }
@@ -281,12 +361,36 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void InternalThreadEntry();
+  // Copies the samples of the batch at pos_ from the i-th array to dst.
+  void CopyBatch(int i, Dtype* dst);
+  // Moves pos_ to the next batch, shuffling again after a full pass.
+  void AdvanceBatch();
+  // Gathers and uploads the batch at pos_ into staging_.
+  void PrefetchBatch();
+  void ShuffleOrder();
 
   int batch_size_;
   vector<int> channels_, height_, width_, size_;  // size of each blob
   vector<Dtype*> data_;
   int n_;
   size_t pos_;
+  // The order to visit the samples in, if shuffling.
+  vector<int> order_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // One batch per top, filled by the prefetch thread; prefetched_ is set
+  // once they hold the batch at pos_.
+  vector<shared_ptr<SyncedMemory> > staging_;
+  bool prefetched_;
+#ifndef CPU_ONLY
+  // The stream the staged batch is uploaded on, and the event recording
+  // when the previous one has been copied out.
+  cudaStream_t stream_;
+  cudaEvent_t copied_;
+  int device_;
+#endif
   // Blob<Dtype> added_data_;
   // Blob<Dtype> added_label_;
   bool has_new_data_;
@@ -326,6 +430,8 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
   bool has_mean_values_;
   bool cache_images_;
   vector<std::pair<std::string, Datum > > image_database_cache_;
+  // Decoded images, if window_data_param.cache_bytes is set.
+  shared_ptr<ImageCache> image_cache_;
 };
 
 }  // namespace caffe
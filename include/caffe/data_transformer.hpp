@@ -1,12 +1,16 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <stdint.h>
+
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
+namespace boost { class thread; class barrier; }
+
 namespace caffe {
 
 /**
@@ -17,7 +21,7 @@ template <typename Dtype>
 class DataTransformer {
  public:
   explicit DataTransformer(const TransformationParameter& param, Phase phase);
-  virtual ~DataTransformer() {}
+  virtual ~DataTransformer();
 
   /**
    * @brief Initialize the Random number generations if needed by the
@@ -41,6 +45,10 @@ class DataTransformer {
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
    *
+   * The crop and mirror of every item are drawn up front, then the items are
+   * converted in one pass each, split between this thread and the
+   * transform_param.num_threads - 1 workers started by the constructor.
+   *
    * @param datum_vector
    *    A vector of Datum containing the data to be transformed.
    * @param transformed_blob
@@ -54,6 +62,8 @@ class DataTransformer {
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Mat.
    *
+   * Planned and threaded like the vector of Datum version.
+   *
    * @param mat_vector
    *    A vector of Mat containing the data to be transformed.
    * @param transformed_blob
@@ -87,6 +97,47 @@ class DataTransformer {
    */
   void Transform(Blob<Dtype>* input_blob, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Crops a vector of uint8 Datum without converting it, for
+   * transform_param.device_transform.
+   *
+   * The crop and mirror are planned as in Transform, but only the crop is
+   * applied; NormalizeCrops_cpu or NormalizeCrops_gpu finish the batch.
+   *
+   * @param crop_data
+   *    Receives num x channels x height x width bytes, where height and
+   *    width are the crop size, or the datum size without cropping.
+   * @param plan_data
+   *    Receives num x 3 ints: h_off, w_off and mirror of every item.
+   */
+  void CropBatch(const vector<Datum>& datum_vector, const int height,
+      const int width, uint8_t* crop_data, int* plan_data);
+
+  /**
+   * @brief Subtracts the mean from, scales and mirrors a batch produced by
+   * CropBatch. The result is identical to Transform on the same Datums.
+   */
+  void NormalizeCrops_cpu(const int num, const int channels, const int height,
+      const int width, const uint8_t* crop_data, const int* plan_data,
+      Dtype* transformed_data);
+  /// @brief Like NormalizeCrops_cpu, with all pointers on the device.
+  void NormalizeCrops_gpu(const int num, const int channels, const int height,
+      const int width, const uint8_t* crop_data, const int* plan_data,
+      Dtype* transformed_data);
+
+  /**
+   * @brief The crop offsets and mirror flag chosen for one item.
+   *
+   * Plans are drawn from the RNG in the same order as the single item
+   * Transform calls, so a planned batch is identical to transforming the
+   * items one by one.
+   */
+  struct Plan {
+    int h_off;
+    int w_off;
+    bool mirror;
+  };
+
  protected:
    /**
    * @brief Generates a random integer from Uniform({0, 1, ..., n-1}).
@@ -99,6 +150,32 @@ class DataTransformer {
   virtual int Rand(int n);
 
   void Transform(const Datum& datum, Dtype* transformed_data);
+
+  /// @brief Draws the crop and mirror decisions for an input of this size.
+  void MakePlan(const int input_height, const int input_width, Plan* plan);
+  /// @brief Replicates a single mean_value and fills the lookup table.
+  void PrepareMean(const int channels);
+  /// @brief Checks that an input matches the mean_file, if there is one.
+  void CheckMeanShape(const int channels, const int height, const int width);
+  /// @brief Transforms the planned items [start, end) of a batch.
+  void TransformDatumRange(const vector<Datum>* datum_vector,
+      const vector<Plan>* plans, const int start, const int end,
+      const int height, const int width, Dtype* transformed_data);
+  void TransformMatRange(const vector<cv::Mat>* mat_vector,
+      const vector<Plan>* plans, const int start, const int end,
+      const int height, const int width, Dtype* transformed_data);
+  /// @brief Splits the planned batch in batch_ over this thread and the
+  /// workers, and returns once all of it is transformed.
+  void TransformBatch();
+  /// @brief Transforms the share of batch_ of the given thread.
+  void TransformBatchShare(const int thread_id);
+  void WorkerEntry(const int thread_id);
+  /// @brief Transforms a single item according to its plan.
+  void TransformPlanned(const Datum& datum, const Plan& plan,
+      const int height, const int width, Dtype* transformed_data);
+  void TransformPlanned(const cv::Mat& cv_img, const Plan& plan,
+      const int height, const int width, Dtype* transformed_data);
+
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -107,6 +184,29 @@ class DataTransformer {
   Phase phase_;
   Blob<Dtype> data_mean_;
   vector<Dtype> mean_values_;
+  // (pixel - mean_values_[c]) * scale for every uint8 pixel value, laid out
+  // as channels x 256; only used when there is no mean_file.
+  vector<Dtype> pixel_lookup_;
+  // mean_values_ (or zeros) as a blob, for NormalizeCrops_gpu.
+  Blob<Dtype> channel_mean_;
+  // The batch being transformed; exactly one of datum_vector and mat_vector
+  // is set.
+  struct Batch {
+    const vector<Datum>* datum_vector;
+    const vector<cv::Mat>* mat_vector;
+    const vector<Plan>* plans;
+    int num;
+    int height;
+    int width;
+    Dtype* transformed_data;
+  };
+  Batch batch_;
+  // The num_threads - 1 workers, which wait on worker_barrier_ for a batch.
+  vector<shared_ptr<boost::thread> > worker_threads_;
+  shared_ptr<boost::barrier> worker_barrier_;
+  bool workers_stop_;
+
+  DISABLE_COPY_AND_ASSIGN(DataTransformer);
 };
 
 }  // namespace caffe
@@ -18,7 +18,7 @@ namespace caffe {
  */
 class InternalThread {
  public:
-  InternalThread() : thread_() {}
+  InternalThread() : thread_(), finished_(false) {}
   virtual ~InternalThread();
 
   /** Returns true if the thread was successfully started. **/
@@ -28,6 +28,9 @@ class InternalThread {
   bool WaitForInternalThreadToExit();
 
   bool is_started() const;
+  /** Returns true once the thread has returned from InternalThreadEntry,
+      so that waiting for it will not block. **/
+  bool is_finished() const { return finished_; }
 
  protected:
   /* Implement this method in your subclass
@@ -35,6 +38,12 @@ class InternalThread {
   virtual void InternalThreadEntry() {}
 
   shared_ptr<boost::thread> thread_;
+
+ private:
+  // Runs InternalThreadEntry, then sets finished_.
+  void Entry();
+
+  volatile bool finished_;
 };
 
 }  // namespace caffe
@@ -11,9 +11,13 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/profiler.hpp"
 
 namespace caffe {
 
+class RawWeights;
+template <typename Dtype> class NetWeights;
+
 /**
  * @brief Connects Layer%s together into a directed acyclic graph (DAG)
  *        specified by a NetParameter.
@@ -25,6 +29,16 @@ class Net {
  public:
   explicit Net(const NetParameter& param);
   explicit Net(const string& param_file, Phase phase);
+  /**
+   * @brief Builds an execution context of weights: the net of its parameters,
+   *        whose layers use the weight blobs of weights instead of their own
+   *        and so hold only the activations.
+   *
+   * The contexts of the same weights can run concurrently, each on a thread
+   * of its own. They only run forward: Backward and Update abort, as the
+   * contexts share the parameter diffs as well. See NetWeights.
+   */
+  explicit Net(const shared_ptr<const NetWeights<Dtype> >& weights);
   virtual ~Net() {}
 
   /// @brief Initialize a network with a NetParameter.
@@ -66,6 +80,13 @@ class Net {
   void BackwardFromTo(int start, int end);
   void BackwardFrom(int start);
   void BackwardTo(int end);
+  /**
+   * @brief Runs Backward and returns the sum of squares of the owned
+   *        parameter diffs. Each parameter is summed as soon as its owner,
+   *        the first layer using it and so the last to write its diff, is
+   *        done, while the diff is still in cache.
+   */
+  Dtype BackwardWithSumsqDiff();
 
   /**
    * @brief Reshape all layers from bottom to top.
@@ -104,7 +125,16 @@ class Net {
    *        another Net.
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
+  /// @brief Loads a .caffemodel, or a raw weights file with
+  ///        CopyTrainedLayersFromRaw.
   void CopyTrainedLayersFrom(const string trained_filename);
+  /**
+   * @brief Maps a raw weights file (see RawWeights) and points the float
+   *        parameters straight at its pages, which are copied on write.
+   *
+   * The values are copied instead for a Net<double> or with flat_params.
+   */
+  void CopyTrainedLayersFromRaw(const string& trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
 
@@ -157,9 +187,40 @@ class Net {
     return param_names_index_;
   }
   inline const vector<int>& param_owners() const { return param_owners_; }
+  /**
+   * @brief returns the Blob whose data and diff are the arenas holding all
+   *        owned parameters when NetParameter.flat_params is set, else NULL.
+   *
+   * Each owned parameter is a view of count() values starting at its
+   * param_flat_offsets() entry. The padding between them is kept at zero.
+   */
+  inline const shared_ptr<Blob<Dtype> >& flat_params() const {
+    return flat_params_;
+  }
+  inline const vector<int>& param_flat_offsets() const {
+    return param_flat_offsets_;
+  }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
+  /**
+   * @brief Whether NetParameter.fp16_storage is set: the activations and
+   *        owned parameters are then kept as halves between the layers.
+   *
+   * The managed blobs are expanded to Dtype in a scratch arena shared by all
+   * layers just before a layer reads them, and compressed again after the
+   * layer writes them, so after a Forward only the inputs and outputs of the
+   * net and the tops of its data layers hold valid data. The parameters are
+   * compressed on the first Forward, so the weights must be loaded before
+   * it; ToProto expands them again. The parameters of shared_weights() stay
+   * in Dtype, as do recurrent layers, their unrolled nets and their bottoms,
+   * tops and parameters.
+   */
+  inline bool fp16_storage() const { return fp16_storage_; }
+  /// @brief The weights this net is an execution context of, if any.
+  inline const shared_ptr<const NetWeights<Dtype> >& shared_weights() const {
+    return shared_weights_;
+  }
   /// @brief Input and output blob numbers
   inline int num_inputs() const { return net_input_blobs_.size(); }
   inline int num_outputs() const { return net_output_blobs_.size(); }
@@ -182,6 +243,13 @@ class Net {
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /**
+   * @brief Records the forward and backward pass of every layer into
+   *        profiler, or stops recording if it is NULL.
+   */
+  void set_profiler(const shared_ptr<Profiler>& profiler);
+  inline const shared_ptr<Profiler>& profiler() const { return profiler_; }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
@@ -207,17 +275,37 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Checks that the net can run backward, as every backward pass
+  ///        does before touching a diff.
+  void CheckBackwardAllowed() const;
+
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
   void BackwardDebugInfo(const int layer_id);
+  /// @brief Helper for displaying debug info about all params in Backward.
+  void BackwardParamsDebugInfo();
   /// @brief Helper for displaying debug info in Update.
   void UpdateDebugInfo(const int param_id);
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
+  /// @brief Move the owned parameters into the flat_params_ arenas.
+  void FlattenParams();
+  /// @brief Groups the blobs stored as halves and compresses them.
+  void SetUpHalfStorage();
+  /// @brief Points the blobs layer_id uses into the half arena and expands
+  ///        those it reads.
+  void ExpandHalfBlobs(const int layer_id);
+  /// @brief Compresses the blobs layer_id wrote back into halves.
+  void CompressHalfBlobs(const int layer_id);
+  /// @brief Moves the blobs of half group from into group into.
+  void MergeHalfGroups(const int from, const int into);
+  /// @brief Writes the parameters of a layer kept as halves to its proto.
+  void HalfParamsToProto(const int layer_id, LayerParameter* param,
+      bool write_diff) const;
 
   /// @brief The network name
   string name_;
@@ -257,6 +345,31 @@ class Net {
   vector<Blob<Dtype>*> net_output_blobs_;
   /// The parameters in the network.
   vector<shared_ptr<Blob<Dtype> > > params_;
+  /// The data and diff arenas holding the owned parameters, if flattened.
+  shared_ptr<Blob<Dtype> > flat_params_;
+  /// The offset of each owned parameter in flat_params_ (-1 if shared).
+  vector<int> param_flat_offsets_;
+  /// The raw weights files the parameters point into.
+  vector<shared_ptr<RawWeights> > raw_weights_;
+  /// With fp16_storage, the blobs sharing one SyncedMemory, stored as count
+  /// halves between the layers using them.
+  struct HalfGroup {
+    vector<Blob<Dtype>*> blobs;
+    shared_ptr<SyncedMemory> half;
+    int count;
+  };
+  bool fp16_storage_;
+  /// Whether SetUpHalfStorage has run.
+  bool half_ready_;
+  vector<HalfGroup> half_groups_;
+  /// The half groups each layer reads, its bottoms and parameters, and
+  /// writes, its tops.
+  vector<vector<int> > layer_half_inputs_;
+  vector<vector<int> > layer_half_outputs_;
+  /// The scratch memory the groups of a layer are expanded into.
+  shared_ptr<SyncedMemory> half_arena_;
+  /// The weights the layers use, if this net is an execution context.
+  shared_ptr<const NetWeights<Dtype> > shared_weights_;
   /// the learning rate multipliers
   vector<float> params_lr_;
   /// the weight decay multipliers
@@ -265,10 +378,58 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// The profiler recording the layer passes, if any, and the ids of the
+  /// layer names in it.
+  shared_ptr<Profiler> profiler_;
+  vector<int> layer_profile_ids_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
 
+/**
+ * @brief The trained weights of a net, shared read-only by any number of
+ *        execution contexts.
+ *
+ * A Net keeps its activations in the top blobs of its layers, so it runs on
+ * one thread at a time. Each Net built from a NetWeights owns only its
+ * activations and scratch buffers, and can run on a thread of its own, which
+ * sets its Caffe mode and device first. The weights take the same memory
+ * however many contexts there are.
+ *
+ * The weights are synchronized once to the mode they are loaded in, the mode
+ * the contexts should run in, so that the contexts only ever read them.
+ * Nothing may write to them afterwards: neither training nor layers updating
+ * their parameters in the forward pass, like BatchNorm without
+ * use_global_stats.
+ */
+template <typename Dtype>
+class NetWeights {
+ public:
+  /// @brief Loads trained_filename, a .caffemodel or raw weights file, into
+  ///        the net of param.
+  NetWeights(const NetParameter& param, const string& trained_filename);
+  /// @brief Loads trained_filename into the TEST phase net of param_file.
+  NetWeights(const string& param_file, const string& trained_filename);
+
+  /// @brief The parameters the execution contexts are built from.
+  inline const NetParameter& param() const { return param_; }
+  /// @brief The net holding the weights, which is never run.
+  inline const Net<Dtype>& net() const { return *net_; }
+  /// @brief The weight blobs of the named layer.
+  const vector<shared_ptr<Blob<Dtype> > >& layer_blobs(
+      const string& layer_name) const;
+  /// @brief The bytes of the weights, counting shared parameters once.
+  size_t memory_bytes() const;
+
+ protected:
+  void Init(const string& trained_filename);
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > net_;
+
+  DISABLE_COPY_AND_ASSIGN(NetWeights);
+};
+
 
 }  // namespace caffe
 
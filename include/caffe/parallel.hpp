@@ -0,0 +1,72 @@
+#ifndef CAFFE_PARALLEL_HPP_
+#define CAFFE_PARALLEL_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/solver.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Averages the gradients of solvers running in separate processes on
+ *        the same machine, for multi-process data parallel training.
+ *
+ * Each of the num_ranks processes trains its own copy of the net on its own
+ * data, with a ShmAllReduce of the same name and its own rank attached to its
+ * solver. Every iteration, once the gradients are ready, the owned parameter
+ * diffs are averaged across the processes by a ring all-reduce through a
+ * POSIX shared memory segment, so that all the processes apply the same
+ * update. The parameters of rank 0 are copied to the other ranks on
+ * construction, which blocks until all the ranks have attached.
+ *
+ * Rank 0 creates the segment, replacing any segment of the same name, and
+ * unlinks it once all the ranks have attached. It records its process id
+ * and start time in the segment, so that the other ranks never attach to a
+ * segment left behind by a run that crashed. A rank waiting longer than
+ * timeout_seconds for the others, e.g. because one of them died, aborts.
+ */
+template <typename Dtype>
+class ShmAllReduce : public Solver<Dtype>::Callback {
+ public:
+  ShmAllReduce(shared_ptr<Solver<Dtype> > solver, const string& name,
+      int rank, int num_ranks, int timeout_seconds = 600);
+  virtual ~ShmAllReduce();
+
+  inline int rank() const { return rank_; }
+  inline int num_ranks() const { return num_ranks_; }
+
+ protected:
+  virtual void on_gradients_ready();
+  // Blocks until all the ranks have called it; phase names the wait if it
+  // times out.
+  void Barrier(const char* phase);
+  // The gradient buffer of a rank in the segment.
+  Dtype* buffer(int rank) const;
+  // Creates the segment (rank 0) or waits for it to be created (others).
+  void Attach();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  string name_;
+  int rank_;
+  int num_ranks_;
+  int timeout_seconds_;
+  // The blobs owning the parameters of the train net.
+  vector<Blob<Dtype>*> params_;
+  // The total count of params_, split into num_ranks_ chunks of chunk_size_.
+  size_t count_;
+  size_t chunk_size_;
+  // The distance between the rank buffers, in Dtype.
+  size_t stride_;
+  void* map_;
+  size_t map_size_;
+  // The flag the barrier in the segment flips to when all ranks arrive.
+  int sense_;
+
+  DISABLE_COPY_AND_ASSIGN(ShmAllReduce);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_PARALLEL_HPP_
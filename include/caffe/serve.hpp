@@ -0,0 +1,85 @@
+#ifndef CAFFE_SERVE_HPP_
+#define CAFFE_SERVE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+/// @brief The types of the frames of the Server protocol.
+enum ServeFrameType {
+  kServeInfer = 0,
+  kServeStats = 1,
+  kServeError = 2
+};
+
+class ServeQueue;
+class ServeStats;
+struct ServeRequest;
+
+/**
+ * @brief Answers inference requests with a Net, running the requests that
+ *        arrive close together as one batch.
+ *
+ * Requests and responses are frames of a uint32 type, the uint32 size of the
+ * payload in bytes and the payload, in native byte order. An inference
+ * request holds the float32 values of one sample of every input blob of the
+ * net, concatenated, and its response those of every output blob. A stats
+ * request has no payload and its response holds the statistics as json.
+ * Every request of a connection is answered in order.
+ *
+ * The first axis of every input and output blob is the batch: a net with an
+ * output that is not computed per sample, such as a scalar loss, is rejected.
+ * A Server serves once, either a pair of file descriptors or a socket.
+ */
+class Server {
+ public:
+  /// max_batch_size 0 batches up to the batch size of the net inputs.
+  Server(Net<float>* net, int max_batch_size, double batch_deadline_ms,
+      int stats_interval);
+  ~Server();
+
+  /// @brief Answers the requests read from in_fd on out_fd, e.g. stdin and
+  ///        stdout, returning once in_fd ends and all are answered.
+  void ServeFds(int in_fd, int out_fd);
+  /// @brief Answers the clients connecting to a Unix socket at path; never
+  ///        returns.
+  void ServeSocket(const string& path);
+
+  inline int max_batch_size() const { return max_batch_size_; }
+  /// @brief What has been served so far, as in a stats response.
+  string StatsJson() const;
+
+ protected:
+  // Runs the queued requests, batch by batch, until the queue is closed.
+  void Run();
+  // Runs the inference requests through the net, replacing their payloads
+  // with the outputs.
+  void Forward(const vector<ServeRequest*>& infer);
+  // Checks that the first axis of every output is the batch.
+  void CheckOutputShapes() const;
+
+  Net<float>* net_;
+  int max_batch_size_;
+  int64_t batch_deadline_us_;
+  int stats_interval_;
+  // The input shapes, with the batch size of the current batch.
+  vector<vector<int> > input_shapes_;
+  // Where the sample of each input starts in a request, in floats.
+  vector<int> input_offsets_;
+  size_t input_bytes_;
+  int batch_size_;
+  shared_ptr<ServeQueue> queue_;
+  shared_ptr<ServeStats> stats_;
+
+  DISABLE_COPY_AND_ASSIGN(Server);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_SERVE_HPP_
@@ -1,11 +1,14 @@
 #ifndef CAFFE_OPTIMIZATION_SOLVER_HPP_
 #define CAFFE_OPTIMIZATION_SOLVER_HPP_
 
+#include <deque>
 #include <string>
 #include <vector>
 
 #include "caffe/net.hpp"
 
+namespace boost { class thread; class barrier; }
+
 namespace caffe {
 
 /**
@@ -17,6 +20,24 @@ namespace caffe {
 template <typename Dtype>
 class Solver {
  public:
+  /**
+   * @brief Hooks into Step, for example to synchronize the gradients of
+   *        solvers training in parallel. Callbacks are not owned and must
+   *        outlive the training.
+   */
+  class Callback {
+   public:
+    virtual ~Callback() {}
+
+   protected:
+    // Called every iteration once the gradients have been accumulated into
+    // the parameter diffs of the train net, before ComputeUpdateValue.
+    virtual void on_gradients_ready() = 0;
+
+    template <typename T>
+    friend class Solver;
+  };
+
   explicit Solver(const SolverParameter& param);
   explicit Solver(const string& param_file);
   void Init(const SolverParameter& param);
@@ -27,21 +48,88 @@ class Solver {
   virtual void Solve(const char* resume_file = NULL);
   inline void Solve(const string resume_file) { Solve(resume_file.c_str()); }
   void Step(int iters);
-  virtual ~Solver() {}
+  virtual ~Solver();
   inline shared_ptr<Net<Dtype> > net() { return net_; }
   inline const vector<shared_ptr<Net<Dtype> > >& test_nets() {
     return test_nets_;
   }
   int iter() { return iter_; }
+  /// @brief The replicas of the train net run by the other solver_threads,
+  ///        sharing its parameters. Empty unless solver_threads > 1.
+  inline const vector<shared_ptr<Net<Dtype> > >& worker_nets() {
+    return worker_nets_;
+  }
+  inline const vector<Callback*>& callbacks() const { return callbacks_; }
+  inline void add_callback(Callback* value) { callbacks_.push_back(value); }
+  /// @brief Waits until all asynchronous snapshots are written to disk.
+  void WaitForSnapshots() { JoinSnapshots(0); }
+  /**
+   * @brief Records the layer passes of the train, test and replica nets and
+   *        the stages of each step into profiler, or stops recording if it
+   *        is NULL. Set from SolverParameter.profile on construction.
+   */
+  void set_profiler(const shared_ptr<Profiler>& profiler);
+  inline const shared_ptr<Profiler>& profiler() const { return profiler_; }
 
  protected:
+  // A snapshot staged in host memory, to be written by WriteSnapshot.
+  struct SnapshotJob {
+    string model_filename;
+    string state_filename;
+    bool write_diff;
+    bool write_fp16;
+    // The net and solver state without their blobs, which are staged below.
+    NetParameter net_param;
+    SolverState state;
+    vector<vector<shared_ptr<Blob<Dtype> > > > layer_blobs;
+    vector<shared_ptr<Blob<Dtype> > > history;
+  };
+
   // Get the update value for the current iteration.
   virtual void ComputeUpdateValue() = 0;
+  // Zeroes the diffs of the parameters of net.
+  static void ClearParamDiffs(Net<Dtype>* net);
+  // Splits the data layers of the train net param between num_shards
+  // solver_threads replicas, setting them up as shard 0; dies on a data layer
+  // that cannot be split.
+  void ShardDataLayers(int num_shards, NetParameter* net_param);
+  // Creates the replicas of the train net for solver_threads and starts a
+  // thread for each.
+  void InitWorkers(const NetParameter& net_param);
+  // Stops and joins the worker threads.
+  void StopWorkers();
+  // The loop of the thread running worker_nets_[thread_id - 1], released by
+  // ForwardBackwardParallel every iteration.
+  void WorkerEntry(int thread_id, unsigned int seed);
+  // Runs the forward and backward passes of the train net and of all its
+  // replicas at the same time, then averages the replica gradients into the
+  // train net. Returns the loss summed over iter_size, averaged over the
+  // replicas.
+  Dtype ForwardBackwardParallel();
+  // Averages the gradients of all the replicas into the train net for the
+  // thread_id-th of solver_threads equal slices of its owned parameters,
+  // so that every thread reduces at the same time.
+  void ReduceDiffs(int thread_id);
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
   // written to disk together with the learned net.
   void Snapshot();
+  // With snapshot_async, Snapshot copies the state into a SnapshotJob and
+  // hands it to a background thread running WriteSnapshot.
+  void SnapshotAsync(const string& model_filename,
+      const string& state_filename);
+  static void WriteSnapshot(shared_ptr<SnapshotJob> job);
+  // Joins the snapshot threads that have finished.
+  void ReapSnapshots();
+  // Waits for the oldest snapshot threads until at most max_pending are
+  // still running.
+  void JoinSnapshots(int max_pending);
+  // The blobs making up the solver state, which SnapshotSolverState writes
+  // as SolverState.history. Needed for asynchronous snapshots.
+  virtual vector<Blob<Dtype>*> SolverStateBlobs() {
+    return vector<Blob<Dtype>*>();
+  }
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
@@ -52,12 +140,40 @@ class Solver {
   void Restore(const char* resume_file);
   virtual void RestoreSolverState(const SolverState& state) = 0;
   void DisplayOutputBlobs(const int net_id);
+  // Logs and clears the input pipeline counters of the data layers, summed
+  // over the replicas.
+  void DisplayDataStats();
+  // Writes the profiler events to profile_file, if both are set.
+  void WriteProfile();
 
   SolverParameter param_;
   int iter_;
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  vector<shared_ptr<Net<Dtype> > > worker_nets_;
+  vector<shared_ptr<boost::thread> > worker_threads_;
+  shared_ptr<boost::barrier> worker_barrier_;
+  bool workers_stop_;
+  // The loss and the owned parameter diffs of every replica, indexed by
+  // thread id, the train net being 0.
+  vector<Dtype> worker_losses_;
+  vector<vector<Dtype*> > worker_diffs_;
+  vector<Callback*> callbacks_;
+  // The sum of squares of the owned parameter diffs, summed by the last
+  // backward pass of the current step when clipping gradients, else -1.
+  Dtype param_sumsq_diff_;
+  // Whether the last update left the parameter diffs zeroed, so that the
+  // next step need not clear them.
+  bool param_diffs_zeroed_;
+  // The background threads writing asynchronous snapshots, oldest first.
+  std::deque<shared_ptr<boost::thread> > snapshot_threads_;
+  shared_ptr<Profiler> profiler_;
+  // The ids of the names of the solver stages in profiler_.
+  int profile_test_id_;
+  int profile_callbacks_id_;
+  int profile_update_id_;
+  int profile_snapshot_id_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -81,9 +197,24 @@ class SGDSolver : public Solver<Dtype> {
   void PreSolve();
   Dtype GetLearningRate();
   virtual void ComputeUpdateValue();
+  // Returns the factor bringing the L2 norm of the owned parameter diffs
+  // down to clip_gradients, or 1 if they are within it or clipping is off.
+  Dtype GetClipScale();
   virtual void ClipGradients();
+  // Scales the owned parameter diffs by diff_scale and adds the weight decay
+  // to them, ahead of the unfused updates of RMSProp and Adam.
+  void ScaleAndRegularize(Dtype diff_scale);
+  // Applies the update to every owned parameter in a single read-modify-write
+  // pass (see SolverParameter.fused_update), leaving the parameter diffs
+  // zeroed for the next step. rate is the global learning rate, and the
+  // diffs are scaled by diff_scale on the fly.
+  void FusedUpdate(Dtype rate, Dtype diff_scale);
+  // Updates the data and history of one owned parameter in place.
+  virtual void FusedUpdateParam(int param_id, Dtype local_rate,
+      Dtype diff_scale, Dtype local_decay, bool l1_decay);
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
+  virtual vector<Blob<Dtype>*> SolverStateBlobs();
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
@@ -103,6 +234,8 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void FusedUpdateParam(int param_id, Dtype local_rate,
+      Dtype diff_scale, Dtype local_decay, bool l1_decay);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -117,6 +250,8 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue();
+  virtual void FusedUpdateParam(int param_id, Dtype local_rate,
+      Dtype diff_scale, Dtype local_decay, bool l1_decay);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -125,6 +260,60 @@ class AdaGradSolver : public SGDSolver<Dtype> {
   DISABLE_COPY_AND_ASSIGN(AdaGradSolver);
 };
 
+/**
+ * @brief Scales the gradients by a running average of their recent squared
+ *        magnitude (RMSProp), decaying with rms_decay and kept in the
+ *        history.
+ */
+template <typename Dtype>
+class RMSPropSolver : public SGDSolver<Dtype> {
+ public:
+  explicit RMSPropSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) { constructor_sanity_check(); }
+  explicit RMSPropSolver(const string& param_file)
+      : SGDSolver<Dtype>(param_file) { constructor_sanity_check(); }
+
+ protected:
+  virtual void ComputeUpdateValue();
+  virtual void FusedUpdateParam(int param_id, Dtype local_rate,
+      Dtype diff_scale, Dtype local_decay, bool l1_decay);
+  void constructor_sanity_check() {
+    CHECK_EQ(0, this->param_.momentum())
+        << "Momentum cannot be used with RMSProp.";
+    CHECK_GE(this->param_.rms_decay(), 0)
+        << "rms_decay should lie between 0 and 1.";
+    CHECK_LT(this->param_.rms_decay(), 1)
+        << "rms_decay should lie between 0 and 1.";
+  }
+
+  DISABLE_COPY_AND_ASSIGN(RMSPropSolver);
+};
+
+/**
+ * @brief Adam (Kingma and Ba, 2014) keeps running averages of the gradients
+ *        and of their squares, decaying with momentum and momentum2, and
+ *        steps by their ratio after correcting their bias towards zero.
+ *
+ * The history holds the first moments of all the parameters, followed by
+ * their second moments.
+ */
+template <typename Dtype>
+class AdamSolver : public SGDSolver<Dtype> {
+ public:
+  explicit AdamSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) { AdamPreSolve(); }
+  explicit AdamSolver(const string& param_file)
+      : SGDSolver<Dtype>(param_file) { AdamPreSolve(); }
+
+ protected:
+  void AdamPreSolve();
+  virtual void ComputeUpdateValue();
+  virtual void FusedUpdateParam(int param_id, Dtype local_rate,
+      Dtype diff_scale, Dtype local_decay, bool l1_decay);
+
+  DISABLE_COPY_AND_ASSIGN(AdamSolver);
+};
+
 template <typename Dtype>
 Solver<Dtype>* GetSolver(const SolverParameter& param) {
   SolverParameter_SolverType type = param.solver_type();
@@ -136,6 +325,10 @@ Solver<Dtype>* GetSolver(const SolverParameter& param) {
       return new NesterovSolver<Dtype>(param);
   case SolverParameter_SolverType_ADAGRAD:
       return new AdaGradSolver<Dtype>(param);
+  case SolverParameter_SolverType_RMSPROP:
+      return new RMSPropSolver<Dtype>(param);
+  case SolverParameter_SolverType_ADAM:
+      return new AdamSolver<Dtype>(param);
   default:
       LOG(FATAL) << "Unknown SolverType: " << type;
   }
@@ -21,13 +21,28 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// Memory that is uploaded asynchronously has to be pinned, so it can be
+// asked for explicitly, which is only safe once a GPU is in use.
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
+inline void CaffeMallocHost(void** ptr, size_t size, bool pinned = false) {
+#ifndef CPU_ONLY
+  if (pinned) {
+    CUDA_CHECK(cudaMallocHost(ptr, size));
+    return;
+  }
+#endif
   *ptr = malloc(size);
   CHECK(*ptr) << "host allocation of size " << size << " failed";
 }
 
-inline void CaffeFreeHost(void* ptr) {
+inline void CaffeFreeHost(void* ptr, bool pinned = false) {
+#ifndef CPU_ONLY
+  if (pinned) {
+    CUDA_CHECK(cudaFreeHost(ptr));
+    return;
+  }
+#endif
   free(ptr);
 }
 
@@ -42,18 +57,35 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
-  explicit SyncedMemory(size_t size)
+        own_cpu_data_(false), pinned_(false), offset_(0) {}
+  /// @param pinned allocate page-locked host memory, only valid on a GPU.
+  explicit SyncedMemory(size_t size, bool pinned = false)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), pinned_(pinned), offset_(0) {}
+  /**
+   * @brief A view of size bytes of arena, starting offset bytes in. The view
+   *        owns no memory and shares the synchronization state of the whole
+   *        arena.
+   */
+  SyncedMemory(const shared_ptr<SyncedMemory>& arena, size_t offset,
+      size_t size);
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
   const void* gpu_data();
   void* mutable_cpu_data();
   void* mutable_gpu_data();
+#ifndef CPU_ONLY
+  /**
+   * @brief Starts copying the host data to the device on stream, leaving
+   *        the memory synced. The caller synchronizes with the stream before
+   *        using the device data, and the copy only overlaps with other work
+   *        if the host memory is pinned.
+   */
+  void async_gpu_push(const cudaStream_t& stream);
+#endif
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
-  SyncedHead head() { return head_; }
+  SyncedHead head() { return arena_ ? arena_->head() : head_; }
   size_t size() { return size_; }
 
  private:
@@ -64,6 +96,10 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  bool pinned_;
+  // Set for views: the memory holding this one, and where it starts in it.
+  shared_ptr<SyncedMemory> arena_;
+  size_t offset_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,70 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_H_
+#define CAFFE_UTIL_IMAGE_CACHE_H_
+
+#include <opencv2/core/core.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe LRU cache of decoded images, bounded by the number of
+ *        bytes of pixel data it holds.
+ *
+ * The cached cv::Mat share their data with the callers, who must not write
+ * into them.
+ */
+class ImageCache {
+ public:
+  explicit ImageCache(size_t capacity_bytes);
+  ~ImageCache();
+
+  /**
+   * @brief The process-wide cache shared by the image data layers. Its
+   *        capacity is raised to at least capacity_bytes.
+   */
+  static shared_ptr<ImageCache> Shared(size_t capacity_bytes);
+  /// @brief The cache key for an image file read with the given options.
+  static string Key(const string& filename, const int height, const int width,
+      const bool is_color);
+
+  /// @brief Returns true and sets image if key is cached.
+  bool Lookup(const string& key, cv::Mat* image);
+  /// @brief Adds an image, evicting the least recently used ones to fit.
+  void Insert(const string& key, const cv::Mat& image);
+
+  void set_capacity(size_t capacity_bytes);
+  size_t capacity() const { return capacity_; }
+  size_t bytes() const { return bytes_; }
+  size_t size() const { return entries_.size(); }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+ protected:
+  void EvictTo(size_t capacity_bytes);
+  void LogStats();
+
+  typedef std::list<string> LruList;
+  typedef std::map<string, std::pair<cv::Mat, LruList::iterator> > EntryMap;
+  // Keys from most to least recently used.
+  LruList lru_;
+  EntryMap entries_;
+  size_t capacity_;
+  size_t bytes_;
+  size_t hits_;
+  size_t misses_;
+  shared_ptr<boost::mutex> mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_H_
@@ -85,6 +85,22 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Stores the data of every blob of the layers of param as IEEE half
+// precision in half_data, halving the size of the weights. Diffs are kept.
+void ConvertNetParameterToHalf(NetParameter* param);
+
+// Expands the half_data of every blob of the layers of param back to data.
+void ConvertNetParameterToFloat(NetParameter* param);
+
+// Stores the blobs of the layers of param with at most max_density of their
+// data nonzero as sparse blobs (BlobProto.sparse_index), e.g. pruned weights.
+// Call before ConvertNetParameterToHalf to combine both.
+void ConvertNetParameterToSparse(NetParameter* param, float max_density);
+
+// Quotes s as a JSON string, escaping quotes, backslashes and control
+// characters.
+string JsonString(const string& s);
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
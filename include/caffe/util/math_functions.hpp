@@ -142,6 +142,63 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Returns the largest absolute value of the elements of vector x
+template <typename Dtype>
+Dtype caffe_cpu_amax(const int n, const Dtype* x);
+
+// Quantizes y = round(alpha * x), saturated to the symmetric int8 range
+// [-127, 127].
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype alpha, const Dtype* x,
+    int8_t* y);
+
+// Quantizes each row of the rows x cols matrix x with its own scale, chosen
+// so that the largest absolute value of the row maps to 127, and returns the
+// scales that map y back: x[r][c] ~= scale[r] * y[r][c].
+template <typename Dtype>
+void caffe_cpu_quantize_rows(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scale);
+
+// Integer gemm for quantized inference:
+// C = alpha * diag(a_scale) * A * B^T * diag(b_scale), with A an M x K and B
+// an N x K int8 matrix, both row-major. The products accumulate exactly in
+// int32 and are only scaled back to Dtype on the way out. The per-row scales
+// a_scale (M values) and b_scale (N values) may each be NULL.
+template <typename Dtype>
+void caffe_cpu_s8gemm(const int M, const int N, const int K,
+    const Dtype alpha, const int8_t* A, const Dtype* a_scale,
+    const int8_t* B, const Dtype* b_scale, Dtype* C);
+
+// Sparse-dense gemm: C = alpha * op(A) * B + beta * C, with A an M x K matrix
+// in block sparse rows (BSR) of block x block blocks, or compressed sparse
+// rows (CSR) for a block of 1. Block row r holds the blocks row_ptr[r] to
+// row_ptr[r + 1] - 1; block i is in block column columns[i] and its values
+// are row-major at values + i * block * block. B and C are dense row-major
+// matrices of N columns, with K and M rows (M and K for op(A) = A^T).
+template <typename Dtype>
+void caffe_cpu_bsrmm(const CBLAS_TRANSPOSE TransA, const int M, const int N,
+    const int K, const int block, const Dtype alpha, const Dtype* values,
+    const int* columns, const int* row_ptr, const Dtype* B, const Dtype beta,
+    Dtype* C);
+
+// The gradient of the values of a BSR matrix (see caffe_cpu_bsrmm) sampled
+// at its blocks: values = alpha * D * B^T + beta * values, computed only for
+// the stored blocks, with D an M x N and B a K x N dense row-major matrix.
+template <typename Dtype>
+void caffe_cpu_bsr_sddmm(const int M, const int N, const int K,
+    const int block, const Dtype alpha, const Dtype* D, const Dtype* B,
+    const int* columns, const int* row_ptr, const Dtype beta, Dtype* values);
+
+// Converts to and from IEEE half precision (binary16), held as its bit
+// pattern, rounding to the nearest even half. Values beyond the half range
+// become infinities and those below half of its smallest subnormal zeros.
+// Halves are a storage format only: all arithmetic stays in Dtype.
+template <typename Dtype>
+void caffe_cpu_float2half(const int n, const Dtype* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_half2float(const int n, const uint16_t* x, Dtype* y);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -247,6 +304,12 @@ void caffe_gpu_fabs(const int n, const Dtype* x, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_float2half(const int n, const Dtype* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_gpu_half2float(const int n, const uint16_t* x, Dtype* y);
+
 #define DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(name, operation) \
 template<typename Dtype> \
 __global__ void name##_kernel(const int n, const Dtype* x, Dtype* y) { \
@@ -0,0 +1,94 @@
+#ifndef CAFFE_UTIL_PROFILER_H_
+#define CAFFE_UTIL_PROFILER_H_
+
+#include <stdint.h>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief Records timed events, such as the passes of each layer of a Net and
+ *        the stages of a Solver, into a ring buffer that can be exported as a
+ *        Chrome trace (chrome://tracing).
+ *
+ * Record is lock free and may be called from any thread. Once capacity
+ * events have been recorded the oldest are overwritten, so the buffer keeps
+ * the most recent activity of a long running job. Exporting while events are
+ * being recorded may see some of them half written.
+ *
+ * Event names are registered once, ahead of recording, and referred to by
+ * the returned id. In GPU mode the times are those seen by the host, which
+ * does not wait for the kernels to finish.
+ */
+class Profiler {
+ public:
+  enum Category { FORWARD, BACKWARD, SOLVER };
+
+  struct Event {
+    int name_id;
+    Category category;
+    // The recording thread, numbered in the order the threads first record.
+    int thread;
+    int64_t start_us;
+    int64_t end_us;
+  };
+
+  explicit Profiler(int capacity);
+  ~Profiler();
+
+  /// @brief The time in microseconds of a monotonic clock.
+  static int64_t Now();
+
+  /// @brief Returns the id of name, registering it if needed.
+  int RegisterName(const string& name);
+  const string& name(int name_id) const { return names_[name_id]; }
+
+  /// @brief Records an event from start_us until now.
+  void Record(int name_id, Category category, int64_t start_us);
+
+  /// @brief The recorded events still in the buffer, oldest first.
+  vector<Event> events() const;
+  /// @brief Drops the recorded events, keeping the registered names.
+  void Clear();
+
+  /// @brief Writes the events in the Chrome trace event format.
+  void WriteChromeTrace(std::ostream* out) const;
+  void WriteChromeTrace(const string& filename) const;
+
+  int capacity() const { return events_.size(); }
+  /// @brief The number of events in the buffer.
+  int size() const;
+
+ protected:
+  vector<Event> events_;
+  // The number of events recorded since the last Clear.
+  volatile uint64_t recorded_;
+  vector<string> names_;
+  shared_ptr<boost::mutex> names_mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(Profiler);
+};
+
+/// @brief The distribution of a set of timings, in milliseconds.
+struct TimeStats {
+  double min, mean, median, p90, p99, max;
+};
+
+/// @brief The distribution of samples, with nearest rank percentiles; all 0
+///        if there are none.
+TimeStats ComputeTimeStats(vector<double> samples);
+
+/// @brief Writes the stats as the members of a json object, e.g.
+///        "min_ms": 1, ..., "max_ms": 3.
+void WriteJsonTimes(std::ostream* out, const TimeStats& stats);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PROFILER_H_
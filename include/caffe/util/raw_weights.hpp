@@ -0,0 +1,92 @@
+#ifndef CAFFE_UTIL_RAW_WEIGHTS_H_
+#define CAFFE_UTIL_RAW_WEIGHTS_H_
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A memory mapping of a raw weights file, the alternative to a
+ *        .caffemodel that loads without any parsing or copying.
+ *
+ * The file holds the 8 byte magic "CAFFERAW", the uint32 size of the
+ * serialized RawWeightsHeader and 4 reserved bytes, then that header. The
+ * data section follows at the next page boundary: the float32 values of each
+ * blob, each array aligned to 64 bytes.
+ *
+ * The file is mapped privately, so the pages are shared by every process
+ * mapping it until one writes to them, which then gets its own copy.
+ */
+class RawWeights {
+ public:
+  explicit RawWeights(const string& filename);
+  ~RawWeights();
+
+  const RawWeightsHeader& header() const { return header_; }
+  /// @brief The values of the i-th blob of the header, inside the mapping.
+  float* data(int i) const;
+  /// @brief The number of values of the i-th blob of the header.
+  int count(int i) const;
+
+ protected:
+  RawWeightsHeader header_;
+  void* map_;
+  size_t map_size_;
+  size_t data_offset_;
+
+  DISABLE_COPY_AND_ASSIGN(RawWeights);
+};
+
+/**
+ * @brief Writes a raw weights file array by array, for values produced
+ *        incrementally rather than held in a NetParameter, such as extracted
+ *        features.
+ *
+ * The constructor lays out the blobs of the header, setting their offsets,
+ * and writes it. Write then appends the values of the blobs in header order,
+ * in pieces of any size.
+ */
+class RawWeightsWriter {
+ public:
+  RawWeightsWriter(const RawWeightsHeader& header, const string& filename);
+
+  const RawWeightsHeader& header() const { return header_; }
+  void Write(const float* data, int count);
+  /// @brief Checks that every value of the header was written and closes.
+  void Close();
+
+ protected:
+  // Skips the blobs that are complete and pads to the next one.
+  void NextBlob();
+
+  RawWeightsHeader header_;
+  string filename_;
+  std::ofstream output_;
+  size_t data_offset_;
+  size_t position_;
+  int blob_index_;
+  int blob_written_;
+
+  DISABLE_COPY_AND_ASSIGN(RawWeightsWriter);
+};
+
+/// @brief Returns true if filename starts with the raw weights magic.
+bool IsRawWeightsFile(const string& filename);
+
+/// @brief Writes the blobs of the layers of net_param as a raw weights file.
+void WriteRawWeights(const NetParameter& net_param, const string& filename);
+
+/**
+ * @brief Fills net_param with one layer per layer in the raw weights, holding
+ *        their name, type and blobs, as read from a .caffemodel.
+ */
+void RawWeightsToNetParameter(const RawWeights& weights,
+    NetParameter* net_param);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RAW_WEIGHTS_H_
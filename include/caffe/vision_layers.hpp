@@ -155,8 +155,9 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and INT8 (quantized inference on the
+   *    CPU, see Int8ConvolutionLayer) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
@@ -176,6 +177,48 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
   virtual void compute_output_shape();
 };
 
+/**
+ * @brief ConvolutionLayer computed in int8 arithmetic, for CPU inference.
+ *        Selected by the INT8 engine of ConvolutionParameter.
+ *
+ * Each filter is quantized symmetrically with its own scale, and the bottom
+ * with the range given by QuantizationParameter input_range (see
+ * tools/calibrate_int8). Each image is quantized once and unrolled into
+ * int8 rows of the filter size, one per output pixel, so the products
+ * accumulate in int32 along contiguous memory. They are scaled back to Dtype
+ * before the bias is added. As with Int8InnerProductLayer, the float filters
+ * remain the parameters and are quantized on the first Forward (on every
+ * Forward in the TRAIN phase) or by QuantizeWeights; Backward is
+ * ConvolutionLayer's, and Forward_gpu runs on the CPU.
+ */
+template <typename Dtype>
+class Int8ConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit Int8ConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), weights_quantized_(false) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Quantizes the current filters, e.g. after they were changed.
+  void QuantizeWeights();
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    Forward_cpu(bottom, top);
+  }
+
+  bool weights_quantized_;
+  /// The quantized filters, one row each, and the scale of each row.
+  vector<int8_t> weight_q_;
+  vector<Dtype> weight_scale_;
+  /// One quantized image, and its rows for one group of filters.
+  vector<int8_t> image_q_;
+  vector<int8_t> rows_q_;
+};
+
 /**
  * @brief Convolve the input with a bank of learned filters, and (optionally)
  *        add biases, treating filters and convolution parameters in the
@@ -140,16 +140,38 @@ static void vgps_train(const mxArray* const bottom) {
     }
   }
 
-  md_layer->Reset(inputs, num_samples);
+  // With solver_threads, every replica of the net trains on its own
+  // contiguous slice of the samples.
+  vector<shared_ptr<MemoryDataLayer<float> > > md_layers(1, md_layer);
+  for (int i = 0; i < solver_->worker_nets().size(); ++i) {
+    md_layers.push_back(boost::dynamic_pointer_cast<MemoryDataLayer<float> >(
+        solver_->worker_nets()[i]->layers()[0]));
+  }
+  const int slice_samples = num_samples / md_layers.size();
+  if (slice_samples * md_layers.size() != num_samples ||
+      slice_samples % md_layer->batch_size() != 0) {
+    mex_error("The samples must split evenly into batches between the "
+        "solver threads");
+  }
+  for (int i = 0; i < md_layers.size(); ++i) {
+    vector<float*> slice_inputs(inputs);
+    for (int j = 0; j < slice_inputs.size(); ++j) {
+      const int sample_size = mxGetNumberOfElements(mxGetCell(bottom, j)) /
+          num_samples;
+      slice_inputs[j] += i * slice_samples * sample_size;
+    }
+    md_layers[i]->Reset(slice_inputs, slice_samples);
+  }
   LOG(INFO) << "Starting Solve";
   solver_->Solve();
+  // The prefetch threads must not read the inputs once this call returns.
+  for (int i = 0; i < md_layers.size(); ++i) {
+    md_layers[i]->Release();
+  }
 }
 
 // Input is a cell array of 4 4-D arrays containing image and joint info
 static mxArray* vgps_forward(const mxArray* const bottom) {
-  vector<shared_ptr<Blob<float> > > input_blobs;
-  input_blobs.resize(4);
-
   const mxArray* const rgb = mxGetCell(bottom, 0);
   const float* const rgb_ptr = reinterpret_cast<const float* const>(mxGetPr(rgb));
   const mxArray* const joint = mxGetCell(bottom, 1);
@@ -174,34 +196,22 @@ static mxArray* vgps_forward(const mxArray* const bottom) {
   //CHECK_EQ(dX, 21) << "Joint state dimension incorrect: " << dX;
   CHECK_EQ(dU, 7) << "Action dimension incorrect: " << dU;
 
-  input_blobs[0] = shared_ptr<Blob<float> >(new Blob<float>());
-  input_blobs[1] = shared_ptr<Blob<float> >(new Blob<float>());
-  input_blobs[2] = shared_ptr<Blob<float> >(new Blob<float>());
-  input_blobs[3] = shared_ptr<Blob<float> >(new Blob<float>());
-
-  input_blobs[0]->Reshape(num_samples, channels, height, width);
-  input_blobs[1]->Reshape(num_samples, dX, 1, 1);
-  input_blobs[2]->Reshape(num_samples, dU, 1, 1);
-  input_blobs[3]->Reshape(num_samples, dU, dU, 1);
-
-  caffe_copy(input_blobs[0]->count(), rgb_ptr, input_blobs[0]->mutable_cpu_data());
-  caffe_copy(input_blobs[1]->count(), joint_ptr, input_blobs[1]->mutable_cpu_data());
-  caffe_copy(input_blobs[2]->count(), action_ptr, input_blobs[2]->mutable_cpu_data());
-  caffe_copy(input_blobs[3]->count(), prec_ptr, input_blobs[3]->mutable_cpu_data());
-
+  // The layer copies each batch out of the arrays, which only live for the
+  // duration of this call.
   shared_ptr<MemoryDataLayer<float> > md_layer =
     boost::dynamic_pointer_cast<MemoryDataLayer<float> >(net_->layers()[0]);
   vector<float*> inputs;
-  inputs.push_back(input_blobs[0]->mutable_cpu_data());
-  inputs.push_back(input_blobs[1]->mutable_cpu_data());
-  inputs.push_back(input_blobs[2]->mutable_cpu_data());
-  inputs.push_back(input_blobs[3]->mutable_cpu_data());
+  inputs.push_back(const_cast<float*>(rgb_ptr));
+  inputs.push_back(const_cast<float*>(joint_ptr));
+  inputs.push_back(const_cast<float*>(action_ptr));
+  inputs.push_back(const_cast<float*>(prec_ptr));
   md_layer->Reset(inputs, num_samples);
 
   float initial_loss;
   LOG(INFO) << "Running forward pass";
   const vector<Blob<float>*>& output_blobs = net_->ForwardPrefilled(&initial_loss);
   LOG(INFO) << "Initial loss: " << initial_loss;
+  md_layer->Release();
 
   // output of fc is the second output blob.
   mxArray* mx_out = mxCreateCellMatrix(1, 1);
@@ -253,6 +263,7 @@ static mxArray* vgps_forward_only(const mxArray* const bottom) {
 
   float initial_loss;
   const vector<Blob<float>*>& output_blobs = net_->ForwardPrefilled(&initial_loss);
+  md_layer->Release();
   CHECK_EQ(output_blobs.size(), 1);
 
   // output of fc is the only output blob.
@@ -344,6 +355,82 @@ static void set_weights_from_string(const mxArray* const proto_string) {
   net_->CopyTrainedLayersFrom(net_param);
 }
 
+// Returns the weights as a uint8 column vector holding the binary
+// serialized NetParameter, the in memory equivalent of a .caffemodel.
+static mxArray* do_get_weights_binary() {
+  NetParameter net_param;
+  net_->ToProto(&net_param, false);
+  const int size = net_param.ByteSize();
+  mxArray* mx_out = mxCreateNumericMatrix(size, 1, mxUINT8_CLASS, mxREAL);
+  CHECK(net_param.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(mxGetData(mx_out))));
+  return mx_out;
+}
+
+static void set_weights_from_binary(const mxArray* const proto_binary) {
+  if (!mxIsUint8(proto_binary)) {
+    mex_error("Binary weights must be a uint8 array");
+  }
+  NetParameter net_param;
+  if (!net_param.ParseFromArray(mxGetData(proto_binary),
+      mxGetNumberOfElements(proto_binary))) {
+    mex_error("Failed to parse the binary weights");
+  }
+  net_->CopyTrainedLayersFrom(net_param);
+}
+
+// The number of values of the parameters owned by the net, in the order of
+// Net::params(). Shared parameters only appear once, through their owner.
+static int count_owned_params() {
+  const vector<shared_ptr<Blob<float> > >& params = net_->params();
+  int count = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      count += params[i]->count();
+    }
+  }
+  return count;
+}
+
+// Returns all the parameters of the net concatenated into a single column
+// vector, copied straight from the blobs.
+static mxArray* do_get_params() {
+  const vector<shared_ptr<Blob<float> > >& params = net_->params();
+  mxArray* mx_out =
+      mxCreateNumericMatrix(count_owned_params(), 1, mxSINGLE_CLASS, mxREAL);
+  float* out_ptr = reinterpret_cast<float*>(mxGetData(mx_out));
+  for (int i = 0; i < params.size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      caffe_copy(params[i]->count(), params[i]->cpu_data(), out_ptr);
+      out_ptr += params[i]->count();
+    }
+  }
+  return mx_out;
+}
+
+// Sets the parameters of the net from a single array laid out as returned
+// by do_get_params.
+static void do_set_params(const mxArray* const mx_params) {
+  if (!mxIsSingle(mx_params)) {
+    mex_error("Parameters must be a single array");
+  }
+  const int count = count_owned_params();
+  if (mxGetNumberOfElements(mx_params) != count) {
+    ostringstream error_msg;
+    error_msg << "Expected " << count << " parameter values, given "
+        << mxGetNumberOfElements(mx_params);
+    mex_error(error_msg.str());
+  }
+  const vector<shared_ptr<Blob<float> > >& params = net_->params();
+  const float* in_ptr = reinterpret_cast<const float*>(mxGetData(mx_params));
+  for (int i = 0; i < params.size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      caffe_copy(params[i]->count(), in_ptr, params[i]->mutable_cpu_data());
+      in_ptr += params[i]->count();
+    }
+  }
+}
+
 static mxArray* do_backward(const mxArray* const top_diff) {
   vector<Blob<float>*> output_blobs = net_->output_blobs();
   vector<Blob<float>*> input_blobs = net_->input_blobs();
@@ -491,6 +578,34 @@ static void set_weights(MEX_ARGS) {
   set_weights_from_string(prhs[0]);
 }
 
+static void get_weights_binary(MEX_ARGS) {
+  plhs[0] = do_get_weights_binary();
+}
+
+static void set_weights_binary(MEX_ARGS) {
+  if (nrhs != 1) {
+    ostringstream error_msg;
+    error_msg << "Only given " << nrhs << " arguments";
+    mex_error(error_msg.str());
+  }
+
+  set_weights_from_binary(prhs[0]);
+}
+
+static void get_params(MEX_ARGS) {
+  plhs[0] = do_get_params();
+}
+
+static void set_params(MEX_ARGS) {
+  if (nrhs != 1) {
+    ostringstream error_msg;
+    error_msg << "Only given " << nrhs << " arguments";
+    mex_error(error_msg.str());
+  }
+
+  do_set_params(prhs[0]);
+}
+
 static void save_weights_to_file(MEX_ARGS) {
   if (nrhs != 1) {
     ostringstream error_msg;
@@ -810,6 +925,50 @@ static void backward(MEX_ARGS) {
   plhs[0] = do_backward(prhs[0]);
 }
 
+// Records the layer passes into a new profiler keeping the last capacity
+// events (the first optional arg, 65536 by default), recording the solver
+// stages too when training.
+static void enable_profiling(MEX_ARGS) {
+  if (nrhs > 1) {
+    ostringstream error_msg;
+    error_msg << "Only given " << nrhs << " arguments";
+    mex_error(error_msg.str());
+  }
+  if (!net_) {
+    mex_error("Initialize the network before profiling it");
+  }
+  const int capacity = nrhs ? static_cast<int>(mxGetScalar(prhs[0])) : 65536;
+  shared_ptr<Profiler> profiler(new Profiler(capacity));
+  if (solver_) {
+    solver_->set_profiler(profiler);
+  } else {
+    net_->set_profiler(profiler);
+  }
+}
+
+static void disable_profiling(MEX_ARGS) {
+  if (solver_) {
+    solver_->set_profiler(shared_ptr<Profiler>());
+  } else if (net_) {
+    net_->set_profiler(shared_ptr<Profiler>());
+  }
+}
+
+// Writes the recorded events as a Chrome trace to the given file.
+static void write_profile(MEX_ARGS) {
+  if (nrhs != 1) {
+    ostringstream error_msg;
+    error_msg << "Only given " << nrhs << " arguments";
+    mex_error(error_msg.str());
+  }
+  if (!net_ || !net_->profiler()) {
+    mex_error("Profiling is not enabled");
+  }
+  char* filename = mxArrayToString(prhs[0]);
+  net_->profiler()->WriteChromeTrace(string(filename));
+  mxFree(filename);
+}
+
 static void is_initialized(MEX_ARGS) {
   if (!net_) {
     plhs[0] = mxCreateDoubleScalar(0);
@@ -876,10 +1035,17 @@ static handler_registry handlers[] = {
   { "get_weights",        get_weights     },
   { "get_weights_string", get_weights_string     },
   { "set_weights",        set_weights     },
+  { "get_weights_binary", get_weights_binary     },
+  { "set_weights_binary", set_weights_binary     },
+  { "get_params",         get_params      },
+  { "set_params",         set_params      },
   { "save_weights",       save_weights_to_file     },
   { "get_init_key",       get_init_key    },
   { "reset",              reset           },
   { "read_mean",          read_mean       },
+  { "enable_profiling",   enable_profiling  },
+  { "disable_profiling",  disable_profiling },
+  { "write_profile",      write_profile   },
   { "train",              vgps_train      },
   // The end.
   { "END",                NULL            },
@@ -13,6 +13,7 @@
 #include <string>  // NOLINT(build/include_order)
 #include <vector>  // NOLINT(build/include_order)
 #include <fstream>  // NOLINT
+#include <sstream>  // NOLINT(build/include_order)
 
 #include "caffe/caffe.hpp"
 #include "caffe/python_layer.hpp"
@@ -93,16 +94,89 @@ shared_ptr<Net<Dtype> > Net_Init_Load(
   return net;
 }
 
+// An execution context of shared weights.
+shared_ptr<Net<Dtype> > Net_Init_Shared(
+    shared_ptr<NetWeights<Dtype> > weights) {
+  return shared_ptr<Net<Dtype> >(new Net<Dtype>(
+      shared_ptr<const NetWeights<Dtype> >(weights)));
+}
+
+shared_ptr<NetWeights<Dtype> > NetWeights_Init(
+    string param_file, string pretrained_param_file) {
+  CheckFile(param_file);
+  CheckFile(pretrained_param_file);
+
+  return shared_ptr<NetWeights<Dtype> >(new NetWeights<Dtype>(param_file,
+      pretrained_param_file));
+}
+
+// Releases the GIL during the forward pass, so that the execution contexts of
+// a NetWeights run concurrently on Python threads. Nets with Python layers
+// keep it, as those need it.
+Dtype Net_ForwardFromTo(Net<Dtype>* net, int start, int end) {
+  for (int i = 0; i < net->layers().size(); ++i) {
+    if (string(net->layers()[i]->type()) == "Python") {
+      return net->ForwardFromTo(start, end);
+    }
+  }
+  PyThreadState* thread_state = PyEval_SaveThread();
+  const Dtype loss = net->ForwardFromTo(start, end);
+  PyEval_RestoreThread(thread_state);
+  return loss;
+}
+
 void Net_Save(const Net<Dtype>& net, string filename) {
   NetParameter net_param;
   net.ToProto(&net_param, false);
   WriteProtoToBinaryFile(net_param, filename.c_str());
 }
 
-// TODO(cfinn) Backwards compatibility of md layer
-/*
-void Net_SetInputArrays(Net<Dtype>* net, bp::object data_obj,
-    bp::object labels_obj) {
+// The input pipeline counters of each data layer, keyed by layer name.
+bp::dict Net_DataStats(const Net<Dtype>& net) {
+  bp::dict all_stats;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const BaseDataLayer<Dtype>* layer =
+        dynamic_cast<const BaseDataLayer<Dtype>*>(net.layers()[i].get());
+    if (!layer) {
+      continue;
+    }
+    const DataLayerStats& stats = layer->stats();
+    bp::dict layer_stats;
+    layer_stats["batches"] = stats.batches;
+    layer_stats["ready_batches"] = stats.ready_batches;
+    layer_stats["items"] = stats.items;
+    layer_stats["bytes_read"] = stats.bytes_read;
+    layer_stats["wait_ms"] = stats.wait_ms;
+    layer_stats["read_ms"] = stats.read_ms;
+    layer_stats["decode_ms"] = stats.decode_ms;
+    layer_stats["transform_ms"] = stats.transform_ms;
+    layer_stats["items_per_second"] = stats.ItemsPerSecond();
+    all_stats[net.layer_names()[i]] = layer_stats;
+  }
+  return all_stats;
+}
+
+void Net_ClearDataStats(Net<Dtype>* net) {
+  for (int i = 0; i < net->layers().size(); ++i) {
+    BaseDataLayer<Dtype>* layer =
+        dynamic_cast<BaseDataLayer<Dtype>*>(net->layers()[i].get());
+    if (layer) {
+      layer->ClearStats();
+    }
+  }
+}
+
+// The recorded events in the Chrome trace event format.
+string Profiler_ChromeTrace(const Profiler& profiler) {
+  std::ostringstream trace;
+  profiler.WriteChromeTrace(&trace);
+  return trace.str();
+}
+
+// Gives the MemoryDataLayer at the bottom of the net one array per top. The
+// layer reads the arrays without copying them until the next call, so the
+// caller keeps them alive (see Net.set_input_arrays).
+void Net_SetInputArrays(Net<Dtype>* net, bp::list arrays) {
   // check that this network has an input MemoryDataLayer
   shared_ptr<MemoryDataLayer<Dtype> > md_layer =
     boost::dynamic_pointer_cast<MemoryDataLayer<Dtype> >(net->layers()[0]);
@@ -110,29 +184,36 @@ void Net_SetInputArrays(Net<Dtype>* net, bp::object data_obj,
     throw std::runtime_error("set_input_arrays may only be called if the"
         " first layer is a MemoryDataLayer");
   }
+  if (bp::len(arrays) != md_layer->channels().size()) {
+    throw std::runtime_error("set_input_arrays needs one array per top of"
+        " the MemoryDataLayer");
+  }
 
   // check that we were passed appropriately-sized contiguous memory
-  PyArrayObject* data_arr =
-      reinterpret_cast<PyArrayObject*>(data_obj.ptr());
-  PyArrayObject* labels_arr =
-      reinterpret_cast<PyArrayObject*>(labels_obj.ptr());
-  CheckContiguousArray(data_arr, "data array", md_layer->channels(),
-      md_layer->height(), md_layer->width());
-  CheckContiguousArray(labels_arr, "labels array", 1, 1, 1);
-  if (PyArray_DIMS(data_arr)[0] != PyArray_DIMS(labels_arr)[0]) {
-    throw std::runtime_error("data and labels must have the same first"
-        " dimension");
+  vector<Dtype*> data;
+  npy_intp num = 0;
+  for (int i = 0; i < bp::len(arrays); ++i) {
+    bp::object array_obj = arrays[i];
+    if (!PyArray_Check(array_obj.ptr())) {
+      throw std::runtime_error("set_input_arrays takes numpy arrays");
+    }
+    PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(array_obj.ptr());
+    CheckContiguousArray(arr, "input array", md_layer->channels()[i],
+        md_layer->height()[i], md_layer->width()[i]);
+    if (i > 0 && PyArray_DIMS(arr)[0] != num) {
+      throw std::runtime_error("input arrays must have the same first"
+          " dimension");
+    }
+    num = PyArray_DIMS(arr)[0];
+    data.push_back(static_cast<Dtype*>(PyArray_DATA(arr)));
   }
-  if (PyArray_DIMS(data_arr)[0] % md_layer->batch_size() != 0) {
+  if (num % md_layer->batch_size() != 0) {
     throw std::runtime_error("first dimensions of input arrays must be a"
         " multiple of batch size");
   }
 
-  md_layer->Reset(static_cast<Dtype*>(PyArray_DATA(data_arr)),
-      static_cast<Dtype*>(PyArray_DATA(labels_arr)),
-      PyArray_DIMS(data_arr)[0]);
+  md_layer->Reset(data, num);
 }
-*/
 
 Solver<Dtype>* GetSolverFromFile(const string& filename) {
   SolverParameter param;
@@ -207,7 +288,8 @@ BOOST_PYTHON_MODULE(_caffe) {
     bp::no_init)
     .def("__init__", bp::make_constructor(&Net_Init))
     .def("__init__", bp::make_constructor(&Net_Init_Load))
-    .def("_forward", &Net<Dtype>::ForwardFromTo)
+    .def("__init__", bp::make_constructor(&Net_Init_Shared))
+    .def("_forward", &Net_ForwardFromTo)
     .def("_backward", &Net<Dtype>::BackwardFromTo)
     .def("reshape", &Net<Dtype>::Reshape)
     // The cast is to select a particular overload.
@@ -227,10 +309,35 @@ BOOST_PYTHON_MODULE(_caffe) {
     .add_property("_outputs",
         bp::make_function(&Net<Dtype>::output_blob_indices,
         bp::return_value_policy<bp::copy_const_reference>()))
-//    .def("_set_input_arrays", &Net_SetInputArrays,
-//        bp::with_custodian_and_ward<1, 2, bp::with_custodian_and_ward<1, 3> >())
+    // None unless the net was built with flat_params: true.
+    .add_property("flat_params",
+        bp::make_function(&Net<Dtype>::flat_params,
+        bp::return_value_policy<bp::copy_const_reference>()))
+    // Assign a Profiler to record the layer passes, None to stop.
+    .add_property("profiler",
+        bp::make_function(&Net<Dtype>::profiler,
+        bp::return_value_policy<bp::copy_const_reference>()),
+        &Net<Dtype>::set_profiler)
+    .def("data_stats", &Net_DataStats)
+    .def("clear_data_stats", &Net_ClearDataStats)
+    .def("_set_input_arrays", &Net_SetInputArrays)
     .def("save", &Net_Save);
 
+  // The weights shared by the nets built from them; see NetWeights.
+  bp::class_<NetWeights<Dtype>, shared_ptr<NetWeights<Dtype> >,
+    boost::noncopyable>("NetWeights", bp::no_init)
+    .def("__init__", bp::make_constructor(&NetWeights_Init))
+    .add_property("memory_bytes", &NetWeights<Dtype>::memory_bytes);
+
+  bp::class_<Profiler, shared_ptr<Profiler>, boost::noncopyable>(
+    "Profiler", bp::init<int>())
+    .add_property("size", &Profiler::size)
+    .add_property("capacity", &Profiler::capacity)
+    .def("clear", &Profiler::Clear)
+    .def("chrome_trace", &Profiler_ChromeTrace)
+    .def("write_chrome_trace", static_cast<void (Profiler::*)(const string&)
+        const>(&Profiler::WriteChromeTrace));
+
   bp::class_<Blob<Dtype>, shared_ptr<Blob<Dtype> >, boost::noncopyable>(
     "Blob", bp::no_init)
     .add_property("num",      &Blob<Dtype>::num)
@@ -262,6 +369,10 @@ BOOST_PYTHON_MODULE(_caffe) {
     .add_property("test_nets", bp::make_function(&Solver<Dtype>::test_nets,
           bp::return_internal_reference<>()))
     .add_property("iter", &Solver<Dtype>::iter)
+    .add_property("profiler",
+        bp::make_function(&Solver<Dtype>::profiler,
+        bp::return_value_policy<bp::copy_const_reference>()),
+        &Solver<Dtype>::set_profiler)
     .def("solve", static_cast<void (Solver<Dtype>::*)(const char*)>(
           &Solver<Dtype>::Solve), SolveOverloads())
     .def("step", &Solver<Dtype>::Step);
@@ -275,6 +386,12 @@ BOOST_PYTHON_MODULE(_caffe) {
   bp::class_<AdaGradSolver<Dtype>, bp::bases<Solver<Dtype> >,
     shared_ptr<AdaGradSolver<Dtype> >, boost::noncopyable>(
         "AdaGradSolver", bp::init<string>());
+  bp::class_<RMSPropSolver<Dtype>, bp::bases<Solver<Dtype> >,
+    shared_ptr<RMSPropSolver<Dtype> >, boost::noncopyable>(
+        "RMSPropSolver", bp::init<string>());
+  bp::class_<AdamSolver<Dtype>, bp::bases<Solver<Dtype> >,
+    shared_ptr<AdamSolver<Dtype> >, boost::noncopyable>(
+        "AdamSolver", bp::init<string>());
 
   bp::def("get_solver", &GetSolverFromFile,
       bp::return_value_policy<bp::manage_new_object>());
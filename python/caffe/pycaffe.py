@@ -214,15 +214,20 @@ def _Net_forward_backward_all(self, blobs=None, diffs=None, **kwargs):
     return all_outs, all_diffs
 
 
-def _Net_set_input_arrays(self, data, labels):
+def _Net_set_input_arrays(self, *arrays):
     """
-    Set input arrays of the in-memory MemoryDataLayer.
+    Set input arrays of the in-memory MemoryDataLayer, one per top, such as
+    data and labels.
     (Note: this is only for networks declared with the memory data layer.)
+
+    The layer reads batches straight out of the arrays, possibly from a
+    prefetch thread, so the net keeps a reference to them until the next
+    call. Do not modify them in place meanwhile.
     """
-    if labels.ndim == 1:
-        labels = np.ascontiguousarray(labels[:, np.newaxis, np.newaxis,
-                                             np.newaxis])
-    return self._set_input_arrays(data, labels)
+    arrays = [np.ascontiguousarray(a[:, np.newaxis, np.newaxis, np.newaxis])
+              if a.ndim == 1 else a for a in arrays]
+    self._set_input_arrays(arrays)
+    self._input_arrays = arrays
 
 
 def _Net_batch(self, blobs):
@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+"""
+Compares two csv reports of caffe_benchmarks, e.g. of two commits:
+
+    caffe_benchmarks --format=csv --output=before.csv
+    caffe_benchmarks --format=csv --output=after.csv
+    scripts/compare_benchmarks.py before.csv after.csv
+
+Prints the median time of each benchmark found in both reports and the
+speedup of the second over the first; benchmarks in only one are listed
+after.
+"""
+import csv
+import sys
+
+
+def read_report(filename):
+    with open(filename) as f:
+        return [(row['name'], float(row['median_ms']))
+                for row in csv.DictReader(f)]
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write('usage: {} before.csv after.csv\n'.format(argv[0]))
+        return 1
+    before = read_report(argv[1])
+    after = read_report(argv[2])
+    before_ms = dict(before)
+    after_ms = dict(after)
+    width = max([len(name) for name, _ in before] + [4])
+    print('{:<{w}} {:>12} {:>12} {:>8}'.format(
+        'name', 'before ms', 'after ms', 'speedup', w=width))
+    for name, ms in before:
+        if name in after_ms:
+            speedup = ms / after_ms[name] if after_ms[name] > 0 else float('inf')
+            print('{:<{w}} {:>12.4f} {:>12.4f} {:>7.2f}x'.format(
+                name, ms, after_ms[name], speedup, w=width))
+    for name, _ in before:
+        if name not in after_ms:
+            print('{} only in {}'.format(name, argv[1]))
+    for name, _ in after:
+        if name not in before_ms:
+            print('{} only in {}'.format(name, argv[2]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
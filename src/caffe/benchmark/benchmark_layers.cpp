@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/benchmark/benchmark_main.hpp"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The Forward, or Backward, of a layer created from its parameters,
+ *        on uniformly random bottoms.
+ *
+ * Backward propagates to every bottom that allows it and times only the
+ * backward pass; the forward pass it needs is run once in SetUp.
+ */
+class LayerBenchmark : public Benchmark {
+ public:
+  LayerBenchmark(const string& name, const LayerParameter& param,
+      const vector<vector<int> >& bottom_shapes, bool backward, double flops)
+      : Benchmark(name), param_(param), bottom_shapes_(bottom_shapes),
+        backward_(backward), flops_(flops) {}
+
+  virtual void SetUp() {
+    for (int i = 0; i < bottom_shapes_.size(); ++i) {
+      bottoms_.push_back(shared_ptr<Blob<float> >(
+          new Blob<float>(bottom_shapes_[i])));
+      caffe_rng_uniform<float>(bottoms_[i]->count(), -1, 1,
+          bottoms_[i]->mutable_cpu_data());
+      bottom_vec_.push_back(bottoms_[i].get());
+    }
+    layer_ = LayerRegistry<float>::CreateLayer(param_);
+    const int num_tops = layer_->ExactNumTopBlobs() >= 0 ?
+        layer_->ExactNumTopBlobs() : std::max(layer_->MinTopBlobs(), 1);
+    for (int i = 0; i < num_tops; ++i) {
+      tops_.push_back(shared_ptr<Blob<float> >(new Blob<float>()));
+      top_vec_.push_back(tops_[i].get());
+    }
+    layer_->SetUp(bottom_vec_, top_vec_);
+    if (backward_) {
+      layer_->Forward(bottom_vec_, top_vec_);
+      for (int i = 0; i < tops_.size(); ++i) {
+        caffe_rng_uniform<float>(tops_[i]->count(), -1, 1,
+            tops_[i]->mutable_cpu_diff());
+      }
+      for (int i = 0; i < bottoms_.size(); ++i) {
+        propagate_down_.push_back(layer_->AllowForceBackward(i));
+      }
+    }
+  }
+
+  virtual void Run() {
+    if (backward_) {
+      layer_->Backward(top_vec_, propagate_down_, bottom_vec_);
+    } else {
+      layer_->Forward(bottom_vec_, top_vec_);
+    }
+  }
+
+  virtual double Flops() const { return flops_; }
+
+ protected:
+  LayerParameter param_;
+  vector<vector<int> > bottom_shapes_;
+  bool backward_;
+  double flops_;
+  shared_ptr<Layer<float> > layer_;
+  vector<shared_ptr<Blob<float> > > bottoms_, tops_;
+  vector<Blob<float>*> bottom_vec_, top_vec_;
+  vector<bool> propagate_down_;
+};
+
+static vector<int> Shape(int num, int channels, int height, int width) {
+  vector<int> shape(4);
+  shape[0] = num;
+  shape[1] = channels;
+  shape[2] = height;
+  shape[3] = width;
+  return shape;
+}
+
+// Adds the forward and backward benchmarks of a layer, named
+// <type>/<shape>/b<batch size>/<pass>.
+static void AddLayer(const string& type, const string& shape_name,
+    int batch_size, const LayerParameter& param,
+    const vector<vector<int> >& bottom_shapes, double forward_flops,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  std::ostringstream name;
+  name << type << "/" << shape_name << "/b" << batch_size;
+  benchmarks->push_back(shared_ptr<Benchmark>(new LayerBenchmark(
+      name.str() + "/forward", param, bottom_shapes, false, forward_flops)));
+  // Backward computes both the weight and the bottom gradients.
+  benchmarks->push_back(shared_ptr<Benchmark>(new LayerBenchmark(
+      name.str() + "/backward", param, bottom_shapes, true,
+      2 * forward_flops)));
+}
+
+static void AddLayer(const string& type, const string& shape_name,
+    int batch_size, const LayerParameter& param, const vector<int>& shape,
+    double forward_flops, vector<shared_ptr<Benchmark> >* benchmarks) {
+  AddLayer(type, shape_name, batch_size, param,
+      vector<vector<int> >(1, shape), forward_flops, benchmarks);
+}
+
+static void LayerSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const vector<ConvShape> convs = BenchmarkConvShapes();
+  const vector<InnerProductShape> ips = BenchmarkInnerProductShapes();
+  const ConvShape& vgps_conv1 = convs[0];
+  const ConvShape& vgps_conv3 = convs[2];
+  const ConvShape& alexnet_conv1 = convs[3];
+  for (int b = 0; b < config.batch_sizes.size(); ++b) {
+    const int batch_size = config.batch_sizes[b];
+    for (int i = 0; i < convs.size(); ++i) {
+      const ConvShape& s = convs[i];
+      LayerParameter param;
+      param.set_type("Convolution");
+      ConvolutionParameter* conv_param = param.mutable_convolution_param();
+      conv_param->set_num_output(s.num_output);
+      conv_param->set_kernel_size(s.kernel_size);
+      conv_param->set_stride(s.stride);
+      conv_param->set_pad(s.pad);
+      conv_param->set_group(s.group);
+      conv_param->mutable_weight_filler()->set_type("gaussian");
+      conv_param->mutable_weight_filler()->set_std(0.01);
+      AddLayer("conv", s.name, batch_size, param,
+          Shape(batch_size, s.channels, s.height, s.width),
+          2. * batch_size * s.num_output * s.gemm_n() * s.gemm_k(),
+          benchmarks);
+    }
+    for (int i = 0; i < ips.size(); ++i) {
+      LayerParameter param;
+      param.set_type("InnerProduct");
+      InnerProductParameter* ip_param = param.mutable_inner_product_param();
+      ip_param->set_num_output(ips[i].output);
+      ip_param->mutable_weight_filler()->set_type("gaussian");
+      ip_param->mutable_weight_filler()->set_std(0.01);
+      AddLayer("innerproduct", ips[i].name, batch_size, param,
+          Shape(batch_size, ips[i].input, 1, 1),
+          2. * batch_size * ips[i].input * ips[i].output, benchmarks);
+    }
+    // The max pooling and normalization after the first AlexNet convolution.
+    const vector<int> alexnet_norm1 = Shape(batch_size,
+        alexnet_conv1.num_output, alexnet_conv1.height_out(),
+        alexnet_conv1.width_out());
+    {
+      LayerParameter param;
+      param.set_type("Pooling");
+      PoolingParameter* pooling_param = param.mutable_pooling_param();
+      pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+      pooling_param->set_kernel_size(3);
+      pooling_param->set_stride(2);
+      AddLayer("pooling", alexnet_conv1.name, batch_size, param,
+          alexnet_norm1, 0, benchmarks);
+    }
+    {
+      LayerParameter param;
+      param.set_type("LRN");
+      param.mutable_lrn_param()->set_local_size(5);
+      param.mutable_lrn_param()->set_alpha(1e-4);
+      AddLayer("lrn", alexnet_conv1.name, batch_size, param, alexnet_norm1, 0,
+          benchmarks);
+    }
+    {
+      LayerParameter param;
+      param.set_type("BatchNorm");
+      param.set_phase(TRAIN);
+      AddLayer("batchnorm", vgps_conv1.name, batch_size, param,
+          Shape(batch_size, vgps_conv1.num_output, vgps_conv1.height_out(),
+          vgps_conv1.width_out()), 0, benchmarks);
+    }
+    {
+      LayerParameter param;
+      param.set_type("Softmax");
+      AddLayer("softmax", "imagenet", batch_size, param,
+          Shape(batch_size, 1000, 1, 1), 0, benchmarks);
+    }
+    // The feature points of the vgps network, which are only implemented on
+    // the GPU.
+    if (Caffe::mode() == Caffe::GPU) {
+      LayerParameter param;
+      param.set_type("SpatialSoftmax");
+      AddLayer("spatialsoftmax", vgps_conv3.name, batch_size, param,
+          Shape(batch_size, vgps_conv3.num_output, vgps_conv3.height_out(),
+          vgps_conv3.width_out()), 0, benchmarks);
+    }
+    {
+      // One step of the 256 unit LSTM of examples/rsgps, over the batch.
+      const int hidden_dim = 256;
+      vector<vector<int> > shapes(3, vector<int>(3, 1));
+      shapes[0][1] = batch_size;
+      shapes[0][2] = hidden_dim;
+      shapes[1][1] = batch_size;
+      shapes[1][2] = 4 * hidden_dim;
+      // The sequence continuation indicators are 1 x 1 x batch.
+      shapes[2][2] = batch_size;
+      LayerParameter param;
+      param.set_type("LSTMUnit");
+      AddLayer("lstmunit", "rsgps", batch_size, param, shapes, 0, benchmarks);
+    }
+  }
+}
+REGISTER_BENCHMARK_SUITE(layer, LayerSuite);
+
+// The SPARSE InnerProduct engine against the dense one across the fraction
+// of the weights kept, named sparseinnerproduct/<shape>/<density>/b<batch
+// size>/<pass>, with a _bsr4 density suffix for 4x4 blocks. The weights are
+// uniform in [-s, s], so a block of n of them is pruned with probability
+// (t / s)^n for the threshold t, which is set to keep the given density.
+// The layers are in the TEST phase, as in the TRAIN phase Forward gathers
+// the kept weights from the dense ones again.
+static void SparseInnerProductSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const vector<InnerProductShape> ips = BenchmarkInnerProductShapes();
+  const float scale = 0.01;
+  const float densities[] = { 0.5, 0.25, 0.1, 0.05 };
+  const int blocks[] = { 1, 4 };
+  for (int b = 0; b < config.batch_sizes.size(); ++b) {
+    const int batch_size = config.batch_sizes[b];
+    for (int i = 0; i < ips.size(); ++i) {
+      LayerParameter param;
+      param.set_type("InnerProduct");
+      param.set_phase(TEST);
+      InnerProductParameter* ip_param = param.mutable_inner_product_param();
+      ip_param->set_num_output(ips[i].output);
+      ip_param->mutable_weight_filler()->set_type("uniform");
+      ip_param->mutable_weight_filler()->set_min(-scale);
+      ip_param->mutable_weight_filler()->set_max(scale);
+      const double dense_flops = 2. * batch_size * ips[i].input *
+          ips[i].output;
+      const vector<int> shape = Shape(batch_size, ips[i].input, 1, 1);
+      AddLayer("sparseinnerproduct", ips[i].name + "/dense", batch_size,
+          param, shape, dense_flops, benchmarks);
+      ip_param->set_engine(InnerProductParameter_Engine_SPARSE);
+      for (int k = 0; k < sizeof(blocks) / sizeof(blocks[0]); ++k) {
+        if (ips[i].input % blocks[k] || ips[i].output % blocks[k]) {
+          continue;
+        }
+        ip_param->set_sparse_block(blocks[k]);
+        for (int d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d) {
+          ip_param->set_sparse_threshold(scale * std::pow(1 - densities[d],
+              1.f / (blocks[k] * blocks[k])));
+          std::ostringstream shape_name;
+          shape_name << ips[i].name << "/d" << 100 * densities[d];
+          if (blocks[k] > 1) {
+            shape_name << "_bsr" << blocks[k];
+          }
+          // Only the kept weights count, so the GFLOP/s compare the kernels.
+          AddLayer("sparseinnerproduct", shape_name.str(), batch_size, param,
+              shape, densities[d] * dense_flops, benchmarks);
+        }
+      }
+    }
+  }
+}
+REGISTER_BENCHMARK_SUITE(sparse, SparseInnerProductSuite);
+
+}  // namespace caffe
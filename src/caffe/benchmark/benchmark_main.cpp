@@ -0,0 +1,267 @@
+// The main caffe microbenchmark code. Runs every registered benchmark, or
+// those matching --filter, and reports the time of one run of each in a
+// fixed order so the output of two commits can be compared line by line
+// (see scripts/compare_benchmarks.py).
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <iostream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/benchmark/benchmark_main.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+
+using caffe::Benchmark;
+using caffe::BenchmarkConfig;
+using caffe::BenchmarkRegistry;
+using caffe::Caffe;
+using caffe::shared_ptr;
+using caffe::string;
+using caffe::Timer;
+using caffe::vector;
+
+DEFINE_int32(gpu, -1,
+    "Run in GPU mode on given device ID.");
+DEFINE_string(batch_sizes, "1,32",
+    "Comma separated batch sizes of the layer and batched math benchmarks.");
+DEFINE_string(filter, "",
+    "Optional; comma separated substrings, only the benchmarks whose name "
+    "contains one of them are run.");
+DEFINE_int32(warmup, 2,
+    "The number of untimed runs of each benchmark.");
+DEFINE_int32(min_iterations, 10,
+    "The minimum number of timed samples of each benchmark.");
+DEFINE_double(min_time_ms, 500,
+    "Timed runs continue until they add up to at least this time.");
+DEFINE_double(min_sample_ms, 1,
+    "Runs shorter than this are timed in groups lasting about this long, "
+    "and the statistics are of the group means.");
+DEFINE_string(format, "text",
+    "The report format, 'text' or 'csv'.");
+DEFINE_string(output, "",
+    "Optional; the file to write the report to, instead of stdout.");
+DEFINE_bool(list, false,
+    "List the benchmark names and exit.");
+DEFINE_int32(seed, 1701,
+    "The random seed the benchmark inputs are filled with.");
+
+namespace caffe {
+
+vector<ConvShape> BenchmarkConvShapes() {
+  // name, channels, height, width, num_output, kernel_size, stride, pad, group
+  const ConvShape shapes[] = {
+    { "vgps_conv1", 3, 240, 240, 64, 7, 2, 0, 1 },
+    { "vgps_conv2", 64, 117, 117, 32, 5, 1, 0, 1 },
+    { "vgps_conv3", 32, 113, 113, 64, 5, 1, 0, 1 },
+    { "alexnet_conv1", 3, 227, 227, 96, 11, 4, 0, 1 },
+    { "alexnet_conv2", 96, 27, 27, 256, 5, 1, 2, 2 },
+  };
+  return vector<ConvShape>(shapes,
+      shapes + sizeof(shapes) / sizeof(shapes[0]));
+}
+
+vector<InnerProductShape> BenchmarkInnerProductShapes() {
+  const InnerProductShape shapes[] = {
+    // The pose regression from the 64 expected feature points.
+    { "vgps_fc", 128, 40 },
+    { "alexnet_fc6", 9216, 4096 },
+    { "alexnet_fc7", 4096, 4096 },
+  };
+  return vector<InnerProductShape>(shapes,
+      shapes + sizeof(shapes) / sizeof(shapes[0]));
+}
+
+}  // namespace caffe
+
+struct BenchmarkResult {
+  string name;
+  int iterations;
+  double median_ms, mean_ms, min_ms, stddev_ms, gflops;
+};
+
+static vector<string> Split(const string& list) {
+  vector<string> items;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return items;
+}
+
+static bool SuiteNameLess(const std::pair<string, BenchmarkRegistry::Suite>& a,
+    const std::pair<string, BenchmarkRegistry::Suite>& b) {
+  return a.first < b.first;
+}
+
+static bool Matches(const string& name, const vector<string>& filters) {
+  if (filters.empty()) {
+    return true;
+  }
+  for (int i = 0; i < filters.size(); ++i) {
+    if (name.find(filters[i]) != string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static BenchmarkResult RunBenchmark(Benchmark* benchmark) {
+  benchmark->SetUp();
+  for (int i = 0; i < FLAGS_warmup; ++i) {
+    benchmark->Run();
+  }
+  // Timer waits for the device in GPU mode.
+  Timer timer;
+  // Time enough runs together that short ones are not lost in the timer's
+  // resolution and overhead.
+  timer.Start();
+  benchmark->Run();
+  timer.Stop();
+  const double once_ms = timer.MicroSeconds() / 1000;
+  const int runs_per_sample = once_ms >= FLAGS_min_sample_ms ? 1 :
+      static_cast<int>(std::ceil(FLAGS_min_sample_ms /
+      std::max(once_ms, 1e-4)));
+  vector<double> times_ms;
+  double total_ms = 0;
+  while (times_ms.size() < FLAGS_min_iterations ||
+         total_ms < FLAGS_min_time_ms) {
+    timer.Start();
+    for (int i = 0; i < runs_per_sample; ++i) {
+      benchmark->Run();
+    }
+    timer.Stop();
+    const double sample_ms = timer.MicroSeconds() / 1000;
+    times_ms.push_back(sample_ms / runs_per_sample);
+    total_ms += sample_ms;
+  }
+  BenchmarkResult result;
+  result.name = benchmark->name();
+  result.iterations = times_ms.size() * runs_per_sample;
+  result.mean_ms = total_ms / result.iterations;
+  double sumsq = 0;
+  for (int i = 0; i < times_ms.size(); ++i) {
+    sumsq += (times_ms[i] - result.mean_ms) * (times_ms[i] - result.mean_ms);
+  }
+  result.stddev_ms = std::sqrt(sumsq / times_ms.size());
+  std::sort(times_ms.begin(), times_ms.end());
+  result.min_ms = times_ms.front();
+  result.median_ms = times_ms[times_ms.size() / 2];
+  result.gflops = result.median_ms > 0 ?
+      benchmark->Flops() / result.median_ms / 1e6 : 0;
+  return result;
+}
+
+static void WriteText(const vector<BenchmarkResult>& results,
+    std::ostream* out) {
+  int width = 4;
+  for (int i = 0; i < results.size(); ++i) {
+    width = std::max(width, static_cast<int>(results[i].name.size()));
+  }
+  *out << std::left << std::setw(width) << "name" << std::right
+       << std::setw(8) << "iters" << std::setw(12) << "median ms"
+       << std::setw(12) << "mean ms" << std::setw(12) << "min ms"
+       << std::setw(12) << "stddev ms" << std::setw(10) << "GFLOP/s\n";
+  for (int i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& r = results[i];
+    *out << std::left << std::setw(width) << r.name << std::right
+         << std::fixed << std::setprecision(4)
+         << std::setw(8) << r.iterations << std::setw(12) << r.median_ms
+         << std::setw(12) << r.mean_ms << std::setw(12) << r.min_ms
+         << std::setw(12) << r.stddev_ms << std::setprecision(2)
+         << std::setw(10);
+    if (r.gflops > 0) {
+      *out << r.gflops << "\n";
+    } else {
+      *out << "-" << "\n";
+    }
+  }
+}
+
+static void WriteCsv(const vector<BenchmarkResult>& results,
+    std::ostream* out) {
+  *out << "name,iterations,median_ms,mean_ms,min_ms,stddev_ms,gflops\n";
+  for (int i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& r = results[i];
+    *out << r.name << "," << r.iterations << "," << std::setprecision(6)
+         << r.median_ms << "," << r.mean_ms << "," << r.min_ms << ","
+         << r.stddev_ms << "," << r.gflops << "\n";
+  }
+}
+
+int main(int argc, char** argv) {
+  gflags::SetUsageMessage("runs the caffe microbenchmarks\n"
+      "usage: caffe_benchmarks [--filter=gemm,conv] [--batch_sizes=1,32] "
+      "[--format=csv]");
+  caffe::GlobalInit(&argc, &argv);
+  CHECK(FLAGS_format == "text" || FLAGS_format == "csv")
+      << "Unknown format " << FLAGS_format;
+  if (FLAGS_gpu >= 0) {
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  BenchmarkConfig config;
+  const vector<string> batch_sizes = Split(FLAGS_batch_sizes);
+  for (int i = 0; i < batch_sizes.size(); ++i) {
+    config.batch_sizes.push_back(atoi(batch_sizes[i].c_str()));
+    CHECK_GT(config.batch_sizes.back(), 0) << "Bad batch size "
+        << batch_sizes[i];
+  }
+  vector<shared_ptr<Benchmark> > benchmarks;
+  // Suites register in link order; sort them so reports line up.
+  BenchmarkRegistry::SuiteList suites = BenchmarkRegistry::Registry();
+  std::sort(suites.begin(), suites.end(), SuiteNameLess);
+  for (int i = 0; i < suites.size(); ++i) {
+    suites[i].second(config, &benchmarks);
+  }
+
+  const vector<string> filters = Split(FLAGS_filter);
+  vector<BenchmarkResult> results;
+  for (int i = 0; i < benchmarks.size(); ++i) {
+    if (!Matches(benchmarks[i]->name(), filters)) {
+      continue;
+    }
+    if (FLAGS_list) {
+      std::cout << benchmarks[i]->name() << std::endl;
+      continue;
+    }
+    // Every benchmark sees the same inputs, whatever ran before it.
+    Caffe::set_random_seed(FLAGS_seed);
+    LOG(INFO) << "Running " << benchmarks[i]->name();
+    results.push_back(RunBenchmark(benchmarks[i].get()));
+    // Free its inputs before the next one is set up.
+    benchmarks[i].reset();
+  }
+  if (FLAGS_list) {
+    return 0;
+  }
+
+  std::ofstream file;
+  if (!FLAGS_output.empty()) {
+    file.open(FLAGS_output.c_str());
+    CHECK(file.is_open()) << "Failed to open " << FLAGS_output;
+  }
+  std::ostream* out = FLAGS_output.empty() ? &std::cout : &file;
+  if (FLAGS_format == "csv") {
+    WriteCsv(results, out);
+  } else {
+    WriteText(results, out);
+  }
+  return 0;
+}
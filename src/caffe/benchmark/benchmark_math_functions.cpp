@@ -0,0 +1,372 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/benchmark/benchmark_main.hpp"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Fills the blob in [min, max), on the host.
+static void FillUniform(float min, float max, Blob<float>* blob) {
+  caffe_rng_uniform<float>(blob->count(), min, max, blob->mutable_cpu_data());
+}
+
+// The data of the blob where the current mode computes.
+static const float* ModeData(Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ? blob->cpu_data() : blob->gpu_data();
+}
+
+static float* ModeMutableData(Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ?
+      blob->mutable_cpu_data() : blob->mutable_gpu_data();
+}
+
+static string BatchName(const string& prefix, int batch_size) {
+  std::ostringstream name;
+  name << prefix << "/b" << batch_size;
+  return name.str();
+}
+
+/// @brief C = op(A) * op(B), with C M x N and op(A) M x K.
+class GemmBenchmark : public Benchmark {
+ public:
+  GemmBenchmark(const string& name, CBLAS_TRANSPOSE trans_a,
+      CBLAS_TRANSPOSE trans_b, int m, int n, int k)
+      : Benchmark(name), trans_a_(trans_a), trans_b_(trans_b),
+        m_(m), n_(n), k_(k) {}
+
+  virtual void SetUp() {
+    a_.Reshape(1, 1, m_, k_);
+    b_.Reshape(1, 1, k_, n_);
+    c_.Reshape(1, 1, m_, n_);
+    FillUniform(-1, 1, &a_);
+    FillUniform(-1, 1, &b_);
+  }
+
+  virtual void Run() {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_cpu_gemm<float>(trans_a_, trans_b_, m_, n_, k_, 1.,
+          a_.cpu_data(), b_.cpu_data(), 0., c_.mutable_cpu_data());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_gemm<float>(trans_a_, trans_b_, m_, n_, k_, 1.,
+          a_.gpu_data(), b_.gpu_data(), 0., c_.mutable_gpu_data());
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+  }
+
+  virtual double Flops() const { return 2. * m_ * n_ * k_; }
+
+ protected:
+  CBLAS_TRANSPOSE trans_a_, trans_b_;
+  int m_, n_, k_;
+  Blob<float> a_, b_, c_;
+};
+
+/// @brief y = op(A) * x, with A M x N.
+class GemvBenchmark : public Benchmark {
+ public:
+  GemvBenchmark(const string& name, CBLAS_TRANSPOSE trans, int m, int n)
+      : Benchmark(name), trans_(trans), m_(m), n_(n) {}
+
+  virtual void SetUp() {
+    a_.Reshape(1, 1, m_, n_);
+    x_.Reshape(1, 1, 1, trans_ == CblasNoTrans ? n_ : m_);
+    y_.Reshape(1, 1, 1, trans_ == CblasNoTrans ? m_ : n_);
+    FillUniform(-1, 1, &a_);
+    FillUniform(-1, 1, &x_);
+  }
+
+  virtual void Run() {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_cpu_gemv<float>(trans_, m_, n_, 1., a_.cpu_data(), x_.cpu_data(),
+          0., y_.mutable_cpu_data());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_gemv<float>(trans_, m_, n_, 1., a_.gpu_data(), x_.gpu_data(),
+          0., y_.mutable_gpu_data());
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+  }
+
+  virtual double Flops() const { return 2. * m_ * n_; }
+
+ protected:
+  CBLAS_TRANSPOSE trans_;
+  int m_, n_;
+  Blob<float> a_, x_, y_;
+};
+
+/// @brief im2col, or col2im, of one image of a convolution.
+class Im2colBenchmark : public Benchmark {
+ public:
+  Im2colBenchmark(const string& name, const ConvShape& shape, bool col2im)
+      : Benchmark(name), shape_(shape), col2im_(col2im) {}
+
+  virtual void SetUp() {
+    image_.Reshape(1, shape_.channels, shape_.height, shape_.width);
+    col_.Reshape(1, shape_.channels * shape_.kernel_size * shape_.kernel_size,
+        shape_.height_out(), shape_.width_out());
+    FillUniform(-1, 1, col2im_ ? &col_ : &image_);
+  }
+
+  virtual void Run() {
+    const ConvShape& s = shape_;
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      if (col2im_) {
+        col2im_cpu(col_.cpu_data(), s.channels, s.height, s.width,
+            s.kernel_size, s.kernel_size, s.pad, s.pad, s.stride, s.stride,
+            image_.mutable_cpu_data());
+      } else {
+        im2col_cpu(image_.cpu_data(), s.channels, s.height, s.width,
+            s.kernel_size, s.kernel_size, s.pad, s.pad, s.stride, s.stride,
+            col_.mutable_cpu_data());
+      }
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      if (col2im_) {
+        col2im_gpu(col_.gpu_data(), s.channels, s.height, s.width,
+            s.kernel_size, s.kernel_size, s.pad, s.pad, s.stride, s.stride,
+            image_.mutable_gpu_data());
+      } else {
+        im2col_gpu(image_.gpu_data(), s.channels, s.height, s.width,
+            s.kernel_size, s.kernel_size, s.pad, s.pad, s.stride, s.stride,
+            col_.mutable_gpu_data());
+      }
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+  }
+
+ protected:
+  ConvShape shape_;
+  bool col2im_;
+  Blob<float> image_, col_;
+};
+
+/// @brief An elementwise math function over count values.
+class ElementwiseBenchmark : public Benchmark {
+ public:
+  enum Function { EXP, POWX, DIV };
+
+  ElementwiseBenchmark(const string& name, Function function, int count)
+      : Benchmark(name), function_(function), count_(count) {}
+
+  virtual void SetUp() {
+    a_.Reshape(1, 1, 1, count_);
+    b_.Reshape(1, 1, 1, count_);
+    y_.Reshape(1, 1, 1, count_);
+    // Positive, as powx and div need.
+    FillUniform(0.5, 1.5, &a_);
+    FillUniform(0.5, 1.5, &b_);
+  }
+
+  virtual void Run() {
+    const float* a = ModeData(&a_);
+    const float* b = ModeData(&b_);
+    float* y = ModeMutableData(&y_);
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      if (function_ == EXP) {
+        caffe_exp(count_, a, y);
+      } else if (function_ == POWX) {
+        caffe_powx(count_, a, -0.75f, y);
+      } else {
+        caffe_div(count_, a, b, y);
+      }
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      if (function_ == EXP) {
+        caffe_gpu_exp(count_, a, y);
+      } else if (function_ == POWX) {
+        caffe_gpu_powx(count_, a, -0.75f, y);
+      } else {
+        caffe_gpu_div(count_, a, b, y);
+      }
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+  }
+
+ protected:
+  Function function_;
+  int count_;
+  Blob<float> a_, b_, y_;
+};
+
+/// @brief DataTransformer::Transform of a batch of uint8 Datums.
+class TransformBenchmark : public Benchmark {
+ public:
+  TransformBenchmark(const string& name, const TransformationParameter& param,
+      int batch_size, int channels, int height, int width)
+      : Benchmark(name), param_(param), batch_size_(batch_size),
+        channels_(channels), height_(height), width_(width) {}
+
+  virtual void SetUp() {
+    transformer_.reset(new DataTransformer<float>(param_, TRAIN));
+    transformer_->InitRand();
+    datums_.resize(batch_size_);
+    const int size = channels_ * height_ * width_;
+    for (int i = 0; i < batch_size_; ++i) {
+      datums_[i].set_channels(channels_);
+      datums_[i].set_height(height_);
+      datums_[i].set_width(width_);
+      string* data = datums_[i].mutable_data();
+      data->resize(size);
+      for (int j = 0; j < size; ++j) {
+        (*data)[j] = static_cast<char>(caffe_rng_rand() % 256);
+      }
+    }
+    const int crop_size = param_.crop_size();
+    transformed_.Reshape(batch_size_, channels_,
+        crop_size ? crop_size : height_, crop_size ? crop_size : width_);
+  }
+
+  // The transformer always runs on the host.
+  virtual void Run() { transformer_->Transform(datums_, &transformed_); }
+
+ protected:
+  TransformationParameter param_;
+  int batch_size_, channels_, height_, width_;
+  shared_ptr<DataTransformer<float> > transformer_;
+  vector<Datum> datums_;
+  Blob<float> transformed_;
+};
+
+// The GEMMs of the forward and backward passes of the convolutions, for one
+// image, and of the inner products, for each batch size.
+static void GemmSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const vector<ConvShape> convs = BenchmarkConvShapes();
+  for (int i = 0; i < convs.size(); ++i) {
+    const int m = convs[i].gemm_m();
+    const int n = convs[i].gemm_n();
+    const int k = convs[i].gemm_k();
+    const string name = "gemm/" + convs[i].name;
+    benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+        name + "/forward", CblasNoTrans, CblasNoTrans, m, n, k)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+        name + "/backward_weight", CblasNoTrans, CblasTrans, m, k, n)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+        name + "/backward_data", CblasTrans, CblasNoTrans, k, n, m)));
+  }
+  const vector<InnerProductShape> ips = BenchmarkInnerProductShapes();
+  for (int b = 0; b < config.batch_sizes.size(); ++b) {
+    const int batch_size = config.batch_sizes[b];
+    for (int i = 0; i < ips.size(); ++i) {
+      const int in = ips[i].input;
+      const int out = ips[i].output;
+      const string name = BatchName("gemm/" + ips[i].name, batch_size);
+      benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+          name + "/forward", CblasNoTrans, CblasTrans, batch_size, out, in)));
+      benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+          name + "/backward_weight", CblasTrans, CblasNoTrans, out, in,
+          batch_size)));
+      benchmarks->push_back(shared_ptr<Benchmark>(new GemmBenchmark(
+          name + "/backward_data", CblasNoTrans, CblasNoTrans, batch_size, in,
+          out)));
+    }
+  }
+}
+REGISTER_BENCHMARK_SUITE(gemm, GemmSuite);
+
+// The matrix-vector products of the layers: a single input through an inner
+// product, and the bias gradient of a convolution.
+static void GemvSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const vector<InnerProductShape> ips = BenchmarkInnerProductShapes();
+  for (int i = 0; i < ips.size(); ++i) {
+    benchmarks->push_back(shared_ptr<Benchmark>(new GemvBenchmark(
+        "gemv/" + ips[i].name + "/forward", CblasNoTrans, ips[i].output,
+        ips[i].input)));
+  }
+  const vector<ConvShape> convs = BenchmarkConvShapes();
+  for (int i = 0; i < convs.size(); ++i) {
+    benchmarks->push_back(shared_ptr<Benchmark>(new GemvBenchmark(
+        "gemv/" + convs[i].name + "/backward_bias", CblasNoTrans,
+        convs[i].num_output, convs[i].gemm_n())));
+  }
+}
+REGISTER_BENCHMARK_SUITE(gemv, GemvSuite);
+
+static void Im2colSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const vector<ConvShape> convs = BenchmarkConvShapes();
+  for (int i = 0; i < convs.size(); ++i) {
+    benchmarks->push_back(shared_ptr<Benchmark>(new Im2colBenchmark(
+        "im2col/" + convs[i].name, convs[i], false)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new Im2colBenchmark(
+        "col2im/" + convs[i].name, convs[i], true)));
+  }
+}
+REGISTER_BENCHMARK_SUITE(im2col, Im2colSuite);
+
+// The elementwise functions of the softmax and normalization layers, over the
+// output of the last vgps convolution for each batch size.
+static void ElementwiseSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  const ConvShape conv3 = BenchmarkConvShapes()[2];
+  const int count = conv3.num_output * conv3.gemm_n();
+  for (int b = 0; b < config.batch_sizes.size(); ++b) {
+    const int batch_size = config.batch_sizes[b];
+    benchmarks->push_back(shared_ptr<Benchmark>(new ElementwiseBenchmark(
+        BatchName("exp/" + conv3.name, batch_size),
+        ElementwiseBenchmark::EXP, batch_size * count)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new ElementwiseBenchmark(
+        BatchName("powx/" + conv3.name, batch_size),
+        ElementwiseBenchmark::POWX, batch_size * count)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new ElementwiseBenchmark(
+        BatchName("div/" + conv3.name, batch_size),
+        ElementwiseBenchmark::DIV, batch_size * count)));
+  }
+}
+REGISTER_BENCHMARK_SUITE(elementwise, ElementwiseSuite);
+
+// The transformation of the vgps images as they are, and of the ImageNet
+// images to mirrored AlexNet crops.
+static void TransformSuite(const BenchmarkConfig& config,
+    vector<shared_ptr<Benchmark> >* benchmarks) {
+  TransformationParameter vgps_param;
+  vgps_param.set_scale(1. / 255);
+  TransformationParameter alexnet_param;
+  alexnet_param.set_crop_size(227);
+  alexnet_param.set_mirror(true);
+  alexnet_param.add_mean_value(104);
+  alexnet_param.add_mean_value(117);
+  alexnet_param.add_mean_value(123);
+  for (int b = 0; b < config.batch_sizes.size(); ++b) {
+    const int batch_size = config.batch_sizes[b];
+    benchmarks->push_back(shared_ptr<Benchmark>(new TransformBenchmark(
+        BatchName("transform/vgps", batch_size), vgps_param, batch_size, 3,
+        240, 240)));
+    benchmarks->push_back(shared_ptr<Benchmark>(new TransformBenchmark(
+        BatchName("transform/alexnet", batch_size), alexnet_param, batch_size,
+        3, 256, 256)));
+  }
+}
+REGISTER_BENCHMARK_SUITE(transform, TransformSuite);
+
+}  // namespace caffe
@@ -1,4 +1,5 @@
 #include <climits>
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -132,6 +133,20 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_data(const shared_ptr<SyncedMemory>& data) {
+  CHECK(data);
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_diff(const shared_ptr<SyncedMemory>& diff) {
+  CHECK(diff);
+  CHECK_GE(diff->size(), count_ * sizeof(Dtype));
+  diff_ = diff;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -430,6 +445,20 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   }
 }
 
+// Expands the half_data of a BlobProto. Only parameters, stored as
+// Blob<float> or Blob<double>, are written as halves.
+template <typename Dtype>
+static void HalfToData(const string& half_data, const int count,
+    Dtype* data) {
+  caffe_cpu_half2float(count,
+      reinterpret_cast<const uint16_t*>(half_data.data()), data);
+}
+
+template <> void HalfToData(const string& /*half_data*/, const int /*count*/,
+    unsigned int* /*data*/) { NOT_IMPLEMENTED; }
+template <> void HalfToData(const string& /*half_data*/, const int /*count*/,
+    int* /*data*/) { NOT_IMPLEMENTED; }
+
 template <typename Dtype>
 void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   if (reshape) {
@@ -455,8 +484,39 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    data_vec[i] = proto.data(i);
+  const int num_values = proto.sparse_index_size() > 0 ?
+      proto.sparse_index_size() : count_;
+  if (proto.has_half_data()) {
+    CHECK_EQ(proto.half_data().size(), num_values * sizeof(uint16_t))
+        << "half_data does not match the shape";
+    HalfToData(proto.half_data(), num_values, data_vec);
+  } else {
+    if (proto.sparse_index_size() > 0) {
+      CHECK_EQ(proto.data_size(), num_values)
+          << "data does not match sparse_index";
+    }
+    for (int i = 0; i < num_values; ++i) {
+      data_vec[i] = proto.data(i);
+    }
+  }
+  if (proto.sparse_index_size() > 0) {
+    // Move the values from the front to their indices, last first, and zero
+    // the gaps behind them. As the indices increase, index >= i, so no value
+    // is overwritten before it is moved.
+    int end = count_;
+    for (int i = num_values - 1; i >= 0; --i) {
+      const int index = proto.sparse_index(i);
+      CHECK(index >= i && index < end)
+          << "sparse_index must increase within the blob";
+      data_vec[index] = data_vec[i];
+      for (int j = index + 1; j < end; ++j) {
+        data_vec[j] = 0;
+      }
+      end = index;
+    }
+    for (int j = 0; j < end; ++j) {
+      data_vec[j] = 0;
+    }
   }
   if (proto.diff_size() > 0) {
     Dtype* diff_vec = mutable_cpu_diff();
@@ -474,6 +534,8 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_data();
   proto->clear_diff();
+  proto->clear_half_data();
+  proto->clear_sparse_index();
   const Dtype* data_vec = cpu_data();
   for (int i = 0; i < count_; ++i) {
     proto->add_data(data_vec[i]);
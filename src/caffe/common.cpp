@@ -1,3 +1,4 @@
+#include <boost/thread/tss.hpp>
 #include <glog/logging.h>
 #include <cstdio>
 #include <ctime>
@@ -9,6 +10,16 @@ namespace caffe {
 
 shared_ptr<Caffe> Caffe::singleton_;
 
+static boost::thread_specific_ptr<Caffe::RNG> thread_random_generator_;
+
+void Caffe::set_thread_random_seed(const unsigned int seed) {
+  thread_random_generator_.reset(new RNG(seed));
+}
+
+Caffe::RNG* Caffe::thread_rng_stream() {
+  return thread_random_generator_.get();
+}
+
 // random seeding
 int64_t cluster_seedgen(void) {
   int64_t s, seed, pid;
@@ -1,5 +1,13 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <boost/thread.hpp>
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -32,6 +40,65 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
       mean_values_.push_back(param_.mean_value(c));
     }
   }
+  const int num_threads = param_.num_threads();
+  workers_stop_ = false;
+  if (num_threads > 1) {
+    worker_barrier_.reset(new boost::barrier(num_threads));
+    for (int i = 1; i < num_threads; ++i) {
+      worker_threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &DataTransformer<Dtype>::WorkerEntry, this, i)));
+    }
+  }
+}
+
+template<typename Dtype>
+DataTransformer<Dtype>::~DataTransformer() {
+  if (worker_threads_.empty()) {
+    return;
+  }
+  workers_stop_ = true;
+  worker_barrier_->wait();
+  for (int i = 0; i < worker_threads_.size(); ++i) {
+    worker_threads_[i]->join();
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::WorkerEntry(const int thread_id) {
+  while (true) {
+    worker_barrier_->wait();
+    if (workers_stop_) {
+      break;
+    }
+    TransformBatchShare(thread_id);
+    worker_barrier_->wait();
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformBatch() {
+  if (worker_threads_.empty()) {
+    TransformBatchShare(0);
+    return;
+  }
+  // Release the workers, do this thread's share and wait for theirs.
+  worker_barrier_->wait();
+  TransformBatchShare(0);
+  worker_barrier_->wait();
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformBatchShare(const int thread_id) {
+  const int num_threads = worker_threads_.size() + 1;
+  const int start = batch_.num * thread_id / num_threads;
+  const int end = batch_.num * (thread_id + 1) / num_threads;
+  if (batch_.datum_vector) {
+    TransformDatumRange(batch_.datum_vector, batch_.plans, start, end,
+        batch_.height, batch_.width, batch_.transformed_data);
+  } else {
+    TransformMatRange(batch_.mat_vector, batch_.plans, start, end,
+        batch_.height, batch_.width, batch_.transformed_data);
+  }
 }
 
 template<typename Dtype>
@@ -165,12 +232,32 @@ void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
   CHECK_GT(datum_num, 0) << "There is no datum to add";
   CHECK_LE(datum_num, num) <<
     "The size of datum_vector must be no greater than transformed_blob->num()";
-  Blob<Dtype> uni_blob(1, channels, height, width);
+  const int crop_size = param_.crop_size();
+  // Draw all the plans on this thread, before the work is split up, so the
+  // RNG sequence is the same as for item by item transformation.
+  vector<Plan> plans(datum_num);
   for (int item_id = 0; item_id < datum_num; ++item_id) {
-    int offset = transformed_blob->offset(item_id);
-    uni_blob.set_cpu_data(transformed_blob->mutable_cpu_data() + offset);
-    Transform(datum_vector[item_id], &uni_blob);
+    const Datum& datum = datum_vector[item_id];
+    CHECK_EQ(channels, datum.channels());
+    if (crop_size) {
+      CHECK_EQ(crop_size, height);
+      CHECK_EQ(crop_size, width);
+    } else {
+      CHECK_EQ(datum.height(), height);
+      CHECK_EQ(datum.width(), width);
+    }
+    CheckMeanShape(datum.channels(), datum.height(), datum.width());
+    MakePlan(datum.height(), datum.width(), &plans[item_id]);
   }
+  PrepareMean(channels);
+  batch_.datum_vector = &datum_vector;
+  batch_.mat_vector = NULL;
+  batch_.plans = &plans;
+  batch_.num = datum_num;
+  batch_.height = height;
+  batch_.width = width;
+  batch_.transformed_data = transformed_blob->mutable_cpu_data();
+  TransformBatch();
 }
 
 template<typename Dtype>
@@ -185,11 +272,408 @@ void DataTransformer<Dtype>::Transform(const vector<cv::Mat> & mat_vector,
   CHECK_GT(mat_num, 0) << "There is no MAT to add";
   CHECK_EQ(mat_num, num) <<
     "The size of mat_vector must be equals to transformed_blob->num()";
-  Blob<Dtype> uni_blob(1, channels, height, width);
+  const int crop_size = param_.crop_size();
+  vector<Plan> plans(mat_num);
   for (int item_id = 0; item_id < mat_num; ++item_id) {
-    int offset = transformed_blob->offset(item_id);
-    uni_blob.set_cpu_data(transformed_blob->mutable_cpu_data() + offset);
-    Transform(mat_vector[item_id], &uni_blob);
+    const cv::Mat& cv_img = mat_vector[item_id];
+    CHECK(cv_img.data);
+    CHECK(cv_img.depth() == CV_8U) << "Image data type must be unsigned byte";
+    CHECK_EQ(channels, cv_img.channels());
+    if (crop_size) {
+      CHECK_EQ(crop_size, height);
+      CHECK_EQ(crop_size, width);
+    } else {
+      CHECK_EQ(cv_img.rows, height);
+      CHECK_EQ(cv_img.cols, width);
+    }
+    CheckMeanShape(cv_img.channels(), cv_img.rows, cv_img.cols);
+    MakePlan(cv_img.rows, cv_img.cols, &plans[item_id]);
+  }
+  PrepareMean(channels);
+  batch_.datum_vector = NULL;
+  batch_.mat_vector = &mat_vector;
+  batch_.plans = &plans;
+  batch_.num = mat_num;
+  batch_.height = height;
+  batch_.width = width;
+  batch_.transformed_data = transformed_blob->mutable_cpu_data();
+  TransformBatch();
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::MakePlan(const int input_height,
+    const int input_width, Plan* plan) {
+  const int crop_size = param_.crop_size();
+  CHECK_GE(input_height, crop_size);
+  CHECK_GE(input_width, crop_size);
+  // Same order of Rand calls as Transform(const Datum&, Dtype*).
+  plan->mirror = param_.mirror() && Rand(2);
+  plan->h_off = 0;
+  plan->w_off = 0;
+  if (crop_size) {
+    // We only do random crop when we do training.
+    if (phase_ == TRAIN) {
+      plan->h_off = Rand(input_height - crop_size + 1);
+      plan->w_off = Rand(input_width - crop_size + 1);
+    } else {
+      plan->h_off = (input_height - crop_size) / 2;
+      plan->w_off = (input_width - crop_size) / 2;
+    }
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CheckMeanShape(const int channels,
+    const int height, const int width) {
+  if (param_.has_mean_file()) {
+    CHECK_EQ(channels, data_mean_.channels());
+    CHECK_EQ(height, data_mean_.height());
+    CHECK_EQ(width, data_mean_.width());
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::PrepareMean(const int channels) {
+  if (mean_values_.size() > 0) {
+    CHECK(mean_values_.size() == 1 || mean_values_.size() == channels) <<
+     "Specify either 1 mean_value or as many as channels: " << channels;
+    if (channels > 1 && mean_values_.size() == 1) {
+      // Replicate the mean_value for simplicity
+      for (int c = 1; c < channels; ++c) {
+        mean_values_.push_back(mean_values_[0]);
+      }
+    }
+  }
+  if (param_.has_mean_file() || pixel_lookup_.size() == channels * 256) {
+    return;
+  }
+  // Without a mean_file the result only depends on the channel and the byte
+  // value, so uint8 inputs are converted through a table.
+  const Dtype scale = param_.scale();
+  pixel_lookup_.resize(channels * 256);
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean_value = mean_values_.size() > 0 ? mean_values_[c] : 0;
+    for (int value = 0; value < 256; ++value) {
+      pixel_lookup_[c * 256 + value] =
+          (static_cast<Dtype>(value) - mean_value) * scale;
+    }
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformDatumRange(
+    const vector<Datum>* datum_vector, const vector<Plan>* plans,
+    const int start, const int end, const int height, const int width,
+    Dtype* transformed_data) {
+  const int size = (*datum_vector)[0].channels() * height * width;
+  for (int item_id = start; item_id < end; ++item_id) {
+    TransformPlanned((*datum_vector)[item_id], (*plans)[item_id], height,
+        width, transformed_data + item_id * size);
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformMatRange(
+    const vector<cv::Mat>* mat_vector, const vector<Plan>* plans,
+    const int start, const int end, const int height, const int width,
+    Dtype* transformed_data) {
+  const int size = (*mat_vector)[0].channels() * height * width;
+  for (int item_id = start; item_id < end; ++item_id) {
+    TransformPlanned((*mat_vector)[item_id], (*plans)[item_id], height,
+        width, transformed_data + item_id * size);
+  }
+}
+
+// The row kernels of the planned transformations. They normalize a prefix of
+// a row of width uint8 pixels to (pixel - mean) * scale, the mean being the
+// row of the mean_file if there is one and mean_value otherwise, and write it
+// to the row top of the CHW output, back to front if mirror. They return the
+// number of pixels done, and the callers' scalar loops finish the row. Only
+// float has a SIMD path; for double the scalar loops do everything.
+template <typename Dtype>
+static int NormalizeRow(const uint8_t* /*ptr*/, const int /*width*/,
+    const Dtype* /*mean*/, const Dtype /*mean_value*/, const Dtype /*scale*/,
+    const bool /*mirror*/, Dtype* /*top*/) {
+  return 0;
+}
+
+// As NormalizeRow for the 3 channels of an interleaved HWC row, writing the
+// CHW rows top[0], top[1] and top[2].
+template <typename Dtype>
+static int NormalizeRow3(const uint8_t* /*row*/, const int /*width*/,
+    const Dtype** /*mean*/, const Dtype* /*mean_value*/,
+    const Dtype /*scale*/, const bool /*mirror*/, Dtype** /*top*/) {
+  return 0;
+}
+
+#if defined(__SSE2__)
+// Normalizes the 16 pixels w to w + 15 of a row, held in bytes. The bytes
+// are widened to int32 and converted to float, 8 at a time with AVX2 and 4
+// at a time with SSE2, and mirrored rows are stored with the lanes reversed.
+static inline void NormalizeBytes(const __m128i bytes, const int w,
+    const int width, const float* mean, const float mean_value,
+    const float scale, const bool mirror, float* top) {
+#if defined(__AVX2__)
+  const __m256 scale8 = _mm256_set1_ps(scale);
+  const __m256i reverse = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i halves[2] = { bytes, _mm_unpackhi_epi64(bytes, bytes) };
+  for (int i = 0; i < 2; ++i) {
+    const int x = w + i * 8;
+    __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(halves[i]));
+    v = _mm256_sub_ps(v, mean ? _mm256_loadu_ps(mean + x) :
+        _mm256_set1_ps(mean_value));
+    v = _mm256_mul_ps(v, scale8);
+    if (mirror) {
+      _mm256_storeu_ps(top + width - x - 8,
+          _mm256_permutevar8x32_ps(v, reverse));
+    } else {
+      _mm256_storeu_ps(top + x, v);
+    }
+  }
+#else
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+  const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+  const __m128i quarters[4] = { _mm_unpacklo_epi16(lo, zero),
+      _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero),
+      _mm_unpackhi_epi16(hi, zero) };
+  for (int i = 0; i < 4; ++i) {
+    const int x = w + i * 4;
+    __m128 v = _mm_cvtepi32_ps(quarters[i]);
+    v = _mm_sub_ps(v, mean ? _mm_loadu_ps(mean + x) : _mm_set1_ps(mean_value));
+    v = _mm_mul_ps(v, scale4);
+    if (mirror) {
+      _mm_storeu_ps(top + width - x - 4,
+          _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3)));
+    } else {
+      _mm_storeu_ps(top + x, v);
+    }
+  }
+#endif
+}
+#endif  // __SSE2__
+
+static int NormalizeRow(const uint8_t* ptr, const int width,
+    const float* mean, const float mean_value, const float scale,
+    const bool mirror, float* top) {
+  int w = 0;
+#if defined(__SSE2__)
+  for (; w + 16 <= width; w += 16) {
+    NormalizeBytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + w)),
+        w, width, mean, mean_value, scale, mirror, top);
+  }
+#endif
+  return w;
+}
+
+static int NormalizeRow3(const uint8_t* row, const int width,
+    const float** mean, const float* mean_value, const float scale,
+    const bool mirror, float** top) {
+  int w = 0;
+#if defined(__SSE2__)
+  for (; w + 16 <= width; w += 16) {
+    // Deinterleaves 16 pixels: each round interleaves the low halves of the
+    // vectors with the high halves, and after four the channels are apart.
+    const __m128i* ptr = reinterpret_cast<const __m128i*>(row + w * 3);
+    __m128i x0 = _mm_loadu_si128(ptr);
+    __m128i x1 = _mm_loadu_si128(ptr + 1);
+    __m128i x2 = _mm_loadu_si128(ptr + 2);
+    for (int i = 0; i < 4; ++i) {
+      const __m128i y0 = _mm_unpacklo_epi8(x0, _mm_unpackhi_epi64(x1, x1));
+      const __m128i y1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(x0, x0), x2);
+      const __m128i y2 = _mm_unpacklo_epi8(x1, _mm_unpackhi_epi64(x2, x2));
+      x0 = y0;
+      x1 = y1;
+      x2 = y2;
+    }
+    NormalizeBytes(x0, w, width, mean[0], mean_value[0], scale, mirror,
+        top[0]);
+    NormalizeBytes(x1, w, width, mean[1], mean_value[1], scale, mirror,
+        top[1]);
+    NormalizeBytes(x2, w, width, mean[2], mean_value[2], scale, mirror,
+        top[2]);
+  }
+#endif
+  return w;
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformPlanned(const Datum& datum,
+    const Plan& plan, const int height, const int width,
+    Dtype* transformed_data) {
+  const string& data = datum.data();
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  const int datum_channels = datum.channels();
+  const int datum_height = datum.height();
+  const int datum_width = datum.width();
+  const Dtype scale = param_.scale();
+  const Dtype* mean = param_.has_mean_file() ? data_mean_.cpu_data() : NULL;
+  // Mirrored rows are written back to front.
+  const int top_step = plan.mirror ? -1 : 1;
+  for (int c = 0; c < datum_channels; ++c) {
+    const Dtype mean_value = mean_values_.size() > 0 ? mean_values_[c] : 0;
+    for (int h = 0; h < height; ++h) {
+      const int data_index =
+          (c * datum_height + plan.h_off + h) * datum_width + plan.w_off;
+      Dtype* top_row = transformed_data + (c * height + h) * width;
+      Dtype* top = top_row + (plan.mirror ? width - 1 : 0);
+      if (data.size() > 0) {
+        const uint8_t* ptr = bytes + data_index;
+        const Dtype* mean_ptr = mean ? mean + data_index : NULL;
+        int w = NormalizeRow(ptr, width, mean_ptr, mean_value, scale,
+            plan.mirror, top_row);
+        if (mean) {
+          for (; w < width; ++w) {
+            top[w * top_step] =
+                (static_cast<Dtype>(ptr[w]) - mean_ptr[w]) * scale;
+          }
+        } else {
+          const Dtype* lookup = &pixel_lookup_[c * 256];
+          for (; w < width; ++w) {
+            top[w * top_step] = lookup[ptr[w]];
+          }
+        }
+      } else {
+        for (int w = 0; w < width; ++w) {
+          const Dtype datum_element = datum.float_data(data_index + w);
+          top[w * top_step] = (datum_element -
+              (mean ? mean[data_index + w] : mean_value)) * scale;
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformPlanned(const cv::Mat& cv_img,
+    const Plan& plan, const int height, const int width,
+    Dtype* transformed_data) {
+  const int img_channels = cv_img.channels();
+  const int img_height = cv_img.rows;
+  const int img_width = cv_img.cols;
+  const Dtype scale = param_.scale();
+  const Dtype* mean = param_.has_mean_file() ? data_mean_.cpu_data() : NULL;
+  const int top_step = plan.mirror ? -1 : 1;
+  for (int h = 0; h < height; ++h) {
+    // Interleaved HWC row; each channel is gathered into its own CHW row.
+    const uchar* row =
+        cv_img.ptr<uchar>(plan.h_off + h) + plan.w_off * img_channels;
+    const int mean_offset = (plan.h_off + h) * img_width + plan.w_off;
+    // Grayscale and color rows start with the row kernels.
+    int done = 0;
+    if (img_channels == 1) {
+      done = NormalizeRow(row, width, mean ? mean + mean_offset : NULL,
+          mean_values_.size() > 0 ? mean_values_[0] : Dtype(0), scale,
+          plan.mirror, transformed_data + h * width);
+    } else if (img_channels == 3) {
+      const Dtype* mean_rows[3];
+      Dtype mean_values[3];
+      Dtype* top_rows[3];
+      for (int c = 0; c < 3; ++c) {
+        mean_rows[c] =
+            mean ? mean + c * img_height * img_width + mean_offset : NULL;
+        mean_values[c] = mean_values_.size() > 0 ? mean_values_[c] : 0;
+        top_rows[c] = transformed_data + (c * height + h) * width;
+      }
+      done = NormalizeRow3(row, width, mean_rows, mean_values, scale,
+          plan.mirror, top_rows);
+    }
+    for (int c = 0; c < img_channels; ++c) {
+      const uchar* ptr = row + c;
+      Dtype* top = transformed_data + (c * height + h) * width +
+          (plan.mirror ? width - 1 : 0);
+      if (mean) {
+        const Dtype* mean_ptr = mean + c * img_height * img_width +
+            mean_offset;
+        for (int w = done; w < width; ++w) {
+          top[w * top_step] =
+              (static_cast<Dtype>(ptr[w * img_channels]) - mean_ptr[w]) * scale;
+        }
+      } else {
+        const Dtype* lookup = &pixel_lookup_[c * 256];
+        for (int w = done; w < width; ++w) {
+          top[w * top_step] = lookup[ptr[w * img_channels]];
+        }
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropBatch(const vector<Datum>& datum_vector,
+    const int height, const int width, uint8_t* crop_data, int* plan_data) {
+  const int datum_num = datum_vector.size();
+  CHECK_GT(datum_num, 0) << "There is no datum to add";
+  const int channels = datum_vector[0].channels();
+  const int crop_size = param_.crop_size();
+  Plan plan;
+  for (int item_id = 0; item_id < datum_num; ++item_id) {
+    const Datum& datum = datum_vector[item_id];
+    const string& data = datum.data();
+    CHECK_GT(data.size(), 0) << "device_transform needs uint8 data";
+    CHECK_EQ(channels, datum.channels());
+    if (crop_size) {
+      CHECK_EQ(crop_size, height);
+      CHECK_EQ(crop_size, width);
+    } else {
+      CHECK_EQ(datum.height(), height);
+      CHECK_EQ(datum.width(), width);
+    }
+    CheckMeanShape(datum.channels(), datum.height(), datum.width());
+    MakePlan(datum.height(), datum.width(), &plan);
+    int* item_plan = plan_data + item_id * 3;
+    item_plan[0] = plan.h_off;
+    item_plan[1] = plan.w_off;
+    item_plan[2] = plan.mirror;
+    uint8_t* top = crop_data + item_id * channels * height * width;
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height; ++h) {
+        const int data_index =
+            (c * datum.height() + plan.h_off + h) * datum.width() + plan.w_off;
+        const uint8_t* ptr =
+            reinterpret_cast<const uint8_t*>(data.data()) + data_index;
+        std::copy(ptr, ptr + width, top + (c * height + h) * width);
+      }
+    }
+  }
+  PrepareMean(channels);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::NormalizeCrops_cpu(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* crop_data, const int* plan_data, Dtype* transformed_data) {
+  const Dtype scale = param_.scale();
+  const Dtype* mean = param_.has_mean_file() ? data_mean_.cpu_data() : NULL;
+  const int mean_height = data_mean_.height();
+  const int mean_width = data_mean_.width();
+  for (int item_id = 0; item_id < num; ++item_id) {
+    const int* plan = plan_data + item_id * 3;
+    const int top_step = plan[2] ? -1 : 1;
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height; ++h) {
+        const int index = ((item_id * channels + c) * height + h) * width;
+        const uint8_t* ptr = crop_data + index;
+        Dtype* top = transformed_data + index + (plan[2] ? width - 1 : 0);
+        const Dtype* mean_ptr = mean ? mean +
+            (c * mean_height + plan[0] + h) * mean_width + plan[1] : NULL;
+        int w = NormalizeRow(ptr, width, mean_ptr,
+            mean_values_.size() > 0 ? mean_values_[c] : Dtype(0), scale,
+            plan[2], transformed_data + index);
+        if (mean) {
+          for (; w < width; ++w) {
+            top[w * top_step] =
+                (static_cast<Dtype>(ptr[w]) - mean_ptr[w]) * scale;
+          }
+        } else {
+          const Dtype* lookup = &pixel_lookup_[c * 256];
+          for (; w < width; ++w) {
+            top[w * top_step] = lookup[ptr[w]];
+          }
+        }
+      }
+    }
   }
 }
 
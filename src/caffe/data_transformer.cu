@@ -0,0 +1,62 @@
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/data_transformer.hpp"
+
+namespace caffe {
+
+// One thread per output value; the mean is indexed at the uncropped source
+// position so the result matches DataTransformer::Transform exactly.
+template <typename Dtype>
+__global__ void NormalizeCropsKernel(const int nthreads, const int channels,
+    const int height, const int width, const int mean_height,
+    const int mean_width, const bool has_mean_file, const Dtype scale,
+    const uint8_t* crop_data, const int* plan_data, const Dtype* mean,
+    Dtype* transformed_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int c = (index / width / height) % channels;
+    const int n = index / width / height / channels;
+    const int* plan = plan_data + n * 3;
+    const Dtype mean_value = has_mean_file ?
+        mean[(c * mean_height + plan[0] + h) * mean_width + plan[1] + w] :
+        mean[c];
+    const int top_w = plan[2] ? width - 1 - w : w;
+    transformed_data[index - w + top_w] =
+        (static_cast<Dtype>(crop_data[index]) - mean_value) * scale;
+  }
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::NormalizeCrops_gpu(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* crop_data, const int* plan_data, Dtype* transformed_data) {
+  const bool has_mean_file = param_.has_mean_file();
+  if (!has_mean_file && channel_mean_.count() != channels) {
+    channel_mean_.Reshape(1, channels, 1, 1);
+    Dtype* channel_mean = channel_mean_.mutable_cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      channel_mean[c] = mean_values_.size() > 0 ? mean_values_[c] : 0;
+    }
+  }
+  const Dtype* mean = has_mean_file ?
+      data_mean_.gpu_data() : channel_mean_.gpu_data();
+  const int count = num * channels * height * width;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  NormalizeCropsKernel<Dtype><<<CAFFE_GET_BLOCKS(count),
+      CAFFE_CUDA_NUM_THREADS>>>(count, channels, height, width,
+      data_mean_.height(), data_mean_.width(), has_mean_file,
+      Dtype(param_.scale()), crop_data, plan_data, mean, transformed_data);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void DataTransformer<float>::NormalizeCrops_gpu(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* crop_data, const int* plan_data, float* transformed_data);
+template void DataTransformer<double>::NormalizeCrops_gpu(const int num,
+    const int channels, const int height, const int width,
+    const uint8_t* crop_data, const int* plan_data, double* transformed_data);
+
+}  // namespace caffe
@@ -16,15 +16,22 @@ bool InternalThread::StartInternalThread() {
   if (!WaitForInternalThreadToExit()) {
     return false;
   }
+  finished_ = false;
   try {
-    thread_.reset(
-        new boost::thread(&InternalThread::InternalThreadEntry, this));
+    thread_.reset(new boost::thread(&InternalThread::Entry, this));
   } catch (...) {
     return false;
   }
   return true;
 }
 
+void InternalThread::Entry() {
+  InternalThreadEntry();
+  // Publish what the thread wrote before the flag.
+  __sync_synchronize();
+  finished_ = true;
+}
+
 /** Will not return until the internal thread has exited. */
 bool InternalThread::WaitForInternalThreadToExit() {
   if (is_started()) {
@@ -1,12 +1,46 @@
+#include <stdint.h>
+
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/profiler.hpp"
 
 namespace caffe {
 
+void DataLayerStats::Clear() {
+  batches = 0;
+  ready_batches = 0;
+  items = 0;
+  bytes_read = 0;
+  wait_ms = 0;
+  read_ms = 0;
+  decode_ms = 0;
+  transform_ms = 0;
+  start_us = Profiler::Now();
+}
+
+void DataLayerStats::Add(const DataLayerStats& other) {
+  batches += other.batches;
+  ready_batches += other.ready_batches;
+  items += other.items;
+  bytes_read += other.bytes_read;
+  wait_ms += other.wait_ms;
+  read_ms += other.read_ms;
+  decode_ms += other.decode_ms;
+  transform_ms += other.transform_ms;
+  start_us = std::min(start_us, other.start_us);
+}
+
+double DataLayerStats::ItemsPerSecond() const {
+  const int64_t elapsed_us = Profiler::Now() - start_us;
+  return elapsed_us > 0 ? items * 1e6 / elapsed_us : 0;
+}
+
 template <typename Dtype>
 BaseDataLayer<Dtype>::BaseDataLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
@@ -28,6 +62,17 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   data_transformer_->InitRand();
 }
 
+template <typename Dtype>
+void BaseDataLayer<Dtype>::CountBatch(int num, bool ready, double wait_ms) {
+  batch_stats_.batches = 1;
+  batch_stats_.ready_batches = ready ? 1 : 0;
+  batch_stats_.items = num;
+  batch_stats_.wait_ms = wait_ms;
+  batch_stats_.start_us = stats_.start_us;
+  stats_.Add(batch_stats_);
+  batch_stats_.Clear();
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -36,7 +81,15 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
   // cpu_data calls so that the prefetch thread does not accidentally make
   // simultaneous cudaMalloc calls when the main thread is running. In some
   // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
+  if (this->transform_param_.device_transform()) {
+    prefetch_crops_.reset(new SyncedMemory(prefetch_data_.count()));
+    prefetch_plans_.reset(
+        new SyncedMemory(prefetch_data_.num() * 3 * sizeof(int)));
+    prefetch_crops_->mutable_cpu_data();
+    prefetch_plans_->mutable_cpu_data();
+  } else {
+    this->prefetch_data_.mutable_cpu_data();
+  }
   if (this->output_labels_) {
     this->prefetch_label_.mutable_cpu_data();
   }
@@ -56,18 +109,37 @@ void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
   CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::WaitForBatch() {
+  const bool ready = is_finished();
+  CPUTimer timer;
+  timer.Start();
+  JoinPrefetchThread();
+  this->CountBatch(prefetch_data_.num(), ready, timer.MilliSeconds());
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   // First, join the thread
-  JoinPrefetchThread();
+  WaitForBatch();
   DLOG(INFO) << "Thread joined";
   // Reshape to loaded data.
   top[0]->Reshape(this->prefetch_data_.num(), this->prefetch_data_.channels(),
       this->prefetch_data_.height(), this->prefetch_data_.width());
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             top[0]->mutable_cpu_data());
+  if (this->transform_param_.device_transform()) {
+    // Finish the transformation of the prefetched crops.
+    this->data_transformer_->NormalizeCrops_cpu(prefetch_data_.num(),
+        prefetch_data_.channels(), prefetch_data_.height(),
+        prefetch_data_.width(),
+        static_cast<const uint8_t*>(prefetch_crops_->cpu_data()),
+        static_cast<const int*>(prefetch_plans_->cpu_data()),
+        top[0]->mutable_cpu_data());
+  } else {
+    // Copy the data
+    caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
+               top[0]->mutable_cpu_data());
+  }
   DLOG(INFO) << "Prefetch copied";
   if (this->output_labels_) {
     caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
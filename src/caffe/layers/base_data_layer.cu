@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #include <vector>
 
 #include "caffe/data_layers.hpp"
@@ -8,13 +10,23 @@ template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   // First, join the thread
-  JoinPrefetchThread();
+  WaitForBatch();
   // Reshape to loaded data.
   top[0]->Reshape(this->prefetch_data_.num(), this->prefetch_data_.channels(),
       this->prefetch_data_.height(), this->prefetch_data_.width());
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-      top[0]->mutable_gpu_data());
+  if (this->transform_param_.device_transform()) {
+    // Upload the uint8 crops and finish the transformation on the device.
+    this->data_transformer_->NormalizeCrops_gpu(prefetch_data_.num(),
+        prefetch_data_.channels(), prefetch_data_.height(),
+        prefetch_data_.width(),
+        static_cast<const uint8_t*>(prefetch_crops_->gpu_data()),
+        static_cast<const int*>(prefetch_plans_->gpu_data()),
+        top[0]->mutable_gpu_data());
+  } else {
+    // Copy the data
+    caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
+        top[0]->mutable_gpu_data());
+  }
   if (this->output_labels_) {
     caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
         top[1]->mutable_gpu_data());
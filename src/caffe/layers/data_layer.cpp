@@ -2,6 +2,10 @@
 
 #include <stdint.h>
 
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <map>
 #include <string>
 #include <vector>
 
@@ -16,28 +20,69 @@
 
 namespace caffe {
 
+// The DBs opened by the Data layers of this process, by backend and source.
+// The layers reading the same source, such as those of the solver_threads
+// replicas, share its DB: LevelDB refuses a second open of a DB in a process.
+static boost::mutex open_dbs_mutex;
+static std::map<string, boost::weak_ptr<db::DB> > open_dbs;
+
+static shared_ptr<db::DB> OpenSharedDB(const DataParameter& param) {
+  boost::mutex::scoped_lock lock(open_dbs_mutex);
+  const string key = DataParameter_DB_Name(param.backend()) + ":" +
+      param.source();
+  shared_ptr<db::DB> db = open_dbs[key].lock();
+  if (!db) {
+    db.reset(db::GetDB(param.backend()));
+    db->Open(param.source(), db::READ);
+    open_dbs[key] = db;
+  }
+  return db;
+}
+
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
   this->JoinPrefetchThread();
 }
 
+template <typename Dtype>
+void DataLayer<Dtype>::Next() {
+  cursor_->Next();
+  if (!cursor_->valid()) {
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    cursor_->SeekToFirst();
+  }
+}
+
 template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  const DataShardParameter& shard_param =
+      this->layer_param_.data_shard_param();
+  CHECK_LT(shard_param.shard(), shard_param.num_shards());
   // Initialize DB
-  db_.reset(db::GetDB(this->layer_param_.data_param().backend()));
-  db_->Open(this->layer_param_.data_param().source(), db::READ);
-  cursor_.reset(db_->NewCursor());
+  db_ = OpenSharedDB(this->layer_param_.data_param());
+  {
+    // LMDB::NewCursor is not thread safe.
+    boost::mutex::scoped_lock lock(open_dbs_mutex);
+    cursor_.reset(db_->NewCursor());
+  }
 
   // Check if we should randomly skip a few data points
   if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
+    const unsigned int random = shard_param.seed() ? shard_param.seed() :
+        caffe_rng_rand();
+    unsigned int skip = random % this->layer_param_.data_param().rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
     while (skip-- > 0) {
       cursor_->Next();
     }
   }
+  // Shard s starts at batch s of the source.
+  const int shard = shard_param.shard();
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  for (int i = 0; i < shard * batch_size; ++i) {
+    Next();
+  }
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
   datum.ParseFromString(cursor_->value());
@@ -81,7 +126,9 @@ void DataLayer<Dtype>::InternalThreadEntry() {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
+  double decode_time = 0;
   double trans_time = 0;
+  uint64_t bytes_read = 0;
   CPUTimer timer;
   CHECK(this->prefetch_data_.count());
   CHECK(this->transformed_data_.count());
@@ -106,58 +153,76 @@ void DataLayer<Dtype>::InternalThreadEntry() {
         datum.height(), datum.width());
   }
 
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
 
   if (this->output_labels_) {
     top_label = this->prefetch_label_.mutable_cpu_data();
   }
+  vector<Datum> datums(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     timer.Start();
     // get a blob
-    Datum datum;
-    datum.ParseFromString(cursor_->value());
+    Datum& datum = datums[item_id];
+    const string& value = cursor_->value();
+    bytes_read += value.size();
+    datum.ParseFromString(value);
+    if (this->output_labels_) {
+      top_label[item_id] = datum.label();
+    }
+    // go to the next iter
+    Next();
+    read_time += timer.MicroSeconds();
 
-    cv::Mat cv_img;
+    // Encoded images are decoded in place so that the whole batch goes
+    // through a single transform call.
     if (datum.encoded()) {
+      timer.Start();
       if (force_color) {
-        cv_img = DecodeDatumToCVMat(datum, true);
+        DecodeDatum(&datum, true);
       } else {
-        cv_img = DecodeDatumToCVMatNative(datum);
+        DecodeDatumNative(&datum);
       }
-      if (cv_img.channels() != this->transformed_data_.channels()) {
+      if (datum.channels() != this->transformed_data_.channels()) {
         LOG(WARNING) << "Your dataset contains encoded images with mixed "
         << "channel sizes. Consider adding a 'force_color' flag to the "
         << "model definition, or rebuild your dataset using "
         << "convert_imageset.";
       }
+      decode_time += timer.MicroSeconds();
     }
-    read_time += timer.MicroSeconds();
-    timer.Start();
-
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    if (datum.encoded()) {
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    } else {
-      this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    }
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
-    // go to the next iter
-    cursor_->Next();
-    if (!cursor_->valid()) {
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      cursor_->SeekToFirst();
+  }
+  // Skip the batches of the other shards.
+  timer.Start();
+  const int num_shards = this->layer_param_.data_shard_param().num_shards();
+  for (int i = 0; i < (num_shards - 1) * batch_size; ++i) {
+    Next();
+  }
+  read_time += timer.MicroSeconds();
+  // Apply data transformations (mirror, scale, crop...)
+  timer.Start();
+  if (this->transform_param_.device_transform()) {
+    // Only crop here; Forward does the rest on the uploaded bytes.
+    const int count = this->prefetch_data_.count();
+    if (this->prefetch_crops_->size() != count) {
+      this->prefetch_crops_.reset(new SyncedMemory(count));
     }
+    this->data_transformer_->CropBatch(datums,
+        this->prefetch_data_.height(), this->prefetch_data_.width(),
+        static_cast<uint8_t*>(this->prefetch_crops_->mutable_cpu_data()),
+        static_cast<int*>(this->prefetch_plans_->mutable_cpu_data()));
+  } else {
+    this->data_transformer_->Transform(datums, &(this->prefetch_data_));
   }
+  trans_time += timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "   Decode time: " << decode_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  this->batch_stats_.read_ms = read_time / 1000;
+  this->batch_stats_.decode_ms = decode_time / 1000;
+  this->batch_stats_.transform_ms = trans_time / 1000;
+  this->batch_stats_.bytes_read = bytes_read;
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -20,24 +20,19 @@ template <typename Dtype>
 void HDF5DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          DLOG(INFO) << "Looping around to first file.";
-        }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-      }
-      current_row_ = 0;
-    }
+  for (int i = 0; i < batch_size; ++i) {
     for (int j = 0; j < this->layer_param_.top_size(); ++j) {
       int data_dim = top[j]->count() / top[j]->num();
       caffe_copy(data_dim,
           &hdf_blobs_[j]->cpu_data()[current_row_ * data_dim],
           &top[j]->mutable_gpu_data()[i * data_dim]);
     }
+    Next();
+  }
+  // Skip the batches of the other shards.
+  const int num_shards = this->layer_param_.data_shard_param().num_shards();
+  for (int i = 0; i < (num_shards - 1) * batch_size; ++i) {
+    Next();
   }
 }
 
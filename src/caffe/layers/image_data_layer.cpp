@@ -1,4 +1,5 @@
 #include <opencv2/core/core.hpp>
+#include <stdint.h>
 
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
@@ -9,6 +10,7 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -31,6 +33,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
       "new_height and new_width to be set at the same time.";
+  CHECK(!this->layer_param_.transform_param().device_transform())
+      << "device_transform is only supported by the Data layer.";
   // Read the file with filenames and labels
   const string& source = this->layer_param_.image_data_param().source();
   LOG(INFO) << "Opening file " << source;
@@ -41,24 +45,43 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_.push_back(std::make_pair(filename, label));
   }
 
+  // The shards of a source shuffle and skip alike.
+  const DataShardParameter& shard_param =
+      this->layer_param_.data_shard_param();
+  CHECK_LT(shard_param.shard(), shard_param.num_shards());
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
-    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    const unsigned int prefetch_rng_seed = shard_param.seed() ?
+        shard_param.seed() : caffe_rng_rand();
     prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
     ShuffleImages();
   }
   LOG(INFO) << "A total of " << lines_.size() << " images.";
+  const uint64_t cache_bytes =
+      this->layer_param_.image_data_param().cache_bytes();
+  if (cache_bytes > 0) {
+    LOG(INFO) << "Caching up to " << cache_bytes << " bytes of images";
+    image_cache_ = ImageCache::Shared(cache_bytes);
+  }
 
   lines_id_ = 0;
   // Check if we would need to randomly skip a few data points
   if (this->layer_param_.image_data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
+    const unsigned int random = shard_param.seed() ? shard_param.seed() :
+        caffe_rng_rand();
+    unsigned int skip = random %
         this->layer_param_.image_data_param().rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  // Shard s starts at batch s of the source.
+  const int shard = shard_param.shard();
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  for (int i = 0; i < shard * batch_size; ++i) {
+    Next();
+  }
   // Read an image, and use it to initialize the top blob.
   cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
                                     new_height, new_width, is_color);
@@ -67,7 +90,6 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int width = cv_img.cols;
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
-  const int batch_size = this->layer_param_.image_data_param().batch_size();
   if (crop_size > 0) {
     top[0]->Reshape(batch_size, channels, crop_size, crop_size);
     this->prefetch_data_.Reshape(batch_size, channels, crop_size, crop_size);
@@ -93,6 +115,19 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
+template <typename Dtype>
+void ImageDataLayer<Dtype>::Next() {
+  const int lines_size = lines_.size();
+  if (++lines_id_ >= lines_size) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+    if (this->layer_param_.image_data_param().shuffle()) {
+      ShuffleImages();
+    }
+  }
+}
+
 // This function is used to create a thread that prefetches the data.
 template <typename Dtype>
 void ImageDataLayer<Dtype>::InternalThreadEntry() {
@@ -100,6 +135,7 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
+  uint64_t bytes_read = 0;
   CPUTimer timer;
   CHECK(this->prefetch_data_.count());
   CHECK(this->transformed_data_.count());
@@ -121,42 +157,52 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
         cv_img.rows, cv_img.cols);
   }
 
-  Dtype* prefetch_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* prefetch_label = this->prefetch_label_.mutable_cpu_data();
 
   // datum scales
   const int lines_size = lines_.size();
+  vector<cv::Mat> cv_imgs(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+    const string filename = root_folder + lines_[lines_id_].first;
+    cv::Mat& cv_img = cv_imgs[item_id];
+    string key;
+    if (image_cache_) {
+      key = ImageCache::Key(filename, new_height, new_width, is_color);
+    }
+    if (!image_cache_ || !image_cache_->Lookup(key, &cv_img)) {
+      cv_img = ReadImageToCVMat(filename, new_height, new_width, is_color);
+      CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+      if (image_cache_) {
+        image_cache_->Insert(key, cv_img);
+      }
+    }
     read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
+    bytes_read += cv_img.total() * cv_img.elemSize();
 
     prefetch_label[item_id] = lines_[lines_id_].second;
     // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
+    Next();
+  }
+  // Skip the batches of the other shards.
+  const int num_shards = this->layer_param_.data_shard_param().num_shards();
+  for (int i = 0; i < (num_shards - 1) * batch_size; ++i) {
+    Next();
   }
+  // Apply transformations (mirror, crop...) to the whole batch
+  timer.Start();
+  this->data_transformer_->Transform(cv_imgs, &(this->prefetch_data_));
+  trans_time += timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  // Images are decoded as they are read, so the read time includes it.
+  this->batch_stats_.read_ms = read_time / 1000;
+  this->batch_stats_.transform_ms = trans_time / 1000;
+  this->batch_stats_.bytes_read = bytes_read;
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
@@ -0,0 +1,94 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Unrolls a channels x height x width int8 image into one row per output
+// pixel holding the values under the kernel there, in the order of the filter
+// weights and with zeros for the padding. This is im2col transposed, so that
+// the int8 gemm takes its dot products along contiguous memory.
+static void im2row_s8(const int8_t* image, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int height_out, const int width_out, int8_t* rows) {
+  for (int h_out = 0; h_out < height_out; ++h_out) {
+    for (int w_out = 0; w_out < width_out; ++w_out) {
+      for (int c = 0; c < channels; ++c) {
+        for (int kh = 0; kh < kernel_h; ++kh) {
+          const int h = h_out * stride_h - pad_h + kh;
+          for (int kw = 0; kw < kernel_w; ++kw) {
+            const int w = w_out * stride_w - pad_w + kw;
+            *rows++ = (h >= 0 && h < height && w >= 0 && w < width) ?
+                image[(c * height + h) * width + w] : 0;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  image_q_.resize(this->channels_ * this->height_ * this->width_);
+  rows_q_.resize(this->height_out_ * this->width_out_ *
+      this->blobs_[0]->count(1));
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::QuantizeWeights() {
+  weight_q_.resize(this->blobs_[0]->count());
+  weight_scale_.resize(this->num_output_);
+  caffe_cpu_quantize_rows(this->num_output_, this->blobs_[0]->count(1),
+      this->blobs_[0]->cpu_data(), &weight_q_[0], &weight_scale_[0]);
+  weights_quantized_ = true;
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!weights_quantized_ || this->phase_ == TRAIN) {
+    QuantizeWeights();
+  }
+  const int group_channels = this->channels_ / this->group_;
+  const int group_outputs = this->num_output_ / this->group_;
+  const int kernel_dim = this->blobs_[0]->count(1);
+  const int out_spatial_dim = this->height_out_ * this->width_out_;
+  const int image_dim = this->channels_ * this->height_ * this->width_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    Dtype range = this->layer_param_.quantization_param().input_range();
+    if (range <= 0) {
+      range = caffe_cpu_amax(bottom[i]->count(), bottom_data);
+    }
+    const Dtype input_scale = range > 0 ? range / 127 : 1;
+    for (int n = 0; n < this->num_; ++n) {
+      caffe_cpu_quantize(image_dim, 1 / input_scale,
+          bottom_data + bottom[i]->offset(n), &image_q_[0]);
+      for (int g = 0; g < this->group_; ++g) {
+        im2row_s8(&image_q_[g * group_channels * this->height_ * this->width_],
+            group_channels, this->height_, this->width_, this->kernel_h_,
+            this->kernel_w_, this->pad_h_, this->pad_w_, this->stride_h_,
+            this->stride_w_, this->height_out_, this->width_out_,
+            &rows_q_[0]);
+        caffe_cpu_s8gemm<Dtype>(group_outputs, out_spatial_dim, kernel_dim,
+            input_scale, &weight_q_[g * group_outputs * kernel_dim],
+            &weight_scale_[g * group_outputs], &rows_q_[0], NULL,
+            top_data + top[i]->offset(n) + g * group_outputs * out_spatial_dim);
+      }
+      if (this->bias_term_) {
+        this->forward_cpu_bias(top_data + top[i]->offset(n),
+            this->blobs_[1]->cpu_data());
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Int8ConvolutionLayer);
+
+}  // namespace caffe
@@ -0,0 +1,53 @@
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  InnerProductLayer<Dtype>::Reshape(bottom, top);
+  bottom_q_.resize(this->M_ * this->K_);
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::QuantizeWeights() {
+  weight_q_.resize(this->N_ * this->K_);
+  weight_scale_.resize(this->N_);
+  caffe_cpu_quantize_rows(this->N_, this->K_, this->blobs_[0]->cpu_data(),
+      &weight_q_[0], &weight_scale_[0]);
+  weights_quantized_ = true;
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!weights_quantized_ || this->phase_ == TRAIN) {
+    QuantizeWeights();
+  }
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype range = this->layer_param_.quantization_param().input_range();
+  if (range <= 0) {
+    range = caffe_cpu_amax(bottom[0]->count(), bottom_data);
+  }
+  const Dtype input_scale = range > 0 ? range / 127 : 1;
+  caffe_cpu_quantize(bottom[0]->count(), 1 / input_scale, bottom_data,
+      &bottom_q_[0]);
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_cpu_s8gemm<Dtype>(this->M_, this->N_, this->K_, input_scale,
+      &bottom_q_[0], NULL, &weight_q_[0], &weight_scale_[0], top_data);
+  if (this->bias_term_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, this->M_, this->N_, 1,
+        (Dtype)1., this->bias_multiplier_.cpu_data(),
+        this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
+  }
+}
+
+INSTANTIATE_CLASS(Int8InnerProductLayer);
+
+}  // namespace caffe
@@ -1,13 +1,27 @@
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+MemoryDataLayer<Dtype>::~MemoryDataLayer() {
+  WaitForInternalThreadToExit();
+#ifndef CPU_ONLY
+  if (stream_) {
+    CUDA_CHECK(cudaStreamDestroy(stream_));
+    CUDA_CHECK(cudaEventDestroy(copied_));
+  }
+#endif
+}
+
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
      const vector<Blob<Dtype>*>& top) {
@@ -23,7 +37,16 @@ void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     size_.push_back(channels_[i] * height_[i] * width_[i]);
     // added_data_[i].Reshape(batch_size_, channels_[i], height_[i], width_[i]);
     data_.push_back(NULL);
+    // Uploads only overlap with the net when staged in pinned memory.
+    staging_.push_back(shared_ptr<SyncedMemory>(new SyncedMemory(
+        batch_size_ * size_[i] * sizeof(Dtype),
+        Caffe::mode() == Caffe::GPU)));
   }
+  if (param.shuffle()) {
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  }
+  prefetched_ = false;
 }
 
 /*
@@ -81,6 +104,9 @@ void MemoryDataLayer<Dtype>::AddMatVector(const vector<cv::Mat>& mat_vector,
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::Reset(vector<Dtype*> data, int n) {
   CHECK_EQ(n % batch_size_, 0) << "n must be a multiple of batch size";
+  CHECK_EQ(data.size(), data_.size()) << "Reset needs one array per top";
+  // The prefetch thread may still be reading the previous arrays.
+  WaitForInternalThreadToExit();
   for (int i = 0; i < data.size(); ++i) {
     CHECK(data[i]);
     data_[i] = data[i];
@@ -92,8 +118,84 @@ void MemoryDataLayer<Dtype>::Reset(vector<Dtype*> data, int n) {
   }
   n_ = n;
   pos_ = 0;
+  prefetched_ = false;
+  if (prefetch_rng_) {
+    order_.resize(n_);
+    for (int i = 0; i < n_; ++i) {
+      order_[i] = i;
+    }
+    ShuffleOrder();
+  }
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::Release() {
+  WaitForInternalThreadToExit();
+  for (int i = 0; i < data_.size(); ++i) {
+    data_[i] = NULL;
+  }
+  prefetched_ = false;
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::ShuffleOrder() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(order_.begin(), order_.end(), prefetch_rng);
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::CopyBatch(int i, Dtype* dst) {
+  CHECK(data_[i]) << "MemoryDataLayer needs to be initalized by calling Reset";
+  if (order_.empty()) {
+    const Dtype* src = data_[i] + pos_ * size_[i];
+    std::copy(src, src + batch_size_ * size_[i], dst);
+  } else {
+    for (int j = 0; j < batch_size_; ++j) {
+      const Dtype* src = data_[i] + order_[pos_ + j] * size_[i];
+      std::copy(src, src + size_[i], dst + j * size_[i]);
+    }
+  }
+  this->batch_stats_.bytes_read += batch_size_ * size_[i] * sizeof(Dtype);
 }
 
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::AdvanceBatch() {
+  pos_ += batch_size_;
+  if (pos_ == static_cast<size_t>(n_)) {
+    pos_ = 0;
+    if (!order_.empty()) {
+      ShuffleOrder();
+    }
+  }
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::PrefetchBatch() {
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < staging_.size(); ++i) {
+    CopyBatch(i, static_cast<Dtype*>(staging_[i]->mutable_cpu_data()));
+  }
+#ifndef CPU_ONLY
+  CUDA_CHECK(cudaSetDevice(device_));
+  // Do not overwrite the device staging before the last batch is copied out.
+  CUDA_CHECK(cudaStreamWaitEvent(stream_, copied_, 0));
+  for (int i = 0; i < staging_.size(); ++i) {
+    staging_[i]->async_gpu_push(stream_);
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream_));
+#else
+  NO_GPU;
+#endif
+  this->batch_stats_.read_ms += timer.MilliSeconds();
+  prefetched_ = true;
+}
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::InternalThreadEntry() {
+  PrefetchBatch();
+}
 
 /*
 template <typename Dtype>
@@ -127,16 +229,38 @@ void MemoryDataLayer<Dtype>::set_batch_size(int new_size) {
 template <typename Dtype>
 void MemoryDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  // A batch may have been prefetched before switching to CPU mode.
+  const bool finished = is_finished();
+  CPUTimer timer;
+  timer.Start();
+  WaitForInternalThreadToExit();
+  const double wait_ms = timer.MilliSeconds();
+  const bool ready = finished && prefetched_;
+  timer.Start();
   for (int i = 0; i < top.size(); ++i) {
-    CHECK(data_[i]) << "MemoryDataLayer needs to be initalized by calling Reset";
     top[i]->Reshape(batch_size_, channels_[i], height_[i], width_[i]);
-    top[i]->set_cpu_data(data_[i] + pos_ * size_[i]);
+    if (prefetched_) {
+      caffe_copy(top[i]->count(),
+          static_cast<const Dtype*>(staging_[i]->cpu_data()),
+          top[i]->mutable_cpu_data());
+    } else {
+      CopyBatch(i, top[i]->mutable_cpu_data());
+    }
+  }
+  if (!prefetched_) {
+    this->batch_stats_.read_ms += timer.MilliSeconds();
   }
-  pos_ = (pos_ + batch_size_) % n_;
+  this->CountBatch(batch_size_, ready, wait_ms);
+  prefetched_ = false;
+  AdvanceBatch();
   //if (pos_ == 0)
   //has_new_data_ = false;
 }
 
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(MemoryDataLayer, Forward);
+#endif
+
 INSTANTIATE_CLASS(MemoryDataLayer);
 REGISTER_LAYER_CLASS(MemoryData);
 
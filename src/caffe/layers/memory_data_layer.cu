@@ -0,0 +1,41 @@
+#include <vector>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/util/benchmark.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void MemoryDataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  if (!stream_) {
+    CUDA_CHECK(cudaGetDevice(&device_));
+    CUDA_CHECK(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    CUDA_CHECK(cudaEventCreateWithFlags(&copied_, cudaEventDisableTiming));
+  }
+  const bool finished = is_finished();
+  CPUTimer timer;
+  timer.Start();
+  WaitForInternalThreadToExit();
+  const double wait_ms = timer.MilliSeconds();
+  const bool ready = finished && prefetched_;
+  if (!prefetched_) {
+    PrefetchBatch();
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    top[i]->Reshape(batch_size_, channels_[i], height_[i], width_[i]);
+    caffe_copy(top[i]->count(),
+        static_cast<const Dtype*>(staging_[i]->gpu_data()),
+        top[i]->mutable_gpu_data());
+  }
+  CUDA_CHECK(cudaEventRecord(copied_, 0));
+  this->CountBatch(batch_size_, ready, wait_ms);
+  prefetched_ = false;
+  AdvanceBatch();
+  // Gather and upload the next batch while the net runs.
+  CHECK(StartInternalThread()) << "Thread execution failed";
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD(MemoryDataLayer);
+
+}  // namespace caffe
@@ -129,7 +129,8 @@ void RecurrentLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // This layer's parameters are any parameters in the layers of the unrolled
   // net. We only want one copy of each parameter, so check that the parameter
   // is "owned" by the layer, rather than shared with another.
-  this->blobs_.clear();
+  vector<shared_ptr<Blob<Dtype> > > given_blobs;
+  given_blobs.swap(this->blobs_);
   for (int i = 0; i < unrolled_net_->params().size(); ++i) {
     if (unrolled_net_->param_owners()[i] == -1) {
       LOG(INFO) << "Adding parameter " << i << ": "
@@ -137,6 +138,19 @@ void RecurrentLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       this->blobs_.push_back(unrolled_net_->params()[i]);
     }
   }
+  // Parameters the layer was given, e.g. the weights of a NetWeights, take
+  // the place of those of the unrolled net and of its shared copies.
+  if (!given_blobs.empty()) {
+    CHECK_EQ(given_blobs.size(), this->blobs_.size())
+        << "Incorrect number of parameters for " << this->layer_param_.name();
+    for (int i = 0; i < given_blobs.size(); ++i) {
+      CHECK(given_blobs[i]->shape() == this->blobs_[i]->shape())
+          << "Incorrect shape of parameter " << i << " of "
+          << this->layer_param_.name();
+      this->blobs_[i]->ShareData(*given_blobs[i]);
+    }
+    unrolled_net_->ShareWeightData();
+  }
   // Check that param_propagate_down is set for all of the parameters in the
   // unrolled net; set param_propagate_down to true in this layer.
   for (int i = 0; i < unrolled_net_->layers().size(); ++i) {
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// The first element of v, or NULL when all the weights are pruned.
+template <typename T>
+static inline T* FirstOrNull(vector<T>* v) {
+  return v->empty() ? NULL : &(*v)[0];
+}
+
+// Writes the rows x cols row-major matrix a as the cols x rows matrix a_t.
+template <typename Dtype>
+static void Transpose(const int rows, const int cols, const Dtype* a,
+    Dtype* a_t) {
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      a_t[j * rows + i] = a[i * cols + j];
+    }
+  }
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  InnerProductLayer<Dtype>::LayerSetUp(bottom, top);
+  block_ = this->layer_param_.inner_product_param().sparse_block();
+  CHECK_GT(block_, 0) << "sparse_block must be positive.";
+  CHECK_EQ(this->N_ % block_, 0) << "sparse_block must divide num_output.";
+  CHECK_EQ(this->K_ % block_, 0)
+      << "sparse_block must divide the input dimension.";
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  InnerProductLayer<Dtype>::Reshape(bottom, top);
+  // A single row needs no transposing.
+  if (this->M_ > 1) {
+    vector<int> shape(2, this->M_);
+    shape[0] = this->K_;
+    bottom_t_.Reshape(shape);
+    shape[0] = this->N_;
+    top_t_.Reshape(shape);
+  }
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::PruneWeights() {
+  const int K = this->K_;
+  const Dtype threshold =
+      this->layer_param_.inner_product_param().sparse_threshold();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  // Only written to if there are pruned weights to zero, so that weights
+  // already pruned offline stay shared, e.g. with NetWeights.
+  Dtype* mutable_weight = NULL;
+  columns_.clear();
+  row_ptr_.assign(1, 0);
+  for (int r = 0; r < this->N_ / block_; ++r) {
+    for (int c = 0; c < K / block_; ++c) {
+      const int offset = r * block_ * K + c * block_;
+      Dtype max_abs = 0;
+      for (int bi = 0; bi < block_; ++bi) {
+        for (int bj = 0; bj < block_; ++bj) {
+          max_abs = std::max<Dtype>(max_abs,
+              std::fabs(weight[offset + bi * K + bj]));
+        }
+      }
+      if (max_abs > threshold) {
+        columns_.push_back(c);
+      } else if (max_abs > 0) {
+        if (!mutable_weight) {
+          mutable_weight = this->blobs_[0]->mutable_cpu_data();
+        }
+        for (int bi = 0; bi < block_; ++bi) {
+          caffe_set(block_, Dtype(0), mutable_weight + offset + bi * K);
+        }
+      }
+    }
+    row_ptr_.push_back(columns_.size());
+  }
+  values_.resize(columns_.size() * block_ * block_);
+  values_diff_.resize(values_.size());
+  GatherWeights();
+  weights_pruned_ = true;
+  LOG(INFO) << this->layer_param_.name() << " keeps " << 100 * density()
+      << "% of its weights in " << block_ << "x" << block_ << " blocks";
+}
+
+template <typename Dtype>
+Dtype SparseInnerProductLayer<Dtype>::density() const {
+  if (!weights_pruned_) {
+    return 1;
+  }
+  return static_cast<Dtype>(values_.size()) / (this->N_ * this->K_);
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::GatherWeights() {
+  const int K = this->K_;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  for (int r = 0; r < this->N_ / block_; ++r) {
+    for (int i = row_ptr_[r]; i < row_ptr_[r + 1]; ++i) {
+      for (int bi = 0; bi < block_; ++bi) {
+        const Dtype* w = weight + (r * block_ + bi) * K + columns_[i] * block_;
+        std::copy(w, w + block_, values_.begin() + (i * block_ + bi) * block_);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!weights_pruned_) {
+    PruneWeights();
+  } else if (this->phase_ == TRAIN) {
+    GatherWeights();
+  }
+  const int M = this->M_;
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  // top^T = weight * bottom^T, with the sparse weights on the left.
+  if (M == 1) {
+    caffe_cpu_bsrmm<Dtype>(CblasNoTrans, this->N_, 1, this->K_, block_,
+        (Dtype)1., FirstOrNull(&values_), FirstOrNull(&columns_),
+        &row_ptr_[0], bottom_data, (Dtype)0., top_data);
+  } else {
+    Transpose(M, this->K_, bottom_data, bottom_t_.mutable_cpu_data());
+    caffe_cpu_bsrmm<Dtype>(CblasNoTrans, this->N_, M, this->K_, block_,
+        (Dtype)1., FirstOrNull(&values_), FirstOrNull(&columns_),
+        &row_ptr_[0], bottom_t_.cpu_data(), (Dtype)0.,
+        top_t_.mutable_cpu_data());
+    Transpose(this->N_, M, top_t_.cpu_data(), top_data);
+  }
+  if (this->bias_term_) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M, this->N_, 1,
+        (Dtype)1., this->bias_multiplier_.cpu_data(),
+        this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
+  }
+}
+
+template <typename Dtype>
+void SparseInnerProductLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  const int M = this->M_;
+  const int K = this->K_;
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_diff_t = top_diff;
+  if (M > 1) {
+    Transpose(M, this->N_, top_diff, top_t_.mutable_cpu_data());
+    top_diff_t = top_t_.cpu_data();
+  }
+  if (this->param_propagate_down_[0]) {
+    const Dtype* bottom_data_t = bottom[0]->cpu_data();
+    if (M > 1) {
+      Transpose(M, K, bottom_data_t, bottom_t_.mutable_cpu_data());
+      bottom_data_t = bottom_t_.cpu_data();
+    }
+    // Gradient with respect to the kept weights only, added to their
+    // entries of the dense weight diff.
+    caffe_cpu_bsr_sddmm<Dtype>(this->N_, M, K, block_, (Dtype)1., top_diff_t,
+        bottom_data_t, FirstOrNull(&columns_), &row_ptr_[0], (Dtype)0.,
+        FirstOrNull(&values_diff_));
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    for (int r = 0; r < this->N_ / block_; ++r) {
+      for (int i = row_ptr_[r]; i < row_ptr_[r + 1]; ++i) {
+        for (int bi = 0; bi < block_; ++bi) {
+          Dtype* w = weight_diff + (r * block_ + bi) * K + columns_[i] * block_;
+          const Dtype* v = &values_diff_[(i * block_ + bi) * block_];
+          for (int bj = 0; bj < block_; ++bj) {
+            w[bj] += v[bj];
+          }
+        }
+      }
+    }
+  }
+  if (this->bias_term_ && this->param_propagate_down_[1]) {
+    // Gradient with respect to bias
+    caffe_cpu_gemv<Dtype>(CblasTrans, M, this->N_, (Dtype)1., top_diff,
+        this->bias_multiplier_.cpu_data(), (Dtype)1.,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (propagate_down[0]) {
+    // Gradient with respect to bottom data: bottom_diff^T = weight^T * top^T.
+    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+    if (M == 1) {
+      caffe_cpu_bsrmm<Dtype>(CblasTrans, this->N_, 1, K, block_, (Dtype)1.,
+          FirstOrNull(&values_), FirstOrNull(&columns_), &row_ptr_[0],
+          top_diff, (Dtype)0., bottom_diff);
+    } else {
+      caffe_cpu_bsrmm<Dtype>(CblasTrans, this->N_, M, K, block_, (Dtype)1.,
+          FirstOrNull(&values_), FirstOrNull(&columns_), &row_ptr_[0],
+          top_diff_t, (Dtype)0., bottom_t_.mutable_cpu_data());
+      Transpose(K, M, bottom_t_.cpu_data(), bottom_diff);
+    }
+  }
+}
+
+INSTANTIATE_CLASS(SparseInnerProductLayer);
+
+}  // namespace caffe
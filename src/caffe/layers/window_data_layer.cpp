@@ -15,6 +15,7 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -33,6 +34,8 @@ WindowDataLayer<Dtype>::~WindowDataLayer<Dtype>() {
 template <typename Dtype>
 void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  CHECK(!this->layer_param_.transform_param().device_transform())
+      << "device_transform is only supported by the Data layer.";
   // LayerSetUp runs through the window_file and creates two structures
   // that hold windows: one for foreground (object) windows and one
   // for background (non-object) windows. We use an overlap threshold
@@ -61,6 +64,12 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       << this->layer_param_.window_data_param().root_folder();
 
   cache_images_ = this->layer_param_.window_data_param().cache_images();
+  const uint64_t cache_bytes =
+      this->layer_param_.window_data_param().cache_bytes();
+  if (cache_bytes > 0) {
+    LOG(INFO) << "Caching up to " << cache_bytes << " bytes of images";
+    image_cache_ = ImageCache::Shared(cache_bytes);
+  }
   string root_folder = this->layer_param_.window_data_param().root_folder();
 
   const bool prefetch_needs_rand =
@@ -226,6 +235,7 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
+  uint64_t bytes_read = 0;
   CPUTimer timer;
   Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
   Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
@@ -276,18 +286,28 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
           image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
 
       cv::Mat cv_img;
-      if (this->cache_images_) {
-        pair<std::string, Datum> image_cached =
-          image_database_cache_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
-        cv_img = DecodeDatumToCVMat(image_cached.second, true);
-      } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-        if (!cv_img.data) {
-          LOG(ERROR) << "Could not open or find file " << image.first;
-          return;
+      string key;
+      if (image_cache_) {
+        key = ImageCache::Key(image.first, 0, 0, true);
+      }
+      if (!image_cache_ || !image_cache_->Lookup(key, &cv_img)) {
+        if (this->cache_images_) {
+          pair<std::string, Datum> image_cached =
+            image_database_cache_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
+          cv_img = DecodeDatumToCVMat(image_cached.second, true);
+        } else {
+          cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
+          if (!cv_img.data) {
+            LOG(ERROR) << "Could not open or find file " << image.first;
+            return;
+          }
+        }
+        if (image_cache_) {
+          image_cache_->Insert(key, cv_img);
         }
       }
       read_time += timer.MicroSeconds();
+      bytes_read += cv_img.total() * cv_img.elemSize();
       timer.Start();
       const int channels = cv_img.channels();
 
@@ -385,9 +405,12 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
       cv::resize(cv_cropped_img, cv_cropped_img,
           cv_crop_size, 0, 0, cv::INTER_LINEAR);
 
-      // horizontal flip at random
+      // horizontal flip at random, out of place since the crop may still
+      // share its pixels with a cached image
       if (do_mirror) {
-        cv::flip(cv_cropped_img, cv_cropped_img, 1);
+        cv::Mat cv_flipped_img;
+        cv::flip(cv_cropped_img, cv_flipped_img, 1);
+        cv_cropped_img = cv_flipped_img;
       }
 
       // copy the warped window into top_data
@@ -458,6 +481,10 @@ void WindowDataLayer<Dtype>::InternalThreadEntry() {
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  // Images are decoded as they are read, so the read time includes it.
+  this->batch_stats_.read_ms = read_time / 1000;
+  this->batch_stats_.transform_ms = trans_time / 1000;
+  this->batch_stats_.bytes_read = bytes_read;
 }
 
 INSTANTIATE_CLASS(WindowDataLayer);
@@ -9,9 +9,11 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/sequence_layers.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/raw_weights.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -31,6 +33,12 @@ Net<Dtype>::Net(const string& param_file, Phase phase) {
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::Net(const shared_ptr<const NetWeights<Dtype> >& weights)
+    : shared_weights_(weights) {
+  Init(weights->param());
+}
+
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
   // Set phase from the state.
@@ -109,9 +117,24 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
         AppendTop(param, layer_id, num_top, NULL, NULL);
       }
     }
+    // An execution context gives the layer the shared weights, so that it
+    // skips allocating and filling its own.
+    if (shared_weights_) {
+      layer->blobs() = shared_weights_->layer_blobs(layer_param.name());
+    }
     // After this layer is connected, set it up.
     LOG(INFO) << "Setting up " << layer_names_[layer_id];
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    if (shared_weights_) {
+      const vector<shared_ptr<Blob<Dtype> > >& weights =
+          shared_weights_->layer_blobs(layer_param.name());
+      CHECK_EQ(weights.size(), layer->blobs().size())
+          << "Layer " << layer_param.name() << " replaced the shared weights";
+      for (int i = 0; i < weights.size(); ++i) {
+        CHECK(layer->blobs()[i]->data() == weights[i]->data())
+            << "Layer " << layer_param.name() << " replaced the shared weights";
+      }
+    }
     for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
       if (blob_loss_weights_.size() <= top_id_vecs_[layer_id][top_id]) {
         blob_loss_weights_.resize(top_id_vecs_[layer_id][top_id] + 1, Dtype(0));
@@ -213,7 +236,18 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   GetLearningRateAndWeightDecay();
-  ShareWeightData();
+  fp16_storage_ = param.fp16_storage();
+  half_ready_ = false;
+  CHECK(!fp16_storage_ || !param.flat_params())
+      << "fp16_storage keeps no Dtype parameters to flatten.";
+  // The shared weights are left as the NetWeights set them up, as other
+  // contexts may be reading them.
+  if (!shared_weights_) {
+    if (param.flat_params()) {
+      FlattenParams();
+    }
+    ShareWeightData();
+  }
   debug_info_ = param.debug_info();
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
@@ -467,11 +501,20 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       InputDebugInfo(i);
     }
   }
+  if (fp16_storage_ && !half_ready_) {
+    SetUpHalfStorage();
+  }
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    const int64_t start_us = profiler_ ? Profiler::Now() : 0;
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    if (fp16_storage_) { ExpandHalfBlobs(i); }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    if (fp16_storage_) { CompressHalfBlobs(i); }
     loss += layer_loss;
+    if (profiler_) {
+      profiler_->Record(layer_profile_ids_[i], Profiler::FORWARD, start_us);
+    }
     if (debug_info_) { ForwardDebugInfo(i); }
   }
   return loss;
@@ -528,19 +571,46 @@ string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
   return output;
 }
 
+template <typename Dtype>
+void Net<Dtype>::CheckBackwardAllowed() const {
+  // The blobs of an fp16_storage net point into a half scratch arena shared
+  // across the layers, which holds no diffs.
+  CHECK(!fp16_storage_) << "fp16_storage nets only run forward.";
+  // The contexts of a NetWeights share the parameter diffs too, so their
+  // backward passes would race on them.
+  CHECK(!shared_weights_) << "Nets built from NetWeights only run forward.";
+}
+
 template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  CheckBackwardAllowed();
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      const int64_t start_us = profiler_ ? Profiler::Now() : 0;
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      if (profiler_) {
+        profiler_->Record(layer_profile_ids_[i], Profiler::BACKWARD,
+                          start_us);
+      }
       if (debug_info_) { BackwardDebugInfo(i); }
     }
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::set_profiler(const shared_ptr<Profiler>& profiler) {
+  profiler_ = profiler;
+  layer_profile_ids_.clear();
+  if (profiler_) {
+    for (int i = 0; i < layer_names_.size(); ++i) {
+      layer_profile_ids_.push_back(profiler_->RegisterName(layer_names_[i]));
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::InputDebugInfo(const int input_id) {
   const Blob<Dtype>& blob = *net_input_blobs_[input_id];
@@ -620,6 +690,8 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  CHECK(!half_ready_)
+      << "The weights of an fp16_storage net are loaded before its Forward.";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -659,21 +731,50 @@ void Net<Dtype>::BackwardTo(int end) {
 template <typename Dtype>
 void Net<Dtype>::Backward() {
   BackwardFromTo(layers_.size() - 1, 0);
-  if (debug_info_) {
-    Dtype asum_data = 0, asum_diff = 0, sumsq_data = 0, sumsq_diff = 0;
-    for (int i = 0; i < params_.size(); ++i) {
-      if (param_owners_[i] >= 0) { continue; }
-      asum_data += params_[i]->asum_data();
-      asum_diff += params_[i]->asum_diff();
-      sumsq_data += params_[i]->sumsq_data();
-      sumsq_diff += params_[i]->sumsq_diff();
+  if (debug_info_) { BackwardParamsDebugInfo(); }
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::BackwardWithSumsqDiff() {
+  CheckBackwardAllowed();
+  Dtype sumsq_diff = 0;
+  for (int i = layers_.size() - 1; i >= 0; --i) {
+    if (layer_need_backward_[i]) {
+      const int64_t start_us = profiler_ ? Profiler::Now() : 0;
+      layers_[i]->Backward(
+          top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      if (profiler_) {
+        profiler_->Record(layer_profile_ids_[i], Profiler::BACKWARD,
+                          start_us);
+      }
+      if (debug_info_) { BackwardDebugInfo(i); }
+    }
+    for (int j = 0; j < param_id_vecs_[i].size(); ++j) {
+      const int param_id = param_id_vecs_[i][j];
+      if (param_owners_[param_id] < 0) {
+        sumsq_diff += params_[param_id]->sumsq_diff();
+      }
     }
-    const Dtype l2norm_data = std::sqrt(sumsq_data);
-    const Dtype l2norm_diff = std::sqrt(sumsq_diff);
-    LOG(ERROR) << "    [Backward] All net params (data, diff): "
-        << "L1 norm = (" << asum_data << ", " << asum_diff << "); "
-        << "L2 norm = (" << l2norm_data << ", " << l2norm_diff << ")";
   }
+  if (debug_info_) { BackwardParamsDebugInfo(); }
+  return sumsq_diff;
+}
+
+template <typename Dtype>
+void Net<Dtype>::BackwardParamsDebugInfo() {
+  Dtype asum_data = 0, asum_diff = 0, sumsq_data = 0, sumsq_diff = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] >= 0) { continue; }
+    asum_data += params_[i]->asum_data();
+    asum_diff += params_[i]->asum_diff();
+    sumsq_data += params_[i]->sumsq_data();
+    sumsq_diff += params_[i]->sumsq_diff();
+  }
+  const Dtype l2norm_data = std::sqrt(sumsq_data);
+  const Dtype l2norm_diff = std::sqrt(sumsq_diff);
+  LOG(ERROR) << "    [Backward] All net params (data, diff): "
+      << "L1 norm = (" << asum_data << ", " << asum_diff << "); "
+      << "L2 norm = (" << l2norm_data << ", " << l2norm_diff << ")";
 }
 
 template <typename Dtype>
@@ -685,6 +786,8 @@ void Net<Dtype>::Reshape() {
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+  CHECK(!half_ready_)
+      << "The weights of an fp16_storage net are loaded before its Forward.";
   int num_source_layers = param.layer_size();
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
@@ -712,11 +815,80 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
+  if (IsRawWeightsFile(trained_filename)) {
+    CopyTrainedLayersFromRaw(trained_filename);
+    return;
+  }
   NetParameter param;
   ReadNetParamsFromBinaryFileOrDie(trained_filename, &param);
   CopyTrainedLayersFrom(param);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFromRaw(const string& trained_filename) {
+  CHECK(!half_ready_)
+      << "The weights of an fp16_storage net are loaded before its Forward.";
+  shared_ptr<RawWeights> weights(new RawWeights(trained_filename));
+  const RawWeightsHeader& header = weights->header();
+  // Views into the flat arenas cannot be repointed, and doubles need a
+  // conversion.
+  const bool share = (sizeof(Dtype) == sizeof(float)) && !flat_params_;
+  int num_shared = 0;
+  int i = 0;
+  while (i < header.blob_size()) {
+    // The blobs of a layer are consecutive.
+    const string& source_layer_name = header.blob(i).layer();
+    int num_source_blobs = 0;
+    while (i + num_source_blobs < header.blob_size() &&
+        header.blob(i + num_source_blobs).layer() == source_layer_name) {
+      ++num_source_blobs;
+    }
+    int target_layer_id = 0;
+    while (target_layer_id != layer_names_.size() &&
+        layer_names_[target_layer_id] != source_layer_name) {
+      ++target_layer_id;
+    }
+    if (target_layer_id == layer_names_.size()) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      i += num_source_blobs;
+      continue;
+    }
+    DLOG(INFO) << "Loading source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), num_source_blobs)
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j, ++i) {
+      const RawWeightsBlob& source_blob = header.blob(i);
+      BlobProto source_shape;
+      if (source_blob.legacy_shape()) {
+        source_shape.set_num(source_blob.shape().dim(0));
+        source_shape.set_channels(source_blob.shape().dim(1));
+        source_shape.set_height(source_blob.shape().dim(2));
+        source_shape.set_width(source_blob.shape().dim(3));
+      } else {
+        source_shape.mutable_shape()->CopyFrom(source_blob.shape());
+      }
+      CHECK(target_blobs[j]->ShapeEquals(source_shape))
+          << "Shape mismatch for blob " << j << " of " << source_layer_name;
+      if (share) {
+        target_blobs[j]->set_cpu_data(
+            reinterpret_cast<Dtype*>(weights->data(i)));
+        ++num_shared;
+      } else {
+        const float* source_data = weights->data(i);
+        Dtype* target_data = target_blobs[j]->mutable_cpu_data();
+        for (int k = 0; k < target_blobs[j]->count(); ++k) {
+          target_data[k] = source_data[k];
+        }
+      }
+    }
+  }
+  if (num_shared > 0) {
+    raw_weights_.push_back(weights);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -735,16 +907,318 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
       layer_param->add_top(blob_names_[top_id_vecs_[i][j]]);
     }
     layers_[i]->ToProto(layer_param, write_diff);
+    if (half_ready_) { HalfParamsToProto(i, layer_param, write_diff); }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::HalfParamsToProto(const int layer_id,
+    LayerParameter* param, bool write_diff) const {
+  // The parameter blobs point into the scratch arena, which later layers
+  // have overwritten; their values are expanded from the halves instead.
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[layer_id]->blobs();
+  const vector<int>& inputs = layer_half_inputs_[layer_id];
+  for (int i = 0; i < blobs.size(); ++i) {
+    for (int j = 0; j < inputs.size(); ++j) {
+      const HalfGroup& group = half_groups_[inputs[j]];
+      if (std::find(group.blobs.begin(), group.blobs.end(), blobs[i].get()) ==
+          group.blobs.end()) {
+        continue;
+      }
+      Blob<Dtype> expanded(blobs[i]->shape());
+      caffe_cpu_half2float(expanded.count(),
+          static_cast<const uint16_t*>(group.half->cpu_data()),
+          expanded.mutable_cpu_data());
+      if (write_diff) { expanded.ShareDiff(*blobs[i]); }
+      expanded.ToProto(param->mutable_blobs(i), write_diff);
+      break;
+    }
   }
 }
 
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  CHECK(!shared_weights_) << "The weights of a NetWeights are read-only.";
   // Update only the owned parameters.
   for (int i = 0; i < params_.size(); ++i) {
     if (param_owners_[i] >= 0) { continue; }
     if (debug_info_) { UpdateDebugInfo(i); }
-    params_[i]->Update();
+    if (!flat_params_) { params_[i]->Update(); }
+  }
+  // The owned parameters are all in the arenas, whose padding stays zero.
+  if (flat_params_) { flat_params_->Update(); }
+}
+
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  // Align every parameter to kAlignment bytes within the arenas.
+  const int kAlignment = 64;
+  const int align = std::max<int>(1, kAlignment / sizeof(Dtype));
+  param_flat_offsets_.assign(params_.size(), -1);
+  int total = 0;
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] >= 0) { continue; }
+    param_flat_offsets_[i] = total;
+    total += (params_[i]->count() + align - 1) / align * align;
+  }
+  if (total == 0) { return; }
+  flat_params_.reset(new Blob<Dtype>(vector<int>(1, total)));
+  Dtype* flat_data = flat_params_->mutable_cpu_data();
+  Dtype* flat_diff = flat_params_->mutable_cpu_diff();
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] >= 0) { continue; }
+    const int count = params_[i]->count();
+    const int offset = param_flat_offsets_[i];
+    caffe_copy(count, params_[i]->cpu_data(), flat_data + offset);
+    caffe_copy(count, params_[i]->cpu_diff(), flat_diff + offset);
+    params_[i]->set_data(shared_ptr<SyncedMemory>(new SyncedMemory(
+        flat_params_->data(), offset * sizeof(Dtype), count * sizeof(Dtype))));
+    params_[i]->set_diff(shared_ptr<SyncedMemory>(new SyncedMemory(
+        flat_params_->diff(), offset * sizeof(Dtype), count * sizeof(Dtype))));
+  }
+  LOG(INFO) << "Flattened " << total << " parameter values into arenas of "
+      << total * sizeof(Dtype) << " bytes.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpHalfStorage() {
+  // Left in Dtype are the inputs and outputs of the net, the tops of the
+  // layers without bottoms, data layers which may point them at memory of
+  // their own, and the parameters of shared weights, which other contexts
+  // read. So is everything sharing memory with them.
+  set<const SyncedMemory*> excluded;
+  for (int i = 0; i < net_input_blobs_.size(); ++i) {
+    excluded.insert(net_input_blobs_[i]->data().get());
+  }
+  for (int i = 0; i < net_output_blobs_.size(); ++i) {
+    excluded.insert(net_output_blobs_[i]->data().get());
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    for (int j = 0; bottom_vecs_[i].empty() && j < top_vecs_[i].size(); ++j) {
+      excluded.insert(top_vecs_[i][j]->data().get());
+    }
+  }
+  // Recurrent layers run an unrolled net of their own, whose blobs share the
+  // memory of the layer's bottoms, tops and parameters when it is reshaped;
+  // pointing those at the arena would leave the unrolled net on stale
+  // memory, so they all stay in Dtype.
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (!dynamic_cast<RecurrentLayer<Dtype>*>(layers_[i].get())) { continue; }
+    LOG(INFO) << "fp16_storage leaves recurrent layer " << layer_names_[i]
+        << " and its blobs in full precision.";
+    vector<Blob<Dtype>*> blobs(bottom_vecs_[i]);
+    blobs.insert(blobs.end(), top_vecs_[i].begin(), top_vecs_[i].end());
+    for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
+      blobs.push_back(layers_[i]->blobs()[j].get());
+    }
+    for (int j = 0; j < blobs.size(); ++j) {
+      excluded.insert(blobs[j]->data().get());
+    }
+  }
+  // Blobs aliasing each other, in place or through ShareData as Split and
+  // Flatten do, form one group with a single half copy.
+  map<const SyncedMemory*, int> memory_group;
+  map<const Blob<Dtype>*, int> blob_group;
+  vector<Blob<Dtype>*> candidates;
+  for (int i = 0; i < blobs_.size(); ++i) {
+    candidates.push_back(blobs_[i].get());
+  }
+  for (int i = 0; !shared_weights_ && i < layers_.size(); ++i) {
+    for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
+      candidates.push_back(layers_[i]->blobs()[j].get());
+    }
+  }
+  half_groups_.clear();
+  for (int i = 0; i < candidates.size(); ++i) {
+    const SyncedMemory* memory = candidates[i]->data().get();
+    if (!memory || excluded.count(memory) || blob_group.count(candidates[i])) {
+      continue;
+    }
+    if (!memory_group.count(memory)) {
+      memory_group[memory] = half_groups_.size();
+      half_groups_.push_back(HalfGroup());
+      half_groups_.back().count = 0;
+    }
+    HalfGroup& group = half_groups_[memory_group[memory]];
+    group.blobs.push_back(candidates[i]);
+    group.count = std::max(group.count, candidates[i]->count());
+    blob_group[candidates[i]] = memory_group[memory];
+  }
+  // Compress whatever the blobs hold now, so that a first forward pass
+  // starting past the data layers finds its bottoms.
+  size_t num_values = 0;
+  for (int i = 0; i < half_groups_.size(); ++i) {
+    HalfGroup& group = half_groups_[i];
+    group.half.reset(new SyncedMemory(group.count * sizeof(uint16_t)));
+    caffe_cpu_float2half(group.count,
+        static_cast<const Dtype*>(group.blobs[0]->data()->cpu_data()),
+        static_cast<uint16_t*>(group.half->mutable_cpu_data()));
+    num_values += group.count;
+  }
+  layer_half_inputs_.assign(layers_.size(), vector<int>());
+  layer_half_outputs_.assign(layers_.size(), vector<int>());
+  for (int i = 0; i < layers_.size(); ++i) {
+    vector<Blob<Dtype>*> inputs(bottom_vecs_[i]);
+    for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
+      inputs.push_back(layers_[i]->blobs()[j].get());
+    }
+    for (int j = 0; j < inputs.size(); ++j) {
+      if (!blob_group.count(inputs[j])) { continue; }
+      const int group_id = blob_group[inputs[j]];
+      vector<int>& groups = layer_half_inputs_[i];
+      if (std::find(groups.begin(), groups.end(), group_id) == groups.end()) {
+        groups.push_back(group_id);
+      }
+    }
+    for (int j = 0; j < top_vecs_[i].size(); ++j) {
+      if (!blob_group.count(top_vecs_[i][j])) { continue; }
+      const int group_id = blob_group[top_vecs_[i][j]];
+      vector<int>& groups = layer_half_outputs_[i];
+      if (std::find(groups.begin(), groups.end(), group_id) == groups.end()) {
+        groups.push_back(group_id);
+      }
+    }
+  }
+  half_arena_.reset();
+  half_ready_ = true;
+  LOG(INFO) << "Compressed " << num_values << " values into halves: "
+      << num_values * sizeof(uint16_t) << " bytes instead of "
+      << num_values * sizeof(Dtype) << ".";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ExpandHalfBlobs(const int layer_id) {
+  const vector<int>& inputs = layer_half_inputs_[layer_id];
+  vector<int> groups(inputs);
+  for (int i = 0; i < layer_half_outputs_[layer_id].size(); ++i) {
+    const int group_id = layer_half_outputs_[layer_id][i];
+    if (std::find(inputs.begin(), inputs.end(), group_id) == inputs.end()) {
+      groups.push_back(group_id);
+    }
+  }
+  if (groups.empty()) { return; }
+  // The layer may have reshaped its tops; a group that changed size loses
+  // its values, which only its producer should be about to write.
+  const int align = std::max<int>(1, 64 / sizeof(Dtype));
+  size_t total = 0;
+  for (int i = 0; i < groups.size(); ++i) {
+    HalfGroup& group = half_groups_[groups[i]];
+    int count = 0;
+    for (int j = 0; j < group.blobs.size(); ++j) {
+      count = std::max(count, group.blobs[j]->count());
+    }
+    if (count != group.count) {
+      group.count = count;
+      group.half.reset(new SyncedMemory(count * sizeof(uint16_t)));
+    }
+    total += (count + align - 1) / align * align;
+  }
+  if (!half_arena_ || half_arena_->size() < total * sizeof(Dtype)) {
+    half_arena_.reset(new SyncedMemory(total * sizeof(Dtype)));
+  }
+  size_t offset = 0;
+  for (int i = 0; i < groups.size(); ++i) {
+    HalfGroup& group = half_groups_[groups[i]];
+    shared_ptr<SyncedMemory> view(new SyncedMemory(half_arena_,
+        offset * sizeof(Dtype), group.count * sizeof(Dtype)));
+    offset += (group.count + align - 1) / align * align;
+    for (int j = 0; j < group.blobs.size(); ++j) {
+      group.blobs[j]->set_data(view);
+    }
+    if (i >= inputs.size()) { continue; }
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_cpu_half2float(group.count,
+          static_cast<const uint16_t*>(group.half->cpu_data()),
+          static_cast<Dtype*>(view->mutable_cpu_data()));
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_half2float(group.count,
+          static_cast<const uint16_t*>(group.half->gpu_data()),
+          static_cast<Dtype*>(view->mutable_gpu_data()));
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode.";
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::MergeHalfGroups(const int from, const int into) {
+  HalfGroup& source = half_groups_[from];
+  HalfGroup& target = half_groups_[into];
+  target.blobs.insert(target.blobs.end(), source.blobs.begin(),
+                      source.blobs.end());
+  target.count = std::max(target.count, source.count);
+  source.blobs.clear();
+  source.half.reset();
+  source.count = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    vector<int>* lists[] = {&layer_half_inputs_[i], &layer_half_outputs_[i]};
+    for (int j = 0; j < 2; ++j) {
+      vector<int>& groups = *lists[j];
+      vector<int>::iterator it = std::find(groups.begin(), groups.end(), from);
+      if (it == groups.end()) { continue; }
+      if (std::find(groups.begin(), groups.end(), into) == groups.end()) {
+        *it = into;
+      } else {
+        groups.erase(it);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::CompressHalfBlobs(const int layer_id) {
+  const vector<int>& inputs = layer_half_inputs_[layer_id];
+  vector<int>& outputs = layer_half_outputs_[layer_id];
+  // A top the layer pointed at a bottom in its Forward, as Split does, joins
+  // the bottom's group for good rather than holding a copy of it.
+  for (int i = 0; i < outputs.size(); ++i) {
+    const SyncedMemory* memory =
+        half_groups_[outputs[i]].blobs[0]->data().get();
+    for (int j = 0; j < inputs.size(); ++j) {
+      const int input = inputs[j];
+      if (input == outputs[i] ||
+          half_groups_[input].blobs[0]->data().get() != memory) {
+        continue;
+      }
+      const bool written =
+          std::find(outputs.begin(), outputs.end(), input) != outputs.end();
+      MergeHalfGroups(outputs[i], input);
+      if (!written) {
+        outputs.erase(std::remove(outputs.begin(), outputs.end(), input),
+                      outputs.end());
+      }
+      i = -1;  // Scan the changed outputs again.
+      break;
+    }
+  }
+  for (int i = 0; i < outputs.size(); ++i) {
+    HalfGroup& group = half_groups_[outputs[i]];
+    const shared_ptr<SyncedMemory>& data = group.blobs[0]->data();
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_cpu_float2half(group.count,
+          static_cast<const Dtype*>(data->cpu_data()),
+          static_cast<uint16_t*>(group.half->mutable_cpu_data()));
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_float2half(group.count,
+          static_cast<const Dtype*>(data->gpu_data()),
+          static_cast<uint16_t*>(group.half->mutable_gpu_data()));
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode.";
+    }
   }
 }
 
@@ -795,4 +1269,57 @@ const shared_ptr<Layer<Dtype> > Net<Dtype>::layer_by_name(
 
 INSTANTIATE_CLASS(Net);
 
+template <typename Dtype>
+NetWeights<Dtype>::NetWeights(const NetParameter& param,
+    const string& trained_filename)
+    : param_(param) {
+  Init(trained_filename);
+}
+
+template <typename Dtype>
+NetWeights<Dtype>::NetWeights(const string& param_file,
+    const string& trained_filename) {
+  ReadNetParamsFromTextFileOrDie(param_file, &param_);
+  param_.mutable_state()->set_phase(TEST);
+  Init(trained_filename);
+}
+
+template <typename Dtype>
+void NetWeights<Dtype>::Init(const string& trained_filename) {
+  net_.reset(new Net<Dtype>(param_));
+  net_->CopyTrainedLayersFrom(trained_filename);
+  // Synchronize the weights now, so that the contexts reading them
+  // concurrently never copy them.
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    params[i]->cpu_data();
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      params[i]->gpu_data();
+    }
+#endif
+  }
+}
+
+template <typename Dtype>
+const vector<shared_ptr<Blob<Dtype> > >& NetWeights<Dtype>::layer_blobs(
+    const string& layer_name) const {
+  const shared_ptr<Layer<Dtype> > layer = net_->layer_by_name(layer_name);
+  CHECK(layer) << "Unknown layer " << layer_name;
+  return layer->blobs();
+}
+
+template <typename Dtype>
+size_t NetWeights<Dtype>::memory_bytes() const {
+  size_t bytes = 0;
+  for (int i = 0; i < net_->params().size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      bytes += net_->params()[i]->count() * sizeof(Dtype);
+    }
+  }
+  return bytes;
+}
+
+INSTANTIATE_CLASS(NetWeights);
+
 }  // namespace caffe
@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/parallel.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+static const uint32_t kReady = 0x43534852;  // "CSHR"
+static const size_t kAlignment = 64;
+
+// The start of the segment, followed by the buffers of the ranks.
+struct ShmHeader {
+  volatile uint32_t ready;
+  int32_t num_ranks;
+  uint64_t count;
+  uint32_t dtype_size;
+  // The state of the barrier, zeroed by ftruncate.
+  volatile int32_t arrived;
+  volatile int32_t sense;
+  // The run the segment belongs to: the process id and start time of the
+  // rank 0 that created it.
+  int32_t pid;
+  uint64_t start_time;
+};
+
+static size_t AlignUp(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// The start time of process pid in clock ticks since boot, from
+// /proc/<pid>/stat, or 0 if there is no such process.
+static uint64_t ProcessStartTime(pid_t pid) {
+  std::ostringstream path;
+  path << "/proc/" << pid << "/stat";
+  std::ifstream file(path.str().c_str());
+  string stat;
+  if (!std::getline(file, stat)) {
+    return 0;
+  }
+  // The command name may contain anything but ends with the last ')'; the
+  // start time is the 20th field after it.
+  const size_t end = stat.rfind(')');
+  if (end == string::npos) {
+    return 0;
+  }
+  std::istringstream fields(stat.substr(end + 1));
+  string field;
+  for (int i = 0; i < 19; ++i) {
+    fields >> field;
+  }
+  uint64_t start_time = 0;
+  fields >> start_time;
+  return start_time;
+}
+
+static double MonotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Marks a segment left behind by an earlier run as not ready and unlinks it,
+// so that a rank which opened it before it was unlinked stops waiting on it.
+static void RemoveSegment(const string& name) {
+  const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd == -1) {
+    return;
+  }
+  struct stat fd_stat;
+  if (fstat(fd, &fd_stat) == 0 && fd_stat.st_size >= sizeof(ShmHeader)) {
+    void* map = mmap(NULL, sizeof(ShmHeader), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      static_cast<ShmHeader*>(map)->ready = 0;
+      __sync_synchronize();
+      munmap(map, sizeof(ShmHeader));
+    }
+  }
+  close(fd);
+  shm_unlink(name.c_str());
+}
+
+template <typename Dtype>
+ShmAllReduce<Dtype>::ShmAllReduce(shared_ptr<Solver<Dtype> > solver,
+    const string& name, int rank, int num_ranks, int timeout_seconds)
+    : solver_(solver), name_(name), rank_(rank), num_ranks_(num_ranks),
+      timeout_seconds_(timeout_seconds), count_(0), map_(NULL), map_size_(0),
+      sense_(0) {
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, num_ranks);
+  CHECK_GT(timeout_seconds, 0);
+  CHECK_EQ(name[0], '/') << "Shared memory names must start with '/'";
+  CHECK_LE(sizeof(ShmHeader), kAlignment);
+  const shared_ptr<Net<Dtype> >& net = solver->net();
+  for (int i = 0; i < net->params().size(); ++i) {
+    if (net->param_owners()[i] < 0) {
+      params_.push_back(net->params()[i].get());
+      count_ += net->params()[i]->count();
+    }
+  }
+  chunk_size_ = (count_ + num_ranks - 1) / num_ranks;
+  stride_ = AlignUp(count_ * sizeof(Dtype), kAlignment) / sizeof(Dtype);
+  map_size_ = kAlignment + num_ranks * stride_ * sizeof(Dtype);
+  Attach();
+  // Start from the parameters of rank 0, staged in its buffer by Attach.
+  if (rank_ > 0) {
+    const Dtype* data = buffer(0);
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_copy(params_[i]->count(), data, params_[i]->mutable_cpu_data());
+      data += params_[i]->count();
+    }
+  }
+  Barrier("attach");
+  if (rank_ == 0) {
+    // All the ranks have mapped the segment; no other may attach to it.
+    static_cast<ShmHeader*>(map_)->ready = 0;
+    __sync_synchronize();
+    shm_unlink(name_.c_str());
+  }
+  solver->add_callback(this);
+  LOG(INFO) << "Rank " << rank_ << " of " << num_ranks_ << " attached to "
+      << name_;
+}
+
+template <typename Dtype>
+ShmAllReduce<Dtype>::~ShmAllReduce() {
+  munmap(map_, map_size_);
+}
+
+template <typename Dtype>
+void ShmAllReduce<Dtype>::Attach() {
+  if (rank_ == 0) {
+    RemoveSegment(name_);
+    const int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    CHECK_NE(fd, -1) << "Failed to create shared memory " << name_;
+    CHECK_EQ(ftruncate(fd, map_size_), 0) << "Failed to size " << name_;
+    map_ = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(map_ != MAP_FAILED) << "Failed to map " << name_;
+    ShmHeader* header = static_cast<ShmHeader*>(map_);
+    header->num_ranks = num_ranks_;
+    header->count = count_;
+    header->dtype_size = sizeof(Dtype);
+    header->pid = getpid();
+    header->start_time = ProcessStartTime(getpid());
+    Dtype* data = buffer(0);
+    for (int i = 0; i < params_.size(); ++i) {
+      caffe_copy(params_[i]->count(), params_[i]->cpu_data(), data);
+      data += params_[i]->count();
+    }
+    __sync_synchronize();
+    header->ready = kReady;
+    return;
+  }
+  // Wait until rank 0 of this run has created and filled the segment. A
+  // segment whose rank 0 is no longer running is left over from a crashed
+  // run, and is skipped until rank 0 replaces it.
+  const double deadline = MonotonicSeconds() + timeout_seconds_;
+  while (true) {
+    const int fd = shm_open(name_.c_str(), O_RDWR, 0600);
+    struct stat fd_stat;
+    if (fd != -1 && fstat(fd, &fd_stat) == 0 && fd_stat.st_size >= map_size_) {
+      map_ = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      CHECK(map_ != MAP_FAILED) << "Failed to map " << name_;
+      const ShmHeader* header = static_cast<ShmHeader*>(map_);
+      if (header->ready == kReady) {
+        __sync_synchronize();
+        if (header->start_time == ProcessStartTime(header->pid)) {
+          close(fd);
+          break;
+        }
+      }
+      munmap(map_, map_size_);
+      map_ = NULL;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+    if (MonotonicSeconds() > deadline) {
+      LOG(FATAL) << "Rank " << rank_ << " timed out after " << timeout_seconds_
+          << " s waiting for rank 0 to create " << name_;
+    }
+    usleep(1000);
+  }
+  const ShmHeader* header = static_cast<ShmHeader*>(map_);
+  CHECK_EQ(header->num_ranks, num_ranks_) << "Inconsistent number of ranks";
+  CHECK_EQ(header->count, count_) << "Inconsistent nets across the ranks";
+  CHECK_EQ(header->dtype_size, sizeof(Dtype)) << "Inconsistent Dtypes";
+}
+
+template <typename Dtype>
+Dtype* ShmAllReduce<Dtype>::buffer(int rank) const {
+  return reinterpret_cast<Dtype*>(static_cast<char*>(map_) + kAlignment) +
+      rank * stride_;
+}
+
+template <typename Dtype>
+void ShmAllReduce<Dtype>::Barrier(const char* phase) {
+  // A sense reversing barrier: the last rank to arrive resets the count and
+  // releases the others by flipping the sense.
+  ShmHeader* header = static_cast<ShmHeader*>(map_);
+  sense_ = !sense_;
+  if (__sync_add_and_fetch(&header->arrived, 1) == num_ranks_) {
+    header->arrived = 0;
+    __sync_synchronize();
+    header->sense = sense_;
+  } else {
+    const double deadline = MonotonicSeconds() + timeout_seconds_;
+    // The clock is only read every so many yields.
+    for (int spins = 1; header->sense != sense_; ++spins) {
+      sched_yield();
+      if (spins % 1024 == 0 && MonotonicSeconds() > deadline) {
+        LOG(FATAL) << "Rank " << rank_ << " timed out after "
+            << timeout_seconds_ << " s waiting for the other ranks in the "
+            << phase << " barrier of " << name_;
+      }
+    }
+  }
+  __sync_synchronize();
+}
+
+template <typename Dtype>
+void ShmAllReduce<Dtype>::on_gradients_ready() {
+  if (num_ranks_ == 1) {
+    return;
+  }
+  Dtype* own = buffer(rank_);
+  Dtype* data = own;
+  for (int i = 0; i < params_.size(); ++i) {
+    caffe_copy(params_[i]->count(), params_[i]->cpu_diff(), data);
+    data += params_[i]->count();
+  }
+  Barrier("gradients");
+  // Reduce-scatter around the ring: at each step every rank adds a chunk of
+  // its left neighbour's buffer into its own, the chunk the neighbour has
+  // just accumulated. After num_ranks - 1 steps, chunk c is fully reduced in
+  // the buffer of rank c - 1.
+  const Dtype* left = buffer((rank_ + num_ranks_ - 1) % num_ranks_);
+  for (int step = 0; step < num_ranks_ - 1; ++step) {
+    const int chunk = (rank_ + 2 * num_ranks_ - step - 1) % num_ranks_;
+    const size_t begin = std::min(chunk * chunk_size_, count_);
+    const size_t end = std::min(begin + chunk_size_, count_);
+    caffe_axpy<Dtype>(end - begin, Dtype(1), left + begin, own + begin);
+    Barrier("reduce-scatter");
+  }
+  // Gather: every rank reads the reduced chunks directly from their owners.
+  for (int chunk = 0; chunk < num_ranks_; ++chunk) {
+    const int owner = (chunk + num_ranks_ - 1) % num_ranks_;
+    const size_t begin = std::min(chunk * chunk_size_, count_);
+    const size_t end = std::min(begin + chunk_size_, count_);
+    if (owner != rank_) {
+      caffe_copy<Dtype>(end - begin, buffer(owner) + begin, own + begin);
+    }
+  }
+  const Dtype scale = Dtype(1) / num_ranks_;
+  data = own;
+  for (int i = 0; i < params_.size(); ++i) {
+    caffe_cpu_scale(params_[i]->count(), scale, data,
+        params_[i]->mutable_cpu_diff());
+    data += params_[i]->count();
+  }
+  // No rank may overwrite its buffer before all the others have read it.
+  Barrier("gather");
+}
+
+INSTANTIATE_CLASS(ShmAllReduce);
+
+}  // namespace caffe
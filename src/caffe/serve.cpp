@@ -0,0 +1,436 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/serve.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/profiler.hpp"
+
+namespace caffe {
+
+// Larger frames close the connection rather than being read.
+static const uint32_t kServeMaxPayload = 1 << 28;
+// The latencies of this many of the last requests make up the statistics.
+static const int kServeLatencyWindow = 10000;
+
+static bool ReadFully(const int fd, char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool WriteFully(const int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// A client: a connected Unix socket, or a pair of file descriptors such as
+// stdin and stdout.
+class ServeConnection {
+ public:
+  ServeConnection(const int in_fd, const int out_fd, const bool owns_fds)
+      : in_fd_(in_fd), out_fd_(out_fd), owns_fds_(owns_fds), broken_(false) {}
+  ~ServeConnection() {
+    if (owns_fds_) {
+      close(in_fd_);
+      if (out_fd_ != in_fd_) {
+        close(out_fd_);
+      }
+    }
+  }
+
+  // Returns false at the end of the input or on a malformed frame.
+  bool ReadFrame(uint32_t* type, string* payload) {
+    uint32_t header[2];
+    if (!ReadFully(in_fd_, reinterpret_cast<char*>(header), sizeof(header))) {
+      return false;
+    }
+    if (header[1] > kServeMaxPayload) {
+      LOG(ERROR) << "Closing a connection sending a " << header[1]
+          << " byte frame";
+      return false;
+    }
+    *type = header[0];
+    payload->resize(header[1]);
+    return header[1] == 0 || ReadFully(in_fd_, &(*payload)[0], header[1]);
+  }
+
+  // Called by the inference and the reading threads. Once a write fails, the
+  // client is gone and the rest are dropped.
+  void WriteFrame(const uint32_t type, const string& payload) {
+    boost::mutex::scoped_lock lock(write_mutex_);
+    const uint32_t header[2] = { type, static_cast<uint32_t>(payload.size()) };
+    broken_ = broken_ ||
+        !WriteFully(out_fd_, reinterpret_cast<const char*>(header),
+            sizeof(header)) ||
+        !WriteFully(out_fd_, payload.data(), payload.size());
+  }
+
+ private:
+  const int in_fd_;
+  const int out_fd_;
+  const bool owns_fds_;
+  boost::mutex write_mutex_;
+  bool broken_;
+};
+
+struct ServeRequest {
+  shared_ptr<ServeConnection> connection;
+  uint32_t type;
+  string payload;
+  // Set instead of running the request if it is malformed.
+  string error;
+  int64_t arrival_us;
+};
+
+// The requests waiting for the inference thread, in arrival order.
+class ServeQueue {
+ public:
+  ServeQueue() : closed_(false) {}
+
+  void Push(const shared_ptr<ServeRequest>& request) {
+    boost::mutex::scoped_lock lock(mutex_);
+    requests_.push_back(request);
+    condition_.notify_one();
+  }
+
+  // No more requests will come; PopBatch returns false once they are done.
+  void Close() {
+    boost::mutex::scoped_lock lock(mutex_);
+    closed_ = true;
+    condition_.notify_one();
+  }
+
+  // Waits for a request, then until max_size inference requests are queued
+  // or deadline_us have passed since the first arrived, and takes them with
+  // the other requests before them.
+  bool PopBatch(const int max_size, const int64_t deadline_us,
+      vector<shared_ptr<ServeRequest> >* batch) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (requests_.empty() && !closed_) {
+      condition_.wait(lock);
+    }
+    if (requests_.empty()) {
+      return false;
+    }
+    const int64_t deadline = requests_.front()->arrival_us + deadline_us;
+    while (!closed_ && NumInfer(max_size) < max_size) {
+      const int64_t remaining_us = deadline - Profiler::Now();
+      if (remaining_us <= 0) {
+        break;
+      }
+      condition_.timed_wait(lock,
+          boost::posix_time::microseconds(remaining_us));
+    }
+    batch->clear();
+    int num_infer = 0;
+    while (!requests_.empty() && (num_infer < max_size ||
+        requests_.front()->type != kServeInfer)) {
+      num_infer += requests_.front()->type == kServeInfer;
+      batch->push_back(requests_.front());
+      requests_.pop_front();
+    }
+    return true;
+  }
+
+ private:
+  // The number of queued inference requests, counting up to max_size.
+  int NumInfer(const int max_size) const {
+    int num_infer = 0;
+    for (int i = 0; i < requests_.size() && num_infer < max_size; ++i) {
+      num_infer += requests_[i]->type == kServeInfer;
+    }
+    return num_infer;
+  }
+
+  std::deque<shared_ptr<ServeRequest> > requests_;
+  bool closed_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+// What the server has done since it started.
+class ServeStats {
+ public:
+  ServeStats()
+      : start_us_(Profiler::Now()), requests_(0), batches_(0), errors_(0) {}
+
+  void AddBatch(const int batch_size, const double forward_ms) {
+    ++batches_;
+    requests_ += batch_size;
+    AddSample(forward_ms, &forward_ms_);
+  }
+  void AddLatency(const double latency_ms) {
+    AddSample(latency_ms, &latency_ms_);
+  }
+  void AddError() { ++errors_; }
+
+  string Json() const {
+    const double seconds = (Profiler::Now() - start_us_) / 1e6;
+    const TimeStats latency = ComputeTimeStats(
+        vector<double>(latency_ms_.begin(), latency_ms_.end()));
+    const TimeStats forward = ComputeTimeStats(
+        vector<double>(forward_ms_.begin(), forward_ms_.end()));
+    std::ostringstream out;
+    out << "{\"requests\": " << requests_ << ", \"batches\": " << batches_
+        << ", \"errors\": " << errors_ << ", \"mean_batch_size\": "
+        << (batches_ > 0 ? static_cast<double>(requests_) / batches_ : 0)
+        << ", \"requests_per_s\": " << (seconds > 0 ? requests_ / seconds : 0)
+        << ", \"latency\": {";
+    WriteJsonTimes(&out, latency);
+    out << "}, \"forward\": {";
+    WriteJsonTimes(&out, forward);
+    out << "}}";
+    return out.str();
+  }
+
+ private:
+  static void AddSample(const double sample, std::deque<double>* samples) {
+    samples->push_back(sample);
+    if (samples->size() > kServeLatencyWindow) {
+      samples->pop_front();
+    }
+  }
+
+  const int64_t start_us_;
+  int64_t requests_;
+  int64_t batches_;
+  int64_t errors_;
+  std::deque<double> latency_ms_;
+  std::deque<double> forward_ms_;
+};
+
+// Reads the requests of a connection until it ends, then closes the queue if
+// asked to.
+static void ServeConnectionLoop(shared_ptr<ServeConnection> connection,
+    const size_t input_bytes, ServeQueue* queue, const bool close_queue) {
+  while (true) {
+    shared_ptr<ServeRequest> request(new ServeRequest());
+    if (!connection->ReadFrame(&request->type, &request->payload)) {
+      break;
+    }
+    request->connection = connection;
+    request->arrival_us = Profiler::Now();
+    if (request->type == kServeInfer) {
+      if (request->payload.size() != input_bytes) {
+        std::ostringstream error;
+        error << "Expected " << input_bytes << " bytes of input, got "
+            << request->payload.size();
+        request->error = error.str();
+      }
+    } else if (request->type != kServeStats) {
+      request->error = "Unknown request type";
+    }
+    queue->Push(request);
+  }
+  if (close_queue) {
+    queue->Close();
+  }
+}
+
+// Accepts clients on the Unix socket, each read by a thread of its own.
+static void ServeAcceptLoop(const int socket_fd, const size_t input_bytes,
+    ServeQueue* queue) {
+  while (true) {
+    const int client_fd = accept(socket_fd, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno != EINTR) {
+        PLOG(ERROR) << "Failed to accept a connection";
+      }
+      continue;
+    }
+    shared_ptr<ServeConnection> connection(
+        new ServeConnection(client_fd, client_fd, true));
+    boost::thread(boost::bind(&ServeConnectionLoop, connection, input_bytes,
+        queue, false)).detach();
+  }
+}
+
+static int ListenOnUnixSocket(const string& path) {
+  struct sockaddr_un address = sockaddr_un();
+  CHECK_LT(path.size(), sizeof(address.sun_path)) << "Socket path too long: "
+      << path;
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  const int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  PCHECK(socket_fd >= 0) << "Failed to create a socket";
+  unlink(path.c_str());
+  PCHECK(bind(socket_fd, reinterpret_cast<struct sockaddr*>(&address),
+      sizeof(address)) == 0) << "Failed to bind " << path;
+  PCHECK(listen(socket_fd, SOMAXCONN) == 0) << "Failed to listen on " << path;
+  return socket_fd;
+}
+
+Server::Server(Net<float>* net, const int max_batch_size,
+    const double batch_deadline_ms, const int stats_interval)
+    : net_(net), batch_deadline_us_(static_cast<int64_t>(
+        batch_deadline_ms * 1000)), stats_interval_(stats_interval),
+      input_bytes_(0), queue_(new ServeQueue()), stats_(new ServeStats()) {
+  CHECK_GE(max_batch_size, 0);
+  CHECK_GE(batch_deadline_ms, 0);
+  const vector<Blob<float>*>& inputs = net_->input_blobs();
+  CHECK_GT(inputs.size(), 0) << "Need a net with input blobs to serve.";
+  for (int i = 0; i < inputs.size(); ++i) {
+    CHECK_GT(inputs[i]->num_axes(), 0) << "Input "
+        << net_->blob_names()[net_->input_blob_indices()[i]]
+        << " has no batch axis to serve.";
+  }
+  max_batch_size_ = max_batch_size > 0 ? max_batch_size : inputs[0]->shape(0);
+
+  // Allocate the largest batch up front; the smaller ones are reshaped into
+  // the same memory.
+  input_shapes_.resize(inputs.size());
+  input_offsets_.resize(inputs.size());
+  for (int i = 0; i < inputs.size(); ++i) {
+    input_shapes_[i] = inputs[i]->shape();
+    input_shapes_[i][0] = max_batch_size_;
+    inputs[i]->Reshape(input_shapes_[i]);
+    input_offsets_[i] = input_bytes_ / sizeof(float);
+    input_bytes_ += inputs[i]->count(1) * sizeof(float);
+  }
+  batch_size_ = max_batch_size_;
+  net_->Reshape();
+  CheckOutputShapes();
+  net_->ForwardPrefilled();
+}
+
+Server::~Server() {
+}
+
+void Server::CheckOutputShapes() const {
+  const vector<Blob<float>*>& outputs = net_->output_blobs();
+  for (int i = 0; i < outputs.size(); ++i) {
+    CHECK(outputs[i]->num_axes() > 0 && outputs[i]->shape(0) == batch_size_)
+        << "Output " << net_->blob_names()[net_->output_blob_indices()[i]]
+        << " of shape " << outputs[i]->shape_string()
+        << " is not computed per sample of a batch of " << batch_size_
+        << "; only nets whose outputs all have the batch as their first axis "
+        << "can be served.";
+  }
+}
+
+void Server::ServeFds(const int in_fd, const int out_fd) {
+  shared_ptr<ServeConnection> connection(
+      new ServeConnection(in_fd, out_fd, false));
+  boost::thread reader(boost::bind(&ServeConnectionLoop, connection,
+      input_bytes_, queue_.get(), true));
+  Run();
+  reader.join();
+}
+
+void Server::ServeSocket(const string& path) {
+  const int socket_fd = ListenOnUnixSocket(path);
+  boost::thread(boost::bind(&ServeAcceptLoop, socket_fd, input_bytes_,
+      queue_.get())).detach();
+  Run();
+}
+
+string Server::StatsJson() const {
+  return stats_->Json();
+}
+
+void Server::Forward(const vector<ServeRequest*>& infer) {
+  const vector<Blob<float>*>& inputs = net_->input_blobs();
+  const vector<Blob<float>*>& outputs = net_->output_blobs();
+  if (infer.size() != batch_size_) {
+    batch_size_ = infer.size();
+    for (int i = 0; i < inputs.size(); ++i) {
+      input_shapes_[i][0] = batch_size_;
+      inputs[i]->Reshape(input_shapes_[i]);
+    }
+    net_->Reshape();
+    CheckOutputShapes();
+  }
+  const int64_t forward_start_us = Profiler::Now();
+  for (int i = 0; i < inputs.size(); ++i) {
+    const int sample_count = inputs[i]->count(1);
+    float* input_data = inputs[i]->mutable_cpu_data();
+    for (int n = 0; n < batch_size_; ++n) {
+      const float* request_data =
+          reinterpret_cast<const float*>(infer[n]->payload.data());
+      caffe_copy(sample_count, request_data + input_offsets_[i],
+          input_data + n * sample_count);
+    }
+  }
+  net_->ForwardPrefilled();
+  for (int n = 0; n < batch_size_; ++n) {
+    string& output = infer[n]->payload;
+    output.clear();
+    for (int i = 0; i < outputs.size(); ++i) {
+      const int sample_count = outputs[i]->count(1);
+      output.append(reinterpret_cast<const char*>(outputs[i]->cpu_data() +
+          n * sample_count), sample_count * sizeof(float));
+    }
+  }
+  stats_->AddBatch(batch_size_,
+      (Profiler::Now() - forward_start_us) / 1000.);
+}
+
+void Server::Run() {
+  LOG(INFO) << "Batching up to " << max_batch_size_ << " requests, for up to "
+      << batch_deadline_us_ / 1000. << " ms.";
+  int64_t last_log_us = Profiler::Now();
+  vector<shared_ptr<ServeRequest> > batch;
+  vector<ServeRequest*> infer;
+  while (queue_->PopBatch(max_batch_size_, batch_deadline_us_, &batch)) {
+    infer.clear();
+    for (int i = 0; i < batch.size(); ++i) {
+      if (batch[i]->type == kServeInfer && batch[i]->error.empty()) {
+        infer.push_back(batch[i].get());
+      }
+    }
+    if (!infer.empty()) {
+      Forward(infer);
+    }
+    for (int i = 0; i < batch.size(); ++i) {
+      ServeRequest& request = *batch[i];
+      if (!request.error.empty()) {
+        stats_->AddError();
+        request.connection->WriteFrame(kServeError, request.error);
+      } else if (request.type == kServeStats) {
+        request.connection->WriteFrame(kServeStats, stats_->Json());
+      } else {
+        request.connection->WriteFrame(kServeInfer, request.payload);
+        stats_->AddLatency((Profiler::Now() - request.arrival_us) / 1000.);
+      }
+    }
+    batch.clear();
+    if (stats_interval_ > 0 && Profiler::Now() - last_log_us >=
+        static_cast<int64_t>(stats_interval_) * 1000000) {
+      LOG(INFO) << "Serving stats: " << stats_->Json();
+      last_log_us = Profiler::Now();
+    }
+  }
+  LOG(INFO) << "Serving stats: " << stats_->Json();
+}
+
+}  // namespace caffe
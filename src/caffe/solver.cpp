@@ -1,9 +1,14 @@
+#include <boost/thread.hpp>
+#include <unistd.h>
+
 #include <cstdio>
 
 #include <algorithm>
+#include <deque>
 #include <string>
 #include <vector>
 
+#include "caffe/data_layers.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
@@ -15,30 +20,47 @@ namespace caffe {
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
-    : net_() {
+    : net_(), workers_stop_(false), param_sumsq_diff_(-1),
+      param_diffs_zeroed_(false) {
   Init(param);
 }
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const string& param_file)
-    : net_() {
+    : net_(), workers_stop_(false), param_sumsq_diff_(-1),
+      param_diffs_zeroed_(false) {
   SolverParameter param;
   ReadProtoFromTextFileOrDie(param_file, &param);
   Init(param);
 }
 
+template <typename Dtype>
+Solver<Dtype>::~Solver() {
+  StopWorkers();
+  WaitForSnapshots();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Init(const SolverParameter& param) {
   LOG(INFO) << "Initializing solver from parameters: " << std::endl
             << param.DebugString();
   param_ = param;
   CHECK_GE(param_.average_loss(), 1) << "average_loss should be non-negative.";
+  // A fused update zeroes the diffs in the same pass that applies the step,
+  // leaving nothing to snapshot.
+  CHECK(!(param_.fused_update() && param_.snapshot_diff()))
+      << "snapshot_diff needs the unfused update, which leaves the step in "
+      << "the diffs; unset fused_update to snapshot them.";
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed());
   }
   // Scaffolding code
   InitTrainNet();
   InitTestNets();
+  if (param_.profile()) {
+    set_profiler(shared_ptr<Profiler>(
+        new Profiler(param_.profile_capacity())));
+  }
   LOG(INFO) << "Solver scaffolding done.";
   iter_ = 0;
   current_step_ = 0;
@@ -79,7 +101,185 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(net_param.state());
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
+  const int num_threads = param_.solver_threads();
+  CHECK_GE(num_threads, 1) << "solver_threads must be positive.";
+  if (num_threads > 1) {
+    // Only the data layers of the train net are split, so that those of the
+    // other phases need not be splittable.
+    NetParameter filtered_param;
+    Net<Dtype>::FilterNet(net_param, &filtered_param);
+    ShardDataLayers(num_threads, &filtered_param);
+    net_param.Swap(&filtered_param);
+  }
   net_.reset(new Net<Dtype>(net_param));
+  InitWorkers(net_param);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ShardDataLayers(const int num_shards,
+    NetParameter* net_param) {
+  for (int i = 0; i < net_param->layer_size(); ++i) {
+    LayerParameter* layer_param = net_param->mutable_layer(i);
+    if (layer_param->bottom_size() > 0) {
+      continue;
+    }
+    const string& type = layer_param->type();
+    if (type == "Data" || type == "HDF5Data" || type == "ImageData") {
+      DataShardParameter* shard_param = layer_param->mutable_data_shard_param();
+      shard_param->set_shard(0);
+      shard_param->set_num_shards(num_shards);
+      // The shards skip and shuffle alike, so they share a seed drawn here.
+      if (layer_param->data_param().rand_skip() > 0 ||
+          layer_param->image_data_param().rand_skip() > 0 ||
+          layer_param->image_data_param().shuffle()) {
+        const unsigned int seed = caffe_rng_rand();
+        shard_param->set_seed(seed ? seed : 1);
+      }
+    } else {
+      CHECK(type == "WindowData" || type == "DummyData" ||
+          type == "MemoryData") << "Cannot split the data of layer "
+          << layer_param->name() << " of type " << type << " between "
+          << num_shards << " solver_threads replicas; use a Data, HDF5Data, "
+          << "ImageData, WindowData, DummyData or MemoryData layer, or a "
+          << "single solver thread.";
+    }
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::InitWorkers(const NetParameter& net_param) {
+  const int num_threads = param_.solver_threads();
+  if (num_threads == 1) {
+    return;
+  }
+  LOG(INFO) << "Creating " << num_threads - 1
+            << " replicas of the training net for data parallel training.";
+  for (int i = 1; i < num_threads; ++i) {
+    // Replica i reads shard i of the data of the train net, which reads
+    // shard 0.
+    NetParameter worker_param(net_param);
+    for (int j = 0; j < worker_param.layer_size(); ++j) {
+      if (worker_param.layer(j).has_data_shard_param()) {
+        worker_param.mutable_layer(j)->mutable_data_shard_param()->set_shard(i);
+      }
+    }
+    worker_nets_.push_back(
+        shared_ptr<Net<Dtype> >(new Net<Dtype>(worker_param)));
+    worker_nets_.back()->ShareTrainedLayersWith(net_.get());
+  }
+  worker_losses_.resize(num_threads);
+  worker_diffs_.resize(num_threads);
+  worker_barrier_.reset(new boost::barrier(num_threads));
+  for (int i = 1; i < num_threads; ++i) {
+    // Every worker gets its own rng, seeded here as the shared one must not
+    // be used from several threads.
+    const unsigned int seed = param_.random_seed() >= 0 ?
+        param_.random_seed() + i : caffe_rng_rand();
+    worker_threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        &Solver<Dtype>::WorkerEntry, this, i, seed)));
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::StopWorkers() {
+  if (worker_threads_.empty()) {
+    return;
+  }
+  workers_stop_ = true;
+  worker_barrier_->wait();
+  for (int i = 0; i < worker_threads_.size(); ++i) {
+    worker_threads_[i]->join();
+  }
+  worker_threads_.clear();
+}
+
+// The diffs of the parameters owned by net, in the order of Net::params.
+template <typename Dtype>
+static void GetOwnedParamDiffs(Net<Dtype>* net, vector<Dtype*>* diffs) {
+  diffs->clear();
+  for (int i = 0; i < net->params().size(); ++i) {
+    if (net->param_owners()[i] < 0) {
+      diffs->push_back(net->params()[i]->mutable_cpu_diff());
+    }
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WorkerEntry(int thread_id, unsigned int seed) {
+  Caffe::set_thread_random_seed(seed);
+  Net<Dtype>* net = worker_nets_[thread_id - 1].get();
+  vector<Blob<Dtype>*> bottom_vec;
+  while (true) {
+    worker_barrier_->wait();
+    if (workers_stop_) {
+      break;
+    }
+    ClearParamDiffs(net);
+    Dtype loss = 0;
+    for (int i = 0; i < param_.iter_size(); ++i) {
+      loss += net->ForwardBackward(bottom_vec);
+    }
+    worker_losses_[thread_id] = loss;
+    GetOwnedParamDiffs(net, &worker_diffs_[thread_id]);
+    worker_barrier_->wait();
+    ReduceDiffs(thread_id);
+    worker_barrier_->wait();
+  }
+}
+
+template <typename Dtype>
+Dtype Solver<Dtype>::ForwardBackwardParallel() {
+  CHECK(Caffe::mode() == Caffe::CPU)
+      << "solver_threads is only supported in CPU mode.";
+  vector<Blob<Dtype>*> bottom_vec;
+  // Release the workers and run the train net meanwhile.
+  worker_barrier_->wait();
+  Dtype loss = 0;
+  for (int i = 0; i < param_.iter_size(); ++i) {
+    loss += net_->ForwardBackward(bottom_vec);
+  }
+  worker_losses_[0] = loss;
+  GetOwnedParamDiffs(net_.get(), &worker_diffs_[0]);
+  worker_barrier_->wait();
+  ReduceDiffs(0);
+  worker_barrier_->wait();
+  loss = 0;
+  for (int i = 0; i < worker_losses_.size(); ++i) {
+    loss += worker_losses_[i];
+  }
+  return loss / worker_losses_.size();
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReduceDiffs(int thread_id) {
+  const int num_threads = worker_diffs_.size();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  vector<size_t> counts;
+  size_t total_count = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    if (net_->param_owners()[i] < 0) {
+      counts.push_back(params[i]->count());
+      total_count += params[i]->count();
+    }
+  }
+  // The slice [begin, end) of the owned parameters laid end to end.
+  const size_t begin = total_count * thread_id / num_threads;
+  const size_t end = total_count * (thread_id + 1) / num_threads;
+  const Dtype scale = Dtype(1) / num_threads;
+  size_t offset = 0;
+  for (int i = 0; i < counts.size(); offset += counts[i], ++i) {
+    const size_t first = std::max(begin, offset);
+    const size_t last = std::min(end, offset + counts[i]);
+    if (first >= last) {
+      continue;
+    }
+    const int n = last - first;
+    Dtype* diff = worker_diffs_[0][i] + (first - offset);
+    for (int j = 1; j < num_threads; ++j) {
+      caffe_axpy(n, Dtype(1), worker_diffs_[j][i] + (first - offset), diff);
+    }
+    caffe_scal(n, scale, diff);
+  }
 }
 
 template <typename Dtype>
@@ -158,6 +358,32 @@ void Solver<Dtype>::InitTestNets() {
   }
 }
 
+template <typename Dtype>
+void Solver<Dtype>::ClearParamDiffs(Net<Dtype>* net) {
+  const shared_ptr<Blob<Dtype> >& flat_params = net->flat_params();
+  const int num_params = flat_params ? 1 : net->params().size();
+  for (int i = 0; i < num_params; ++i) {
+    // Shared parameters share the diff of their owner.
+    if (!flat_params && net->param_owners()[i] >= 0) { continue; }
+    shared_ptr<Blob<Dtype> > blob =
+        flat_params ? flat_params : net->params()[i];
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_set(blob->count(), static_cast<Dtype>(0),
+          blob->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_set(blob->count(), static_cast<Dtype>(0),
+          blob->mutable_gpu_diff());
+#else
+      NO_GPU;
+#endif
+      break;
+    }
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Step(int iters) {
   vector<Blob<Dtype>*> bottom_vec;
@@ -166,25 +392,17 @@ void Solver<Dtype>::Step(int iters) {
   int average_loss = this->param_.average_loss();
   vector<Dtype> losses;
   Dtype smoothed_loss = 0;
+  // When clipping gradients, the last backward pass of each step sums the
+  // squares of the diffs, unless replicas or callbacks change them after.
+  const bool sumsq_in_backward = param_.clip_gradients() >= 0 &&
+      worker_nets_.empty() && callbacks_.empty();
   for (; iter_ < stop_iter; ++iter_) {
-    // zero-init the params
-    for (int i = 0; i < net_->params().size(); ++i) {
-      shared_ptr<Blob<Dtype> > blob = net_->params()[i];
-      switch (Caffe::mode()) {
-      case Caffe::CPU:
-        caffe_set(blob->count(), static_cast<Dtype>(0),
-            blob->mutable_cpu_diff());
-        break;
-      case Caffe::GPU:
-#ifndef CPU_ONLY
-        caffe_gpu_set(blob->count(), static_cast<Dtype>(0),
-            blob->mutable_gpu_diff());
-#else
-        NO_GPU;
-#endif
-        break;
-      }
+    // zero-init the params, unless a fused update already did
+    if (!param_diffs_zeroed_) {
+      ClearParamDiffs(net_.get());
     }
+    param_diffs_zeroed_ = false;
+    param_sumsq_diff_ = -1;
 
     if (param_.test_interval() && iter_ % param_.test_interval() == 0
         && (iter_ > 0 || param_.test_initialization())) {
@@ -195,8 +413,19 @@ void Solver<Dtype>::Step(int iters) {
     net_->set_debug_info(display && param_.debug_info());
     // accumulate the loss and gradient
     Dtype loss = 0;
-    for (int i = 0; i < param_.iter_size(); ++i) {
-      loss += net_->ForwardBackward(bottom_vec);
+    if (worker_nets_.empty()) {
+      for (int i = 0; i < param_.iter_size(); ++i) {
+        if (sumsq_in_backward && i == param_.iter_size() - 1) {
+          Dtype iter_loss;
+          net_->Forward(bottom_vec, &iter_loss);
+          param_sumsq_diff_ = net_->BackwardWithSumsqDiff();
+          loss += iter_loss;
+        } else {
+          loss += net_->ForwardBackward(bottom_vec);
+        }
+      }
+    } else {
+      loss = ForwardBackwardParallel();
     }
     loss /= param_.iter_size();
     // average the loss across iterations for smoothed reporting
@@ -230,9 +459,24 @@ void Solver<Dtype>::Step(int iters) {
               << result_vec[k] << loss_msg_stream.str();
         }
       }
+      DisplayDataStats();
+    }
+    int64_t start_us = profiler_ ? Profiler::Now() : 0;
+    for (int i = 0; i < callbacks_.size(); ++i) {
+      callbacks_[i]->on_gradients_ready();
+    }
+    if (profiler_ && !callbacks_.empty()) {
+      profiler_->Record(profile_callbacks_id_, Profiler::SOLVER, start_us);
+      start_us = Profiler::Now();
     }
     ComputeUpdateValue();
-    net_->Update();
+    // A fused update has already been applied to the parameters.
+    if (!param_.fused_update()) {
+      net_->Update();
+    }
+    if (profiler_) {
+      profiler_->Record(profile_update_id_, Profiler::SOLVER, start_us);
+    }
 
     // Save a snapshot if needed.
     if (param_.snapshot() && (iter_ + 1) % param_.snapshot() == 0) {
@@ -274,15 +518,80 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  WaitForSnapshots();
+  WriteProfile();
   LOG(INFO) << "Optimization Done.";
 }
 
 
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  const int64_t start_us = profiler_ ? Profiler::Now() : 0;
   for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
     Test(test_net_id);
   }
+  if (profiler_) {
+    profiler_->Record(profile_test_id_, Profiler::SOLVER, start_us);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::set_profiler(const shared_ptr<Profiler>& profiler) {
+  profiler_ = profiler;
+  if (profiler_) {
+    profile_test_id_ = profiler_->RegisterName("Test");
+    profile_callbacks_id_ = profiler_->RegisterName("Callbacks");
+    profile_update_id_ = profiler_->RegisterName("Update");
+    profile_snapshot_id_ = profiler_->RegisterName("Snapshot");
+  }
+  net_->set_profiler(profiler);
+  for (int i = 0; i < test_nets_.size(); ++i) {
+    test_nets_[i]->set_profiler(profiler);
+  }
+  for (int i = 0; i < worker_nets_.size(); ++i) {
+    worker_nets_[i]->set_profiler(profiler);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteProfile() {
+  if (profiler_ && param_.has_profile_file()) {
+    LOG(INFO) << "Writing the profile to " << param_.profile_file();
+    profiler_->WriteChromeTrace(param_.profile_file());
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::DisplayDataStats() {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+  for (int i = 0; i < layers.size(); ++i) {
+    BaseDataLayer<Dtype>* layer =
+        dynamic_cast<BaseDataLayer<Dtype>*>(layers[i].get());
+    if (!layer) {
+      continue;
+    }
+    DataLayerStats stats = layer->stats();
+    layer->ClearStats();
+    // The replicas are built from the same parameters, so their layers line
+    // up with those of net_.
+    for (int j = 0; j < worker_nets_.size(); ++j) {
+      BaseDataLayer<Dtype>* replica = static_cast<BaseDataLayer<Dtype>*>(
+          worker_nets_[j]->layers()[i].get());
+      stats.Add(replica->stats());
+      replica->ClearStats();
+    }
+    if (!stats.batches) {
+      continue;
+    }
+    LOG(INFO) << "    Data layer " << net_->layer_names()[i] << ": "
+        << stats.ItemsPerSecond() << " items/s, "
+        << stats.ready_batches << "/" << stats.batches << " batches ready, "
+        << "per batch: wait " << stats.wait_ms / stats.batches << " ms, read "
+        << stats.read_ms / stats.batches << " ms ("
+        << stats.bytes_read / 1024.0 / stats.batches << " KB), decode "
+        << stats.decode_ms / stats.batches << " ms, transform "
+        << stats.transform_ms / stats.batches << " ms";
+  }
 }
 
 template <typename Dtype>
@@ -344,9 +653,6 @@ void Solver<Dtype>::Test(const int test_net_id) {
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
-  NetParameter net_param;
-  // For intermediate results, we will also dump the gradient values.
-  net_->ToProto(&net_param, param_.snapshot_diff());
   string filename(param_.snapshot_prefix());
   string model_filename, snapshot_filename;
   const int kBufferSize = 20;
@@ -355,16 +661,153 @@ void Solver<Dtype>::Snapshot() {
   snprintf(iter_str_buffer, kBufferSize, "_iter_%d", iter_ + 1);
   filename += iter_str_buffer;
   model_filename = filename + ".caffemodel";
-  LOG(INFO) << "Snapshotting to " << model_filename;
-  WriteProtoToBinaryFile(net_param, model_filename.c_str());
-  SolverState state;
-  SnapshotSolverState(&state);
-  state.set_iter(iter_ + 1);
-  state.set_learned_net(model_filename);
-  state.set_current_step(current_step_);
   snapshot_filename = filename + ".solverstate";
-  LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  const int64_t start_us = profiler_ ? Profiler::Now() : 0;
+  if (param_.snapshot_async()) {
+    SnapshotAsync(model_filename, snapshot_filename);
+  } else {
+    NetParameter net_param;
+    // For intermediate results, we will also dump the gradient values.
+    net_->ToProto(&net_param, param_.snapshot_diff());
+    if (param_.snapshot_fp16()) {
+      ConvertNetParameterToHalf(&net_param);
+    }
+    LOG(INFO) << "Snapshotting to " << model_filename;
+    WriteProtoToBinaryFile(net_param, model_filename.c_str());
+    SolverState state;
+    SnapshotSolverState(&state);
+    state.set_iter(iter_ + 1);
+    state.set_learned_net(model_filename);
+    state.set_current_step(current_step_);
+    LOG(INFO) << "Snapshotting solver state to " << snapshot_filename;
+    WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  }
+  if (profiler_) {
+    profiler_->Record(profile_snapshot_id_, Profiler::SOLVER, start_us);
+  }
+}
+
+// Copies blob into a new host blob, reading it back from the device first if
+// needed.
+template <typename Dtype>
+static shared_ptr<Blob<Dtype> > StageBlob(const Blob<Dtype>& blob,
+    bool copy_diff) {
+  shared_ptr<Blob<Dtype> > staged(new Blob<Dtype>(blob.shape()));
+  caffe_copy(blob.count(), blob.cpu_data(), staged->mutable_cpu_data());
+  if (copy_diff) {
+    caffe_copy(blob.count(), blob.cpu_diff(), staged->mutable_cpu_diff());
+  }
+  return staged;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::SnapshotAsync(const string& model_filename,
+    const string& state_filename) {
+  const int max_pending = std::max(1, param_.snapshot_max_pending());
+  ReapSnapshots();
+  if (snapshot_threads_.size() >= max_pending) {
+    if (param_.snapshot_back_pressure() ==
+        SolverParameter_SnapshotBackPressure_SKIP) {
+      LOG(WARNING) << "Skipping snapshot " << model_filename << ": "
+          << snapshot_threads_.size() << " snapshots are still being written.";
+      return;
+    }
+    LOG(INFO) << "Waiting for the previous snapshot to be written.";
+    JoinSnapshots(max_pending - 1);
+  }
+  LOG(INFO) << "Snapshotting asynchronously to " << model_filename;
+  shared_ptr<SnapshotJob> job(new SnapshotJob());
+  job->model_filename = model_filename;
+  job->state_filename = state_filename;
+  job->write_diff = param_.snapshot_diff();
+  job->write_fp16 = param_.snapshot_fp16();
+  // Only the parameters are copied here; the protos get their blobs in
+  // WriteSnapshot, like Net::ToProto and SnapshotSolverState would do.
+  NetParameter* net_param = &job->net_param;
+  net_param->set_name(net_->name());
+  for (int i = 0; i < net_->input_blob_indices().size(); ++i) {
+    net_param->add_input(net_->blob_names()[net_->input_blob_indices()[i]]);
+  }
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+  job->layer_blobs.resize(layers.size());
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerParameter* layer_param = net_param->add_layer();
+    layer_param->CopyFrom(layers[i]->layer_param());
+    layer_param->clear_blobs();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = layers[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      job->layer_blobs[i].push_back(StageBlob(*blobs[j], job->write_diff));
+    }
+  }
+  job->state.set_iter(iter_ + 1);
+  job->state.set_learned_net(model_filename);
+  job->state.set_current_step(current_step_);
+  const vector<Blob<Dtype>*> state_blobs = SolverStateBlobs();
+  for (int i = 0; i < state_blobs.size(); ++i) {
+    job->history.push_back(StageBlob(*state_blobs[i], false));
+  }
+  snapshot_threads_.push_back(shared_ptr<boost::thread>(
+      new boost::thread(&Solver<Dtype>::WriteSnapshot, job)));
+}
+
+// Writes proto to a temporary file, syncs it to disk and renames it into
+// place, so that a crash never leaves a truncated snapshot behind.
+static void WriteProtoToBinaryFileSynced(const Message& proto,
+    const string& filename) {
+  string buffer;
+  CHECK(proto.SerializeToString(&buffer));
+  const string tmp_filename = filename + ".tmp";
+  FILE* file = fopen(tmp_filename.c_str(), "wb");
+  CHECK(file) << "Failed to open " << tmp_filename;
+  CHECK_EQ(fwrite(buffer.data(), 1, buffer.size(), file), buffer.size())
+      << "Failed to write " << tmp_filename;
+  CHECK_EQ(fflush(file), 0) << "Failed to write " << tmp_filename;
+  CHECK_EQ(fsync(fileno(file)), 0) << "Failed to sync " << tmp_filename;
+  CHECK_EQ(fclose(file), 0) << "Failed to close " << tmp_filename;
+  CHECK_EQ(rename(tmp_filename.c_str(), filename.c_str()), 0)
+      << "Failed to rename " << tmp_filename << " to " << filename;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshot(shared_ptr<SnapshotJob> job) {
+  for (int i = 0; i < job->layer_blobs.size(); ++i) {
+    LayerParameter* layer_param = job->net_param.mutable_layer(i);
+    for (int j = 0; j < job->layer_blobs[i].size(); ++j) {
+      job->layer_blobs[i][j]->ToProto(layer_param->add_blobs(),
+          job->write_diff);
+    }
+  }
+  if (job->write_fp16) {
+    ConvertNetParameterToHalf(&job->net_param);
+  }
+  WriteProtoToBinaryFileSynced(job->net_param, job->model_filename);
+  for (int i = 0; i < job->history.size(); ++i) {
+    job->history[i]->ToProto(job->state.add_history());
+  }
+  WriteProtoToBinaryFileSynced(job->state, job->state_filename);
+  LOG(INFO) << "Wrote snapshot " << job->model_filename << " and "
+      << job->state_filename;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReapSnapshots() {
+  std::deque<shared_ptr<boost::thread> >::iterator it =
+      snapshot_threads_.begin();
+  while (it != snapshot_threads_.end()) {
+    if ((*it)->timed_join(boost::posix_time::milliseconds(0))) {
+      it = snapshot_threads_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::JoinSnapshots(int max_pending) {
+  while (snapshot_threads_.size() > max_pending) {
+    snapshot_threads_.front()->join();
+    snapshot_threads_.pop_front();
+  }
 }
 
 template <typename Dtype>
@@ -382,6 +825,171 @@ void Solver<Dtype>::Restore(const char* state_file) {
 }
 
 
+// Single-pass update kernels: each element of the parameter data, diff and
+// history is read and written once, the diff being zeroed for the next step.
+// The regularizer is picked outside the loops so that they stay branch-free
+// and vectorizable.
+template <typename Dtype>
+void sgd_update_cpu(const int N, const Dtype momentum, const Dtype local_rate,
+    const Dtype diff_scale, const Dtype local_decay, const bool l1_decay,
+    Dtype* data, Dtype* diff, Dtype* history) {
+  if (l1_decay) {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g =
+          diff_scale * diff[i] + local_decay * caffe_sign(data[i]);
+      const Dtype h = momentum * history[i] + local_rate * g;
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= h;
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g = diff_scale * diff[i] + local_decay * data[i];
+      const Dtype h = momentum * history[i] + local_rate * g;
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= h;
+    }
+  }
+}
+
+template <typename Dtype>
+void nesterov_update_cpu(const int N, const Dtype momentum,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  if (l1_decay) {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g =
+          diff_scale * diff[i] + local_decay * caffe_sign(data[i]);
+      const Dtype h_old = history[i];
+      const Dtype h = momentum * h_old + local_rate * g;
+      // step back then over step
+      const Dtype u = (1 + momentum) * h - momentum * h_old;
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g = diff_scale * diff[i] + local_decay * data[i];
+      const Dtype h_old = history[i];
+      const Dtype h = momentum * h_old + local_rate * g;
+      // step back then over step
+      const Dtype u = (1 + momentum) * h - momentum * h_old;
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  }
+}
+
+template <typename Dtype>
+void adagrad_update_cpu(const int N, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  if (l1_decay) {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g =
+          diff_scale * diff[i] + local_decay * caffe_sign(data[i]);
+      const Dtype h = history[i] + g * g;
+      const Dtype u = local_rate * g / (std::sqrt(h) + delta);
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g = diff_scale * diff[i] + local_decay * data[i];
+      const Dtype h = history[i] + g * g;
+      const Dtype u = local_rate * g / (std::sqrt(h) + delta);
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  }
+}
+
+template <typename Dtype>
+void rmsprop_update_cpu(const int N, const Dtype rms_decay, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  if (l1_decay) {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g =
+          diff_scale * diff[i] + local_decay * caffe_sign(data[i]);
+      const Dtype h = rms_decay * history[i] + (1 - rms_decay) * g * g;
+      const Dtype u = local_rate * g / (std::sqrt(h) + delta);
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g = diff_scale * diff[i] + local_decay * data[i];
+      const Dtype h = rms_decay * history[i] + (1 - rms_decay) * g * g;
+      const Dtype u = local_rate * g / (std::sqrt(h) + delta);
+      history[i] = h;
+      diff[i] = 0;
+      data[i] -= u;
+    }
+  }
+}
+
+// local_rate includes the bias correction of the moments.
+template <typename Dtype>
+void adam_update_cpu(const int N, const Dtype beta1, const Dtype beta2,
+    const Dtype delta, const Dtype local_rate, const Dtype diff_scale,
+    const Dtype local_decay, const bool l1_decay, Dtype* data, Dtype* diff,
+    Dtype* m, Dtype* v) {
+  if (l1_decay) {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g =
+          diff_scale * diff[i] + local_decay * caffe_sign(data[i]);
+      const Dtype mi = beta1 * m[i] + (1 - beta1) * g;
+      const Dtype vi = beta2 * v[i] + (1 - beta2) * g * g;
+      m[i] = mi;
+      v[i] = vi;
+      diff[i] = 0;
+      data[i] -= local_rate * mi / (std::sqrt(vi) + delta);
+    }
+  } else {
+    for (int i = 0; i < N; ++i) {
+      const Dtype g = diff_scale * diff[i] + local_decay * data[i];
+      const Dtype mi = beta1 * m[i] + (1 - beta1) * g;
+      const Dtype vi = beta2 * v[i] + (1 - beta2) * g * g;
+      m[i] = mi;
+      v[i] = vi;
+      diff[i] = 0;
+      data[i] -= local_rate * mi / (std::sqrt(vi) + delta);
+    }
+  }
+}
+
+#ifndef CPU_ONLY
+// Defined in solver.cu.
+template <typename Dtype>
+void sgd_update_gpu(const int N, const Dtype momentum, const Dtype local_rate,
+    const Dtype diff_scale, const Dtype local_decay, const bool l1_decay,
+    Dtype* data, Dtype* diff, Dtype* history);
+template <typename Dtype>
+void nesterov_update_gpu(const int N, const Dtype momentum,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history);
+template <typename Dtype>
+void adagrad_update_gpu(const int N, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history);
+template <typename Dtype>
+void rmsprop_update_gpu(const int N, const Dtype rms_decay, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history);
+template <typename Dtype>
+void adam_update_gpu(const int N, const Dtype beta1, const Dtype beta2,
+    const Dtype delta, const Dtype local_rate, const Dtype diff_scale,
+    const Dtype local_decay, const bool l1_decay, Dtype* data, Dtype* diff,
+    Dtype* m, Dtype* v);
+#endif
+
 // Return the current learning rate. The currently implemented learning rate
 // policies are as follows:
 //    - fixed: always return base_lr.
@@ -452,22 +1060,43 @@ void SGDSolver<Dtype>::PreSolve() {
 }
 
 template <typename Dtype>
-void SGDSolver<Dtype>::ClipGradients() {
+Dtype SGDSolver<Dtype>::GetClipScale() {
   const Dtype clip_gradients = this->param_.clip_gradients();
-  if (clip_gradients < 0) { return; }
+  if (clip_gradients < 0) { return 1; }
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
-  Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    if (this->net_->param_owners()[i] < 0) {
-      sumsq_diff += net_params[i]->sumsq_diff();
+  const shared_ptr<Blob<Dtype> >& flat_params = this->net_->flat_params();
+  // Use the sum of squares from the last backward pass if Step kept it.
+  Dtype sumsq_diff = this->param_sumsq_diff_;
+  if (sumsq_diff < 0) {
+    sumsq_diff = 0;
+    if (flat_params) {
+      sumsq_diff = flat_params->sumsq_diff();
+    } else {
+      for (int i = 0; i < net_params.size(); ++i) {
+        if (this->net_->param_owners()[i] < 0) {
+          sumsq_diff += net_params[i]->sumsq_diff();
+        }
+      }
     }
   }
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
-  if (l2norm_diff > clip_gradients) {
-    Dtype scale_factor = clip_gradients / l2norm_diff;
-    LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
-        << l2norm_diff << " > " << clip_gradients << ") "
-        << "by scale factor " << scale_factor;
+  if (l2norm_diff <= clip_gradients) { return 1; }
+  const Dtype scale_factor = clip_gradients / l2norm_diff;
+  LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
+      << l2norm_diff << " > " << clip_gradients << ") "
+      << "by scale factor " << scale_factor;
+  return scale_factor;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ClipGradients() {
+  const Dtype scale_factor = GetClipScale();
+  if (scale_factor == 1) { return; }
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const shared_ptr<Blob<Dtype> >& flat_params = this->net_->flat_params();
+  if (flat_params) {
+    flat_params->scale_diff(scale_factor);
+  } else {
     for (int i = 0; i < net_params.size(); ++i) {
       if (this->net_->param_owners()[i] < 0) {
         net_params[i]->scale_diff(scale_factor);
@@ -476,6 +1105,60 @@ void SGDSolver<Dtype>::ClipGradients() {
   }
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::ScaleAndRegularize(Dtype diff_scale) {
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const Dtype weight_decay = this->param_.weight_decay();
+  const string& regularization_type = this->param_.regularization_type();
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    // Shared parameters share the diff of their owner.
+    if (this->net_->param_owners()[param_id] >= 0) { continue; }
+    Blob<Dtype>* param = net_params[param_id].get();
+    const Dtype local_decay =
+        weight_decay * net_params_weight_decay[param_id];
+    if (diff_scale != 1) {
+      param->scale_diff(diff_scale);
+    }
+    if (!local_decay) { continue; }
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      if (regularization_type == "L2") {
+        caffe_axpy(param->count(), local_decay, param->cpu_data(),
+            param->mutable_cpu_diff());
+      } else if (regularization_type == "L1") {
+        caffe_cpu_sign(param->count(), param->cpu_data(),
+            temp_[param_id]->mutable_cpu_data());
+        caffe_axpy(param->count(), local_decay, temp_[param_id]->cpu_data(),
+            param->mutable_cpu_diff());
+      } else {
+        LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+      }
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      if (regularization_type == "L2") {
+        caffe_gpu_axpy(param->count(), local_decay, param->gpu_data(),
+            param->mutable_gpu_diff());
+      } else if (regularization_type == "L1") {
+        caffe_gpu_sign(param->count(), param->gpu_data(),
+            temp_[param_id]->mutable_gpu_data());
+        caffe_gpu_axpy(param->count(), local_decay, temp_[param_id]->gpu_data(),
+            param->mutable_gpu_diff());
+      } else {
+        LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+      }
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue() {
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -487,6 +1170,11 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
+  if (this->param_.fused_update()) {
+    // The clipping factor is applied by the update kernels.
+    FusedUpdate(rate / this->param_.iter_size(), GetClipScale());
+    return;
+  }
   ClipGradients();
   Dtype momentum = this->param_.momentum();
   Dtype weight_decay = this->param_.weight_decay();
@@ -573,6 +1261,55 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdate(Dtype rate, Dtype diff_scale) {
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const Dtype weight_decay = this->param_.weight_decay();
+  const string& regularization_type = this->param_.regularization_type();
+  const bool l1_decay = (regularization_type == "L1");
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    // Shared parameters are updated through their owner.
+    if (this->net_->param_owners()[param_id] >= 0) { continue; }
+    const Dtype local_rate = rate * net_params_lr[param_id];
+    const Dtype local_decay =
+        weight_decay * net_params_weight_decay[param_id];
+    if (local_decay && !l1_decay && regularization_type != "L2") {
+      LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+    }
+    FusedUpdateParam(param_id, local_rate, diff_scale, local_decay,
+        l1_decay);
+  }
+  this->param_diffs_zeroed_ = true;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdateParam(int param_id, Dtype local_rate,
+    Dtype diff_scale, Dtype local_decay, bool l1_decay) {
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  const Dtype momentum = this->param_.momentum();
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    sgd_update_cpu(param->count(), momentum, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_cpu_data(),
+        param->mutable_cpu_diff(), history_[param_id]->mutable_cpu_data());
+    break;
+  case Caffe::GPU:
+#ifndef CPU_ONLY
+    sgd_update_gpu(param->count(), momentum, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_gpu_data(),
+        param->mutable_gpu_diff(), history_[param_id]->mutable_gpu_data());
+#else
+    NO_GPU;
+#endif
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   state->clear_history();
@@ -583,6 +1320,15 @@ void SGDSolver<Dtype>::SnapshotSolverState(SolverState* state) {
   }
 }
 
+template <typename Dtype>
+vector<Blob<Dtype>*> SGDSolver<Dtype>::SolverStateBlobs() {
+  vector<Blob<Dtype>*> blobs;
+  for (int i = 0; i < history_.size(); ++i) {
+    blobs.push_back(history_[i].get());
+  }
+  return blobs;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::RestoreSolverState(const SolverState& state) {
   CHECK_EQ(state.history_size(), history_.size())
@@ -604,6 +1350,10 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
+  if (this->param_.fused_update()) {
+    this->FusedUpdate(rate, this->GetClipScale());
+    return;
+  }
   SGDSolver<Dtype>::ClipGradients();
   Dtype momentum = this->param_.momentum();
   Dtype weight_decay = this->param_.weight_decay();
@@ -710,6 +1460,33 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::FusedUpdateParam(int param_id, Dtype local_rate,
+    Dtype diff_scale, Dtype local_decay, bool l1_decay) {
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  const Dtype momentum = this->param_.momentum();
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    nesterov_update_cpu(param->count(), momentum, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_cpu_data(),
+        param->mutable_cpu_diff(),
+        this->history_[param_id]->mutable_cpu_data());
+    break;
+  case Caffe::GPU:
+#ifndef CPU_ONLY
+    nesterov_update_gpu(param->count(), momentum, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_gpu_data(),
+        param->mutable_gpu_diff(),
+        this->history_[param_id]->mutable_gpu_data());
+#else
+    NO_GPU;
+#endif
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -722,6 +1499,10 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
+  if (this->param_.fused_update()) {
+    this->FusedUpdate(rate, this->GetClipScale());
+    return;
+  }
   SGDSolver<Dtype>::ClipGradients();
   Dtype weight_decay = this->param_.weight_decay();
   string regularization_type = this->param_.regularization_type();
@@ -845,9 +1626,256 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::FusedUpdateParam(int param_id, Dtype local_rate,
+    Dtype diff_scale, Dtype local_decay, bool l1_decay) {
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  const Dtype delta = this->param_.delta();
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    adagrad_update_cpu(param->count(), delta, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_cpu_data(),
+        param->mutable_cpu_diff(),
+        this->history_[param_id]->mutable_cpu_data());
+    break;
+  case Caffe::GPU:
+#ifndef CPU_ONLY
+    adagrad_update_gpu(param->count(), delta, local_rate, diff_scale,
+        local_decay, l1_decay, param->mutable_gpu_data(),
+        param->mutable_gpu_diff(),
+        this->history_[param_id]->mutable_gpu_data());
+#else
+    NO_GPU;
+#endif
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
+template <typename Dtype>
+void RMSPropSolver<Dtype>::ComputeUpdateValue() {
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  // get the learning rate
+  const Dtype rate = this->GetLearningRate();
+  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+    LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
+  }
+  // The gradients are averaged over iter_size, unlike the step size.
+  const Dtype diff_scale = this->GetClipScale() / this->param_.iter_size();
+  if (this->param_.fused_update()) {
+    this->FusedUpdate(rate, diff_scale);
+    return;
+  }
+  this->ScaleAndRegularize(diff_scale);
+  const Dtype rms_decay = this->param_.rms_decay();
+  const Dtype delta = this->param_.delta();
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    if (this->net_->param_owners()[param_id] >= 0) { continue; }
+    const int count = net_params[param_id]->count();
+    const Dtype local_rate = rate * net_params_lr[param_id];
+    Blob<Dtype>* update = this->update_[param_id].get();
+    Blob<Dtype>* history = this->history_[param_id].get();
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      // compute square of gradient in update
+      caffe_powx(count, net_params[param_id]->cpu_diff(), Dtype(2),
+          update->mutable_cpu_data());
+      // update history
+      caffe_cpu_axpby(count, Dtype(1) - rms_decay, update->cpu_data(),
+          rms_decay, history->mutable_cpu_data());
+      // prepare update
+      caffe_powx(count, history->cpu_data(), Dtype(0.5),
+          update->mutable_cpu_data());
+      caffe_add_scalar(count, delta, update->mutable_cpu_data());
+      caffe_div(count, net_params[param_id]->cpu_diff(), update->cpu_data(),
+          update->mutable_cpu_data());
+      // scale and copy
+      caffe_cpu_axpby(count, local_rate, update->cpu_data(), Dtype(0),
+          net_params[param_id]->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      // compute square of gradient in update
+      caffe_gpu_powx(count, net_params[param_id]->gpu_diff(), Dtype(2),
+          update->mutable_gpu_data());
+      // update history
+      caffe_gpu_axpby(count, Dtype(1) - rms_decay, update->gpu_data(),
+          rms_decay, history->mutable_gpu_data());
+      // prepare update
+      caffe_gpu_powx(count, history->gpu_data(), Dtype(0.5),
+          update->mutable_gpu_data());
+      caffe_gpu_add_scalar(count, delta, update->mutable_gpu_data());
+      caffe_gpu_div(count, net_params[param_id]->gpu_diff(), update->gpu_data(),
+          update->mutable_gpu_data());
+      // scale and copy
+      caffe_gpu_axpby(count, local_rate, update->gpu_data(), Dtype(0),
+          net_params[param_id]->mutable_gpu_diff());
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
+}
+
+template <typename Dtype>
+void RMSPropSolver<Dtype>::FusedUpdateParam(int param_id, Dtype local_rate,
+    Dtype diff_scale, Dtype local_decay, bool l1_decay) {
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  const Dtype rms_decay = this->param_.rms_decay();
+  const Dtype delta = this->param_.delta();
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    rmsprop_update_cpu(param->count(), rms_decay, delta, local_rate,
+        diff_scale, local_decay, l1_decay, param->mutable_cpu_data(),
+        param->mutable_cpu_diff(),
+        this->history_[param_id]->mutable_cpu_data());
+    break;
+  case Caffe::GPU:
+#ifndef CPU_ONLY
+    rmsprop_update_gpu(param->count(), rms_decay, delta, local_rate,
+        diff_scale, local_decay, l1_decay, param->mutable_gpu_data(),
+        param->mutable_gpu_diff(),
+        this->history_[param_id]->mutable_gpu_data());
+#else
+    NO_GPU;
+#endif
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
+template <typename Dtype>
+void AdamSolver<Dtype>::AdamPreSolve() {
+  // Add the second moments after the first ones, kept by SGDSolver.
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  for (int i = 0; i < net_params.size(); ++i) {
+    const vector<int>& shape = net_params[i]->shape();
+    this->history_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
+  }
+}
+
+template <typename Dtype>
+void AdamSolver<Dtype>::ComputeUpdateValue() {
+  const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  // get the learning rate
+  const Dtype rate = this->GetLearningRate();
+  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+    LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
+  }
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  // Correct the bias of the moments, started at zero, in the step size.
+  const int t = this->iter_ + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(beta2, t)) /
+      (Dtype(1) - pow(beta1, t));
+  // The gradients are averaged over iter_size, unlike the step size.
+  const Dtype diff_scale = this->GetClipScale() / this->param_.iter_size();
+  if (this->param_.fused_update()) {
+    this->FusedUpdate(rate * correction, diff_scale);
+    return;
+  }
+  this->ScaleAndRegularize(diff_scale);
+  const Dtype delta = this->param_.delta();
+  const int num_params = net_params.size();
+  for (int param_id = 0; param_id < num_params; ++param_id) {
+    if (this->net_->param_owners()[param_id] >= 0) { continue; }
+    const int count = net_params[param_id]->count();
+    const Dtype local_rate = rate * correction * net_params_lr[param_id];
+    Blob<Dtype>* val_m = this->history_[param_id].get();
+    Blob<Dtype>* val_v = this->history_[param_id + num_params].get();
+    Blob<Dtype>* val_t = this->update_[param_id].get();
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      // update m <- beta1 m + (1 - beta1) g
+      caffe_cpu_axpby(count, Dtype(1) - beta1,
+          net_params[param_id]->cpu_diff(), beta1, val_m->mutable_cpu_data());
+      // update v <- beta2 v + (1 - beta2) g^2
+      caffe_mul(count, net_params[param_id]->cpu_diff(),
+          net_params[param_id]->cpu_diff(), val_t->mutable_cpu_data());
+      caffe_cpu_axpby(count, Dtype(1) - beta2, val_t->cpu_data(), beta2,
+          val_v->mutable_cpu_data());
+      // set the update to m / (sqrt(v) + delta), scaled
+      caffe_powx(count, val_v->cpu_data(), Dtype(0.5),
+          val_t->mutable_cpu_data());
+      caffe_add_scalar(count, delta, val_t->mutable_cpu_data());
+      caffe_div(count, val_m->cpu_data(), val_t->cpu_data(),
+          val_t->mutable_cpu_data());
+      caffe_cpu_scale(count, local_rate, val_t->cpu_data(),
+          net_params[param_id]->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      // update m <- beta1 m + (1 - beta1) g
+      caffe_gpu_axpby(count, Dtype(1) - beta1,
+          net_params[param_id]->gpu_diff(), beta1, val_m->mutable_gpu_data());
+      // update v <- beta2 v + (1 - beta2) g^2
+      caffe_gpu_mul(count, net_params[param_id]->gpu_diff(),
+          net_params[param_id]->gpu_diff(), val_t->mutable_gpu_data());
+      caffe_gpu_axpby(count, Dtype(1) - beta2, val_t->gpu_data(), beta2,
+          val_v->mutable_gpu_data());
+      // set the update to m / (sqrt(v) + delta), scaled
+      caffe_gpu_powx(count, val_v->gpu_data(), Dtype(0.5),
+          val_t->mutable_gpu_data());
+      caffe_gpu_add_scalar(count, delta, val_t->mutable_gpu_data());
+      caffe_gpu_div(count, val_m->gpu_data(), val_t->gpu_data(),
+          val_t->mutable_gpu_data());
+      caffe_gpu_scale(count, local_rate, val_t->gpu_data(),
+          net_params[param_id]->mutable_gpu_diff());
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
+}
+
+template <typename Dtype>
+void AdamSolver<Dtype>::FusedUpdateParam(int param_id, Dtype local_rate,
+    Dtype diff_scale, Dtype local_decay, bool l1_decay) {
+  Blob<Dtype>* param = this->net_->params()[param_id].get();
+  Blob<Dtype>* val_m = this->history_[param_id].get();
+  Blob<Dtype>* val_v =
+      this->history_[param_id + this->net_->params().size()].get();
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  const Dtype delta = this->param_.delta();
+  switch (Caffe::mode()) {
+  case Caffe::CPU:
+    adam_update_cpu(param->count(), beta1, beta2, delta, local_rate,
+        diff_scale, local_decay, l1_decay, param->mutable_cpu_data(),
+        param->mutable_cpu_diff(), val_m->mutable_cpu_data(),
+        val_v->mutable_cpu_data());
+    break;
+  case Caffe::GPU:
+#ifndef CPU_ONLY
+    adam_update_gpu(param->count(), beta1, beta2, delta, local_rate,
+        diff_scale, local_decay, l1_decay, param->mutable_gpu_data(),
+        param->mutable_gpu_diff(), val_m->mutable_gpu_data(),
+        val_v->mutable_gpu_data());
+#else
+    NO_GPU;
+#endif
+    break;
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
 INSTANTIATE_CLASS(Solver);
 INSTANTIATE_CLASS(SGDSolver);
 INSTANTIATE_CLASS(NesterovSolver);
 INSTANTIATE_CLASS(AdaGradSolver);
+INSTANTIATE_CLASS(RMSPropSolver);
+INSTANTIATE_CLASS(AdamSolver);
 
 }  // namespace caffe
@@ -0,0 +1,180 @@
+#include <cmath>
+
+#include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Fused solver updates: one thread per parameter reads its data, diff and
+// history once, writes back its data and history, and zeroes its diff. See
+// the CPU versions in solver.cpp.
+template <typename Dtype>
+__device__ Dtype decayed_gradient(const Dtype diff, const Dtype data,
+    const Dtype diff_scale, const Dtype local_decay, const bool l1_decay) {
+  const Dtype decay = l1_decay ?
+      static_cast<Dtype>((Dtype(0) < data) - (data < Dtype(0))) : data;
+  return diff_scale * diff + local_decay * decay;
+}
+
+template <typename Dtype>
+__global__ void SGDUpdate(const int N, const Dtype momentum,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  CUDA_KERNEL_LOOP(i, N) {
+    const Dtype g = decayed_gradient(diff[i], data[i], diff_scale,
+        local_decay, l1_decay);
+    const Dtype h = momentum * history[i] + local_rate * g;
+    history[i] = h;
+    diff[i] = 0;
+    data[i] -= h;
+  }
+}
+
+template <typename Dtype>
+void sgd_update_gpu(const int N, const Dtype momentum, const Dtype local_rate,
+    const Dtype diff_scale, const Dtype local_decay, const bool l1_decay,
+    Dtype* data, Dtype* diff, Dtype* history) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SGDUpdate<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, momentum, local_rate, diff_scale, local_decay, l1_decay, data, diff,
+      history);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+__global__ void NesterovUpdate(const int N, const Dtype momentum,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  CUDA_KERNEL_LOOP(i, N) {
+    const Dtype g = decayed_gradient(diff[i], data[i], diff_scale,
+        local_decay, l1_decay);
+    const Dtype h_old = history[i];
+    const Dtype h = momentum * h_old + local_rate * g;
+    const Dtype u = (1 + momentum) * h - momentum * h_old;
+    history[i] = h;
+    diff[i] = 0;
+    data[i] -= u;
+  }
+}
+
+template <typename Dtype>
+void nesterov_update_gpu(const int N, const Dtype momentum,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  NesterovUpdate<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, momentum, local_rate, diff_scale, local_decay, l1_decay, data, diff,
+      history);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+__global__ void AdaGradUpdate(const int N, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  CUDA_KERNEL_LOOP(i, N) {
+    const Dtype g = decayed_gradient(diff[i], data[i], diff_scale,
+        local_decay, l1_decay);
+    const Dtype h = history[i] + g * g;
+    const Dtype u = local_rate * g / (sqrt(h) + delta);
+    history[i] = h;
+    diff[i] = 0;
+    data[i] -= u;
+  }
+}
+
+template <typename Dtype>
+void adagrad_update_gpu(const int N, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  AdaGradUpdate<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, delta, local_rate, diff_scale, local_decay, l1_decay, data, diff,
+      history);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+__global__ void RMSPropUpdate(const int N, const Dtype rms_decay,
+    const Dtype delta, const Dtype local_rate, const Dtype diff_scale,
+    const Dtype local_decay, const bool l1_decay, Dtype* data, Dtype* diff,
+    Dtype* history) {
+  CUDA_KERNEL_LOOP(i, N) {
+    const Dtype g = decayed_gradient(diff[i], data[i], diff_scale,
+        local_decay, l1_decay);
+    const Dtype h = rms_decay * history[i] + (1 - rms_decay) * g * g;
+    const Dtype u = local_rate * g / (sqrt(h) + delta);
+    history[i] = h;
+    diff[i] = 0;
+    data[i] -= u;
+  }
+}
+
+template <typename Dtype>
+void rmsprop_update_gpu(const int N, const Dtype rms_decay, const Dtype delta,
+    const Dtype local_rate, const Dtype diff_scale, const Dtype local_decay,
+    const bool l1_decay, Dtype* data, Dtype* diff, Dtype* history) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  RMSPropUpdate<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, rms_decay, delta, local_rate, diff_scale, local_decay, l1_decay,
+      data, diff, history);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Dtype>
+__global__ void AdamUpdate(const int N, const Dtype beta1, const Dtype beta2,
+    const Dtype delta, const Dtype local_rate, const Dtype diff_scale,
+    const Dtype local_decay, const bool l1_decay, Dtype* data, Dtype* diff,
+    Dtype* m, Dtype* v) {
+  CUDA_KERNEL_LOOP(i, N) {
+    const Dtype g = decayed_gradient(diff[i], data[i], diff_scale,
+        local_decay, l1_decay);
+    const Dtype mi = beta1 * m[i] + (1 - beta1) * g;
+    const Dtype vi = beta2 * v[i] + (1 - beta2) * g * g;
+    m[i] = mi;
+    v[i] = vi;
+    diff[i] = 0;
+    data[i] -= local_rate * mi / (sqrt(vi) + delta);
+  }
+}
+
+template <typename Dtype>
+void adam_update_gpu(const int N, const Dtype beta1, const Dtype beta2,
+    const Dtype delta, const Dtype local_rate, const Dtype diff_scale,
+    const Dtype local_decay, const bool l1_decay, Dtype* data, Dtype* diff,
+    Dtype* m, Dtype* v) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  AdamUpdate<Dtype><<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS>>>(
+      N, beta1, beta2, delta, local_rate, diff_scale, local_decay, l1_decay,
+      data, diff, m, v);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void sgd_update_gpu<float>(const int, const float, const float,
+    const float, const float, const bool, float*, float*, float*);
+template void sgd_update_gpu<double>(const int, const double, const double,
+    const double, const double, const bool, double*, double*, double*);
+template void nesterov_update_gpu<float>(const int, const float, const float,
+    const float, const float, const bool, float*, float*, float*);
+template void nesterov_update_gpu<double>(const int, const double,
+    const double, const double, const double, const bool, double*, double*,
+    double*);
+template void adagrad_update_gpu<float>(const int, const float, const float,
+    const float, const float, const bool, float*, float*, float*);
+template void adagrad_update_gpu<double>(const int, const double,
+    const double, const double, const double, const bool, double*, double*,
+    double*);
+template void rmsprop_update_gpu<float>(const int, const float, const float,
+    const float, const float, const float, const bool, float*, float*,
+    float*);
+template void rmsprop_update_gpu<double>(const int, const double,
+    const double, const double, const double, const double, const bool,
+    double*, double*, double*);
+template void adam_update_gpu<float>(const int, const float, const float,
+    const float, const float, const float, const float, const bool, float*,
+    float*, float*, float*);
+template void adam_update_gpu<double>(const int, const double, const double,
+    const double, const double, const double, const double, const bool,
+    double*, double*, double*, double*);
+
+}  // namespace caffe
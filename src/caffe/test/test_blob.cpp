@@ -1,4 +1,5 @@
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +7,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -105,6 +107,52 @@ TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   EXPECT_FALSE(this->blob_->ShapeEquals(blob_proto));
 }
 
+TYPED_TEST(BlobSimpleTest, TestFromHalfProto) {
+  BlobProto blob_proto;
+  blob_proto.mutable_shape()->add_dim(3);
+  // 1, -2 and 0.5 as halves.
+  const uint16_t halves[] = {0x3c00, 0xc000, 0x3800};
+  blob_proto.set_half_data(string(reinterpret_cast<const char*>(halves),
+                                  sizeof(halves)));
+  this->blob_->FromProto(blob_proto);
+  ASSERT_EQ(3, this->blob_->count());
+  EXPECT_EQ(1, this->blob_->cpu_data()[0]);
+  EXPECT_EQ(-2, this->blob_->cpu_data()[1]);
+  EXPECT_EQ(0.5, this->blob_->cpu_data()[2]);
+  // Writing the blob back gives float data again.
+  this->blob_->ToProto(&blob_proto);
+  EXPECT_FALSE(blob_proto.has_half_data());
+  ASSERT_EQ(3, blob_proto.data_size());
+  EXPECT_EQ(-2, blob_proto.data(1));
+}
+
+TYPED_TEST(BlobSimpleTest, TestFromSparseProto) {
+  BlobProto blob_proto;
+  blob_proto.mutable_shape()->add_dim(2);
+  blob_proto.mutable_shape()->add_dim(3);
+  const int indices[] = {1, 2, 5};
+  const float values[] = {3, -1, 4};
+  for (int i = 0; i < 3; ++i) {
+    blob_proto.add_sparse_index(indices[i]);
+    blob_proto.add_data(values[i]);
+  }
+  // The blob's old values must not show through the gaps.
+  this->blob_->Reshape(2, 3, 1, 1);
+  caffe_set(this->blob_->count(), TypeParam(7),
+      this->blob_->mutable_cpu_data());
+  this->blob_->FromProto(blob_proto);
+  const TypeParam expected[] = {0, 3, -1, 0, 0, 4};
+  ASSERT_EQ(6, this->blob_->count());
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(expected[i], this->blob_->cpu_data()[i]);
+  }
+  // Writing the blob back gives dense data again.
+  this->blob_->ToProto(&blob_proto);
+  EXPECT_EQ(0, blob_proto.sparse_index_size());
+  ASSERT_EQ(6, blob_proto.data_size());
+  EXPECT_EQ(4, blob_proto.data(5));
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
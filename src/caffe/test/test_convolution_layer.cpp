@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -421,6 +422,42 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestInt8ConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> float_top, float_top_2;
+  float_top.CopyFrom(*this->blob_top_, false, true);
+  float_top_2.CopyFrom(*this->blob_top_2_, false, true);
+  // The INT8 engine, with the bottom ranges taken as they are forwarded.
+  convolution_param->set_engine(ConvolutionParameter_Engine_INT8);
+  Int8ConvolutionLayer<Dtype> int8_layer(layer_param);
+  int8_layer.blobs() = layer.blobs();
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype tolerance = 0.02 * caffe_cpu_amax(float_top.count(),
+      float_top.cpu_data());
+  for (int i = 0; i < float_top.count(); ++i) {
+    EXPECT_NEAR(float_top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+        tolerance);
+    EXPECT_NEAR(float_top_2.cpu_data()[i], this->blob_top_2_->cpu_data()[i],
+        tolerance);
+  }
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -104,6 +104,50 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads the DB with two layers, the two shards of its batches, which
+  // share the DB.
+  void TestReadShards() {
+    const int kNumShards = 2;
+    const int kBatchSize = 2;
+    vector<shared_ptr<DataLayer<Dtype> > > layers;
+    vector<shared_ptr<Blob<Dtype> > > data;
+    vector<shared_ptr<Blob<Dtype> > > labels;
+    for (int shard = 0; shard < kNumShards; ++shard) {
+      LayerParameter param;
+      param.set_phase(TRAIN);
+      DataParameter* data_param = param.mutable_data_param();
+      data_param->set_batch_size(kBatchSize);
+      data_param->set_source(filename_->c_str());
+      data_param->set_backend(backend_);
+      DataShardParameter* shard_param = param.mutable_data_shard_param();
+      shard_param->set_shard(shard);
+      shard_param->set_num_shards(kNumShards);
+      layers.push_back(shared_ptr<DataLayer<Dtype> >(
+          new DataLayer<Dtype>(param)));
+      data.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      labels.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      vector<Blob<Dtype>*> top_vec;
+      top_vec.push_back(data.back().get());
+      top_vec.push_back(labels.back().get());
+      layers.back()->SetUp(blob_bottom_vec_, top_vec);
+    }
+
+    for (int iter = 0; iter < 10; ++iter) {
+      for (int shard = 0; shard < kNumShards; ++shard) {
+        vector<Blob<Dtype>*> top_vec;
+        top_vec.push_back(data[shard].get());
+        top_vec.push_back(labels[shard].get());
+        layers[shard]->Forward(blob_bottom_vec_, top_vec);
+        // Batch iter * kNumShards + shard of the DB of 5 datums.
+        for (int i = 0; i < kBatchSize; ++i) {
+          EXPECT_EQ(((iter * kNumShards + shard) * kBatchSize + i) % 5,
+                    labels[shard]->cpu_data()[i])
+              << "debug: iter " << iter << " shard " << shard << " i " << i;
+        }
+      }
+    }
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -354,6 +398,12 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadShards();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -392,6 +442,12 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShards();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
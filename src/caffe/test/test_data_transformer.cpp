@@ -1,3 +1,5 @@
+#include <opencv2/core/core.hpp>
+
 #include <string>
 #include <vector>
 
@@ -352,4 +354,219 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestBatchMatchesItems) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int channels = 3;
+  const int height = 40;
+  const int width = 41;
+  // Wide enough for the vectorized rows, with a remainder.
+  const int crop_size = 37;
+  const int num = 5;
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(3);
+  vector<Datum> datum_vector(num);
+  for (int item_id = 0; item_id < num; ++item_id) {
+    FillDatum(item_id, channels, height, width, unique_pixels,
+        &datum_vector[item_id]);
+  }
+  // Item by item with the same seed is the reference.
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  Caffe::set_random_seed(this->seed_);
+  transformer.InitRand();
+  Blob<TypeParam> item_blob(num, channels, crop_size, crop_size);
+  Blob<TypeParam> uni_blob(1, channels, crop_size, crop_size);
+  for (int item_id = 0; item_id < num; ++item_id) {
+    transformer.Transform(datum_vector[item_id], &uni_blob);
+    caffe_copy(uni_blob.count(), uni_blob.cpu_data(),
+        item_blob.mutable_cpu_data() + item_blob.offset(item_id));
+  }
+  for (int num_threads = 1; num_threads <= 3; ++num_threads) {
+    transform_param.set_num_threads(num_threads);
+    DataTransformer<TypeParam> batch_transformer(transform_param, TRAIN);
+    Caffe::set_random_seed(this->seed_);
+    batch_transformer.InitRand();
+    Blob<TypeParam> batch_blob(num, channels, crop_size, crop_size);
+    batch_transformer.Transform(datum_vector, &batch_blob);
+    for (int j = 0; j < batch_blob.count(); ++j) {
+      EXPECT_EQ(item_blob.cpu_data()[j], batch_blob.cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestBatchMatMatchesItems) {
+  const int height = 40;
+  const int width = 41;
+  const int size = 3 * height * width;
+  const int crop_size = 37;
+  const int num = 3;
+
+  string* mean_file = new string();
+  MakeTempFilename(mean_file);
+  // Grayscale and color images, with a mean_value and with a mean_file.
+  for (int channels = 1; channels <= 3; channels += 2) {
+    BlobProto blob_mean;
+    blob_mean.set_num(1);
+    blob_mean.set_channels(channels);
+    blob_mean.set_height(height);
+    blob_mean.set_width(width);
+    for (int j = 0; j < channels * height * width; ++j) {
+      blob_mean.add_data(j * 0.01);
+    }
+    WriteProtoToBinaryFile(blob_mean, *mean_file);
+    vector<cv::Mat> mat_vector;
+    for (int item_id = 0; item_id < num; ++item_id) {
+      cv::Mat cv_img(height, width, CV_8UC(channels));
+      for (int j = 0; j < channels * height * width; ++j) {
+        cv_img.data[j] = static_cast<uint8_t>((item_id + 1) * j % size);
+      }
+      mat_vector.push_back(cv_img);
+    }
+    for (int use_mean_file = 0; use_mean_file <= 1; ++use_mean_file) {
+      TransformationParameter transform_param;
+      transform_param.set_crop_size(crop_size);
+      transform_param.set_mirror(true);
+      transform_param.set_scale(0.5);
+      if (use_mean_file) {
+        transform_param.set_mean_file(*mean_file);
+      } else {
+        transform_param.add_mean_value(3);
+      }
+      DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+      Caffe::set_random_seed(this->seed_);
+      transformer.InitRand();
+      Blob<TypeParam> item_blob(num, channels, crop_size, crop_size);
+      Blob<TypeParam> uni_blob(1, channels, crop_size, crop_size);
+      for (int item_id = 0; item_id < num; ++item_id) {
+        transformer.Transform(mat_vector[item_id], &uni_blob);
+        caffe_copy(uni_blob.count(), uni_blob.cpu_data(),
+            item_blob.mutable_cpu_data() + item_blob.offset(item_id));
+      }
+      transform_param.set_num_threads(2);
+      DataTransformer<TypeParam> batch_transformer(transform_param, TRAIN);
+      Caffe::set_random_seed(this->seed_);
+      batch_transformer.InitRand();
+      Blob<TypeParam> batch_blob(num, channels, crop_size, crop_size);
+      batch_transformer.Transform(mat_vector, &batch_blob);
+      for (int j = 0; j < batch_blob.count(); ++j) {
+        EXPECT_EQ(item_blob.cpu_data()[j], batch_blob.cpu_data()[j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestBatchMeanFile) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+  const int size = channels * height * width;
+  const int num = 2;
+
+  string* mean_file = new string();
+  MakeTempFilename(mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int j = 0; j < size; ++j) {
+      blob_mean.add_data(j);
+  }
+  WriteProtoToBinaryFile(blob_mean, *mean_file);
+
+  transform_param.set_mean_file(*mean_file);
+  transform_param.set_mirror(true);
+  transform_param.set_num_threads(num);
+  vector<Datum> datum_vector(num);
+  for (int item_id = 0; item_id < num; ++item_id) {
+    FillDatum(label, channels, height, width, unique_pixels,
+        &datum_vector[item_id]);
+  }
+  Blob<TypeParam>* blob = new Blob<TypeParam>(num, channels, height, width);
+  DataTransformer<TypeParam>* transformer =
+      new DataTransformer<TypeParam>(transform_param, TEST);
+  transformer->InitRand();
+  transformer->Transform(datum_vector, blob);
+  for (int j = 0; j < blob->count(); ++j) {
+      EXPECT_EQ(blob->cpu_data()[j], 0);
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestCropsMatchTransform) {
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int channels = 3;
+  const int height = 6;
+  const int width = 7;
+  const int size = channels * height * width;
+  const int crop_size = 4;
+  const int num = 5;
+
+  string* mean_file = new string();
+  MakeTempFilename(mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int j = 0; j < size; ++j) {
+    blob_mean.add_data(j * 0.75);
+  }
+  WriteProtoToBinaryFile(blob_mean, *mean_file);
+  vector<Datum> datum_vector(num);
+  for (int item_id = 0; item_id < num; ++item_id) {
+    FillDatum(item_id, channels, height, width, unique_pixels,
+        &datum_vector[item_id]);
+  }
+  // Once with a mean_value, once with a mean_file.
+  for (int use_mean_file = 0; use_mean_file <= 1; ++use_mean_file) {
+    TransformationParameter transform_param;
+    transform_param.set_crop_size(crop_size);
+    transform_param.set_mirror(true);
+    transform_param.set_scale(0.5);
+    if (use_mean_file) {
+      transform_param.set_mean_file(*mean_file);
+    } else {
+      transform_param.add_mean_value(3);
+    }
+    DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+    Caffe::set_random_seed(this->seed_);
+    transformer.InitRand();
+    Blob<TypeParam> expected_blob(num, channels, crop_size, crop_size);
+    transformer.Transform(datum_vector, &expected_blob);
+
+    transform_param.set_device_transform(true);
+    DataTransformer<TypeParam> crop_transformer(transform_param, TRAIN);
+    Caffe::set_random_seed(this->seed_);
+    crop_transformer.InitRand();
+    SyncedMemory crops(expected_blob.count());
+    SyncedMemory plans(num * 3 * sizeof(int));
+    crop_transformer.CropBatch(datum_vector, crop_size, crop_size,
+        static_cast<uint8_t*>(crops.mutable_cpu_data()),
+        static_cast<int*>(plans.mutable_cpu_data()));
+    Blob<TypeParam> blob(num, channels, crop_size, crop_size);
+    crop_transformer.NormalizeCrops_cpu(num, channels, crop_size, crop_size,
+        static_cast<const uint8_t*>(crops.cpu_data()),
+        static_cast<const int*>(plans.cpu_data()), blob.mutable_cpu_data());
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_EQ(expected_blob.cpu_data()[j], blob.cpu_data()[j]);
+    }
+#ifndef CPU_ONLY
+    Blob<TypeParam> gpu_blob(num, channels, crop_size, crop_size);
+    crop_transformer.NormalizeCrops_gpu(num, channels, crop_size, crop_size,
+        static_cast<const uint8_t*>(crops.gpu_data()),
+        static_cast<const int*>(plans.gpu_data()),
+        gpu_blob.mutable_gpu_data());
+    for (int j = 0; j < gpu_blob.count(); ++j) {
+      EXPECT_EQ(expected_blob.cpu_data()[j], gpu_blob.cpu_data()[j]);
+    }
+#endif
+  }
+}
+
 }  // namespace caffe
@@ -10,6 +10,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -23,12 +24,23 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 
  protected:
   GradientBasedSolverTest() :
-      seed_(1701), num_(5), channels_(3), height_(10), width_(10) {}
+      seed_(1701), num_(5), channels_(3), height_(10), width_(10),
+      fused_update_(false), flat_params_(false), snapshot_async_(false),
+      iter_size_(1), clip_gradients_(-1) {}
 
   shared_ptr<SGDSolver<Dtype> > solver_;
   int seed_;
   int num_, channels_, height_, width_;
-  Dtype delta_;  // Stability constant for AdaGrad.
+  bool fused_update_;  // Whether to run the single-pass solver update.
+  bool flat_params_;  // Whether the net keeps its params in one arena.
+  // If set, snapshot asynchronously to this prefix after the last iteration.
+  string snapshot_prefix_;
+  bool snapshot_async_;
+  int iter_size_;  // The number of passes accumulated per iteration.
+  Dtype clip_gradients_;  // The L2 norm to clip the gradients to, if >= 0.
+  // If set, resume from this solver state instead of starting afresh.
+  string resume_file_;
+  Dtype delta_;  // Stability constant for AdaGrad, RMSProp and Adam.
 
   virtual SolverParameter_SolverType solver_type() = 0;
   virtual void InitSolver(const SolverParameter& param) = 0;
@@ -51,7 +63,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
         LOG(FATAL) << "Unknown Caffe mode: " << Caffe::mode();
     }
     InitSolver(param);
-    delta_ = (solver_type() == SolverParameter_SolverType_ADAGRAD) ?
+    delta_ = (solver_type() == SolverParameter_SolverType_ADAGRAD ||
+              solver_type() == SolverParameter_SolverType_RMSPROP ||
+              solver_type() == SolverParameter_SolverType_ADAM) ?
          param.delta() : 0;
   }
 
@@ -64,6 +78,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "lr_policy: 'fixed' "
        "net_param { "
        "  name: 'TestNetwork' "
+       "  flat_params: " << (flat_params_ ? "true " : "false ") <<
        "  layer { "
        "    name: 'data' "
        "    type: 'DummyData' "
@@ -113,6 +128,83 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (fused_update_) {
+      proto << "fused_update: true ";
+    }
+    if (iter_size_ != 1) {
+      proto << "iter_size: " << iter_size_ << " ";
+    }
+    if (clip_gradients_ >= 0) {
+      proto << "clip_gradients: " << clip_gradients_ << " ";
+    }
+    if (!snapshot_prefix_.empty()) {
+      proto << "snapshot: " << num_iters << " "
+            << "snapshot_prefix: '" << snapshot_prefix_ << "' "
+            << "snapshot_async: " << (snapshot_async_ ? "true " : "false ");
+    }
+    Caffe::set_random_seed(this->seed_);
+    this->InitSolverFromProtoString(proto.str());
+    this->solver_->Solve(resume_file_.empty() ? NULL : resume_file_.c_str());
+  }
+
+  // Trains a least squares net on the HDF5 test data with solver_threads
+  // replicas, each reading batches of batch_size samples.
+  void RunHDF5Solver(const int solver_threads, const int batch_size,
+      const int num_iters) {
+    ostringstream proto;
+    proto <<
+       "max_iter: " << num_iters << " "
+       "base_lr: 0.01 "
+       "lr_policy: 'fixed' "
+       "momentum: 0.9 "
+       "weight_decay: 0.001 "
+       "solver_threads: " << solver_threads << " "
+       "net_param { "
+       "  name: 'TestNetwork' "
+       "  layer { "
+       "    name: 'data' "
+       "    type: 'HDF5Data' "
+       "    hdf5_data_param { "
+       "      source: '" CMAKE_SOURCE_DIR
+           "caffe/test/test_data/sample_data_list.txt" CMAKE_EXT "' "
+       "      batch_size: " << batch_size << " "
+       "    } "
+       "    top: 'data' "
+       "    top: 'label' "
+       "  } "
+       "  layer { "
+       "    name: 'scale' "
+       "    type: 'Power' "
+       "    power_param { "
+       "      scale: 0.001 "
+       "    } "
+       "    bottom: 'data' "
+       "    top: 'scaled' "
+       "  } "
+       "  layer { "
+       "    name: 'innerprod' "
+       "    type: 'InnerProduct' "
+       "    inner_product_param { "
+       "      num_output: 1 "
+       "      weight_filler { "
+       "        type: 'gaussian' "
+       "        std: 0.1 "
+       "      } "
+       "      bias_filler { "
+       "        type: 'gaussian' "
+       "        std: 0.1 "
+       "      } "
+       "    } "
+       "    bottom: 'scaled' "
+       "    top: 'innerprod' "
+       "  } "
+       "  layer { "
+       "    name: 'loss' "
+       "    type: 'EuclideanLoss' "
+       "    bottom: 'innerprod' "
+       "    bottom: 'label' "
+       "  } "
+       "} ";
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     this->solver_->Solve();
@@ -123,7 +215,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // updated_params will store the updated weight and bias results,
   // using the blobs' diffs to hold the update values themselves.
   void ComputeLeastSquaresUpdate(const Dtype learning_rate,
-      const Dtype weight_decay, const Dtype momentum,
+      const Dtype weight_decay, const Dtype momentum, const int num_iters,
       vector<shared_ptr<Blob<Dtype> > >* updated_params) {
     const int N = num_;
     const int D = channels_ * height_ * width_;
@@ -189,7 +281,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
           ((i == D) ? bias.cpu_data()[0] : weights.cpu_data()[i]);
       // Finally, compute update.
       const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
-      ASSERT_EQ(2, history.size());  // 1 blob for weights, 1 for bias
+      if (solver_type() == SolverParameter_SolverType_ADAM) {
+        // First and second moments, for the weights and the bias
+        ASSERT_EQ(4, history.size());
+      } else {
+        ASSERT_EQ(2, history.size());  // 1 blob for weights, 1 for bias
+      }
       Dtype update_value = learning_rate * grad;
       const Dtype history_value = (i == D) ?
             history[1]->cpu_data()[0] : history[0]->cpu_data()[i];
@@ -206,6 +303,25 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       case SolverParameter_SolverType_ADAGRAD:
         update_value /= std::sqrt(history_value + grad * grad) + delta_;
         break;
+      case SolverParameter_SolverType_RMSPROP: {
+        const Dtype rms_decay = SolverParameter().rms_decay();
+        update_value /= std::sqrt(rms_decay * history_value +
+            grad * grad * (1 - rms_decay)) + delta_;
+        break;
+      }
+      case SolverParameter_SolverType_ADAM: {
+        const Dtype momentum2 = SolverParameter().momentum2();
+        const Dtype m = history_value;
+        const Dtype v = (i == D) ?
+            history[3]->cpu_data()[0] : history[2]->cpu_data()[i];
+        const Dtype val_m = (1 - momentum) * grad + momentum * m;
+        const Dtype val_v = (1 - momentum2) * grad * grad + momentum2 * v;
+        const Dtype alpha_t = learning_rate *
+            std::sqrt(Dtype(1) - pow(momentum2, num_iters + 1)) /
+            (Dtype(1) - pow(momentum, num_iters + 1));
+        update_value = alpha_t * val_m / (std::sqrt(val_v) + delta_);
+        break;
+      }
       default:
         LOG(FATAL) << "Unknown solver type: " << solver_type();
       }
@@ -294,7 +410,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     // Compute the (K+1)th update using the analytic least squares gradient.
     vector<shared_ptr<Blob<Dtype> > > updated_params;
     ComputeLeastSquaresUpdate(learning_rate, weight_decay, momentum,
-                              &updated_params);
+                              iter_to_check, &updated_params);
 
     // Reinitialize the solver and run K+1 solver iterations.
     RunLeastSquaresSolver(learning_rate, weight_decay, momentum,
@@ -372,6 +488,163 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingFused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->fused_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestFusedUpdateAccumClip) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->iter_size_ = 2;
+  this->clip_gradients_ = 0.5;
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+  vector<shared_ptr<Blob<Dtype> > > expected_params;
+  const vector<shared_ptr<Blob<Dtype> > >& params =
+      this->solver_->net()->params();
+  for (int i = 0; i < params.size(); ++i) {
+    expected_params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    expected_params[i]->CopyFrom(*params[i], false, true);
+  }
+
+  // The fused update clips and accumulates the same, in a single pass.
+  this->fused_update_ = true;
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+  const vector<shared_ptr<Blob<Dtype> > >& fused_params =
+      this->solver_->net()->params();
+  ASSERT_EQ(expected_params.size(), fused_params.size());
+  for (int i = 0; i < fused_params.size(); ++i) {
+    for (int j = 0; j < fused_params[i]->count(); ++j) {
+      const Dtype expected = expected_params[i]->cpu_data()[j];
+      EXPECT_NEAR(expected, fused_params[i]->cpu_data()[j],
+                  1e-5 * std::max(Dtype(1), fabs(expected)));
+      // and leaves the diffs zeroed for the next iteration.
+      EXPECT_EQ(0, fused_params[i]->cpu_diff()[j]);
+    }
+  }
+  // So there are no diffs for snapshot_diff to save.
+  SolverParameter param;
+  param.set_fused_update(true);
+  param.set_snapshot_diff(true);
+  EXPECT_DEATH(this->InitSolver(param), "snapshot_diff");
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingFlat) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->flat_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 3;
+  string snapshot_dir;
+  MakeTempDir(&snapshot_dir);
+  this->snapshot_prefix_ = snapshot_dir + "/snapshot";
+  this->snapshot_async_ = true;
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+  // Solve waits for the snapshot, which was taken after the last update.
+  ostringstream filename;
+  filename << this->snapshot_prefix_ << "_iter_" << kNumIters;
+  const string model_filename = filename.str() + ".caffemodel";
+  NetParameter net_param;
+  ReadProtoFromBinaryFileOrDie(model_filename, &net_param);
+  SolverState state;
+  ReadProtoFromBinaryFileOrDie(filename.str() + ".solverstate", &state);
+  EXPECT_EQ(kNumIters, state.iter());
+  EXPECT_EQ(model_filename, state.learned_net());
+  // The files match what a synchronous snapshot would write.
+  NetParameter expected_net_param;
+  this->solver_->net()->ToProto(&expected_net_param);
+  EXPECT_EQ(expected_net_param.SerializeAsString(),
+            net_param.SerializeAsString());
+  const vector<shared_ptr<Blob<Dtype> > >& history = this->solver_->history();
+  ASSERT_EQ(history.size(), state.history_size());
+  for (int i = 0; i < history.size(); ++i) {
+    BlobProto expected_history;
+    history[i]->ToProto(&expected_history);
+    EXPECT_EQ(expected_history.SerializeAsString(),
+              state.history(i).SerializeAsString());
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestSolverThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // solver_threads only runs on the CPU.
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  const int kNumIters = 5;
+  const int kNumThreads = 3;
+  const int kBatchSize = 2;
+  // A single thread training on the samples of all the replicas at once
+  // computes the same average gradients.
+  this->RunHDF5Solver(1, kNumThreads * kBatchSize, kNumIters);
+  vector<shared_ptr<Blob<Dtype> > > expected_params;
+  const vector<shared_ptr<Blob<Dtype> > >& params =
+      this->solver_->net()->params();
+  for (int i = 0; i < params.size(); ++i) {
+    expected_params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    expected_params[i]->CopyFrom(*params[i], false, true);
+  }
+  Blob<Dtype> expected_label;
+  expected_label.CopyFrom(*this->solver_->net()->blob_by_name("label"), false,
+                          true);
+
+  this->RunHDF5Solver(kNumThreads, kBatchSize, kNumIters);
+  const vector<shared_ptr<Net<Dtype> > >& worker_nets =
+      this->solver_->worker_nets();
+  ASSERT_EQ(kNumThreads - 1, worker_nets.size());
+  // The train net and its replicas read consecutive batches of the single
+  // thread batch, in order.
+  for (int i = 0; i < kNumThreads; ++i) {
+    const Net<Dtype>& net = i == 0 ? *this->solver_->net() :
+        *worker_nets[i - 1];
+    const Blob<Dtype>& label = *net.blob_by_name("label");
+    ASSERT_EQ(kBatchSize, label.num());
+    for (int j = 0; j < kBatchSize; ++j) {
+      EXPECT_EQ(expected_label.cpu_data()[i * kBatchSize + j],
+                label.cpu_data()[j]);
+    }
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& threaded_params =
+      this->solver_->net()->params();
+  ASSERT_EQ(expected_params.size(), threaded_params.size());
+  for (int i = 0; i < threaded_params.size(); ++i) {
+    // The replicas share the parameters of the train net.
+    for (int j = 0; j < worker_nets.size(); ++j) {
+      EXPECT_EQ(threaded_params[i]->cpu_data(),
+                worker_nets[j]->params()[i]->cpu_data());
+    }
+    for (int j = 0; j < threaded_params[i]->count(); ++j) {
+      const Dtype expected = expected_params[i]->cpu_data()[j];
+      EXPECT_NEAR(expected, threaded_params[i]->cpu_data()[j],
+                  1e-5 * std::max(Dtype(1), fabs(expected)));
+    }
+  }
+}
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -416,6 +689,19 @@ TYPED_TEST(AdaGradSolverTest, TestAdaGradLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest,
+    TestAdaGradLeastSquaresUpdateWithEverythingFused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->fused_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -482,4 +768,184 @@ TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest,
+    TestNesterovLeastSquaresUpdateWithEverythingFused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->fused_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+
+template <typename TypeParam>
+class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  virtual void InitSolver(const SolverParameter& param) {
+    this->solver_.reset(new RMSPropSolver<Dtype>(param));
+  }
+  virtual SolverParameter_SolverType solver_type() {
+    return SolverParameter_SolverType_RMSPROP;
+  }
+};
+
+TYPED_TEST_CASE(RMSPropSolverTest, TestDtypesAndDevices);
+
+TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdate) {
+  this->TestLeastSquaresUpdate();
+}
+
+TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateLROneTenth) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  this->TestLeastSquaresUpdate(kLearningRate);
+}
+
+TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithWeightDecay) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 1.0;
+  const Dtype kWeightDecay = 0.5;
+  this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay);
+}
+
+TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(RMSPropSolverTest,
+    TestRMSPropLeastSquaresUpdateWithEverythingFused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->fused_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+template <typename TypeParam>
+class AdamSolverTest : public GradientBasedSolverTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  virtual void InitSolver(const SolverParameter& param) {
+    this->solver_.reset(new AdamSolver<Dtype>(param));
+  }
+  virtual SolverParameter_SolverType solver_type() {
+    return SolverParameter_SolverType_ADAM;
+  }
+};
+
+TYPED_TEST_CASE(AdamSolverTest, TestDtypesAndDevices);
+
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdate) {
+  this->TestLeastSquaresUpdate();
+}
+
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateLROneTenth) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  this->TestLeastSquaresUpdate(kLearningRate);
+}
+
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithWeightDecay) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 1.0;
+  const Dtype kWeightDecay = 0.5;
+  this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay);
+}
+
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverything) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(AdamSolverTest,
+    TestAdamLeastSquaresUpdateWithEverythingFused) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->fused_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(AdamSolverTest, TestAdamSnapshotRestore) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 3;
+  string snapshot_dir;
+  MakeTempDir(&snapshot_dir);
+  this->snapshot_prefix_ = snapshot_dir + "/snapshot";
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+  vector<shared_ptr<Blob<Dtype> > > expected_history;
+  const vector<shared_ptr<Blob<Dtype> > >& history = this->solver_->history();
+  for (int i = 0; i < history.size(); ++i) {
+    expected_history.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    expected_history[i]->CopyFrom(*history[i], false, true);
+  }
+  vector<shared_ptr<Blob<Dtype> > > expected_params;
+  const vector<shared_ptr<Blob<Dtype> > >& params =
+      this->solver_->net()->params();
+  for (int i = 0; i < params.size(); ++i) {
+    expected_params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    expected_params[i]->CopyFrom(*params[i], false, true);
+  }
+
+  // Both moments come back from the solver state, to the float precision
+  // of the snapshots.
+  ostringstream resume_file;
+  resume_file << this->snapshot_prefix_ << "_iter_" << kNumIters
+              << ".solverstate";
+  this->snapshot_prefix_.clear();
+  this->resume_file_ = resume_file.str();
+  this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+                              kNumIters);
+  const vector<shared_ptr<Blob<Dtype> > >& restored_history =
+      this->solver_->history();
+  ASSERT_EQ(4, restored_history.size());
+  ASSERT_EQ(expected_history.size(), restored_history.size());
+  for (int i = 0; i < restored_history.size(); ++i) {
+    for (int j = 0; j < restored_history[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(expected_history[i]->cpu_data()[j],
+                      restored_history[i]->cpu_data()[j]);
+    }
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& restored_params =
+      this->solver_->net()->params();
+  for (int i = 0; i < restored_params.size(); ++i) {
+    for (int j = 0; j < restored_params[i]->count(); ++j) {
+      EXPECT_FLOAT_EQ(expected_params[i]->cpu_data()[j],
+                      restored_params[i]->cpu_data()[j]);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,101 @@
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  ImageCacheTest()
+      : image_bytes_(4 * 5 * 3) {}
+
+  cv::Mat MakeImage(const int value) {
+    cv::Mat image(4, 5, CV_8UC3);
+    for (int h = 0; h < image.rows; ++h) {
+      uchar* ptr = image.ptr<uchar>(h);
+      for (int w = 0; w < image.cols * 3; ++w) {
+        ptr[w] = static_cast<uchar>(value);
+      }
+    }
+    return image;
+  }
+
+  const size_t image_bytes_;
+};
+
+TEST_F(ImageCacheTest, TestLookup) {
+  ImageCache cache(10 * image_bytes_);
+  cv::Mat image;
+  EXPECT_FALSE(cache.Lookup("a", &image));
+  cache.Insert("a", MakeImage(7));
+  EXPECT_TRUE(cache.Lookup("a", &image));
+  EXPECT_EQ(4, image.rows);
+  EXPECT_EQ(5, image.cols);
+  EXPECT_EQ(3, image.channels());
+  EXPECT_EQ(7, image.ptr<uchar>(3)[14]);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+  EXPECT_EQ(1, cache.size());
+  EXPECT_EQ(image_bytes_, cache.bytes());
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCache cache(2 * image_bytes_);
+  cv::Mat image;
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  // Touch a, so b is the least recently used.
+  EXPECT_TRUE(cache.Lookup("a", &image));
+  cache.Insert("c", MakeImage(3));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(2 * image_bytes_, cache.bytes());
+  EXPECT_TRUE(cache.Lookup("a", &image));
+  EXPECT_EQ(1, image.ptr<uchar>(0)[0]);
+  EXPECT_FALSE(cache.Lookup("b", &image));
+  EXPECT_TRUE(cache.Lookup("c", &image));
+  EXPECT_EQ(3, image.ptr<uchar>(0)[0]);
+}
+
+TEST_F(ImageCacheTest, TestBudget) {
+  ImageCache cache(image_bytes_ - 1);
+  cv::Mat image;
+  // Too large to ever fit.
+  cache.Insert("a", MakeImage(1));
+  EXPECT_FALSE(cache.Lookup("a", &image));
+  EXPECT_EQ(0, cache.bytes());
+  cache.set_capacity(3 * image_bytes_);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  cache.Insert("c", MakeImage(3));
+  EXPECT_EQ(3, cache.size());
+  // Shrinking evicts the oldest images.
+  cache.set_capacity(image_bytes_);
+  EXPECT_EQ(1, cache.size());
+  EXPECT_TRUE(cache.Lookup("c", &image));
+}
+
+TEST_F(ImageCacheTest, TestKey) {
+  EXPECT_EQ(ImageCache::Key("x.jpg", 0, 0, true),
+      ImageCache::Key("x.jpg", 0, 0, true));
+  EXPECT_NE(ImageCache::Key("x.jpg", 0, 0, true),
+      ImageCache::Key("x.jpg", 0, 0, false));
+  EXPECT_NE(ImageCache::Key("x.jpg", 0, 0, true),
+      ImageCache::Key("x.jpg", 32, 32, true));
+}
+
+TEST_F(ImageCacheTest, TestShared) {
+  shared_ptr<ImageCache> cache = ImageCache::Shared(image_bytes_);
+  EXPECT_EQ(cache.get(), ImageCache::Shared(0).get());
+  EXPECT_GE(cache->capacity(), image_bytes_);
+  ImageCache::Shared(4 * image_bytes_);
+  EXPECT_GE(cache->capacity(), 4 * image_bytes_);
+}
+
+}  // namespace caffe
@@ -6,6 +6,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -85,6 +87,108 @@ TYPED_TEST(InnerProductLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardInt8) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> float_top;
+  float_top.CopyFrom(*this->blob_top_, false, true);
+  // The INT8 engine, with the bottom range calibrated to the filled [0, 1].
+  layer_param.set_type("InnerProduct");
+  inner_product_param->set_engine(InnerProductParameter_Engine_INT8);
+  layer_param.mutable_quantization_param()->set_input_range(1);
+  shared_ptr<Layer<Dtype> > int8_layer =
+      LayerRegistry<Dtype>::CreateLayer(layer_param);
+  ASSERT_TRUE(dynamic_cast<Int8InnerProductLayer<Dtype>*>(int8_layer.get()));
+  int8_layer->blobs() = layer.blobs();
+  int8_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype tolerance = 0.02 * caffe_cpu_amax(float_top.count(),
+      float_top.cpu_data());
+  for (int i = 0; i < float_top.count(); ++i) {
+    EXPECT_NEAR(float_top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+        tolerance);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparse) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_type("InnerProduct");
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  inner_product_param->set_engine(InnerProductParameter_Engine_SPARSE);
+  inner_product_param->set_sparse_threshold(1.2);
+  // Single weights, and 2x2 blocks of the 10 x 60 weights, for a batch of
+  // two and of one.
+  for (int block = 1; block <= 2; ++block) {
+    inner_product_param->set_sparse_block(block);
+    for (int num = 2; num >= 1; --num) {
+      this->blob_bottom_->Reshape(num, 3, 4, 5);
+      FillerParameter filler_param;
+      UniformFiller<Dtype> filler(filler_param);
+      filler.Fill(this->blob_bottom_);
+      shared_ptr<Layer<Dtype> > layer =
+          LayerRegistry<Dtype>::CreateLayer(layer_param);
+      SparseInnerProductLayer<Dtype>* sparse_layer =
+          dynamic_cast<SparseInnerProductLayer<Dtype>*>(layer.get());
+      ASSERT_TRUE(sparse_layer);
+      layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      EXPECT_GT(sparse_layer->density(), 0.1);
+      EXPECT_LT(sparse_layer->density(), 0.9);
+      // The pruned weights are zeroed, so the dense layer sharing them
+      // computes the same.
+      const Blob<Dtype>& weights = *layer->blobs()[0];
+      int num_nonzero = 0;
+      for (int i = 0; i < weights.count(); ++i) {
+        num_nonzero += weights.cpu_data()[i] != 0;
+      }
+      EXPECT_NEAR(sparse_layer->density() * weights.count(), num_nonzero,
+          1e-3);
+      Blob<Dtype> sparse_top;
+      sparse_top.CopyFrom(*this->blob_top_, false, true);
+      InnerProductLayer<Dtype> dense_layer(layer_param);
+      dense_layer.blobs() = layer->blobs();
+      dense_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      dense_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < sparse_top.count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i], sparse_top.cpu_data()[i],
+            1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestGradientSparse) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  inner_product_param->set_sparse_threshold(1.2);
+  inner_product_param->set_sparse_block(2);
+  SparseInnerProductLayer<Dtype> layer(layer_param);
+  // The pruned weights do not change the output, so both their numeric and
+  // their computed gradients are zero.
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+  EXPECT_LT(layer.density(), 0.9);
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   bool IS_VALID_CUDA = false;
@@ -3,12 +3,15 @@
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <limits>
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -144,6 +147,160 @@ TYPED_TEST(MathFunctionsTest, TestCopyCPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestQuantizeCPU) {
+  const TypeParam x[] = {0, 0.2, 0.7, -0.7, 2.5, -100, 100};
+  const int8_t expected[] = {0, 1, 4, -4, 13, -127, 127};
+  int8_t y[7];
+  caffe_cpu_quantize<TypeParam>(7, 5, x, y);
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(expected[i], y[i]);
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestS8GemmCPU) {
+  // Sizes that exercise both the blocks of four rows and the remainder.
+  const int M = 3, N = 7, K = 1000;
+  vector<int8_t> A(M * K), B(N * K);
+  for (int i = 0; i < M * K; ++i) {
+    A[i] = static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  for (int i = 0; i < N * K; ++i) {
+    B[i] = static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  const TypeParam a_scale[] = {1, 0.5, 2};
+  const TypeParam b_scale[] = {1, 2, 3, 4, 5, 6, 0.25};
+  TypeParam C[M * N];
+  caffe_cpu_s8gemm<TypeParam>(M, N, K, 0.5, &A[0], a_scale, &B[0], b_scale,
+      C);
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      int32_t sum = 0;
+      for (int k = 0; k < K; ++k) {
+        sum += A[m * K + k] * B[n * K + k];
+      }
+      EXPECT_EQ(TypeParam(0.5) * a_scale[m] * b_scale[n] * sum, C[m * N + n]);
+    }
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestBsrmmCPU) {
+  // 37 columns take every path of the sparse gemm: 32 wide, 4 wide and 1.
+  const int M = 6, K = 8, N = 37;
+  for (int block = 1; block <= 2; ++block) {
+    // A dense matrix with about half of its blocks zero, and its BSR form.
+    vector<TypeParam> A(M * K, 0), values;
+    vector<int> columns, row_ptr(1, 0);
+    for (int r = 0; r < M / block; ++r) {
+      for (int c = 0; c < K / block; ++c) {
+        if (caffe_rng_rand() % 2) {
+          continue;
+        }
+        columns.push_back(c);
+        for (int bi = 0; bi < block; ++bi) {
+          for (int bj = 0; bj < block; ++bj) {
+            const TypeParam value = static_cast<int>(caffe_rng_rand() % 9) - 4;
+            A[(r * block + bi) * K + c * block + bj] = value;
+            values.push_back(value);
+          }
+        }
+      }
+      row_ptr.push_back(columns.size());
+    }
+    ASSERT_GT(values.size(), 0);
+    vector<TypeParam> B(K * N), B_t(M * N), C(M * N), C_t(K * N);
+    caffe_rng_uniform<TypeParam>(B.size(), -1, 1, &B[0]);
+    caffe_rng_uniform<TypeParam>(B_t.size(), -1, 1, &B_t[0]);
+    caffe_rng_uniform<TypeParam>(C.size(), -1, 1, &C[0]);
+    caffe_rng_uniform<TypeParam>(C_t.size(), -1, 1, &C_t[0]);
+    // C = 0.5 * A * B + 2 * C, against the dense gemm, for N columns and for
+    // the single column of the sparse gemv.
+    const int widths[] = {N, 1};
+    for (int w = 0; w < 2; ++w) {
+      const int n = widths[w];
+      vector<TypeParam> expected(C), actual(C);
+      caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasNoTrans, M, n, K, 0.5,
+          &A[0], &B[0], 2, &expected[0]);
+      caffe_cpu_bsrmm<TypeParam>(CblasNoTrans, M, n, K, block, 0.5,
+          &values[0], &columns[0], &row_ptr[0], &B[0], 2, &actual[0]);
+      for (int i = 0; i < M * n; ++i) {
+        EXPECT_NEAR(expected[i], actual[i], 1e-4);
+      }
+    }
+    // C_t = 0.5 * A^T * B_t + 2 * C_t.
+    vector<TypeParam> expected(C_t), actual(C_t);
+    caffe_cpu_gemm<TypeParam>(CblasTrans, CblasNoTrans, K, N, M, 0.5,
+        &A[0], &B_t[0], 2, &expected[0]);
+    caffe_cpu_bsrmm<TypeParam>(CblasTrans, M, N, K, block, 0.5,
+        &values[0], &columns[0], &row_ptr[0], &B_t[0], 2, &actual[0]);
+    for (int i = 0; i < K * N; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-4);
+    }
+    // The values gradient is B_t * B^T at the stored blocks only.
+    vector<TypeParam> product(M * K), gradient(values.size());
+    caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasTrans, M, K, N, 0.5,
+        &B_t[0], &B[0], 0, &product[0]);
+    caffe_cpu_bsr_sddmm<TypeParam>(M, N, K, block, 0.5, &B_t[0], &B[0],
+        &columns[0], &row_ptr[0], 0, &gradient[0]);
+    for (int r = 0; r < M / block; ++r) {
+      for (int i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+        for (int bi = 0; bi < block; ++bi) {
+          for (int bj = 0; bj < block; ++bj) {
+            EXPECT_NEAR(product[(r * block + bi) * K + columns[i] * block + bj],
+                gradient[(i * block + bi) * block + bj], 1e-4);
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(MathFunctionsTest, TestFloat2HalfCPU) {
+  const TypeParam inf = std::numeric_limits<TypeParam>::infinity();
+  // Exact values, the largest half and ties past it, subnormals and the
+  // ties around them, and ties between normal halves, which go to even.
+  const TypeParam x[] = {0, -0., 1, -2, 65504, 65519, 65520, 1e6, -inf,
+      std::pow(2., -14), std::pow(2., -24), std::pow(2., -25),
+      3 * std::pow(2., -26), 1 + std::pow(2., -11), 1 + 3 * std::pow(2., -11)};
+  const uint16_t expected[] = {0x0000, 0x8000, 0x3c00, 0xc000, 0x7bff,
+      0x7bff, 0x7c00, 0x7c00, 0xfc00, 0x0400, 0x0001, 0x0000, 0x0001, 0x3c00,
+      0x3c02};
+  // Three copies, so that vectorized conversions also see a tail.
+  const int n = sizeof(expected) / sizeof(expected[0]);
+  vector<TypeParam> values;
+  for (int i = 0; i < 3; ++i) {
+    values.insert(values.end(), x, x + n);
+  }
+  vector<uint16_t> y(values.size());
+  caffe_cpu_float2half<TypeParam>(values.size(), &values[0], &y[0]);
+  for (int i = 0; i < y.size(); ++i) {
+    EXPECT_EQ(expected[i % n], y[i]) << "value " << values[i];
+  }
+  TypeParam nan = std::numeric_limits<TypeParam>::quiet_NaN();
+  uint16_t half_nan;
+  caffe_cpu_float2half<TypeParam>(1, &nan, &half_nan);
+  EXPECT_EQ(0x7c00, half_nan & 0x7c00);
+  EXPECT_NE(0, half_nan & 0x3ff);
+}
+
+TYPED_TEST(MathFunctionsTest, TestHalfRoundTripCPU) {
+  // Every half but the NaNs converts to a Dtype and back to itself.
+  vector<uint16_t> halves;
+  for (int i = 0; i < 65536; ++i) {
+    if ((i & 0x7c00) != 0x7c00 || (i & 0x3ff) == 0) {
+      halves.push_back(i);
+    }
+  }
+  vector<TypeParam> values(halves.size());
+  caffe_cpu_half2float<TypeParam>(halves.size(), &halves[0], &values[0]);
+  EXPECT_EQ(1, values[0x3c00]);
+  EXPECT_EQ(std::pow(2., -24), values[1]);
+  vector<uint16_t> y(halves.size());
+  caffe_cpu_float2half<TypeParam>(values.size(), &values[0], &y[0]);
+  for (int i = 0; i < halves.size(); ++i) {
+    EXPECT_EQ(halves[i], y[i]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 // TODO: Fix caffe_gpu_hamming_distance and re-enable this test.
@@ -229,6 +386,27 @@ TYPED_TEST(MathFunctionsTest, TestCopyGPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestHalfGPU) {
+  const int n = this->blob_bottom_->count();
+  vector<uint16_t> expected(n);
+  caffe_cpu_float2half(n, this->blob_bottom_->cpu_data(), &expected[0]);
+  SyncedMemory halves(n * sizeof(uint16_t));
+  caffe_gpu_float2half(n, this->blob_bottom_->gpu_data(),
+      static_cast<uint16_t*>(halves.mutable_gpu_data()));
+  const uint16_t* y = static_cast<const uint16_t*>(halves.cpu_data());
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(expected[i], y[i]);
+  }
+  caffe_gpu_half2float(n, static_cast<const uint16_t*>(halves.gpu_data()),
+      this->blob_top_->mutable_gpu_data());
+  vector<TypeParam> expected_values(n);
+  caffe_cpu_half2float(n, &expected[0], &expected_values[0]);
+  const TypeParam* values = this->blob_top_->cpu_data();
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(expected_values[i], values[i]);
+  }
+}
+
 #endif
 
 
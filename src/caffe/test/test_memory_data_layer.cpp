@@ -1,5 +1,6 @@
 #include <opencv2/core/core.hpp>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -132,6 +133,123 @@ TYPED_TEST(MemoryDataLayerTest, TestForward) {
   }
 }
 
+// the input pipeline counters count every delivered batch until cleared
+TYPED_TEST(MemoryDataLayerTest, TestForwardStats) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  BlobShape* data_shape = md_param->add_input_shapes();
+  BlobShape* label_shape = md_param->add_input_shapes();
+
+  data_shape->add_dim(this->batch_size_);
+  data_shape->add_dim(this->channels_);
+  data_shape->add_dim(this->height_);
+  data_shape->add_dim(this->width_);
+  label_shape->add_dim(this->batch_size_);
+  label_shape->add_dim(1);
+  label_shape->add_dim(1);
+  label_shape->add_dim(1);
+  shared_ptr<MemoryDataLayer<Dtype> > layer(
+      new MemoryDataLayer<Dtype>(layer_param));
+  layer->DataLayerSetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(0, layer->stats().batches);
+
+  vector<Dtype*> raw_data;
+  raw_data.push_back(this->data_->mutable_cpu_data());
+  raw_data.push_back(this->labels_->mutable_cpu_data());
+  layer->Reset(raw_data, this->data_->num());
+
+  const int num_batches = 5;
+  for (int i = 0; i < num_batches; ++i) {
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  const DataLayerStats& stats = layer->stats();
+  EXPECT_EQ(num_batches, stats.batches);
+  EXPECT_LE(stats.ready_batches, stats.batches);
+  EXPECT_EQ(num_batches * this->batch_size_, stats.items);
+  const int batch_bytes = (this->data_blob_->count() +
+      this->label_blob_->count()) * sizeof(Dtype);
+  // The GPU path has one more batch prefetched, but not yet counted.
+  EXPECT_GE(stats.bytes_read, num_batches * batch_bytes);
+  EXPECT_GE(stats.wait_ms, 0);
+  EXPECT_GE(stats.read_ms, 0);
+  EXPECT_GE(stats.ItemsPerSecond(), 0);
+
+  layer->ClearStats();
+  EXPECT_EQ(0, layer->stats().batches);
+  EXPECT_EQ(0, layer->stats().items);
+  EXPECT_EQ(0, layer->stats().bytes_read);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(1, layer->stats().batches);
+  EXPECT_EQ(this->batch_size_, layer->stats().items);
+
+  DataLayerStats total;
+  total.Add(stats);
+  total.Add(stats);
+  EXPECT_EQ(2, total.batches);
+  EXPECT_EQ(2 * this->batch_size_, total.items);
+}
+
+// with shuffle, every pass visits each sample once, in a new order
+TYPED_TEST(MemoryDataLayerTest, TestForwardShuffle) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_shuffle(true);
+  BlobShape* data_shape = md_param->add_input_shapes();
+  BlobShape* label_shape = md_param->add_input_shapes();
+
+  data_shape->add_dim(this->batch_size_);
+  data_shape->add_dim(this->channels_);
+  data_shape->add_dim(this->height_);
+  data_shape->add_dim(this->width_);
+  label_shape->add_dim(this->batch_size_);
+  label_shape->add_dim(1);
+  label_shape->add_dim(1);
+  label_shape->add_dim(1);
+  shared_ptr<MemoryDataLayer<Dtype> > layer(
+      new MemoryDataLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  // label each sample by its index
+  const int num = this->data_->num();
+  for (int i = 0; i < num; ++i) {
+    this->labels_->mutable_cpu_data()[i] = i;
+  }
+  vector<Dtype*> raw_data;
+  raw_data.push_back(this->data_->mutable_cpu_data());
+  raw_data.push_back(this->labels_->mutable_cpu_data());
+  layer->Reset(raw_data, num);
+
+  const int sample_size = this->data_->offset(1);
+  vector<vector<int> > orders;
+  for (int pass = 0; pass < 3; ++pass) {
+    vector<int> order;
+    for (int i = 0; i < this->batches_; ++i) {
+      layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int j = 0; j < this->batch_size_; ++j) {
+        const int index = this->label_blob_->cpu_data()[j];
+        order.push_back(index);
+        for (int k = 0; k < sample_size; ++k) {
+          EXPECT_EQ(this->data_->cpu_data()[index * sample_size + k],
+              this->data_blob_->cpu_data()[j * sample_size + k]);
+        }
+      }
+    }
+    vector<int> sorted_order(order);
+    std::sort(sorted_order.begin(), sorted_order.end());
+    for (int i = 0; i < num; ++i) {
+      EXPECT_EQ(i, sorted_order[i]);
+    }
+    orders.push_back(order);
+  }
+  EXPECT_NE(orders[0], orders[1]);
+  EXPECT_NE(orders[1], orders[2]);
+  layer->Release();
+}
+
 /*
 TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
 #include "google/protobuf/text_format.h"
 
 #include "gtest/gtest.h"
@@ -9,6 +12,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -427,7 +431,7 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitDiffDataUnsharedWeightsNet() {
+  virtual void InitDiffDataUnsharedWeightsNet(const bool flat_params = false) {
     const string& proto =
         "name: 'DiffDataUnsharedWeightsNetwork' "
         "layer { "
@@ -486,10 +490,11 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  bottom: 'data2' "
         "  bottom: 'innerproduct2' "
         "} ";
-    InitNetFromProtoString(proto);
+    InitNetFromProtoString(
+        flat_params ? string("flat_params: true ") + proto : proto);
   }
 
-  virtual void InitDiffDataSharedWeightsNet() {
+  virtual void InitDiffDataSharedWeightsNet(const bool flat_params = false) {
     const string& proto =
         "name: 'DiffDataSharedWeightsNetwork' "
         "layer { "
@@ -548,7 +553,8 @@ class NetTest : public MultiDeviceTest<TypeParam> {
         "  bottom: 'data2' "
         "  bottom: 'innerproduct2' "
         "} ";
-    InitNetFromProtoString(proto);
+    InitNetFromProtoString(
+        flat_params ? string("flat_params: true ") + proto : proto);
   }
 
   virtual void InitReshapableNet() {
@@ -619,6 +625,17 @@ class NetTest : public MultiDeviceTest<TypeParam> {
 
 TYPED_TEST_CASE(NetTest, TestDtypesAndDevices);
 
+// Runs the forward pass of an execution context on the current thread.
+template <typename Dtype>
+static void ForwardContext(Net<Dtype>* net, const Caffe::Brew mode,
+    const int device) {
+  Caffe::set_mode(mode);
+  if (mode == Caffe::GPU) {
+    Caffe::SetDevice(device);
+  }
+  net->ForwardPrefilled();
+}
+
 TYPED_TEST(NetTest, TestHasBlob) {
   this->InitTinyNet();
   EXPECT_TRUE(this->net_->has_blob("data"));
@@ -1080,6 +1097,97 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   }
 }
 
+TYPED_TEST(NetTest, TestFlatParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataUnsharedWeightsNet();
+  EXPECT_TRUE(this->net_->flat_params().get() == NULL);
+  const bool kFlatParams = true;
+  this->InitDiffDataUnsharedWeightsNet(kFlatParams);
+  const shared_ptr<Blob<Dtype> >& flat_params = this->net_->flat_params();
+  ASSERT_TRUE(flat_params.get() != NULL);
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  ASSERT_EQ(2, params.size());
+  const vector<int>& offsets = this->net_->param_flat_offsets();
+  ASSERT_EQ(params.size(), offsets.size());
+  EXPECT_EQ(0, offsets[0]);
+  EXPECT_LE(params[0]->count(), offsets[1]);
+  EXPECT_LE(offsets[1] + params[1]->count(), flat_params->count());
+  // The parameters are views into the arenas and kept their values.
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(flat_params->cpu_data() + offsets[i], params[i]->cpu_data());
+    EXPECT_EQ(flat_params->cpu_diff() + offsets[i], params[i]->cpu_diff());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(0.5, params[i]->cpu_data()[j]);
+    }
+  }
+  // Writes through either the arena or a parameter are seen by both.
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  const Dtype sumsq_diff = params[0]->sumsq_diff() + params[1]->sumsq_diff();
+  EXPECT_GT(sumsq_diff, 0);
+  EXPECT_NEAR(sumsq_diff, flat_params->sumsq_diff(), 1e-4 * sumsq_diff);
+  caffe_set(flat_params->count(), Dtype(0), flat_params->mutable_cpu_diff());
+  EXPECT_EQ(0, params[0]->asum_diff());
+  EXPECT_EQ(0, params[1]->asum_diff());
+}
+
+TYPED_TEST(NetTest, TestFlatParamsSharedWeightsUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  const bool kFlatParams = true;
+  this->InitDiffDataSharedWeightsNet(kFlatParams);
+  vector<Blob<Dtype>*> bottom;
+  Blob<Dtype>* ip1_weights = this->net_->layers()[1]->blobs()[0].get();
+  Blob<Dtype>* ip2_weights = this->net_->layers()[2]->blobs()[0].get();
+  // Only the owner is in the arena; the shared blob aliases it.
+  const shared_ptr<Blob<Dtype> >& flat_params = this->net_->flat_params();
+  ASSERT_TRUE(flat_params.get() != NULL);
+  EXPECT_EQ(-1, this->net_->param_flat_offsets()[1]);
+  EXPECT_EQ(flat_params->cpu_data(), ip1_weights->cpu_data());
+  EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
+  EXPECT_EQ(ip1_weights->cpu_diff(), ip2_weights->cpu_diff());
+  this->net_->Forward(bottom);
+  this->net_->Backward();
+  Blob<Dtype> shared_params;
+  const bool reshape = true;
+  const bool copy_diff = false;
+  shared_params.CopyFrom(*ip1_weights, copy_diff, reshape);
+  shared_params.CopyFrom(*ip1_weights, !copy_diff, reshape);
+  const int count = ip1_weights->count();
+  caffe_axpy(count, Dtype(-1), shared_params.cpu_diff(),
+             shared_params.mutable_cpu_data());
+  this->net_->Update();
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(shared_params.cpu_data()[i], ip1_weights->cpu_data()[i]);
+  }
+  // The padding of the arena is untouched.
+  for (int i = count; i < flat_params->count(); ++i) {
+    EXPECT_EQ(0, flat_params->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestBackwardWithSumsqDiff) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  vector<Blob<Dtype>*> bottom;
+  this->net_->Forward(bottom);
+  // The shared weights must be summed only once both layers have written
+  // their diff.
+  const Dtype sumsq_diff = this->net_->BackwardWithSumsqDiff();
+  Dtype expected_sumsq_diff = 0;
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    if (this->net_->param_owners()[i] < 0) {
+      expected_sumsq_diff += params[i]->sumsq_diff();
+    }
+  }
+  EXPECT_GT(expected_sumsq_diff, 0);
+  EXPECT_NEAR(expected_sumsq_diff, sumsq_diff, 1e-5 * expected_sumsq_diff);
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsResume) {
   typedef typename TypeParam::Dtype Dtype;
 
@@ -2159,6 +2267,334 @@ TEST_F(FilterNetTest, TestFilterInOutByExcludeMultiRule) {
   this->RunFilterNetTest(input_proto_test, output_proto_test);
 }
 
+TYPED_TEST(NetTest, TestNetWeightsContexts) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Convolution and inner product layers, two of them sharing their weights,
+  // and an LSTM, whose weights live in its unrolled net.
+  const string proto =
+      "name: 'NetWeightsNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "input: 'x' "
+      "input_shape { dim: 3 dim: 2 dim: 4 } "
+      "input: 'cont' "
+      "input_shape { dim: 3 dim: 2 } "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'innerproduct1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  param { name: 'sharedweights' } "
+      "  bottom: 'conv' "
+      "  top: 'innerproduct1' "
+      "} "
+      "layer { "
+      "  name: 'innerproduct2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  param { name: 'sharedweights' } "
+      "  bottom: 'conv' "
+      "  top: 'innerproduct2' "
+      "} "
+      "layer { "
+      "  name: 'lstm' "
+      "  type: 'LSTM' "
+      "  recurrent_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'uniform' min: -0.5 max: 0.5 } "
+      "    bias_filler { type: 'uniform' min: -0.5 max: 0.5 } "
+      "  } "
+      "  bottom: 'x' "
+      "  bottom: 'cont' "
+      "  top: 'h' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> reference_net(param);
+  NetParameter trained_param;
+  reference_net.ToProto(&trained_param);
+  string filename;
+  MakeTempFilename(&filename);
+  WriteProtoToBinaryFile(trained_param, filename);
+  shared_ptr<const NetWeights<Dtype> > weights(
+      new NetWeights<Dtype>(param, filename));
+  remove(filename.c_str());
+  // The shared inner product weights count once.
+  size_t param_bytes = 0;
+  for (int i = 0; i < reference_net.params().size(); ++i) {
+    param_bytes += reference_net.params()[i]->count() * sizeof(Dtype);
+  }
+  EXPECT_EQ(param_bytes - 6 * 16 * sizeof(Dtype), weights->memory_bytes());
+
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(reference_net.input_blobs()[i]);
+  }
+  Dtype* cont = reference_net.input_blobs()[2]->mutable_cpu_data();
+  for (int i = 0; i < reference_net.input_blobs()[2]->count(); ++i) {
+    cont[i] = i < 2 ? 0 : 1;
+  }
+  reference_net.ForwardPrefilled();
+
+  const int kNumContexts = 3;
+  vector<shared_ptr<Net<Dtype> > > contexts;
+  for (int i = 0; i < kNumContexts; ++i) {
+    contexts.push_back(shared_ptr<Net<Dtype> >(new Net<Dtype>(weights)));
+    Net<Dtype>& context = *contexts.back();
+    EXPECT_TRUE(context.shared_weights() == weights);
+    ASSERT_EQ(weights->net().params().size(), context.params().size());
+    for (int j = 0; j < context.params().size(); ++j) {
+      EXPECT_TRUE(context.params()[j]->data() ==
+                  weights->net().params()[j]->data());
+    }
+    for (int j = 0; j < context.input_blobs().size(); ++j) {
+      context.input_blobs()[j]->CopyFrom(*reference_net.input_blobs()[j]);
+    }
+  }
+  int device = 0;
+#ifndef CPU_ONLY
+  CUDA_CHECK(cudaGetDevice(&device));
+#endif
+  boost::thread_group threads;
+  for (int i = 0; i < kNumContexts; ++i) {
+    threads.create_thread(boost::bind(&ForwardContext<Dtype>,
+        contexts[i].get(), Caffe::mode(), device));
+  }
+  threads.join_all();
+  for (int i = 0; i < kNumContexts; ++i) {
+    ASSERT_EQ(reference_net.num_outputs(), contexts[i]->num_outputs());
+    for (int j = 0; j < reference_net.num_outputs(); ++j) {
+      const Blob<Dtype>& expected = *reference_net.output_blobs()[j];
+      const Blob<Dtype>& actual = *contexts[i]->output_blobs()[j];
+      ASSERT_EQ(expected.count(), actual.count());
+      for (int k = 0; k < expected.count(); ++k) {
+        EXPECT_NEAR(expected.cpu_data()[k], actual.cpu_data()[k],
+            1e-4 * std::max(Dtype(1), std::abs(expected.cpu_data()[k])));
+      }
+    }
+  }
+  // The contexts share the parameter diffs, so they cannot train.
+  EXPECT_DEATH(contexts[0]->Backward(), "only run forward");
+  EXPECT_DEATH(contexts[0]->BackwardWithSumsqDiff(), "only run forward");
+  EXPECT_DEATH(contexts[0]->Update(), "read-only");
+}
+
+TYPED_TEST(NetTest, TestFP16Storage) {
+  typedef typename TypeParam::Dtype Dtype;
+  // An in-place ReLU, a split of conv1 into two branches, a Flatten sharing
+  // its bottom's data and an Eltwise joining the branches.
+  const string proto =
+      "name: 'FP16StorageNetwork' "
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 3 dim: 8 dim: 8 } "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layer { name: 'flat' type: 'Flatten' bottom: 'pool1' top: 'flat' } "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.2 } "
+      "  } "
+      "  bottom: 'flat' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "  bottom: 'conv1' "
+      "  top: 'ip2' "
+      "} "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'ip1' bottom: 'ip2' "
+      "        top: 'sum' } "
+      "layer { name: 'prob' type: 'Softmax' bottom: 'sum' top: 'prob' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> float_net(param);
+  param.set_fp16_storage(true);
+  Net<Dtype> half_net(param);
+  EXPECT_FALSE(float_net.fp16_storage());
+  EXPECT_TRUE(half_net.fp16_storage());
+  // Both nets get the weights as halves, so that they only differ in how
+  // they store the activations.
+  NetParameter weights;
+  float_net.ToProto(&weights);
+  ConvertNetParameterToHalf(&weights);
+  EXPECT_TRUE(weights.layer(0).blobs(0).has_half_data());
+  EXPECT_EQ(0, weights.layer(0).blobs(0).data_size());
+  float_net.CopyTrainedLayersFrom(weights);
+  half_net.CopyTrainedLayersFrom(weights);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  // Forward twice, the second time with the parameters only held as
+  // halves, then with a larger batch.
+  for (int pass = 0; pass < 3; ++pass) {
+    if (pass == 2) {
+      vector<int> shape = float_net.input_blobs()[0]->shape();
+      shape[0] = 3;
+      float_net.input_blobs()[0]->Reshape(shape);
+      half_net.input_blobs()[0]->Reshape(shape);
+    }
+    filler.Fill(float_net.input_blobs()[0]);
+    half_net.input_blobs()[0]->CopyFrom(*float_net.input_blobs()[0]);
+    float_net.ForwardPrefilled();
+    half_net.ForwardPrefilled();
+    const Blob<Dtype>& expected = *float_net.output_blobs()[0];
+    const Blob<Dtype>& actual = *half_net.output_blobs()[0];
+    ASSERT_TRUE(expected.shape() == actual.shape());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], actual.cpu_data()[i], 5e-3);
+    }
+  }
+  // The parameters written after a Forward are the halves, expanded.
+  NetParameter expected_param;
+  float_net.ToProto(&expected_param);
+  NetParameter actual_param;
+  half_net.ToProto(&actual_param);
+  ASSERT_EQ(expected_param.layer_size(), actual_param.layer_size());
+  for (int i = 0; i < expected_param.layer_size(); ++i) {
+    const LayerParameter& expected_layer = expected_param.layer(i);
+    const LayerParameter& actual_layer = actual_param.layer(i);
+    ASSERT_EQ(expected_layer.blobs_size(), actual_layer.blobs_size());
+    for (int j = 0; j < expected_layer.blobs_size(); ++j) {
+      Blob<Dtype> expected_blob;
+      expected_blob.FromProto(expected_layer.blobs(j));
+      Blob<Dtype> actual_blob;
+      actual_blob.FromProto(actual_layer.blobs(j));
+      ASSERT_EQ(expected_blob.count(), actual_blob.count());
+      for (int k = 0; k < expected_blob.count(); ++k) {
+        EXPECT_EQ(expected_blob.cpu_data()[k], actual_blob.cpu_data()[k]);
+      }
+    }
+  }
+  // Neither backward pass may write into the half arena, including the one
+  // clip_gradients runs.
+  EXPECT_DEATH(half_net.Backward(), "only run forward");
+  EXPECT_DEATH(half_net.BackwardWithSumsqDiff(), "only run forward");
+}
+
+TYPED_TEST(NetTest, TestFP16StorageRecurrent) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // The LSTM and its blobs stay in Dtype, the InnerProducts after it not.
+  const string proto =
+      "name: 'FP16StorageRecurrentNetwork' "
+      "input: 'x' "
+      "input_shape { dim: 3 dim: 2 dim: 4 } "
+      "input: 'cont' "
+      "input_shape { dim: 3 dim: 2 } "
+      "layer { "
+      "  name: 'lstm' "
+      "  type: 'LSTM' "
+      "  recurrent_param { "
+      "    num_output: 5 "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "  bottom: 'x' "
+      "  bottom: 'cont' "
+      "  top: 'h' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    axis: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "  bottom: 'h' "
+      "  top: 'ip1' "
+      "} "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    axis: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TEST);
+  Net<Dtype> float_net(param);
+  param.set_fp16_storage(true);
+  Net<Dtype> half_net(param);
+  NetParameter weights;
+  float_net.ToProto(&weights);
+  ConvertNetParameterToHalf(&weights);
+  float_net.CopyTrainedLayersFrom(weights);
+  half_net.CopyTrainedLayersFrom(weights);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int pass = 0; pass < 2; ++pass) {
+    filler.Fill(float_net.input_blobs()[0]);
+    half_net.input_blobs()[0]->CopyFrom(*float_net.input_blobs()[0]);
+    for (int i = 0; i < 6; ++i) {
+      // The first timestep starts the sequences.
+      float_net.input_blobs()[1]->mutable_cpu_data()[i] = i >= 2;
+    }
+    half_net.input_blobs()[1]->CopyFrom(*float_net.input_blobs()[1]);
+    float_net.ForwardPrefilled();
+    half_net.ForwardPrefilled();
+    const Blob<Dtype>& expected = *float_net.output_blobs()[0];
+    const Blob<Dtype>& actual = *half_net.output_blobs()[0];
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], actual.cpu_data()[i], 5e-3);
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestReshape) {
   typedef typename TypeParam::Dtype Dtype;
   // We set up bottom blobs of two different sizes, switch between
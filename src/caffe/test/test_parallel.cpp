@@ -0,0 +1,227 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/solver.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::ostringstream;
+
+namespace caffe {
+
+template <typename Dtype>
+class ShmAllReduceTest : public ::testing::Test {
+ protected:
+  ShmAllReduceTest()
+      : seed_(1701), num_ranks_(3), batch_size_(2), dim_(4), num_iters_(4),
+        timeout_seconds_(60) {}
+
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    // The samples of all the ranks, drawn before any process is forked.
+    Caffe::set_random_seed(seed_);
+    data_.Reshape(num_ranks_ * batch_size_, 1, 1, dim_);
+    labels_.Reshape(num_ranks_ * batch_size_, 1, 1, 1);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&data_);
+    filler.Fill(&labels_);
+  }
+
+  // A solver training a least squares net on batches of batch_size samples
+  // given to its MemoryData layer, with weights drawn from seed.
+  shared_ptr<Solver<Dtype> > MakeSolver(const int batch_size,
+      const int seed) {
+    ostringstream proto;
+    proto <<
+       "max_iter: " << num_iters_ << " "
+       "base_lr: 0.1 "
+       "lr_policy: 'fixed' "
+       "momentum: 0.9 "
+       "weight_decay: 0.01 "
+       "solver_mode: CPU "
+       "snapshot_after_train: false "
+       "net_param { "
+       "  name: 'TestNetwork' "
+       "  layer { "
+       "    name: 'data' "
+       "    type: 'MemoryData' "
+       "    memory_data_param { "
+       "      input_shapes { dim: " << batch_size << " dim: 1 dim: 1 "
+           "dim: " << dim_ << " } "
+       "      input_shapes { dim: " << batch_size << " dim: 1 dim: 1 "
+           "dim: 1 } "
+       "    } "
+       "    top: 'data' "
+       "    top: 'label' "
+       "  } "
+       "  layer { "
+       "    name: 'innerprod' "
+       "    type: 'InnerProduct' "
+       "    inner_product_param { "
+       "      num_output: 1 "
+       "      weight_filler { "
+       "        type: 'gaussian' "
+       "        std: 1.0 "
+       "      } "
+       "      bias_filler { "
+       "        type: 'gaussian' "
+       "        std: 1.0 "
+       "      } "
+       "    } "
+       "    bottom: 'data' "
+       "    top: 'innerprod' "
+       "  } "
+       "  layer { "
+       "    name: 'loss' "
+       "    type: 'EuclideanLoss' "
+       "    bottom: 'innerprod' "
+       "    bottom: 'label' "
+       "  } "
+       "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    Caffe::set_random_seed(seed);
+    return shared_ptr<Solver<Dtype> >(new SGDSolver<Dtype>(param));
+  }
+
+  // Trains solver on the samples [first, first + batch_size).
+  void Train(const shared_ptr<Solver<Dtype> >& solver, const int first,
+      const int batch_size) {
+    MemoryDataLayer<Dtype>* layer = static_cast<MemoryDataLayer<Dtype>*>(
+        solver->net()->layers()[0].get());
+    vector<Dtype*> arrays;
+    arrays.push_back(data_.mutable_cpu_data() + data_.offset(first));
+    arrays.push_back(labels_.mutable_cpu_data() + labels_.offset(first));
+    layer->Reset(arrays, batch_size);
+    solver->Solve();
+    layer->Release();
+  }
+
+  int seed_;
+  int num_ranks_;
+  int batch_size_;
+  int dim_;
+  int num_iters_;
+  // A dead rank fails the test instead of hanging it.
+  int timeout_seconds_;
+  Blob<Dtype> data_;
+  Blob<Dtype> labels_;
+};
+
+TYPED_TEST_CASE(ShmAllReduceTest, TestDtypes);
+
+TYPED_TEST(ShmAllReduceTest, TestMatchesSingleProcess) {
+  ostringstream name;
+  name << "/caffe_test_allreduce_" << getpid();
+  // Every rank trains on its own samples, from its own initial weights which
+  // are replaced by those of rank 0.
+  vector<pid_t> children;
+  for (int rank = 1; rank < this->num_ranks_; ++rank) {
+    const pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+      shared_ptr<Solver<TypeParam> > solver =
+          this->MakeSolver(this->batch_size_, this->seed_ + rank);
+      ShmAllReduce<TypeParam> all_reduce(solver, name.str(), rank,
+          this->num_ranks_, this->timeout_seconds_);
+      this->Train(solver, rank * this->batch_size_, this->batch_size_);
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+  shared_ptr<Solver<TypeParam> > solver =
+      this->MakeSolver(this->batch_size_, this->seed_);
+  {
+    ShmAllReduce<TypeParam> all_reduce(solver, name.str(), 0,
+        this->num_ranks_, this->timeout_seconds_);
+    this->Train(solver, 0, this->batch_size_);
+  }
+  for (int i = 0; i < children.size(); ++i) {
+    int status;
+    ASSERT_EQ(children[i], waitpid(children[i], &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+  }
+
+  // A single process training on the samples of all the ranks at once
+  // computes the same average gradients.
+  shared_ptr<Solver<TypeParam> > reference =
+      this->MakeSolver(this->num_ranks_ * this->batch_size_, this->seed_);
+  this->Train(reference, 0, this->num_ranks_ * this->batch_size_);
+  const vector<shared_ptr<Blob<TypeParam> > >& params =
+      solver->net()->params();
+  const vector<shared_ptr<Blob<TypeParam> > >& expected_params =
+      reference->net()->params();
+  ASSERT_EQ(expected_params.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_EQ(expected_params[i]->count(), params[i]->count());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(expected_params[i]->cpu_data()[j], params[i]->cpu_data()[j],
+                  1e-5);
+    }
+  }
+}
+
+TYPED_TEST(ShmAllReduceTest, TestIgnoresStaleSegment) {
+  ostringstream name;
+  name << "/caffe_test_allreduce_stale_" << getpid();
+  // A rank 0 that dies waiting for its other rank leaves a ready segment.
+  const pid_t crashed = fork();
+  ASSERT_NE(-1, crashed);
+  if (crashed == 0) {
+    shared_ptr<Solver<TypeParam> > solver =
+        this->MakeSolver(this->batch_size_, this->seed_);
+    ShmAllReduce<TypeParam> all_reduce(solver, name.str(), 0, 2,
+        this->timeout_seconds_);
+    _exit(0);
+  }
+  int fd;
+  while ((fd = shm_open(name.str().c_str(), O_RDONLY, 0600)) == -1) {
+    usleep(1000);
+  }
+  close(fd);
+  usleep(100000);
+  kill(crashed, SIGKILL);
+  int status;
+  ASSERT_EQ(crashed, waitpid(crashed, &status, 0));
+  // Rank 1 of the next run starts first and must wait for the new segment.
+  const pid_t child = fork();
+  ASSERT_NE(-1, child);
+  if (child == 0) {
+    shared_ptr<Solver<TypeParam> > solver =
+        this->MakeSolver(this->batch_size_, this->seed_ + 1);
+    ShmAllReduce<TypeParam> all_reduce(solver, name.str(), 1, 2,
+        this->timeout_seconds_);
+    this->Train(solver, this->batch_size_, this->batch_size_);
+    _exit(0);
+  }
+  usleep(100000);
+  shared_ptr<Solver<TypeParam> > solver =
+      this->MakeSolver(this->batch_size_, this->seed_);
+  {
+    ShmAllReduce<TypeParam> all_reduce(solver, name.str(), 0, 2,
+        this->timeout_seconds_);
+    this->Train(solver, 0, this->batch_size_);
+  }
+  ASSERT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+}  // namespace caffe
@@ -0,0 +1,174 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/profiler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ProfilerTest : public ::testing::Test {};
+
+TEST_F(ProfilerTest, TestRingBuffer) {
+  Profiler profiler(3);
+  EXPECT_EQ(3, profiler.capacity());
+  EXPECT_EQ(0, profiler.size());
+  const int first = profiler.RegisterName("first");
+  const int second = profiler.RegisterName("second");
+  EXPECT_NE(first, second);
+  EXPECT_EQ(first, profiler.RegisterName("first"));
+  EXPECT_EQ("second", profiler.name(second));
+  for (int i = 0; i < 5; ++i) {
+    profiler.Record(i % 2 ? second : first, Profiler::SOLVER, i);
+  }
+  // Only the last 3 events are kept, oldest first.
+  EXPECT_EQ(3, profiler.size());
+  const vector<Profiler::Event> events = profiler.events();
+  ASSERT_EQ(3, events.size());
+  for (int i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(i + 2, events[i].start_us);
+    EXPECT_LE(events[i].start_us, events[i].end_us);
+    EXPECT_EQ(i % 2 ? second : first, events[i].name_id);
+    EXPECT_EQ(Profiler::SOLVER, events[i].category);
+  }
+  profiler.Clear();
+  EXPECT_EQ(0, profiler.size());
+  EXPECT_EQ(0, profiler.events().size());
+}
+
+TEST_F(ProfilerTest, TestChromeTrace) {
+  Profiler profiler(4);
+  const int name_id = profiler.RegisterName("conv \"1\"");
+  const int64_t start_us = Profiler::Now();
+  profiler.Record(name_id, Profiler::FORWARD, start_us);
+  std::ostringstream trace;
+  profiler.WriteChromeTrace(&trace);
+  EXPECT_NE(string::npos, trace.str().find("\"traceEvents\""));
+  EXPECT_NE(string::npos, trace.str().find("\"name\": \"conv \\\"1\\\"\""));
+  EXPECT_NE(string::npos, trace.str().find("\"cat\": \"forward\""));
+  EXPECT_NE(string::npos, trace.str().find("\"ph\": \"X\""));
+  std::ostringstream ts;
+  ts << "\"ts\": " << start_us << ",";
+  EXPECT_NE(string::npos, trace.str().find(ts.str()));
+}
+
+template <typename TypeParam>
+class NetProfilerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NetProfilerTest() : proto_(
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 5 dim: 2 dim: 3 dim: 4 } "
+      "    shape { dim: 5 dim: 1 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'innerprod' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 1 "
+      "    weight_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'innerprod' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'innerprod' "
+      "  bottom: 'label' "
+      "} ") {}
+
+  virtual void SetUp() {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto_, &param));
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  string proto_;
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(NetProfilerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NetProfilerTest, TestLayerPasses) {
+  typedef typename TypeParam::Dtype Dtype;
+  shared_ptr<Profiler> profiler(new Profiler(64));
+  this->net_->set_profiler(profiler);
+  EXPECT_EQ(profiler, this->net_->profiler());
+  this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  // Every layer forward, then the backward of those that need it.
+  const vector<Profiler::Event> events = profiler->events();
+  const char* names[] = { "data", "innerprod", "loss", "loss", "innerprod" };
+  ASSERT_EQ(5, events.size());
+  for (int i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(names[i], profiler->name(events[i].name_id));
+    EXPECT_EQ(i < 3 ? Profiler::FORWARD : Profiler::BACKWARD,
+              events[i].category);
+    EXPECT_LE(events[i].start_us, events[i].end_us);
+    if (i > 0) {
+      EXPECT_LE(events[i - 1].end_us, events[i].start_us);
+      EXPECT_EQ(events[0].thread, events[i].thread);
+    }
+  }
+  // Nothing is recorded without a profiler.
+  this->net_->set_profiler(shared_ptr<Profiler>());
+  this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  EXPECT_EQ(5, profiler->size());
+}
+
+TYPED_TEST(NetProfilerTest, TestSolverProfile) {
+  typedef typename TypeParam::Dtype Dtype;
+  string profile_file;
+  MakeTempFilename(&profile_file);
+  std::ostringstream proto;
+  proto << "max_iter: 2 base_lr: 0.01 lr_policy: 'fixed' "
+        << "snapshot_after_train: false profile: true "
+        << "profile_file: '" << profile_file << "' "
+        << "solver_mode: " << (Caffe::mode() == Caffe::CPU ? "CPU" : "GPU")
+        << " net_param { " << this->proto_ << " }";
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+  SGDSolver<Dtype> solver(param);
+  ASSERT_TRUE(solver.profiler().get() != NULL);
+  EXPECT_EQ(solver.profiler(), solver.net()->profiler());
+  solver.Solve();
+  // 2 iterations of 5 layer passes and an update each.
+  const vector<Profiler::Event> events = solver.profiler()->events();
+  EXPECT_EQ(12, events.size());
+  int updates = 0;
+  for (int i = 0; i < events.size(); ++i) {
+    if (events[i].category == Profiler::SOLVER) {
+      EXPECT_EQ("Update", solver.profiler()->name(events[i].name_id));
+      ++updates;
+    }
+  }
+  EXPECT_EQ(2, updates);
+  // The trace is written after solving.
+  std::ifstream file(profile_file.c_str());
+  ASSERT_TRUE(file.is_open());
+  std::ostringstream trace;
+  trace << file.rdbuf();
+  EXPECT_NE(string::npos, trace.str().find("\"name\": \"Update\""));
+  EXPECT_NE(string::npos, trace.str().find("\"name\": \"innerprod\""));
+}
+
+}  // namespace caffe
@@ -0,0 +1,191 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/raw_weights.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RawWeightsTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RawWeightsTest() : seed_(1701) {}
+
+  // A net whose weights are filled by a gaussian with the given std.
+  shared_ptr<Net<Dtype> > MakeNet(const float std, const bool flat_params) {
+    std::ostringstream proto;
+    proto <<
+        "name: 'RawWeightsNetwork' "
+        "flat_params: " << (flat_params ? "true " : "false ") <<
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 2 "
+        "    height: 3 "
+        "    width: 4 "
+        "  } "
+        "  top: 'data' "
+        "} "
+        "layer { "
+        "  name: 'innerproduct' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 7 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: " << std << " "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: " << std << " "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'innerproduct' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    return shared_ptr<Net<Dtype> >(new Net<Dtype>(param));
+  }
+
+  void TestLoad(const bool flat_params) {
+    Caffe::set_random_seed(seed_);
+    shared_ptr<Net<Dtype> > source_net = MakeNet(1, false);
+    NetParameter net_param;
+    source_net->ToProto(&net_param);
+    string filename;
+    MakeTempFilename(&filename);
+    WriteRawWeights(net_param, filename);
+    EXPECT_TRUE(IsRawWeightsFile(filename));
+
+    shared_ptr<Net<Dtype> > net = MakeNet(10, flat_params);
+    net->CopyTrainedLayersFrom(filename);
+    const vector<shared_ptr<Blob<Dtype> > >& source_params =
+        source_net->params();
+    const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+    ASSERT_EQ(source_params.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      ASSERT_EQ(source_params[i]->count(), params[i]->count());
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(static_cast<float>(source_params[i]->cpu_data()[j]),
+                  params[i]->cpu_data()[j]);
+      }
+    }
+    // Training writes to the private pages, never to the file.
+    const Dtype expected_value = params[0]->cpu_data()[0];
+    params[0]->mutable_cpu_data()[0] = expected_value + 1;
+    RawWeights weights(filename);
+    EXPECT_EQ(expected_value, weights.data(0)[0]);
+    remove(filename.c_str());
+  }
+
+  int seed_;
+};
+
+TYPED_TEST_CASE(RawWeightsTest, TestDtypesAndDevices);
+
+TYPED_TEST(RawWeightsTest, TestRoundTrip) {
+  NetParameter net_param;
+  net_param.set_name("net");
+  LayerParameter* layer = net_param.add_layer();
+  layer->set_name("ip");
+  layer->set_type("InnerProduct");
+  BlobProto* weights_proto = layer->add_blobs();
+  weights_proto->mutable_shape()->add_dim(3);
+  weights_proto->mutable_shape()->add_dim(5);
+  for (int i = 0; i < 15; ++i) {
+    weights_proto->add_data(i * 0.25 - 1);
+  }
+  // Old models have 4D shapes, kept as is.
+  BlobProto* bias_proto = layer->add_blobs();
+  bias_proto->set_num(1);
+  bias_proto->set_channels(1);
+  bias_proto->set_height(1);
+  bias_proto->set_width(3);
+  for (int i = 0; i < 3; ++i) {
+    bias_proto->add_data(i + 0.5);
+  }
+  string filename;
+  MakeTempFilename(&filename);
+  WriteRawWeights(net_param, filename);
+  ASSERT_TRUE(IsRawWeightsFile(filename));
+  RawWeights weights(filename);
+  ASSERT_EQ(2, weights.header().blob_size());
+  EXPECT_EQ(15, weights.count(0));
+  EXPECT_EQ(3, weights.count(1));
+  for (int i = 0; i < weights.header().blob_size(); ++i) {
+    EXPECT_EQ(0, reinterpret_cast<size_t>(weights.data(i)) % 64);
+  }
+  NetParameter converted_net_param;
+  RawWeightsToNetParameter(weights, &converted_net_param);
+  EXPECT_EQ(net_param.SerializeAsString(),
+            converted_net_param.SerializeAsString());
+  remove(filename.c_str());
+
+  WriteProtoToBinaryFile(net_param, filename);
+  EXPECT_FALSE(IsRawWeightsFile(filename));
+  remove(filename.c_str());
+}
+
+TYPED_TEST(RawWeightsTest, TestStreamedWrite) {
+  RawWeightsHeader header;
+  header.set_name("features");
+  RawWeightsBlob* entry = header.add_blob();
+  entry->set_layer("fc7");
+  entry->mutable_shape()->add_dim(7);
+  entry->mutable_shape()->add_dim(3);
+  // Empty blobs take no space.
+  header.add_blob()->mutable_shape()->add_dim(0);
+  entry = header.add_blob();
+  entry->set_layer("prob");
+  entry->mutable_shape()->add_dim(5);
+  vector<float> values(26);
+  for (int i = 0; i < values.size(); ++i) {
+    values[i] = i * 0.5 - 3;
+  }
+  string filename;
+  MakeTempFilename(&filename);
+  RawWeightsWriter writer(header, filename);
+  // Pieces that straddle the blobs.
+  writer.Write(&values[0], 4);
+  writer.Write(&values[4], 20);
+  writer.Write(&values[24], 2);
+  writer.Close();
+  RawWeights weights(filename);
+  ASSERT_EQ(3, weights.header().blob_size());
+  EXPECT_EQ(writer.header().SerializeAsString(),
+            weights.header().SerializeAsString());
+  ASSERT_EQ(21, weights.count(0));
+  ASSERT_EQ(0, weights.count(1));
+  ASSERT_EQ(5, weights.count(2));
+  for (int i = 0; i < 21; ++i) {
+    EXPECT_EQ(values[i], weights.data(0)[i]);
+  }
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(values[21 + i], weights.data(2)[i]);
+  }
+  EXPECT_EQ(0, reinterpret_cast<size_t>(weights.data(2)) % 64);
+  remove(filename.c_str());
+}
+
+TYPED_TEST(RawWeightsTest, TestLoad) {
+  this->TestLoad(false);
+}
+
+TYPED_TEST(RawWeightsTest, TestLoadFlatParams) {
+  this->TestLoad(true);
+}
+
+}  // namespace caffe
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/serve.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ServerTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  // A net of batch 4 computing 2 * data + 1 and the sum of data per sample.
+  // Outputs without a batch axis are added by a loss if with_loss.
+  void InitNet(const bool with_loss) {
+    string proto =
+        "name: 'ServeNet' "
+        "input: 'data' "
+        "input_shape { dim: 4 dim: 3 } "
+        "layer { "
+        "  name: 'scale' "
+        "  type: 'Power' "
+        "  bottom: 'data' "
+        "  top: 'out' "
+        "  power_param { scale: 2 shift: 1 } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'data' "
+        "  top: 'sum' "
+        "  inner_product_param { "
+        "    num_output: 1 "
+        "    bias_term: false "
+        "    weight_filler { type: 'constant' value: 1 } "
+        "  } "
+        "} ";
+    if (with_loss) {
+      proto +=
+          "input: 'target' "
+          "input_shape { dim: 4 dim: 3 } "
+          "layer { "
+          "  name: 'loss' "
+          "  type: 'EuclideanLoss' "
+          "  bottom: 'out' "
+          "  bottom: 'target' "
+          "  top: 'loss' "
+          "} ";
+    }
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<float>(param));
+  }
+
+  static void WriteFrame(const int fd, const uint32_t type,
+      const string& payload) {
+    const uint32_t header[2] = { type, static_cast<uint32_t>(payload.size()) };
+    ASSERT_EQ(sizeof(header), write(fd, header, sizeof(header)));
+    ASSERT_EQ(payload.size(), write(fd, payload.data(), payload.size()));
+  }
+
+  static bool ReadFrame(const int fd, uint32_t* type, string* payload) {
+    uint32_t header[2];
+    if (read(fd, header, sizeof(header)) != sizeof(header)) {
+      return false;
+    }
+    *type = header[0];
+    payload->resize(header[1]);
+    return header[1] == 0 ||
+        read(fd, &(*payload)[0], header[1]) == header[1];
+  }
+
+  // The input of the i-th inference request.
+  static vector<float> Sample(const int i) {
+    vector<float> sample(3);
+    sample[0] = i;
+    sample[1] = 0.5 * i;
+    sample[2] = -1;
+    return sample;
+  }
+
+  shared_ptr<Net<float> > net_;
+};
+
+TEST_F(ServerTest, TestBatchedRoundTrip) {
+  InitNet(false);
+  const int num_requests = 6;
+  int requests[2];
+  int responses[2];
+  ASSERT_EQ(0, pipe(requests));
+  ASSERT_EQ(0, pipe(responses));
+  // All the requests are queued before the server starts, so that the first
+  // batch fills up to the batch size of the net and the second holds the
+  // rest, the malformed request and the stats request, in order.
+  for (int i = 0; i < num_requests; ++i) {
+    const vector<float> sample = Sample(i);
+    WriteFrame(requests[1], kServeInfer, string(
+        reinterpret_cast<const char*>(&sample[0]),
+        sample.size() * sizeof(float)));
+  }
+  WriteFrame(requests[1], kServeInfer, string(sizeof(float), '\0'));
+  WriteFrame(requests[1], kServeStats, "");
+  close(requests[1]);
+  {
+    // A deadline long enough that only the batch size and the end of the
+    // input end a batch.
+    Server server(net_.get(), 0, 10000, 0);
+    EXPECT_EQ(4, server.max_batch_size());
+    server.ServeFds(requests[0], responses[1]);
+  }
+  close(requests[0]);
+  close(responses[1]);
+
+  uint32_t type;
+  string payload;
+  for (int i = 0; i < num_requests; ++i) {
+    ASSERT_TRUE(ReadFrame(responses[0], &type, &payload));
+    EXPECT_EQ(kServeInfer, type);
+    // The outputs of the sample, in the order of the net outputs.
+    ASSERT_EQ(4 * sizeof(float), payload.size());
+    const float* output = reinterpret_cast<const float*>(payload.data());
+    const vector<float> sample = Sample(i);
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_FLOAT_EQ(2 * sample[j] + 1, output[j]);
+    }
+    EXPECT_FLOAT_EQ(sample[0] + sample[1] + sample[2], output[3]);
+  }
+  ASSERT_TRUE(ReadFrame(responses[0], &type, &payload));
+  EXPECT_EQ(kServeError, type);
+  EXPECT_EQ("Expected 12 bytes of input, got 4", payload);
+  ASSERT_TRUE(ReadFrame(responses[0], &type, &payload));
+  EXPECT_EQ(kServeStats, type);
+  EXPECT_NE(string::npos, payload.find("\"requests\": 6, \"batches\": 2, "
+      "\"errors\": 1, \"mean_batch_size\": 3,")) << payload;
+  EXPECT_FALSE(ReadFrame(responses[0], &type, &payload));
+  close(responses[0]);
+}
+
+TEST_F(ServerTest, TestRejectsOutputWithoutBatchAxis) {
+  InitNet(true);
+  EXPECT_DEATH(Server(net_.get(), 0, 1, 0), "Output loss of shape");
+}
+
+}  // namespace caffe
@@ -0,0 +1,92 @@
+#include <boost/thread.hpp>
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+// Hit-rate statistics are logged every this many lookups.
+static const size_t kLogInterval = 10000;
+
+ImageCache::ImageCache(size_t capacity_bytes)
+    : capacity_(capacity_bytes), bytes_(0), hits_(0), misses_(0),
+      mutex_(new boost::mutex()) {
+}
+
+ImageCache::~ImageCache() {
+}
+
+shared_ptr<ImageCache> ImageCache::Shared(size_t capacity_bytes) {
+  static boost::mutex shared_mutex;
+  static shared_ptr<ImageCache> shared_cache;
+  boost::mutex::scoped_lock lock(shared_mutex);
+  if (!shared_cache) {
+    shared_cache.reset(new ImageCache(capacity_bytes));
+  } else if (shared_cache->capacity() < capacity_bytes) {
+    shared_cache->set_capacity(capacity_bytes);
+  }
+  return shared_cache;
+}
+
+string ImageCache::Key(const string& filename, const int height,
+    const int width, const bool is_color) {
+  stringstream key;
+  key << filename << ":" << height << "x" << width << ":" << is_color;
+  return key.str();
+}
+
+bool ImageCache::Lookup(const string& key, cv::Mat* image) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  EntryMap::iterator it = entries_.find(key);
+  const bool found = it != entries_.end();
+  if (found) {
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    *image = it->second.first;
+  } else {
+    ++misses_;
+  }
+  if ((hits_ + misses_) % kLogInterval == 0) {
+    LogStats();
+  }
+  return found;
+}
+
+void ImageCache::Insert(const string& key, const cv::Mat& image) {
+  const size_t image_bytes = image.total() * image.elemSize();
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (image_bytes > capacity_ || entries_.count(key)) {
+    return;
+  }
+  EvictTo(capacity_ - image_bytes);
+  lru_.push_front(key);
+  // Keep a continuous copy so that the cache owns exactly image_bytes.
+  entries_[key] = std::make_pair(image.clone(), lru_.begin());
+  bytes_ += image_bytes;
+}
+
+void ImageCache::set_capacity(size_t capacity_bytes) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  capacity_ = capacity_bytes;
+  EvictTo(capacity_);
+}
+
+void ImageCache::EvictTo(size_t capacity_bytes) {
+  while (bytes_ > capacity_bytes) {
+    EntryMap::iterator it = entries_.find(lru_.back());
+    bytes_ -= it->second.first.total() * it->second.first.elemSize();
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+void ImageCache::LogStats() {
+  LOG(INFO) << "Image cache: " << hits_ << " hits, " << misses_
+      << " misses (" << 100. * hits_ / (hits_ + misses_) << "% hit rate), "
+      << entries_.size() << " images in " << bytes_ / (1024 * 1024)
+      << " of " << capacity_ / (1024 * 1024) << " MB.";
+}
+
+}  // namespace caffe
@@ -10,12 +10,15 @@
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 
 const int kProtoReadBytesLimit = INT_MAX;  // Max size of 2 GB minus 1 byte.
 
@@ -67,6 +70,112 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+static void ConvertBlobToHalf(BlobProto* blob) {
+  if (blob->has_half_data()) {
+    return;
+  }
+  string* half_data = blob->mutable_half_data();
+  half_data->resize(blob->data_size() * sizeof(uint16_t));
+  caffe_cpu_float2half(blob->data_size(), blob->data().data(),
+      reinterpret_cast<uint16_t*>(&(*half_data)[0]));
+  blob->clear_data();
+}
+
+static void ConvertBlobToFloat(BlobProto* blob) {
+  if (!blob->has_half_data()) {
+    return;
+  }
+  const int count = blob->half_data().size() / sizeof(uint16_t);
+  blob->mutable_data()->Resize(count, 0);
+  caffe_cpu_half2float(count,
+      reinterpret_cast<const uint16_t*>(blob->half_data().data()),
+      blob->mutable_data()->mutable_data());
+  blob->clear_half_data();
+}
+
+static void ConvertBlobToSparse(BlobProto* blob, const float max_density) {
+  if (blob->has_half_data() || blob->sparse_index_size() > 0 ||
+      blob->data_size() == 0) {
+    return;
+  }
+  int num_nonzero = 0;
+  for (int i = 0; i < blob->data_size(); ++i) {
+    num_nonzero += blob->data(i) != 0;
+  }
+  if (num_nonzero > max_density * blob->data_size()) {
+    return;
+  }
+  // Compact the nonzeros to the front of data, in order. A blob of zeros
+  // keeps its first, as no sparse_index would read as a dense blob.
+  int num_values = 0;
+  for (int i = 0; i < blob->data_size(); ++i) {
+    if (blob->data(i) != 0 || (num_nonzero == 0 && i == 0)) {
+      blob->add_sparse_index(i);
+      blob->set_data(num_values++, blob->data(i));
+    }
+  }
+  blob->mutable_data()->Truncate(num_values);
+}
+
+void ConvertNetParameterToHalf(NetParameter* param) {
+  for (int i = 0; i < param->layer_size(); ++i) {
+    for (int j = 0; j < param->layer(i).blobs_size(); ++j) {
+      ConvertBlobToHalf(param->mutable_layer(i)->mutable_blobs(j));
+    }
+  }
+  for (int i = 0; i < param->layers_size(); ++i) {
+    for (int j = 0; j < param->layers(i).blobs_size(); ++j) {
+      ConvertBlobToHalf(param->mutable_layers(i)->mutable_blobs(j));
+    }
+  }
+}
+
+void ConvertNetParameterToFloat(NetParameter* param) {
+  for (int i = 0; i < param->layer_size(); ++i) {
+    for (int j = 0; j < param->layer(i).blobs_size(); ++j) {
+      ConvertBlobToFloat(param->mutable_layer(i)->mutable_blobs(j));
+    }
+  }
+  for (int i = 0; i < param->layers_size(); ++i) {
+    for (int j = 0; j < param->layers(i).blobs_size(); ++j) {
+      ConvertBlobToFloat(param->mutable_layers(i)->mutable_blobs(j));
+    }
+  }
+}
+
+void ConvertNetParameterToSparse(NetParameter* param,
+    const float max_density) {
+  for (int i = 0; i < param->layer_size(); ++i) {
+    for (int j = 0; j < param->layer(i).blobs_size(); ++j) {
+      ConvertBlobToSparse(param->mutable_layer(i)->mutable_blobs(j),
+          max_density);
+    }
+  }
+  for (int i = 0; i < param->layers_size(); ++i) {
+    for (int j = 0; j < param->layers(i).blobs_size(); ++j) {
+      ConvertBlobToSparse(param->mutable_layers(i)->mutable_blobs(j),
+          max_density);
+    }
+  }
+}
+
+string JsonString(const string& s) {
+  std::ostringstream out;
+  out << '"';
+  for (int i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      out << '\\' << s[i];
+    } else if (static_cast<unsigned char>(s[i]) < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(s[i]) << std::dec;
+    } else {
+      out << s[i];
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color) {
   cv::Mat cv_img;
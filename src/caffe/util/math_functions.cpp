@@ -1,3 +1,14 @@
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// The half conversions are compiled for F16C and picked at run time, so the
+// intrinsics are available whatever the target flags.
+#define CAFFE_F16C_DISPATCH
+#endif
+#if defined(CAFFE_F16C_DISPATCH) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
@@ -384,4 +395,533 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <>
+float caffe_cpu_amax<float>(const int n, const float* x) {
+  return n > 0 ? std::fabs(x[cblas_isamax(n, x, 1)]) : 0;
+}
+
+template <>
+double caffe_cpu_amax<double>(const int n, const double* x) {
+  return n > 0 ? std::fabs(x[cblas_idamax(n, x, 1)]) : 0;
+}
+
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype alpha, const Dtype* x,
+    int8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    Dtype value = alpha * x[i];
+    value = value < -127 ? -127 : (value > 127 ? 127 : value);
+    y[i] = static_cast<int8_t>(value + (value < 0 ? -0.5 : 0.5));
+  }
+}
+
+template
+void caffe_cpu_quantize<float>(const int n, const float alpha,
+    const float* x, int8_t* y);
+
+template
+void caffe_cpu_quantize<double>(const int n, const double alpha,
+    const double* x, int8_t* y);
+
+template <typename Dtype>
+void caffe_cpu_quantize_rows(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scale) {
+  for (int r = 0; r < rows; ++r) {
+    const Dtype range = caffe_cpu_amax(cols, x + r * cols);
+    scale[r] = range > 0 ? range / 127 : 1;
+    caffe_cpu_quantize(cols, 1 / scale[r], x + r * cols, y + r * cols);
+  }
+}
+
+template
+void caffe_cpu_quantize_rows<float>(const int rows, const int cols,
+    const float* x, int8_t* y, float* scale);
+
+template
+void caffe_cpu_quantize_rows<double>(const int rows, const int cols,
+    const double* x, int8_t* y, double* scale);
+
+// Sums the products of the K int8 values of a with each of the R rows of b,
+// K values apart, in int32. The values are widened to int16 and multiplied
+// pairwise into int32 lanes, 16 at a time with SSE2 or AVX2 where the target
+// has them, and each load of a serves all R rows.
+template <int R>
+static void caffe_cpu_s8dot(const int K, const int8_t* a, const int8_t* b,
+    int32_t* sum) {
+  int k = 0;
+#if defined(__AVX2__)
+  __m256i acc[R];
+  for (int r = 0; r < R; ++r) {
+    acc[r] = _mm256_setzero_si256();
+  }
+  for (; k + 16 <= K; k += 16) {
+    const __m256i a16 = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k)));
+    for (int r = 0; r < R; ++r) {
+      const __m256i b16 = _mm256_cvtepi8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + r * K + k)));
+      acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(a16, b16));
+    }
+  }
+  for (int r = 0; r < R; ++r) {
+    const __m128i acc4 = _mm_add_epi32(_mm256_castsi256_si128(acc[r]),
+        _mm256_extracti128_si256(acc[r], 1));
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc4);
+    sum[r] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#elif defined(__SSE2__)
+  __m128i acc[R];
+  for (int r = 0; r < R; ++r) {
+    acc[r] = _mm_setzero_si128();
+  }
+  for (; k + 16 <= K; k += 16) {
+    // Interleaving a vector with itself and shifting right sign-extends it.
+    const __m128i a8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+    const __m128i a_lo = _mm_srai_epi16(_mm_unpacklo_epi8(a8, a8), 8);
+    const __m128i a_hi = _mm_srai_epi16(_mm_unpackhi_epi8(a8, a8), 8);
+    for (int r = 0; r < R; ++r) {
+      const __m128i b8 =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + r * K + k));
+      const __m128i b_lo = _mm_srai_epi16(_mm_unpacklo_epi8(b8, b8), 8);
+      const __m128i b_hi = _mm_srai_epi16(_mm_unpackhi_epi8(b8, b8), 8);
+      acc[r] = _mm_add_epi32(acc[r], _mm_add_epi32(
+          _mm_madd_epi16(a_lo, b_lo), _mm_madd_epi16(a_hi, b_hi)));
+    }
+  }
+  for (int r = 0; r < R; ++r) {
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc[r]);
+    sum[r] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#else
+  for (int r = 0; r < R; ++r) {
+    sum[r] = 0;
+  }
+#endif
+  for (; k < K; ++k) {
+    for (int r = 0; r < R; ++r) {
+      sum[r] += static_cast<int32_t>(a[k]) * static_cast<int32_t>(b[r * K + k]);
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_s8gemm(const int M, const int N, const int K,
+    const Dtype alpha, const int8_t* A, const Dtype* a_scale,
+    const int8_t* B, const Dtype* b_scale, Dtype* C) {
+  // 127 * 127 * K must not overflow the int32 accumulators.
+  CHECK_LE(K, 133144) << "The int8 gemm accumulates at most 133144 products.";
+  // Each block of four rows of B is dotted with every row of A while it is
+  // in cache, so B, typically the larger matrix, is read from memory once.
+  int32_t sum[4];
+  int n = 0;
+  for (; n + 4 <= N; n += 4) {
+    for (int m = 0; m < M; ++m) {
+      caffe_cpu_s8dot<4>(K, A + m * K, B + n * K, sum);
+      const Dtype row_alpha = a_scale ? alpha * a_scale[m] : alpha;
+      for (int r = 0; r < 4; ++r) {
+        C[m * N + n + r] = row_alpha * (b_scale ? b_scale[n + r] : 1) * sum[r];
+      }
+    }
+  }
+  for (; n < N; ++n) {
+    for (int m = 0; m < M; ++m) {
+      caffe_cpu_s8dot<1>(K, A + m * K, B + n * K, sum);
+      const Dtype row_alpha = a_scale ? alpha * a_scale[m] : alpha;
+      C[m * N + n] = row_alpha * (b_scale ? b_scale[n] : 1) * sum[0];
+    }
+  }
+}
+
+template
+void caffe_cpu_s8gemm<float>(const int M, const int N, const int K,
+    const float alpha, const int8_t* A, const float* a_scale,
+    const int8_t* B, const float* b_scale, float* C);
+
+template
+void caffe_cpu_s8gemm<double>(const int M, const int N, const int K,
+    const double alpha, const int8_t* A, const double* a_scale,
+    const int8_t* B, const double* b_scale, double* C);
+
+// Sums the products of row bi of the blocks begin to end - 1 of a block row
+// and the W columns of B from b, N apart, into sum.
+template <int W, typename Dtype>
+static inline void caffe_cpu_bsr_row(const int block, const int bi,
+    const int begin, const int end, const Dtype* values, const int* columns,
+    const Dtype* b, const int N, Dtype* sum) {
+  for (int w = 0; w < W; ++w) {
+    sum[w] = 0;
+  }
+  for (int i = begin; i < end; ++i) {
+    const Dtype* a = values + (i * block + bi) * block;
+    const Dtype* b_block = b + columns[i] * block * N;
+    for (int bj = 0; bj < block; ++bj) {
+      for (int w = 0; w < W; ++w) {
+        sum[w] += a[bj] * b_block[bj * N + w];
+      }
+    }
+  }
+}
+
+// Adds a * b to c for W values.
+template <int W, typename Dtype>
+static inline void caffe_cpu_bsr_axpy(const Dtype a, const Dtype* b,
+    Dtype* c) {
+  for (int w = 0; w < W; ++w) {
+    c[w] += a * b[w];
+  }
+}
+
+// The dot product of the n values of a and b.
+template <typename Dtype>
+static inline Dtype caffe_cpu_bsr_dot(const int n, const Dtype* a,
+    const Dtype* b) {
+  Dtype sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#ifdef __SSE2__
+// The float versions keep their sums in SSE registers, which the compiler
+// does not do for the arrays of the generic ones.
+template <>
+inline void caffe_cpu_bsr_row<32, float>(const int block, const int bi,
+    const int begin, const int end, const float* values, const int* columns,
+    const float* b, const int N, float* sum) {
+  __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+  __m128 sum2 = _mm_setzero_ps(), sum3 = _mm_setzero_ps();
+  __m128 sum4 = _mm_setzero_ps(), sum5 = _mm_setzero_ps();
+  __m128 sum6 = _mm_setzero_ps(), sum7 = _mm_setzero_ps();
+  for (int i = begin; i < end; ++i) {
+    const float* a = values + (i * block + bi) * block;
+    const float* b_block = b + columns[i] * block * N;
+    for (int bj = 0; bj < block; ++bj) {
+      const __m128 a4 = _mm_set1_ps(a[bj]);
+      const float* b_row = b_block + bj * N;
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(a4, _mm_loadu_ps(b_row)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 4)));
+      sum2 = _mm_add_ps(sum2, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 8)));
+      sum3 = _mm_add_ps(sum3, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 12)));
+      sum4 = _mm_add_ps(sum4, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 16)));
+      sum5 = _mm_add_ps(sum5, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 20)));
+      sum6 = _mm_add_ps(sum6, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 24)));
+      sum7 = _mm_add_ps(sum7, _mm_mul_ps(a4, _mm_loadu_ps(b_row + 28)));
+    }
+  }
+  _mm_storeu_ps(sum, sum0);
+  _mm_storeu_ps(sum + 4, sum1);
+  _mm_storeu_ps(sum + 8, sum2);
+  _mm_storeu_ps(sum + 12, sum3);
+  _mm_storeu_ps(sum + 16, sum4);
+  _mm_storeu_ps(sum + 20, sum5);
+  _mm_storeu_ps(sum + 24, sum6);
+  _mm_storeu_ps(sum + 28, sum7);
+}
+
+template <>
+inline void caffe_cpu_bsr_row<4, float>(const int block, const int bi,
+    const int begin, const int end, const float* values, const int* columns,
+    const float* b, const int N, float* sum) {
+  __m128 sum0 = _mm_setzero_ps();
+  for (int i = begin; i < end; ++i) {
+    const float* a = values + (i * block + bi) * block;
+    const float* b_block = b + columns[i] * block * N;
+    for (int bj = 0; bj < block; ++bj) {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_set1_ps(a[bj]),
+          _mm_loadu_ps(b_block + bj * N)));
+    }
+  }
+  _mm_storeu_ps(sum, sum0);
+}
+
+template <>
+inline void caffe_cpu_bsr_axpy<16, float>(const float a, const float* b,
+    float* c) {
+  const __m128 a4 = _mm_set1_ps(a);
+  for (int w = 0; w < 16; w += 4) {
+    _mm_storeu_ps(c + w, _mm_add_ps(_mm_loadu_ps(c + w),
+        _mm_mul_ps(a4, _mm_loadu_ps(b + w))));
+  }
+}
+
+template <>
+inline float caffe_cpu_bsr_dot<float>(const int n, const float* a,
+    const float* b) {
+  if (n < 8) {
+    float sum = 0;
+    for (int i = 0; i < n; ++i) {
+      sum += a[i] * b[i];
+    }
+    return sum;
+  }
+  __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),
+        _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+        _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+  float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+#endif  // __SSE2__
+
+template <typename Dtype>
+void caffe_cpu_bsrmm(const CBLAS_TRANSPOSE TransA, const int M, const int N,
+    const int K, const int block, const Dtype alpha, const Dtype* values,
+    const int* columns, const int* row_ptr, const Dtype* B, const Dtype beta,
+    Dtype* C) {
+  CHECK_EQ(M % block, 0) << "The blocks must tile the rows of A.";
+  CHECK_EQ(K % block, 0) << "The blocks must tile the columns of A.";
+  const int block_rows = M / block;
+  if (TransA == CblasNoTrans) {
+    // Each row of C is summed in registers, 32 columns at a time, then 4,
+    // then 1, over the stored values of its row of A, which stay in cache
+    // for the passes over the columns.
+    Dtype sum[32];
+    for (int r = 0; r < block_rows; ++r) {
+      for (int bi = 0; bi < block; ++bi) {
+        Dtype* c = C + (r * block + bi) * N;
+        int n = 0;
+        for (; n + 32 <= N; n += 32) {
+          caffe_cpu_bsr_row<32>(block, bi, row_ptr[r], row_ptr[r + 1],
+              values, columns, B + n, N, sum);
+          for (int w = 0; w < 32; ++w) {
+            c[n + w] = alpha * sum[w] + (beta == 0 ? 0 : beta * c[n + w]);
+          }
+        }
+        for (; n + 4 <= N; n += 4) {
+          caffe_cpu_bsr_row<4>(block, bi, row_ptr[r], row_ptr[r + 1],
+              values, columns, B + n, N, sum);
+          for (int w = 0; w < 4; ++w) {
+            c[n + w] = alpha * sum[w] + (beta == 0 ? 0 : beta * c[n + w]);
+          }
+        }
+        for (; n < N; ++n) {
+          caffe_cpu_bsr_row<1>(block, bi, row_ptr[r], row_ptr[r + 1],
+              values, columns, B + n, N, sum);
+          c[n] = alpha * sum[0] + (beta == 0 ? 0 : beta * c[n]);
+        }
+      }
+    }
+    return;
+  }
+  // A^T scatters: each stored value adds a scaled row of B to a row of C.
+  if (beta == 0) {
+    caffe_set(K * N, Dtype(0), C);
+  } else if (beta != 1) {
+    caffe_scal(K * N, beta, C);
+  }
+  for (int r = 0; r < block_rows; ++r) {
+    for (int i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+      const Dtype* a = values + i * block * block;
+      for (int bi = 0; bi < block; ++bi) {
+        const Dtype* b = B + (r * block + bi) * N;
+        for (int bj = 0; bj < block; ++bj) {
+          const Dtype scale = alpha * a[bi * block + bj];
+          Dtype* c = C + (columns[i] * block + bj) * N;
+          int n = 0;
+          for (; n + 16 <= N; n += 16) {
+            caffe_cpu_bsr_axpy<16>(scale, b + n, c + n);
+          }
+          for (; n < N; ++n) {
+            c[n] += scale * b[n];
+          }
+        }
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_bsrmm<float>(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const int block, const float alpha,
+    const float* values, const int* columns, const int* row_ptr,
+    const float* B, const float beta, float* C);
+
+template
+void caffe_cpu_bsrmm<double>(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const int block, const double alpha,
+    const double* values, const int* columns, const int* row_ptr,
+    const double* B, const double beta, double* C);
+
+template <typename Dtype>
+void caffe_cpu_bsr_sddmm(const int M, const int N, const int K,
+    const int block, const Dtype alpha, const Dtype* D, const Dtype* B,
+    const int* columns, const int* row_ptr, const Dtype beta, Dtype* values) {
+  CHECK_EQ(M % block, 0) << "The blocks must tile the rows of A.";
+  CHECK_EQ(K % block, 0) << "The blocks must tile the columns of A.";
+  const int block_rows = M / block;
+  for (int r = 0; r < block_rows; ++r) {
+    for (int i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+      Dtype* value = values + i * block * block;
+      for (int bi = 0; bi < block; ++bi) {
+        const Dtype* d = D + (r * block + bi) * N;
+        for (int bj = 0; bj < block; ++bj) {
+          const Dtype dot = caffe_cpu_bsr_dot(N, d,
+              B + (columns[i] * block + bj) * N);
+          Dtype* v = value + bi * block + bj;
+          *v = alpha * dot + (beta == 0 ? 0 : beta * *v);
+        }
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_bsr_sddmm<float>(const int M, const int N, const int K,
+    const int block, const float alpha, const float* D, const float* B,
+    const int* columns, const int* row_ptr, const float beta, float* values);
+
+template
+void caffe_cpu_bsr_sddmm<double>(const int M, const int N, const int K,
+    const int block, const double alpha, const double* D, const double* B,
+    const int* columns, const int* row_ptr, const double beta,
+    double* values);
+
+// The bits of float f as a half, rounded to the nearest even.
+static inline uint16_t caffe_float2half_bits(const float f) {
+  union { float f; uint32_t u; } value;
+  value.f = f;
+  const uint32_t sign = (value.u >> 16) & 0x8000;
+  const uint32_t abs = value.u & 0x7fffffff;
+  if (abs > 0x7f800000) {
+    // NaN, kept quiet with the high bits of its payload.
+    return sign | 0x7e00 | ((abs >> 13) & 0x3ff);
+  }
+  if (abs >= 0x477ff000) {
+    // Infinity, or rounds past the largest half, 65504.
+    return sign | 0x7c00;
+  }
+  uint32_t half, rem, tie;
+  if (abs >= 0x38800000) {
+    // Normal half: rebias the exponent from 127 to 15 and drop 13 bits of
+    // the mantissa. A carry out of the mantissa correctly bumps the exponent.
+    half = (abs - 0x38000000) >> 13;
+    rem = abs & 0x1fff;
+    tie = 0x1000;
+  } else if (abs >= 0x33000000) {
+    // Subnormal half, in units of 2^-24.
+    const int shift = 126 - static_cast<int>(abs >> 23);
+    const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    half = mantissa >> shift;
+    rem = mantissa & ((1u << shift) - 1);
+    tie = 1u << (shift - 1);
+  } else {
+    return sign;
+  }
+  if (rem > tie || (rem == tie && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+// The float of the half with bits h, which is always exact.
+static inline float caffe_half2float_bits(const uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  union { float f; uint32_t u; } value;
+  if (exponent == 0x1f) {
+    value.u = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    value.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    value.u = sign;
+  } else {
+    // Subnormal half: normalize the mantissa for the float.
+    exponent = 113;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    value.u = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+  return value.f;
+}
+
+#ifdef CAFFE_F16C_DISPATCH
+static bool caffe_cpu_has_f16c() {
+  static const bool has_f16c = __builtin_cpu_supports("f16c");
+  return has_f16c;
+}
+
+__attribute__((target("avx,f16c")))
+static void caffe_cpu_float2half_f16c(const int n, const float* x,
+    uint16_t* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  for (; i < n; ++i) {
+    y[i] = caffe_float2half_bits(x[i]);
+  }
+}
+
+__attribute__((target("avx,f16c")))
+static void caffe_cpu_half2float_f16c(const int n, const uint16_t* x,
+    float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))));
+  }
+  for (; i < n; ++i) {
+    y[i] = caffe_half2float_bits(x[i]);
+  }
+}
+#endif  // CAFFE_F16C_DISPATCH
+
+template <>
+void caffe_cpu_float2half<float>(const int n, const float* x, uint16_t* y) {
+#ifdef CAFFE_F16C_DISPATCH
+  if (caffe_cpu_has_f16c()) {
+    caffe_cpu_float2half_f16c(n, x, y);
+    return;
+  }
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_float2half_bits(x[i]);
+  }
+}
+
+template <>
+void caffe_cpu_float2half<double>(const int n, const double* x, uint16_t* y) {
+  // Through float, so a double within float precision of the midpoint
+  // between two halves may round the other way.
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_float2half_bits(static_cast<float>(x[i]));
+  }
+}
+
+template <>
+void caffe_cpu_half2float<float>(const int n, const uint16_t* x, float* y) {
+#ifdef CAFFE_F16C_DISPATCH
+  if (caffe_cpu_has_f16c()) {
+    caffe_cpu_half2float_f16c(n, x, y);
+    return;
+  }
+#endif
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_half2float_bits(x[i]);
+  }
+}
+
+template <>
+void caffe_cpu_half2float<double>(const int n, const uint16_t* x, double* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = caffe_half2float_bits(x[i]);
+  }
+}
+
 }  // namespace caffe
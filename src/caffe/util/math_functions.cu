@@ -348,6 +348,53 @@ void caffe_gpu_powx<double>(const int N, const double* a,
       N, a, alpha, y);
 }
 
+// The half conversions of the PTX ISA, rounding to the nearest even, so the
+// kernels match caffe_cpu_float2half and caffe_cpu_half2float on every CUDA
+// version, whatever its half type.
+template <typename Dtype>
+__global__ void float2half_kernel(const int n, const Dtype* x, uint16_t* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const float value = x[index];
+    unsigned short half;  // NOLINT(runtime/int)
+    asm("cvt.rn.f16.f32 %0, %1;" : "=h"(half) : "f"(value));
+    y[index] = half;
+  }
+}
+
+template <typename Dtype>
+__global__ void half2float_kernel(const int n, const uint16_t* x, Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const unsigned short half = x[index];  // NOLINT(runtime/int)
+    float value;
+    asm("cvt.f32.f16 %0, %1;" : "=f"(value) : "h"(half));
+    y[index] = value;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_float2half(const int n, const Dtype* x, uint16_t* y) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  float2half_kernel<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, x, y);
+}
+
+template void caffe_gpu_float2half<float>(const int n, const float* x,
+    uint16_t* y);
+template void caffe_gpu_float2half<double>(const int n, const double* x,
+    uint16_t* y);
+
+template <typename Dtype>
+void caffe_gpu_half2float(const int n, const uint16_t* x, Dtype* y) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  half2float_kernel<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, x, y);
+}
+
+template void caffe_gpu_half2float<float>(const int n, const uint16_t* x,
+    float* y);
+template void caffe_gpu_half2float<double>(const int n, const uint16_t* x,
+    double* y);
+
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sign, y[index] = (Dtype(0) < x[index])
                                       - (x[index] < Dtype(0)));
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sgnbit, y[index] = signbit(x[index]));
@@ -0,0 +1,137 @@
+#include <boost/thread.hpp>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>  // NOLINT(readability/streams)
+#include <numeric>
+#include <ostream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/io.hpp"
+#include "caffe/util/profiler.hpp"
+
+namespace caffe {
+
+Profiler::Profiler(int capacity)
+    : events_(capacity), recorded_(0), names_mutex_(new boost::mutex()) {
+  CHECK_GT(capacity, 0) << "The profiler needs room for at least one event.";
+}
+
+Profiler::~Profiler() {
+}
+
+int64_t Profiler::Now() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+int Profiler::RegisterName(const string& name) {
+  boost::mutex::scoped_lock lock(*names_mutex_);
+  for (int i = 0; i < names_.size(); ++i) {
+    if (names_[i] == name) {
+      return i;
+    }
+  }
+  names_.push_back(name);
+  return names_.size() - 1;
+}
+
+// The number of the calling thread, in the order the threads first record.
+static int ThreadId() {
+  static boost::thread_specific_ptr<int> id;
+  static volatile int num_threads = 0;
+  if (!id.get()) {
+    id.reset(new int(__sync_fetch_and_add(&num_threads, 1)));
+  }
+  return *id;
+}
+
+void Profiler::Record(int name_id, Category category, int64_t start_us) {
+  const int64_t end_us = Now();
+  // Claim a slot; concurrent recorders never share one unless they lap the
+  // whole buffer.
+  const uint64_t slot = __sync_fetch_and_add(&recorded_, 1) % events_.size();
+  Event& event = events_[slot];
+  event.name_id = name_id;
+  event.category = category;
+  event.thread = ThreadId();
+  event.start_us = start_us;
+  event.end_us = end_us;
+}
+
+int Profiler::size() const {
+  const uint64_t recorded = recorded_;
+  return std::min<uint64_t>(recorded, events_.size());
+}
+
+vector<Profiler::Event> Profiler::events() const {
+  const uint64_t recorded = recorded_;
+  const int size = std::min<uint64_t>(recorded, events_.size());
+  vector<Event> events;
+  events.reserve(size);
+  for (uint64_t i = recorded - size; i < recorded; ++i) {
+    events.push_back(events_[i % events_.size()]);
+  }
+  return events;
+}
+
+void Profiler::Clear() {
+  recorded_ = 0;
+}
+
+void Profiler::WriteChromeTrace(std::ostream* out) const {
+  static const char* kCategoryNames[] = { "forward", "backward", "solver" };
+  const vector<Event> events = this->events();
+  const int pid = getpid();
+  *out << "{\"traceEvents\": [";
+  for (int i = 0; i < events.size(); ++i) {
+    const Event& event = events[i];
+    *out << (i ? ",\n" : "\n") << "{\"name\": "
+         << JsonString(names_[event.name_id]) << ", \"cat\": \""
+         << kCategoryNames[event.category] << "\", \"ph\": \"X\", \"ts\": "
+         << event.start_us << ", \"dur\": " << event.end_us - event.start_us
+         << ", \"pid\": " << pid << ", \"tid\": " << event.thread << "}";
+  }
+  *out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+void Profiler::WriteChromeTrace(const string& filename) const {
+  std::ofstream out(filename.c_str());
+  CHECK(out.is_open()) << "Failed to open " << filename;
+  WriteChromeTrace(&out);
+}
+
+// The nearest rank percentile p of the sorted samples.
+static double Percentile(const vector<double>& sorted, const double p) {
+  const int rank = static_cast<int>(std::ceil(p / 100 * sorted.size()));
+  return sorted[std::min(std::max(rank, 1), static_cast<int>(sorted.size()))
+      - 1];
+}
+
+TimeStats ComputeTimeStats(vector<double> samples) {
+  TimeStats stats = {0, 0, 0, 0, 0, 0};
+  if (samples.empty()) {
+    return stats;
+  }
+  std::sort(samples.begin(), samples.end());
+  stats.min = samples.front();
+  stats.max = samples.back();
+  stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) /
+      samples.size();
+  stats.median = Percentile(samples, 50);
+  stats.p90 = Percentile(samples, 90);
+  stats.p99 = Percentile(samples, 99);
+  return stats;
+}
+
+void WriteJsonTimes(std::ostream* out, const TimeStats& stats) {
+  *out << "\"min_ms\": " << stats.min << ", \"mean_ms\": " << stats.mean
+      << ", \"median_ms\": " << stats.median << ", \"p90_ms\": " << stats.p90
+      << ", \"p99_ms\": " << stats.p99 << ", \"max_ms\": " << stats.max;
+}
+
+}  // namespace caffe
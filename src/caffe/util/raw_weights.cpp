@@ -0,0 +1,227 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/util/raw_weights.hpp"
+
+namespace caffe {
+
+static const char kMagic[] = "CAFFERAW";
+static const size_t kMagicSize = 8;
+// The magic, the header size and 4 reserved bytes.
+static const size_t kPreambleSize = 16;
+static const size_t kPageSize = 4096;
+static const size_t kArrayAlignment = 64;
+
+static size_t AlignUp(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+static int ShapeCount(const BlobShape& shape) {
+  int count = 1;
+  for (int i = 0; i < shape.dim_size(); ++i) {
+    count *= shape.dim(i);
+  }
+  return count;
+}
+
+RawWeights::RawWeights(const string& filename)
+    : map_(NULL), map_size_(0), data_offset_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "File not found: " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  map_size_ = file_stat.st_size;
+  CHECK_GE(map_size_, kPreambleSize) << filename
+      << " is not a raw weights file";
+  // Private and writable: the pages are shared until written to.
+  map_ = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(map_ != MAP_FAILED) << "Failed to map " << filename;
+  const char* bytes = static_cast<const char*>(map_);
+  CHECK(std::equal(kMagic, kMagic + kMagicSize, bytes)) << filename
+      << " is not a raw weights file";
+  uint32_t header_size;
+  std::copy(bytes + kMagicSize, bytes + kMagicSize + sizeof(header_size),
+      reinterpret_cast<char*>(&header_size));
+  CHECK_LE(kPreambleSize + header_size, map_size_)
+      << "Truncated raw weights file " << filename;
+  CHECK(header_.ParseFromArray(bytes + kPreambleSize, header_size))
+      << "Failed to parse the header of " << filename;
+  data_offset_ = AlignUp(kPreambleSize + header_size, kPageSize);
+  for (int i = 0; i < header_.blob_size(); ++i) {
+    const size_t end = data_offset_ + header_.blob(i).offset() +
+        count(i) * sizeof(float);
+    CHECK_LE(end, map_size_) << "Truncated raw weights file " << filename;
+  }
+}
+
+RawWeights::~RawWeights() {
+  munmap(map_, map_size_);
+}
+
+float* RawWeights::data(int i) const {
+  return reinterpret_cast<float*>(static_cast<char*>(map_) + data_offset_ +
+      header_.blob(i).offset());
+}
+
+int RawWeights::count(int i) const {
+  return ShapeCount(header_.blob(i).shape());
+}
+
+bool IsRawWeightsFile(const string& filename) {
+  std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+  char magic[kMagicSize];
+  input.read(magic, kMagicSize);
+  return input.good() && std::equal(kMagic, kMagic + kMagicSize, magic);
+}
+
+RawWeightsWriter::RawWeightsWriter(const RawWeightsHeader& header,
+    const string& filename)
+    : header_(header), filename_(filename),
+      output_(filename.c_str(),
+          std::ios::out | std::ios::trunc | std::ios::binary),
+      blob_index_(0), blob_written_(0) {
+  CHECK(output_.is_open()) << "Failed to open " << filename;
+  size_t offset = 0;
+  for (int i = 0; i < header_.blob_size(); ++i) {
+    header_.mutable_blob(i)->set_offset(offset);
+    offset = AlignUp(offset + ShapeCount(header_.blob(i).shape()) *
+        sizeof(float), kArrayAlignment);
+  }
+  string header_string;
+  CHECK(header_.SerializeToString(&header_string));
+  const uint32_t preamble[2] = { static_cast<uint32_t>(header_string.size()),
+      0 };
+  output_.write(kMagic, kMagicSize);
+  output_.write(reinterpret_cast<const char*>(preamble), sizeof(preamble));
+  output_.write(header_string.data(), header_string.size());
+  position_ = kPreambleSize + header_string.size();
+  data_offset_ = AlignUp(position_, kPageSize);
+  NextBlob();
+}
+
+void RawWeightsWriter::NextBlob() {
+  while (blob_index_ < header_.blob_size() &&
+      blob_written_ == ShapeCount(header_.blob(blob_index_).shape())) {
+    ++blob_index_;
+    blob_written_ = 0;
+  }
+  if (blob_index_ < header_.blob_size() && blob_written_ == 0) {
+    static const char padding[kPageSize] = { 0 };
+    const size_t blob_offset = data_offset_ +
+        header_.blob(blob_index_).offset();
+    output_.write(padding, blob_offset - position_);
+    position_ = blob_offset;
+  }
+}
+
+void RawWeightsWriter::Write(const float* data, int count) {
+  while (count > 0) {
+    CHECK_LT(blob_index_, header_.blob_size())
+        << "More values than the header of " << filename_ << " has";
+    const int blob_count = ShapeCount(header_.blob(blob_index_).shape());
+    const int n = std::min(count, blob_count - blob_written_);
+    output_.write(reinterpret_cast<const char*>(data), n * sizeof(float));
+    position_ += n * sizeof(float);
+    blob_written_ += n;
+    data += n;
+    count -= n;
+    NextBlob();
+  }
+}
+
+void RawWeightsWriter::Close() {
+  CHECK_EQ(blob_index_, header_.blob_size())
+      << "Missing values of blob " << blob_index_ << " of " << filename_;
+  output_.close();
+  CHECK(!output_.fail()) << "Failed to write " << filename_;
+}
+
+void WriteRawWeights(const NetParameter& net_param, const string& filename) {
+  RawWeightsHeader header;
+  header.set_name(net_param.name());
+  vector<const BlobProto*> blobs;
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    const LayerParameter& layer = net_param.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const BlobProto& blob = layer.blobs(j);
+      RawWeightsBlob* entry = header.add_blob();
+      entry->set_layer(layer.name());
+      entry->set_layer_type(layer.type());
+      if (blob.has_num() || blob.has_channels() ||
+          blob.has_height() || blob.has_width()) {
+        BlobShape* shape = entry->mutable_shape();
+        shape->add_dim(blob.num());
+        shape->add_dim(blob.channels());
+        shape->add_dim(blob.height());
+        shape->add_dim(blob.width());
+        entry->set_legacy_shape(true);
+      } else {
+        entry->mutable_shape()->CopyFrom(blob.shape());
+      }
+      const int count = ShapeCount(entry->shape());
+      const int data_size = blob.has_half_data() ?
+          blob.half_data().size() / sizeof(uint16_t) : blob.data_size();
+      const int num_values = blob.sparse_index_size() > 0 ?
+          blob.sparse_index_size() : count;
+      CHECK_EQ(data_size, num_values)
+          << "Incorrect data size for blob " << j << " of " << layer.name();
+      blobs.push_back(&blob);
+    }
+  }
+  RawWeightsWriter writer(header, filename);
+  for (int i = 0; i < blobs.size(); ++i) {
+    if (blobs[i]->has_half_data() || blobs[i]->sparse_index_size() > 0) {
+      // Raw weights are mapped straight into float blobs, so halves and
+      // sparse blobs expand.
+      Blob<float> expanded;
+      expanded.FromProto(*blobs[i]);
+      writer.Write(expanded.cpu_data(), expanded.count());
+    } else {
+      writer.Write(blobs[i]->data().data(), blobs[i]->data_size());
+    }
+  }
+  writer.Close();
+}
+
+void RawWeightsToNetParameter(const RawWeights& weights,
+    NetParameter* net_param) {
+  const RawWeightsHeader& header = weights.header();
+  net_param->Clear();
+  net_param->set_name(header.name());
+  LayerParameter* layer = NULL;
+  for (int i = 0; i < header.blob_size(); ++i) {
+    const RawWeightsBlob& entry = header.blob(i);
+    if (!layer || layer->name() != entry.layer()) {
+      layer = net_param->add_layer();
+      layer->set_name(entry.layer());
+      layer->set_type(entry.layer_type());
+    }
+    BlobProto* blob = layer->add_blobs();
+    if (entry.legacy_shape()) {
+      CHECK_EQ(entry.shape().dim_size(), 4);
+      blob->set_num(entry.shape().dim(0));
+      blob->set_channels(entry.shape().dim(1));
+      blob->set_height(entry.shape().dim(2));
+      blob->set_width(entry.shape().dim(3));
+    } else {
+      blob->mutable_shape()->CopyFrom(entry.shape());
+    }
+    const float* data = weights.data(i);
+    blob->mutable_data()->Reserve(weights.count(i));
+    for (int j = 0; j < weights.count(i); ++j) {
+      blob->add_data(data[j]);
+    }
+  }
+}
+
+}  // namespace caffe
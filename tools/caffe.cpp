@@ -1,18 +1,29 @@
 #include <glog/logging.h>
+#include <signal.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <iostream>  // NOLINT(readability/streams)
 #include <map>
 #include <string>
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/profiler.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
+using caffe::ComputeTimeStats;
+using caffe::JsonString;
 using caffe::Net;
 using caffe::Layer;
 using caffe::shared_ptr;
 using caffe::Timer;
+using caffe::TimeStats;
+using caffe::WriteJsonTimes;
 using caffe::vector;
 
 
@@ -29,6 +40,39 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(warmup, 0,
+    "Optional; the number of untimed iterations to run before timing.");
+DEFINE_bool(forward_only, false,
+    "Optional; time only the forward pass, of the TEST phase net.");
+DEFINE_string(format, "",
+    "Optional; also report the timings as 'json' or 'csv'.");
+DEFINE_string(output, "",
+    "Optional; the file to write the json or csv timings to, instead of "
+    "stdout.");
+DEFINE_int32(num_ranks, 1,
+    "Optional; the number of processes training together, each started "
+    "with its own rank and the same shm_name.");
+DEFINE_int32(rank, 0,
+    "Optional; the rank of this process when training with num_ranks > 1. "
+    "Only rank 0 saves snapshots.");
+DEFINE_string(socket, "",
+    "Optional; the Unix socket to serve requests on, instead of stdin and "
+    "stdout.");
+DEFINE_int32(batch_size, 0,
+    "Optional; the most requests served as one batch, by default the batch "
+    "size of the model's inputs.");
+DEFINE_double(batch_deadline_ms, 5,
+    "Optional; how long the first request of a batch waits for others to "
+    "join it, in milliseconds.");
+DEFINE_int32(stats_interval, 60,
+    "Optional; log the serving statistics every this many seconds, 0 to only "
+    "log them at the end.");
+DEFINE_string(shm_name, "/caffe_allreduce",
+    "Optional; the shared memory segment averaging the gradients of the "
+    "num_ranks processes.");
+DEFINE_int32(rank_timeout, 600,
+    "Optional; abort when the other ranks have not caught up after this many "
+    "seconds, e.g. because one of them died.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -104,17 +148,29 @@ int train() {
     Caffe::set_mode(Caffe::CPU);
   }
 
+  CHECK_GE(FLAGS_rank, 0) << "The rank must not be negative.";
+  CHECK_LT(FLAGS_rank, FLAGS_num_ranks) << "The rank must be below num_ranks.";
+  if (FLAGS_num_ranks > 1 && FLAGS_rank > 0) {
+    solver_param.set_snapshot(0);
+    solver_param.set_snapshot_after_train(false);
+  }
+
   LOG(INFO) << "Starting Optimization";
   shared_ptr<caffe::Solver<float> >
     solver(caffe::GetSolver<float>(solver_param));
 
+  if (FLAGS_weights.size()) {
+    LOG(INFO) << "Finetuning from " << FLAGS_weights;
+    solver->net()->CopyTrainedLayersFrom(FLAGS_weights);
+  }
+  shared_ptr<caffe::ShmAllReduce<float> > all_reduce;
+  if (FLAGS_num_ranks > 1) {
+    all_reduce.reset(new caffe::ShmAllReduce<float>(solver, FLAGS_shm_name,
+        FLAGS_rank, FLAGS_num_ranks, FLAGS_rank_timeout));
+  }
   if (FLAGS_snapshot.size()) {
     LOG(INFO) << "Resuming from " << FLAGS_snapshot;
     solver->Solve(FLAGS_snapshot);
-  } else if (FLAGS_weights.size()) {
-    LOG(INFO) << "Finetuning from " << FLAGS_weights;
-    solver->net()->CopyTrainedLayersFrom(FLAGS_weights);
-    solver->Solve();
   } else {
     solver->Solve();
   }
@@ -191,8 +247,85 @@ RegisterBrewFunction(test);
 
 
 // Time: benchmark the execution time of a model.
+
+// What is measured and reported for each layer.
+struct LayerTiming {
+  caffe::string name;
+  caffe::string type;
+  // The bytes of the top blobs the layer computes (not in place) and of its
+  // parameters.
+  size_t activation_bytes;
+  size_t param_bytes;
+  double forward_flops;
+  double backward_flops;
+  vector<double> forward_ms;
+  vector<double> backward_ms;
+};
+
+// The floating point operations of a forward pass of the layers dominated by
+// a matrix product, counting a multiply-add as two. Other layers are reported
+// without FLOPs.
+static double ForwardFlops(Layer<float>* layer,
+    const vector<Blob<float>*>& bottom, const vector<Blob<float>*>& top) {
+  const caffe::string type = layer->type();
+  const bool per_top = (type == "Convolution" || type == "InnerProduct");
+  if (!per_top && type != "Deconvolution") {
+    return 0;
+  }
+  // Every output (or, deconvolving, input) element takes one multiply-add
+  // per weight of its output channel.
+  const Blob<float>& weights = *layer->blobs()[0];
+  const double macs_per_element =
+      static_cast<double>(weights.count()) / weights.shape(0);
+  const vector<Blob<float>*>& blobs = per_top ? top : bottom;
+  double elements = 0;
+  for (int i = 0; i < blobs.size(); ++i) {
+    elements += blobs[i]->count();
+  }
+  return 2 * macs_per_element * elements;
+}
+
+static caffe::string CsvString(const caffe::string& s) {
+  if (s.find_first_of(",\"\n") == caffe::string::npos) {
+    return s;
+  }
+  caffe::string quoted = "\"";
+  for (int i = 0; i < s.size(); ++i) {
+    quoted += (s[i] == '"') ? caffe::string("\"\"") : caffe::string(1, s[i]);
+  }
+  return quoted + "\"";
+}
+
+// The achieved GFLOP/s at the median time, 0 if unknown.
+static double GFlopsPerSecond(const double flops, const TimeStats& stats) {
+  return (flops > 0 && stats.median > 0) ? flops / (stats.median * 1e6) : 0;
+}
+
+static void WriteJsonStats(std::ostream* out, const TimeStats& stats,
+    const double flops) {
+  *out << "{";
+  WriteJsonTimes(out, stats);
+  *out << ", \"flops\": " << flops
+      << ", \"gflops_per_s\": " << GFlopsPerSecond(flops, stats) << "}";
+}
+
+static void WriteCsvRow(std::ostream* out, const caffe::string& scope,
+    const caffe::string& name, const caffe::string& type,
+    const caffe::string& pass, const TimeStats& stats, const double flops,
+    const size_t activation_bytes, const size_t param_bytes) {
+  *out << scope << "," << CsvString(name) << "," << CsvString(type) << ","
+      << pass << "," << stats.min << "," << stats.mean << "," << stats.median
+      << "," << stats.p90 << "," << stats.p99 << "," << stats.max << ","
+      << flops << "," << GFlopsPerSecond(flops, stats) << ","
+      << activation_bytes << "," << param_bytes << "\n";
+}
+
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+  CHECK_GT(FLAGS_iterations, 0) << "Need at least one iteration to time.";
+  CHECK_GE(FLAGS_warmup, 0);
+  CHECK(FLAGS_format.empty() || FLAGS_format == "json" ||
+        FLAGS_format == "csv") << "Unknown format: " << FLAGS_format;
 
   // Set device id and mode
   if (FLAGS_gpu >= 0) {
@@ -203,8 +336,13 @@ int time() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
-  // Instantiate the caffe net.
-  Net<float> caffe_net(FLAGS_model, caffe::TRAIN);
+  // Instantiate the caffe net, as it runs for inference if only timing the
+  // forward pass.
+  const bool backward = !FLAGS_forward_only;
+  Net<float> caffe_net(FLAGS_model, backward ? caffe::TRAIN : caffe::TEST);
+  if (FLAGS_weights.size()) {
+    caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  }
 
   // Do a clean forward and backward pass, so that memory allocation are done
   // and future iterations will be more stable.
@@ -214,28 +352,63 @@ int time() {
   float initial_loss;
   caffe_net.Forward(vector<Blob<float>*>(), &initial_loss);
   LOG(INFO) << "Initial loss: " << initial_loss;
-  LOG(INFO) << "Performing Backward";
-  caffe_net.Backward();
+  if (backward) {
+    LOG(INFO) << "Performing Backward";
+    caffe_net.Backward();
+  }
 
   const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
   const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
   const vector<vector<Blob<float>*> >& top_vecs = caffe_net.top_vecs();
   const vector<vector<bool> >& bottom_need_backward =
       caffe_net.bottom_need_backward();
+  vector<LayerTiming> timings(layers.size());
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerTiming& timing = timings[i];
+    timing.name = layers[i]->layer_param().name();
+    timing.type = layers[i]->type();
+    timing.activation_bytes = 0;
+    for (int j = 0; j < top_vecs[i].size(); ++j) {
+      const Blob<float>* top = top_vecs[i][j];
+      if (std::find(bottom_vecs[i].begin(), bottom_vecs[i].end(), top) ==
+          bottom_vecs[i].end()) {
+        timing.activation_bytes += top->count() * sizeof(float);
+      }
+    }
+    timing.param_bytes = 0;
+    for (int j = 0; j < layers[i]->blobs().size(); ++j) {
+      timing.param_bytes += layers[i]->blobs()[j]->count() * sizeof(float);
+    }
+    timing.forward_flops = ForwardFlops(layers[i].get(), bottom_vecs[i],
+        top_vecs[i]);
+    // The gradients with respect to the weights and to the bottom each cost
+    // as much as the forward pass.
+    timing.backward_flops = 0;
+    if (backward && layers[i]->param_propagate_down(0)) {
+      timing.backward_flops += timing.forward_flops;
+    }
+    if (backward && !bottom_need_backward[i].empty() &&
+        bottom_need_backward[i][0]) {
+      timing.backward_flops += timing.forward_flops;
+    }
+  }
+
   LOG(INFO) << "*** Benchmark begins ***";
-  LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
+  LOG(INFO) << "Warming up for " << FLAGS_warmup << " iterations, testing "
+      "for " << FLAGS_iterations << " iterations.";
   Timer total_timer;
-  total_timer.Start();
   Timer forward_timer;
   Timer backward_timer;
   Timer timer;
-  std::vector<double> forward_time_per_layer(layers.size(), 0.0);
-  std::vector<double> backward_time_per_layer(layers.size(), 0.0);
-  double forward_time = 0.0;
-  double backward_time = 0.0;
-  for (int j = 0; j < FLAGS_iterations; ++j) {
-    Timer iter_timer;
-    iter_timer.Start();
+  vector<double> forward_ms;
+  vector<double> backward_ms;
+  vector<double> forward_backward_ms;
+  for (int j = -FLAGS_warmup; j < FLAGS_iterations; ++j) {
+    // Warmup iterations run exactly as the timed ones, but are not recorded.
+    const bool record = (j >= 0);
+    if (j == 0) {
+      total_timer.Start();
+    }
     forward_timer.Start();
     for (int i = 0; i < layers.size(); ++i) {
       timer.Start();
@@ -243,43 +416,190 @@ int time() {
       // so that we will notice Reshape performance bugs.
       layers[i]->Reshape(bottom_vecs[i], top_vecs[i]);
       layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
-      forward_time_per_layer[i] += timer.MicroSeconds();
+      if (record) {
+        timings[i].forward_ms.push_back(timer.MicroSeconds() / 1000);
+      }
     }
-    forward_time += forward_timer.MicroSeconds();
-    backward_timer.Start();
-    for (int i = layers.size() - 1; i >= 0; --i) {
-      timer.Start();
-      layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
-                          bottom_vecs[i]);
-      backward_time_per_layer[i] += timer.MicroSeconds();
+    const double iter_forward_ms = forward_timer.MicroSeconds() / 1000;
+    double iter_backward_ms = 0;
+    if (backward) {
+      backward_timer.Start();
+      for (int i = layers.size() - 1; i >= 0; --i) {
+        timer.Start();
+        layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
+                            bottom_vecs[i]);
+        if (record) {
+          timings[i].backward_ms.push_back(timer.MicroSeconds() / 1000);
+        }
+      }
+      iter_backward_ms = backward_timer.MicroSeconds() / 1000;
+    }
+    if (record) {
+      forward_ms.push_back(iter_forward_ms);
+      backward_ms.push_back(iter_backward_ms);
+      forward_backward_ms.push_back(iter_forward_ms + iter_backward_ms);
+      LOG(INFO) << "Iteration: " << j + 1 << " forward"
+          << (backward ? "-backward" : "") << " time: "
+          << forward_backward_ms.back() << " ms.";
     }
-    backward_time += backward_timer.MicroSeconds();
-    LOG(INFO) << "Iteration: " << j + 1 << " forward-backward time: "
-      << iter_timer.MilliSeconds() << " ms.";
   }
-  LOG(INFO) << "Average time per layer: ";
+  total_timer.Stop();
+
+  double net_forward_flops = 0;
+  double net_backward_flops = 0;
+  size_t net_activation_bytes = 0;
+  size_t net_param_bytes = 0;
+  vector<TimeStats> forward_stats(layers.size());
+  vector<TimeStats> backward_stats(layers.size());
+  LOG(INFO) << "Time per layer (min / median / p90 / p99 ms), memory and "
+      "achieved GFLOP/s at the median: ";
   for (int i = 0; i < layers.size(); ++i) {
-    const caffe::string& layername = layers[i]->layer_param().name();
-    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
-      "\tforward: " << forward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
-    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername  <<
-      "\tbackward: " << backward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+    const LayerTiming& timing = timings[i];
+    net_forward_flops += timing.forward_flops;
+    net_backward_flops += timing.backward_flops;
+    net_activation_bytes += timing.activation_bytes;
+    net_param_bytes += timing.param_bytes;
+    forward_stats[i] = ComputeTimeStats(timing.forward_ms);
+    backward_stats[i] = ComputeTimeStats(timing.backward_ms);
+    for (int pass = 0; pass < (backward ? 2 : 1); ++pass) {
+      const TimeStats& stats = pass ? backward_stats[i] : forward_stats[i];
+      const double flops = pass ? timing.backward_flops : timing.forward_flops;
+      std::ostringstream gflops;
+      if (flops > 0) {
+        gflops << "\t" << GFlopsPerSecond(flops, stats) << " GFLOP/s";
+      }
+      LOG(INFO) << std::setfill(' ') << std::setw(10) << timing.name
+          << (pass ? "\tbackward: " : "\tforward: ") << stats.min << " / "
+          << stats.median << " / " << stats.p90 << " / " << stats.p99
+          << " ms.\t" << (timing.activation_bytes + timing.param_bytes) / 1024
+          << " KB" << gflops.str();
+    }
   }
-  total_timer.Stop();
-  LOG(INFO) << "Average Forward pass: " << forward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Backward pass: " << backward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
-    FLAGS_iterations << " ms.";
+  const TimeStats net_forward = ComputeTimeStats(forward_ms);
+  const TimeStats net_backward = ComputeTimeStats(backward_ms);
+  const TimeStats net_forward_backward = ComputeTimeStats(forward_backward_ms);
+  LOG(INFO) << "Forward pass: mean " << net_forward.mean << " ms, median "
+      << net_forward.median << " ms, p90 " << net_forward.p90 << " ms, p99 "
+      << net_forward.p99 << " ms.";
+  if (backward) {
+    LOG(INFO) << "Backward pass: mean " << net_backward.mean << " ms, median "
+        << net_backward.median << " ms, p90 " << net_backward.p90
+        << " ms, p99 " << net_backward.p99 << " ms.";
+    LOG(INFO) << "Forward-Backward: mean " << net_forward_backward.mean
+        << " ms, median " << net_forward_backward.median << " ms, p90 "
+        << net_forward_backward.p90 << " ms, p99 "
+        << net_forward_backward.p99 << " ms.";
+  }
+  LOG(INFO) << "Memory: " << net_activation_bytes / 1024 << " KB of "
+      "activations, " << net_param_bytes / 1024 << " KB of parameters.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
   LOG(INFO) << "*** Benchmark ends ***";
+
+  if (FLAGS_format.empty()) {
+    return 0;
+  }
+  std::ofstream file;
+  if (FLAGS_output.size()) {
+    file.open(FLAGS_output.c_str());
+    CHECK(file.is_open()) << "Failed to open " << FLAGS_output;
+  }
+  std::ostream& out = FLAGS_output.size() ? file : std::cout;
+  out << std::setprecision(6);
+  if (FLAGS_format == "json") {
+    out << "{\n  \"model\": " << JsonString(FLAGS_model) << ",\n"
+        << "  \"net\": " << JsonString(caffe_net.name()) << ",\n"
+        << "  \"mode\": \"" << (FLAGS_gpu >= 0 ? "GPU" : "CPU") << "\",\n"
+        << "  \"warmup\": " << FLAGS_warmup << ",\n"
+        << "  \"iterations\": " << FLAGS_iterations << ",\n"
+        << "  \"forward_only\": " << (backward ? "false" : "true") << ",\n"
+        << "  \"activation_bytes\": " << net_activation_bytes << ",\n"
+        << "  \"param_bytes\": " << net_param_bytes << ",\n"
+        << "  \"forward\": ";
+    WriteJsonStats(&out, net_forward, net_forward_flops);
+    if (backward) {
+      out << ",\n  \"backward\": ";
+      WriteJsonStats(&out, net_backward, net_backward_flops);
+      out << ",\n  \"forward_backward\": ";
+      WriteJsonStats(&out, net_forward_backward,
+          net_forward_flops + net_backward_flops);
+    }
+    out << ",\n  \"layers\": [";
+    for (int i = 0; i < layers.size(); ++i) {
+      const LayerTiming& timing = timings[i];
+      out << (i ? ",\n" : "\n") << "    {\"name\": " << JsonString(timing.name)
+          << ", \"type\": " << JsonString(timing.type)
+          << ", \"activation_bytes\": " << timing.activation_bytes
+          << ", \"param_bytes\": " << timing.param_bytes
+          << ",\n     \"forward\": ";
+      WriteJsonStats(&out, forward_stats[i], timing.forward_flops);
+      if (backward) {
+        out << ",\n     \"backward\": ";
+        WriteJsonStats(&out, backward_stats[i], timing.backward_flops);
+      }
+      out << "}";
+    }
+    out << "\n  ]\n}\n";
+  } else {
+    out << "scope,name,type,pass,min_ms,mean_ms,median_ms,p90_ms,p99_ms,"
+        "max_ms,flops,gflops_per_s,activation_bytes,param_bytes\n";
+    WriteCsvRow(&out, "net", caffe_net.name(), "", "forward", net_forward,
+        net_forward_flops, net_activation_bytes, net_param_bytes);
+    if (backward) {
+      WriteCsvRow(&out, "net", caffe_net.name(), "", "backward", net_backward,
+          net_backward_flops, net_activation_bytes, net_param_bytes);
+      WriteCsvRow(&out, "net", caffe_net.name(), "", "forward_backward",
+          net_forward_backward, net_forward_flops + net_backward_flops,
+          net_activation_bytes, net_param_bytes);
+    }
+    for (int i = 0; i < layers.size(); ++i) {
+      const LayerTiming& timing = timings[i];
+      WriteCsvRow(&out, "layer", timing.name, timing.type, "forward",
+          forward_stats[i], timing.forward_flops, timing.activation_bytes,
+          timing.param_bytes);
+      if (backward) {
+        WriteCsvRow(&out, "layer", timing.name, timing.type, "backward",
+            backward_stats[i], timing.backward_flops,
+            timing.activation_bytes, timing.param_bytes);
+      }
+    }
+  }
   return 0;
 }
 RegisterBrewFunction(time);
 
+// Serve: answer inference requests with a model, running the requests that
+// arrive close together as one batch. See caffe/serve.hpp for the protocol.
+int serve() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to serve.";
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Net<float> caffe_net(FLAGS_model, caffe::TEST);
+  if (FLAGS_weights.size()) {
+    caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  }
+  caffe::Server server(&caffe_net, FLAGS_batch_size, FLAGS_batch_deadline_ms,
+      FLAGS_stats_interval);
+  // A client that goes away fails the writes to it instead.
+  signal(SIGPIPE, SIG_IGN);
+  if (FLAGS_socket.empty()) {
+    LOG(INFO) << "Serving " << caffe_net.name() << " on stdin and stdout.";
+    server.ServeFds(STDIN_FILENO, STDOUT_FILENO);
+  } else {
+    LOG(INFO) << "Serving " << caffe_net.name() << " on " << FLAGS_socket;
+    server.ServeSocket(FLAGS_socket);
+  }
+  return 0;
+}
+RegisterBrewFunction(serve);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -290,7 +610,8 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  serve           answer inference requests in batches");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
   if (argc == 2) {
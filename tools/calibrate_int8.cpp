@@ -0,0 +1,130 @@
+// This program calibrates a model for int8 inference: it forwards a sample
+// set through the float model, records the largest absolute value of the
+// bottom of each InnerProduct and Convolution layer, and writes the model
+// definition again with these layers switched to the INT8 engine and their
+// ranges stored in quantization_param. The samples are read by the data
+// layers of the TEST phase, so they should be representative of the inputs
+// the model will see. Check the result with compare_int8.
+// Usage:
+//    calibrate_int8 -model net.prototxt -weights net.caffemodel
+//        -output net_int8.prototxt [-iterations 50] [-layers ip1,ip2]
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::LayerParameter;
+using caffe::Net;
+using caffe::NetParameter;
+using std::string;
+using std::vector;
+
+DEFINE_string(model, "",
+    "The float model definition protocol buffer text file.");
+DEFINE_string(weights, "",
+    "The trained weights of the model.");
+DEFINE_string(output, "",
+    "The calibrated model definition to write.");
+DEFINE_int32(iterations, 50,
+    "The number of mini-batches of samples to calibrate on.");
+DEFINE_string(layers, "",
+    "Optional; a comma separated list of the InnerProduct and Convolution "
+    "layers to switch to int8. By default all of them are.");
+
+static bool IsQuantizable(const string& type) {
+  return type == "InnerProduct" || type == "Convolution";
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Calibrates a model for int8 inference.\n"
+      "Usage: calibrate_int8 -model net.prototxt -weights net.caffemodel "
+      "-output net_int8.prototxt");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need trained weights to calibrate.";
+  CHECK_GT(FLAGS_output.size(), 0) << "Need a file to write the model to.";
+
+  vector<string> layers;
+  if (FLAGS_layers.size()) {
+    boost::split(layers, FLAGS_layers, boost::is_any_of(","));
+  }
+
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(FLAGS_model, caffe::TEST);
+  net.CopyTrainedLayersFrom(FLAGS_weights);
+  CHECK_EQ(net.num_inputs(), 0)
+      << "The model must read its samples through data layers.";
+  vector<bool> calibrate(net.layers().size(), false);
+  for (int i = 0; i < net.layers().size(); ++i) {
+    calibrate[i] = IsQuantizable(net.layers()[i]->type()) &&
+        (layers.empty() || std::find(layers.begin(), layers.end(),
+                                     net.layer_names()[i]) != layers.end());
+  }
+
+  // Forward layer by layer, so each bottom is seen as its layer sees it,
+  // before any later in-place layer changes it.
+  vector<float> ranges(net.layers().size(), 0);
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    for (int i = 0; i < net.layers().size(); ++i) {
+      if (calibrate[i]) {
+        const vector<Blob<float>*>& bottom = net.bottom_vecs()[i];
+        for (int j = 0; j < bottom.size(); ++j) {
+          ranges[i] = std::max(ranges[i], caffe::caffe_cpu_amax(
+              bottom[j]->count(), bottom[j]->cpu_data()));
+        }
+      }
+      net.ForwardFromTo(i, i);
+    }
+  }
+
+  std::map<string, float> layer_ranges;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    if (calibrate[i]) {
+      layer_ranges[net.layer_names()[i]] = ranges[i];
+      LOG(INFO) << net.layer_names()[i] << " input range: " << ranges[i];
+    }
+  }
+  CHECK_GT(layer_ranges.size(), 0) << "There is no layer to calibrate.";
+
+  // Rewrite the original definition rather than the net's, to keep the
+  // layers of every phase.
+  NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    LayerParameter* layer = param.mutable_layer(i);
+    std::map<string, float>::const_iterator range =
+        layer_ranges.find(layer->name());
+    if (range == layer_ranges.end() || !IsQuantizable(layer->type())) {
+      continue;
+    }
+    if (layer->type() == "InnerProduct") {
+      layer->mutable_inner_product_param()->set_engine(
+          caffe::InnerProductParameter_Engine_INT8);
+    } else {
+      layer->mutable_convolution_param()->set_engine(
+          caffe::ConvolutionParameter_Engine_INT8);
+    }
+    layer->mutable_quantization_param()->set_input_range(range->second);
+  }
+  caffe::WriteProtoToTextFile(param, FLAGS_output);
+  LOG(INFO) << "Wrote " << layer_ranges.size() << " int8 layers to "
+      << FLAGS_output;
+  return 0;
+}
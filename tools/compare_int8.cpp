@@ -0,0 +1,168 @@
+// This program checks a model calibrated by calibrate_int8 against its float
+// version. Both nets forward the same samples, read once by the data layers
+// of the float net, and the relative error of the int8 outputs,
+// ||int8 - float|| / ||float||, is compared to a tolerance. It also reports
+// the time each net takes past the data layers.
+// Usage:
+//    compare_int8 -model net_int8.prototxt -weights net.caffemodel
+//        [-iterations 50] [-tolerance 0.01] [-blobs prob,accuracy]
+// The exit status is 0 if every blob is within the tolerance, 1 otherwise.
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::LayerParameter;
+using caffe::Net;
+using caffe::NetParameter;
+using caffe::Timer;
+using std::string;
+using std::vector;
+
+DEFINE_string(model, "",
+    "The int8 model definition written by calibrate_int8.");
+DEFINE_string(weights, "",
+    "The trained weights of the model.");
+DEFINE_int32(iterations, 50,
+    "The number of mini-batches of samples to compare on.");
+DEFINE_double(tolerance, 0.01,
+    "The largest relative error of a blob that passes.");
+DEFINE_string(blobs, "",
+    "Optional; a comma separated list of the blobs to compare. By default "
+    "the outputs of the net are.");
+
+// The accumulated differences of one blob over the iterations.
+struct BlobError {
+  string name;
+  double squared_error;
+  double squared_norm;
+  double max_error;
+};
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compares an int8 model to its float version.\n"
+      "Usage: compare_int8 -model net_int8.prototxt -weights net.caffemodel");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to compare.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need trained weights to compare.";
+
+  // The float net is the same definition with the INT8 engines reset.
+  NetParameter int8_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &int8_param);
+  int8_param.mutable_state()->set_phase(caffe::TEST);
+  NetParameter float_param(int8_param);
+  int num_int8 = 0;
+  for (int i = 0; i < float_param.layer_size(); ++i) {
+    LayerParameter* layer = float_param.mutable_layer(i);
+    if (layer->inner_product_param().engine() ==
+        caffe::InnerProductParameter_Engine_INT8) {
+      layer->mutable_inner_product_param()->clear_engine();
+      ++num_int8;
+    }
+    if (layer->convolution_param().engine() ==
+        caffe::ConvolutionParameter_Engine_INT8) {
+      layer->mutable_convolution_param()->clear_engine();
+      ++num_int8;
+    }
+  }
+  if (num_int8 == 0) {
+    LOG(WARNING) << FLAGS_model << " has no layer with the INT8 engine.";
+  }
+
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> float_net(float_param);
+  Net<float> int8_net(int8_param);
+  float_net.CopyTrainedLayersFrom(FLAGS_weights);
+  int8_net.CopyTrainedLayersFrom(FLAGS_weights);
+  CHECK_EQ(float_net.num_inputs(), 0)
+      << "The model must read its samples through data layers.";
+
+  // The leading layers without bottoms read the samples; the int8 net gets
+  // their tops from the float net and forwards from the next layer.
+  int first = 0;
+  while (first < float_net.layers().size() &&
+         float_net.bottom_vecs()[first].empty()) {
+    ++first;
+  }
+  CHECK_GT(first, 0) << "The model must read its samples through data layers.";
+  CHECK_LT(first, float_net.layers().size()) << "The net only reads data.";
+
+  vector<BlobError> errors;
+  vector<string> names;
+  if (FLAGS_blobs.size()) {
+    boost::split(names, FLAGS_blobs, boost::is_any_of(","));
+  } else {
+    for (int i = 0; i < float_net.num_outputs(); ++i) {
+      const int index = float_net.output_blob_indices()[i];
+      names.push_back(float_net.blob_names()[index]);
+    }
+  }
+  for (int i = 0; i < names.size(); ++i) {
+    CHECK(float_net.has_blob(names[i])) << "Unknown blob " << names[i];
+    BlobError error = {names[i], 0, 0, 0};
+    errors.push_back(error);
+  }
+
+  Timer timer;
+  double float_ms = 0, int8_ms = 0;
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    float_net.ForwardFromTo(0, first - 1);
+    timer.Start();
+    float_net.ForwardFrom(first);
+    float_ms += timer.MilliSeconds();
+    for (int i = 0; i < first; ++i) {
+      for (int j = 0; j < float_net.top_vecs()[i].size(); ++j) {
+        int8_net.top_vecs()[i][j]->CopyFrom(*float_net.top_vecs()[i][j],
+            false, true);
+      }
+    }
+    timer.Start();
+    int8_net.ForwardFrom(first);
+    int8_ms += timer.MilliSeconds();
+    for (int i = 0; i < errors.size(); ++i) {
+      const Blob<float>& expected = *float_net.blob_by_name(errors[i].name);
+      const Blob<float>& actual = *int8_net.blob_by_name(errors[i].name);
+      for (int k = 0; k < expected.count(); ++k) {
+        const double error = actual.cpu_data()[k] - expected.cpu_data()[k];
+        errors[i].squared_error += error * error;
+        errors[i].squared_norm += expected.cpu_data()[k] *
+            expected.cpu_data()[k];
+        errors[i].max_error = std::max(errors[i].max_error, std::fabs(error));
+      }
+    }
+  }
+
+  LOG(INFO) << "Float forward: " << float_ms / FLAGS_iterations << " ms, "
+      << "int8 forward: " << int8_ms / FLAGS_iterations << " ms.";
+  bool passed = true;
+  for (int i = 0; i < errors.size(); ++i) {
+    const double relative_error = errors[i].squared_norm > 0 ?
+        std::sqrt(errors[i].squared_error / errors[i].squared_norm) :
+        std::sqrt(errors[i].squared_error);
+    const bool blob_passed = relative_error <= FLAGS_tolerance;
+    LOG(INFO) << errors[i].name << ": relative error " << relative_error
+        << ", max absolute error " << errors[i].max_error
+        << (blob_passed ? "" : " exceeds the tolerance");
+    passed = passed && blob_passed;
+  }
+  LOG(INFO) << (passed ? "PASSED" : "FAILED") << " with tolerance "
+      << FLAGS_tolerance;
+  return passed ? 0 : 1;
+}
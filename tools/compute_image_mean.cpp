@@ -1,12 +1,18 @@
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
@@ -20,6 +26,69 @@ using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
         "The backend {leveldb, lmdb} containing the images");
+DEFINE_int32(threads, 1,
+        "Number of threads decoding and accumulating the images");
+DEFINE_string(channel_stats_file, "",
+        "Optional: write the mean and std of every channel to this file");
+DEFINE_int32(resize_height, 0, "Height of the optional resized mean");
+DEFINE_int32(resize_width, 0, "Width of the optional resized mean");
+DEFINE_string(resized_mean_file, "",
+        "Optional: write the mean resized to resize_height x resize_width");
+
+// Values are read from the DB this many at a time, while the workers
+// accumulate the previous ones.
+const int kChunkSize = 1024;
+
+// Per-thread double precision sums, reduced at the end.
+struct Accumulator {
+  std::vector<double> sum;
+  std::vector<double> channel_sum_sq;
+};
+
+// Accumulates the serialized Datums values[begin, end) with the given stride.
+void Accumulate(const std::vector<std::string>* values, const int begin,
+    const int end, const int stride, const int channels,
+    Accumulator* accumulator) {
+  const int data_size = accumulator->sum.size();
+  const int dim = data_size / channels;
+  double* sum = &accumulator->sum[0];
+  double* channel_sum_sq = &accumulator->channel_sum_sq[0];
+  Datum datum;
+  for (int i = begin; i < end; i += stride) {
+    datum.ParseFromString((*values)[i]);
+    DecodeDatumNative(&datum);
+
+    const std::string& data = datum.data();
+    const int size_in_datum = std::max<int>(datum.data().size(),
+        datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+        size_in_datum;
+    if (data.size() != 0) {
+      CHECK_EQ(data.size(), size_in_datum);
+      const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data.data());
+      for (int c = 0; c < channels; ++c) {
+        double sum_sq = 0;
+        for (int j = c * dim; j < (c + 1) * dim; ++j) {
+          const double value = ptr[j];
+          sum[j] += value;
+          sum_sq += value * value;
+        }
+        channel_sum_sq[c] += sum_sq;
+      }
+    } else {
+      CHECK_EQ(datum.float_data_size(), size_in_datum);
+      for (int c = 0; c < channels; ++c) {
+        double sum_sq = 0;
+        for (int j = c * dim; j < (c + 1) * dim; ++j) {
+          const double value = datum.float_data(j);
+          sum[j] += value;
+          sum_sq += value * value;
+        }
+        channel_sum_sq[c] += sum_sq;
+      }
+    }
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -45,7 +114,6 @@ int main(int argc, char** argv) {
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
 
   BlobProto sum_blob;
-  int count = 0;
   // load first datum
   Datum datum;
   datum.ParseFromString(cursor->value());
@@ -58,62 +126,112 @@ int main(int argc, char** argv) {
   sum_blob.set_channels(datum.channels());
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
+  const int channels = datum.channels();
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
+  const int dim = datum.height() * datum.width();
+  const int num_threads = std::max(1, FLAGS_threads);
+  std::vector<Accumulator> accumulators(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    accumulators[i].sum.resize(data_size, 0.);
+    accumulators[i].channel_sum_sq.resize(channels, 0.);
   }
   LOG(INFO) << "Starting Iteration";
-  while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
-
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-      }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
-      }
+  // This thread only reads the DB; the workers decode and accumulate the
+  // previous chunk meanwhile.
+  std::vector<std::string> values;
+  std::vector<std::string> next_values;
+  values.reserve(kChunkSize);
+  next_values.reserve(kChunkSize);
+  int count = 0;
+  while (cursor->valid() || !values.empty()) {
+    boost::thread_group workers;
+    for (int i = 0; i < num_threads; ++i) {
+      workers.create_thread(boost::bind(&Accumulate, &values, i,
+          static_cast<int>(values.size()), num_threads, channels,
+          &accumulators[i]));
     }
-    ++count;
-    if (count % 10000 == 0) {
+    next_values.clear();
+    while (cursor->valid() && next_values.size() < size_t(kChunkSize)) {
+      next_values.push_back(cursor->value());
+      cursor->Next();
+    }
+    workers.join_all();
+    const int previous_count = count;
+    count += values.size();
+    if (count / 10000 != previous_count / 10000) {
       LOG(INFO) << "Processed " << count << " files.";
     }
-    cursor->Next();
+    values.swap(next_values);
   }
 
   if (count % 10000 != 0) {
     LOG(INFO) << "Processed " << count << " files.";
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  // Reduce the per-thread sums
+  std::vector<double> sum(data_size, 0.);
+  std::vector<double> channel_sum_sq(channels, 0.);
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK_EQ(accumulators[i].sum.size(), data_size);
+    for (int j = 0; j < data_size; ++j) {
+      sum[j] += accumulators[i].sum[j];
+    }
+    for (int c = 0; c < channels; ++c) {
+      channel_sum_sq[c] += accumulators[i].channel_sum_sq[c];
+    }
+  }
+  for (int j = 0; j < data_size; ++j) {
+    sum_blob.add_data(sum[j] / count);
   }
   // Write to disk
   if (argc == 3) {
     LOG(INFO) << "Write to " << argv[2];
     WriteProtoToBinaryFile(sum_blob, argv[2]);
   }
-  const int channels = sum_blob.channels();
-  const int dim = sum_blob.height() * sum_blob.width();
-  std::vector<float> mean_values(channels, 0.0);
+  std::vector<double> mean_values(channels, 0.0);
+  std::vector<double> std_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int c = 0; c < channels; ++c) {
     for (int i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+      mean_values[c] += sum[dim * c + i];
+    }
+    mean_values[c] /= static_cast<double>(count) * dim;
+    const double variance = channel_sum_sq[c] /
+        (static_cast<double>(count) * dim) - mean_values[c] * mean_values[c];
+    std_values[c] = std::sqrt(std::max(variance, 0.));
+    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c];
+    LOG(INFO) << "std_value channel [" << c << "]:" << std_values[c];
+  }
+  if (FLAGS_channel_stats_file.size()) {
+    LOG(INFO) << "Write channel stats to " << FLAGS_channel_stats_file;
+    std::ofstream outfile(FLAGS_channel_stats_file.c_str());
+    for (int c = 0; c < channels; ++c) {
+      outfile << mean_values[c] << " " << std_values[c] << std::endl;
+    }
+    CHECK(outfile.good()) << "Failed to write " << FLAGS_channel_stats_file;
+  }
+  if (FLAGS_resized_mean_file.size()) {
+    CHECK_GT(FLAGS_resize_height, 0) << "resize_height must be set";
+    CHECK_GT(FLAGS_resize_width, 0) << "resize_width must be set";
+    BlobProto resized_blob;
+    resized_blob.set_num(1);
+    resized_blob.set_channels(channels);
+    resized_blob.set_height(FLAGS_resize_height);
+    resized_blob.set_width(FLAGS_resize_width);
+    cv::Size size(FLAGS_resize_width, FLAGS_resize_height);
+    for (int c = 0; c < channels; ++c) {
+      cv::Mat channel_mean(datum.height(), datum.width(), CV_32FC1,
+          sum_blob.mutable_data()->mutable_data() + dim * c);
+      cv::Mat resized_mean;
+      cv::resize(channel_mean, resized_mean, size, 0, 0, cv::INTER_LINEAR);
+      for (int h = 0; h < resized_mean.rows; ++h) {
+        const float* ptr = resized_mean.ptr<float>(h);
+        for (int w = 0; w < resized_mean.cols; ++w) {
+          resized_blob.add_data(ptr[w]);
+        }
+      }
     }
-    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c] / dim;
+    LOG(INFO) << "Write resized mean to " << FLAGS_resized_mean_file;
+    WriteProtoToBinaryFile(resized_blob, FLAGS_resized_mean_file);
   }
   return 0;
 }
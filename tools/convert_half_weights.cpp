@@ -0,0 +1,54 @@
+// This program converts the trained weights of a .caffemodel between full
+// and half precision (BlobProto.half_data), which halves the size of the
+// model. Weights with any half precision blob are expanded to full
+// precision; others, or raw weights, are compressed to half precision.
+// Usage:
+//    convert_half_weights input_weights output_weights
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/raw_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+static bool HasHalfData(const NetParameter& net_param) {
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    for (int j = 0; j < net_param.layer(i).blobs_size(); ++j) {
+      if (net_param.layer(i).blobs(j).has_half_data()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_half_weights input_weights output_weights";
+    return 1;
+  }
+  const string input_filename(argv[1]);
+  const string output_filename(argv[2]);
+  NetParameter net_param;
+  if (IsRawWeightsFile(input_filename)) {
+    RawWeights weights(input_filename);
+    RawWeightsToNetParameter(weights, &net_param);
+  } else {
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+  }
+  if (HasHalfData(net_param)) {
+    ConvertNetParameterToFloat(&net_param);
+    LOG(ERROR) << "Expanding the weights to full precision.";
+  } else {
+    ConvertNetParameterToHalf(&net_param);
+    LOG(ERROR) << "Compressing the weights to half precision.";
+  }
+  WriteProtoToBinaryFile(net_param, output_filename);
+  LOG(ERROR) << "Wrote " << output_filename;
+  return 0;
+}
@@ -9,15 +9,20 @@
 //   ....
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
@@ -41,6 +46,73 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_int32(threads, 1,
+    "Number of threads reading, resizing and encoding images");
+DEFINE_int32(commit_size, 1000,
+    "Number of images written per database transaction");
+DEFINE_int32(shards, 1,
+    "Split the output round robin over this many databases, named "
+    "DB_NAME_000, DB_NAME_001, ...");
+DEFINE_bool(resume, false,
+    "Continue an interrupted conversion from DB_NAME.progress");
+
+// Lines are read this many at a time, while the previous ones are written.
+const int kChunkSize = 256;
+
+// Reads lines [begin, end) with the given stride into values[line - begin]
+// as serialized Datums. Images that cannot be read are left empty.
+void ReadLines(const std::vector<std::pair<std::string, int> >* lines,
+    const std::string* root_folder, const int begin, const int end,
+    const int stride, std::vector<std::string>* values) {
+  const bool is_color = !FLAGS_gray;
+  const int resize_height = std::max<int>(0, FLAGS_resize_height);
+  const int resize_width = std::max<int>(0, FLAGS_resize_width);
+  Datum datum;
+  for (int line_id = begin; line_id < end; line_id += stride) {
+    std::string enc = FLAGS_encode_type;
+    if (FLAGS_encoded && !enc.size()) {
+      // Guess the encoding type from the file name
+      string fn = (*lines)[line_id].first;
+      size_t p = fn.rfind('.');
+      if ( p == fn.npos )
+        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+      enc = fn.substr(p);
+      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    }
+    std::string& value = (*values)[line_id - begin];
+    value.clear();
+    if (ReadImageToDatum(*root_folder + (*lines)[line_id].first,
+        (*lines)[line_id].second, resize_height, resize_width, is_color,
+        enc, &datum)) {
+      CHECK(datum.SerializeToString(&value));
+    }
+  }
+}
+
+// Splits lines [begin, end) over num_threads new workers.
+void StartReading(const std::vector<std::pair<std::string, int> >* lines,
+    const std::string* root_folder, const int begin, const int end,
+    const int num_threads, std::vector<std::string>* values,
+    boost::thread_group* workers) {
+  for (int i = 0; i < num_threads; ++i) {
+    workers->create_thread(boost::bind(&ReadLines, lines, root_folder,
+        begin + i, end, num_threads, values));
+  }
+}
+
+// Progress of a conversion: the shuffle seed, the first line that has not
+// been committed and the number of images committed before it.
+void WriteProgress(const std::string& filename, const unsigned int seed,
+    const int line_id, const int count) {
+  const std::string temp_filename = filename + ".tmp";
+  {
+    std::ofstream outfile(temp_filename.c_str());
+    outfile << seed << " " << line_id << " " << count << std::endl;
+    CHECK(outfile.good()) << "Failed to write " << temp_filename;
+  }
+  CHECK_EQ(rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Failed to write " << filename;
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -62,10 +134,25 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const bool is_color = !FLAGS_gray;
   const bool check_size = FLAGS_check_size;
   const bool encoded = FLAGS_encoded;
   const string encode_type = FLAGS_encode_type;
+  const int num_threads = std::max(1, FLAGS_threads);
+  const int commit_size = std::max(1, FLAGS_commit_size);
+  const int num_shards = std::max(1, FLAGS_shards);
+  const std::string progress_filename = string(argv[3]) + ".progress";
+
+  // A resumed run continues from the last commit, with the same shuffle.
+  unsigned int seed = caffe_rng_rand();
+  int start_line = 0;
+  int count = 0;
+  if (FLAGS_resume) {
+    std::ifstream progress_file(progress_filename.c_str());
+    CHECK(progress_file >> seed >> start_line >> count)
+        << "Cannot resume without " << progress_filename;
+    LOG(INFO) << "Resuming at line " << start_line << " after " << count
+        << " images.";
+  }
 
   std::ifstream infile(argv[2]);
   std::vector<std::pair<std::string, int> > lines;
@@ -77,76 +164,100 @@ int main(int argc, char** argv) {
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
-    shuffle(lines.begin(), lines.end());
+    Caffe::RNG shuffle_rng(seed);
+    shuffle(lines.begin(), lines.end(),
+        static_cast<caffe::rng_t*>(shuffle_rng.generator()));
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
+  CHECK_LE(start_line, lines.size()) << "The progress does not match the list";
 
   if (encode_type.size() && !encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
 
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
-
-  // Create new DB
-  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[3], db::NEW);
-  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  // Create new DBs, or reopen them to resume
+  std::vector<boost::shared_ptr<db::DB> > dbs(num_shards);
+  std::vector<boost::shared_ptr<db::Transaction> > txns(num_shards);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    std::string db_name(argv[3]);
+    if (num_shards > 1) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "_%03d", shard);
+      db_name += suffix;
+    }
+    dbs[shard].reset(db::GetDB(FLAGS_backend));
+    dbs[shard]->Open(db_name, FLAGS_resume ? db::WRITE : db::NEW);
+    txns[shard].reset(dbs[shard]->NewTransaction());
+  }
 
   // Storing to db
   std::string root_folder(argv[1]);
-  Datum datum;
-  int count = 0;
   const int kMaxKeyLength = 256;
   char key_cstr[kMaxKeyLength];
   int data_size = 0;
   bool data_size_initialized = false;
+  const int num_lines = lines.size();
+  Datum datum;
 
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  // The workers read the next chunk of lines while this thread writes the
+  // current one in order, so the output does not depend on num_threads.
+  std::vector<std::string> values(kChunkSize);
+  std::vector<std::string> next_values(kChunkSize);
+  if (start_line < num_lines) {
+    boost::thread_group workers;
+    StartReading(&lines, &root_folder, start_line,
+        std::min(start_line + kChunkSize, num_lines), num_threads, &values,
+        &workers);
+    workers.join_all();
+  }
+  for (int begin = start_line; begin < num_lines; begin += kChunkSize) {
+    const int end = std::min(begin + kChunkSize, num_lines);
+    boost::thread_group workers;
+    if (end < num_lines) {
+      StartReading(&lines, &root_folder, end,
+          std::min(end + kChunkSize, num_lines), num_threads, &next_values,
+          &workers);
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
-    if (check_size) {
-      if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
-        data_size_initialized = true;
-      } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+    for (int line_id = begin; line_id < end; ++line_id) {
+      const string& out = values[line_id - begin];
+      if (out.empty()) continue;
+      if (check_size) {
+        CHECK(datum.ParseFromString(out));
+        if (!data_size_initialized) {
+          data_size = datum.channels() * datum.height() * datum.width();
+          data_size_initialized = true;
+        } else {
+          const std::string& data = datum.data();
+          CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
+              << data.size();
+        }
+      }
+      // sequential
+      int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
+          lines[line_id].first.c_str());
+
+      // Put in db
+      txns[line_id % num_shards]->Put(string(key_cstr, length), out);
+
+      if (++count % commit_size == 0) {
+        // Commit db
+        for (int shard = 0; shard < num_shards; ++shard) {
+          txns[shard]->Commit();
+          txns[shard].reset(dbs[shard]->NewTransaction());
+        }
+        WriteProgress(progress_filename, seed, line_id + 1, count);
+        LOG(ERROR) << "Processed " << count << " files.";
       }
     }
-    // sequential
-    int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
-
-    // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(string(key_cstr, length), out);
-
-    if (++count % 1000 == 0) {
-      // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
-      LOG(ERROR) << "Processed " << count << " files.";
-    }
+    workers.join_all();
+    values.swap(next_values);
   }
   // write the last batch
-  if (count % 1000 != 0) {
-    txn->Commit();
+  if (count % commit_size != 0) {
+    for (int shard = 0; shard < num_shards; ++shard) {
+      txns[shard]->Commit();
+    }
     LOG(ERROR) << "Processed " << count << " files.";
   }
+  WriteProgress(progress_filename, seed, num_lines, count);
   return 0;
 }
@@ -0,0 +1,38 @@
+// This program converts trained weights between the .caffemodel format and
+// the memory mapped raw weights format (see caffe/util/raw_weights.hpp). The
+// direction is given by the format of the input.
+// Usage:
+//    convert_raw_weights input_weights output_weights
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/raw_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_raw_weights input_weights output_weights";
+    return 1;
+  }
+  const string input_filename(argv[1]);
+  const string output_filename(argv[2]);
+  NetParameter net_param;
+  if (IsRawWeightsFile(input_filename)) {
+    RawWeights weights(input_filename);
+    RawWeightsToNetParameter(weights, &net_param);
+    WriteProtoToBinaryFile(net_param, output_filename);
+    LOG(ERROR) << "Wrote " << weights.header().blob_size()
+        << " blobs as a binary NetParameter to " << output_filename;
+  } else {
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+    WriteRawWeights(net_param, output_filename);
+    LOG(ERROR) << "Wrote raw weights to " << output_filename;
+  }
+  return 0;
+}
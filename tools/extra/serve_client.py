@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+"""
+Sends inference requests to `caffe serve` on a Unix socket and reports their
+latency and the throughput, e.g.
+
+    caffe serve -model deploy.prototxt -weights net.caffemodel \\
+        -socket /tmp/caffe.sock
+    tools/extra/serve_client.py /tmp/caffe.sock --input_floats 3072 \\
+        --requests 10000 --concurrency 32
+
+Each of the concurrent clients has its own connection and sends its next
+request when the last one is answered. The inputs are random; input_floats
+must be the number of values of one sample of all the inputs of the model.
+"""
+import argparse
+import random
+import socket
+import struct
+import threading
+import time
+
+INFER, STATS, ERROR = 0, 1, 2
+
+
+def read_fully(sock, size):
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise IOError('The server closed the connection')
+        data += chunk
+    return data
+
+
+def request(sock, frame_type, payload=b''):
+    sock.sendall(struct.pack('=II', frame_type, len(payload)) + payload)
+    frame_type, size = struct.unpack('=II', read_fully(sock, 8))
+    payload = read_fully(sock, size)
+    if frame_type == ERROR:
+        raise RuntimeError(payload.decode())
+    return payload
+
+
+def client(path, payload, num_requests, latencies):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    for _ in range(num_requests):
+        start = time.time()
+        request(sock, INFER, payload)
+        latencies.append((time.time() - start) * 1000)
+    sock.close()
+
+
+def percentile(sorted_values, p):
+    rank = max(int(-(-p * len(sorted_values) // 100)), 1)
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Load test a caffe serve Unix socket.')
+    parser.add_argument('socket')
+    parser.add_argument('--input_floats', type=int, required=True)
+    parser.add_argument('--requests', type=int, default=1000)
+    parser.add_argument('--concurrency', type=int, default=8)
+    args = parser.parse_args()
+
+    payload = struct.pack('=%df' % args.input_floats,
+                          *[random.uniform(-1, 1)
+                            for _ in range(args.input_floats)])
+    latencies = []
+    per_client = args.requests // args.concurrency
+    threads = [threading.Thread(target=client,
+                                args=(args.socket, payload, per_client,
+                                      latencies))
+               for _ in range(args.concurrency)]
+    start = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    seconds = time.time() - start
+
+    latencies.sort()
+    print('%d requests in %.2f s: %.1f requests/s' % (
+        len(latencies), seconds, len(latencies) / seconds))
+    for p in (50, 90, 99):
+        print('p%d latency: %.3f ms' % (p, percentile(latencies, p)))
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(args.socket)
+    print('server stats: ' + request(sock, STATS).decode())
+    sock.close()
+
+
+if __name__ == '__main__':
+    main()
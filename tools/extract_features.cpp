@@ -1,16 +1,24 @@
 #include <stdio.h>  // for snprintf
+#include <algorithm>
+#include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+#include "gflags/gflags.h"
 #include "google/protobuf/text_format.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/raw_weights.hpp"
 #include "caffe/vision_layers.hpp"
 
 using caffe::Blob;
@@ -19,8 +27,303 @@ using caffe::Datum;
 using caffe::Net;
 using boost::shared_ptr;
 using std::string;
+using std::vector;
 namespace db = caffe::db;
 
+DEFINE_int32(num_samples, 0,
+    "Extract the features of exactly this many samples, trimming the last "
+    "mini-batch, instead of num_mini_batches mini-batches");
+DEFINE_int32(queue_size, 4,
+    "Number of mini-batches buffered between the stages of the pipeline");
+DEFINE_int32(commit_size, 1000,
+    "Number of samples written per database transaction");
+
+// The features of one blob for samples [start, start + num), copied out of
+// the net so the next Forward can run while they are written.
+template <typename Dtype>
+struct FeatureBatch {
+  int start;
+  int num;
+  vector<Dtype> data;
+};
+
+// Serialized Datums and their keys, ready to be put into a database.
+struct RecordBatch {
+  vector<std::pair<string, string> > records;
+};
+
+// A queue between two stages of the pipeline. Push blocks while it is full,
+// so a slow stage holds back the ones before it rather than buffering
+// every feature, and Pop blocks while it is empty.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(int capacity) : capacity_(std::max(1, capacity)) {}
+
+  void Push(const T& t) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.size() >= capacity_) {
+      not_full_.wait(lock);
+    }
+    queue_.push(t);
+    not_empty_.notify_one();
+  }
+
+  T Pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      not_empty_.wait(lock);
+    }
+    T t = queue_.front();
+    queue_.pop();
+    not_full_.notify_one();
+    return t;
+  }
+
+ private:
+  const size_t capacity_;
+  std::queue<T> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable not_full_;
+  boost::condition_variable not_empty_;
+};
+
+// Writes the features of one blob on threads of its own. The forward pass
+// pushes the batches in order and a null batch after the last one.
+template <typename Dtype>
+class FeatureWriter {
+ public:
+  FeatureWriter(const string& blob_name, const string& dataset_name,
+      const vector<int>& sample_shape, int num_samples)
+      : blob_name_(blob_name), dataset_name_(dataset_name),
+        sample_shape_(sample_shape), num_samples_(num_samples),
+        sample_count_(1), batches_(FLAGS_queue_size) {
+    for (int i = 0; i < sample_shape.size(); ++i) {
+      sample_count_ *= sample_shape[i];
+    }
+  }
+  virtual ~FeatureWriter() {}
+
+  int num_samples() const { return num_samples_; }
+  int sample_count() const { return sample_count_; }
+
+  virtual void Start() {
+    threads_.create_thread(boost::bind(&FeatureWriter::Write, this));
+  }
+  void Push(const shared_ptr<FeatureBatch<Dtype> >& batch) {
+    batches_.Push(batch);
+  }
+  // Signals the end of the features and waits until they are written.
+  void Finish() {
+    batches_.Push(shared_ptr<FeatureBatch<Dtype> >());
+    threads_.join_all();
+    LOG(ERROR) << "Extracted features of " << num_samples_
+        << " query images for feature blob " << blob_name_;
+  }
+
+ protected:
+  // Pops and writes batches until the null one.
+  virtual void Write() = 0;
+
+  const string blob_name_;
+  const string dataset_name_;
+  const vector<int> sample_shape_;
+  const int num_samples_;
+  int sample_count_;
+  BoundedQueue<shared_ptr<FeatureBatch<Dtype> > > batches_;
+  boost::thread_group threads_;
+};
+
+// Writes one Datum per sample to a leveldb or lmdb, keyed by the sample
+// index. Serializing the Datums and committing them are separate stages, so
+// a commit overlaps the serialization of the next batch.
+template <typename Dtype>
+class DBFeatureWriter : public FeatureWriter<Dtype> {
+ public:
+  DBFeatureWriter(const string& blob_name, const string& dataset_name,
+      const vector<int>& sample_shape, int num_samples, const string& db_type)
+      : FeatureWriter<Dtype>(blob_name, dataset_name, sample_shape,
+            num_samples),
+        db_(db::GetDB(db_type)), records_(FLAGS_queue_size) {
+    LOG(INFO) << "Opening dataset " << dataset_name;
+    db_->Open(dataset_name, db::NEW);
+  }
+
+  virtual void Start() {
+    FeatureWriter<Dtype>::Start();
+    this->threads_.create_thread(boost::bind(&DBFeatureWriter::Commit, this));
+  }
+
+ protected:
+  virtual void Write() {
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    Datum datum;
+    datum.set_height(this->sample_count_);
+    datum.set_width(1);
+    datum.set_channels(1);
+    // Sized once and overwritten for every sample, rather than appended to
+    // value by value.
+    google::protobuf::RepeatedField<float>* float_data =
+        datum.mutable_float_data();
+    float_data->Resize(this->sample_count_, 0);
+    while (true) {
+      shared_ptr<FeatureBatch<Dtype> > batch = this->batches_.Pop();
+      if (!batch) {
+        break;
+      }
+      shared_ptr<RecordBatch> records(new RecordBatch());
+      records->records.resize(batch->num);
+      for (int n = 0; n < batch->num; ++n) {
+        const Dtype* sample_data =
+            &batch->data[0] + n * this->sample_count_;
+        std::copy(sample_data, sample_data + this->sample_count_,
+            float_data->mutable_data());
+        int length = snprintf(key_str, kMaxKeyStrLength, "%d",
+            batch->start + n);
+        records->records[n].first.assign(key_str, length);
+        CHECK(datum.SerializeToString(&records->records[n].second));
+      }
+      records_.Push(records);
+    }
+    records_.Push(shared_ptr<RecordBatch>());
+  }
+
+  void Commit() {
+    const int commit_size = std::max(1, FLAGS_commit_size);
+    shared_ptr<db::Transaction> txn(db_->NewTransaction());
+    int count = 0;
+    while (true) {
+      shared_ptr<RecordBatch> records = records_.Pop();
+      if (!records) {
+        break;
+      }
+      for (int i = 0; i < records->records.size(); ++i) {
+        txn->Put(records->records[i].first, records->records[i].second);
+        if (++count % commit_size == 0) {
+          txn->Commit();
+          txn.reset(db_->NewTransaction());
+          LOG(ERROR) << "Extracted features of " << count
+              << " query images for feature blob " << this->blob_name_;
+        }
+      }
+    }
+    // write the last batch
+    if (count % commit_size != 0) {
+      txn->Commit();
+    }
+    db_->Close();
+  }
+
+  shared_ptr<db::DB> db_;
+  BoundedQueue<shared_ptr<RecordBatch> > records_;
+};
+
+static hid_t Hdf5Type(float /*value*/) { return H5T_NATIVE_FLOAT; }
+static hid_t Hdf5Type(double /*value*/) { return H5T_NATIVE_DOUBLE; }
+
+// The HDF5 library is not thread safe; the writers take turns.
+static boost::mutex hdf5_mutex;
+
+// Writes the features to an HDF5 file, as a num_samples x sample_shape
+// dataset named after the blob, so the file can feed an HDF5Data layer.
+template <typename Dtype>
+class Hdf5FeatureWriter : public FeatureWriter<Dtype> {
+ public:
+  Hdf5FeatureWriter(const string& blob_name, const string& dataset_name,
+      const vector<int>& sample_shape, int num_samples)
+      : FeatureWriter<Dtype>(blob_name, dataset_name, sample_shape,
+            num_samples) {
+    boost::mutex::scoped_lock lock(hdf5_mutex);
+    file_id_ = H5Fcreate(dataset_name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    CHECK_GE(file_id_, 0) << "Failed to create HDF5 file " << dataset_name;
+    vector<hsize_t> dims(1, num_samples);
+    dims.insert(dims.end(), sample_shape.begin(), sample_shape.end());
+    hid_t space_id = H5Screate_simple(dims.size(), &dims[0], NULL);
+    dataset_id_ = H5Dcreate2(file_id_, blob_name.c_str(), Hdf5Type(Dtype()),
+        space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sclose(space_id);
+    CHECK_GE(dataset_id_, 0) << "Failed to create dataset " << blob_name
+        << " in " << dataset_name;
+  }
+
+ protected:
+  virtual void Write() {
+    while (true) {
+      shared_ptr<FeatureBatch<Dtype> > batch = this->batches_.Pop();
+      if (!batch) {
+        break;
+      }
+      boost::mutex::scoped_lock lock(hdf5_mutex);
+      vector<hsize_t> start(this->sample_shape_.size() + 1, 0);
+      start[0] = batch->start;
+      vector<hsize_t> count(1, batch->num);
+      count.insert(count.end(), this->sample_shape_.begin(),
+          this->sample_shape_.end());
+      hid_t memory_space_id = H5Screate_simple(count.size(), &count[0], NULL);
+      hid_t file_space_id = H5Dget_space(dataset_id_);
+      H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET, &start[0], NULL,
+          &count[0], NULL);
+      herr_t status = H5Dwrite(dataset_id_, Hdf5Type(Dtype()),
+          memory_space_id, file_space_id, H5P_DEFAULT, &batch->data[0]);
+      CHECK_GE(status, 0) << "Failed to write to " << this->dataset_name_;
+      H5Sclose(file_space_id);
+      H5Sclose(memory_space_id);
+    }
+    boost::mutex::scoped_lock lock(hdf5_mutex);
+    H5Dclose(dataset_id_);
+    CHECK_GE(H5Fclose(file_id_), 0) << "Failed to close "
+        << this->dataset_name_;
+  }
+
+  hid_t file_id_;
+  hid_t dataset_id_;
+};
+
+// Writes the features as a raw weights file holding one num_samples x
+// sample_shape float32 blob, which can be memory mapped with RawWeights.
+template <typename Dtype>
+class RawFeatureWriter : public FeatureWriter<Dtype> {
+ public:
+  RawFeatureWriter(const string& blob_name, const string& dataset_name,
+      const vector<int>& sample_shape, int num_samples)
+      : FeatureWriter<Dtype>(blob_name, dataset_name, sample_shape,
+            num_samples) {
+    caffe::RawWeightsHeader header;
+    header.set_name(blob_name);
+    caffe::RawWeightsBlob* entry = header.add_blob();
+    entry->set_layer(blob_name);
+    entry->mutable_shape()->add_dim(num_samples);
+    for (int i = 0; i < sample_shape.size(); ++i) {
+      entry->mutable_shape()->add_dim(sample_shape[i]);
+    }
+    writer_.reset(new caffe::RawWeightsWriter(header, dataset_name));
+  }
+
+ protected:
+  virtual void Write() {
+    while (true) {
+      shared_ptr<FeatureBatch<Dtype> > batch = this->batches_.Pop();
+      if (!batch) {
+        break;
+      }
+      WriteValues(batch->data);
+    }
+    writer_->Close();
+  }
+
+  void WriteValues(const vector<float>& values) {
+    writer_->Write(&values[0], values.size());
+  }
+  void WriteValues(const vector<double>& values) {
+    const vector<float> float_values(values.begin(), values.end());
+    writer_->Write(&float_values[0], float_values.size());
+  }
+
+  shared_ptr<caffe::RawWeightsWriter> writer_;
+};
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -32,19 +335,32 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
   const int num_required_args = 7;
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features [FLAGS] pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
     "  [CPU/GPU] [DEVICE_ID=0]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and dataset names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and datasets must be equal.";
+    " and datasets must be equal.\n"
+    "db_type is leveldb or lmdb, or hdf5 or raw to write each feature to a"
+    " file holding a single num_samples x feature_shape array.\n"
+    "Flags:\n"
+    "  --num_samples=N  extract exactly N samples instead of num_mini_batches"
+    " mini-batches\n"
+    "  --queue_size=N  mini-batches buffered between the pipeline stages\n"
+    "  --commit_size=N  samples written per database transaction";
     return 1;
   }
   int arg_pos = num_required_args;
@@ -119,70 +435,75 @@ int feature_extraction_pipeline(int argc, char** argv) {
   }
 
   int num_mini_batches = atoi(argv[++arg_pos]);
+  std::string db_type(argv[++arg_pos]);
 
-  std::vector<shared_ptr<db::DB> > feature_dbs;
-  std::vector<shared_ptr<db::Transaction> > txns;
+  std::vector<shared_ptr<Blob<Dtype> > > feature_blobs;
+  std::vector<shared_ptr<FeatureWriter<Dtype> > > writers;
   for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    shared_ptr<db::DB> db(db::GetDB(argv[++arg_pos]));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
+    const shared_ptr<Blob<Dtype> > feature_blob =
+        feature_extraction_net->blob_by_name(blob_names[i]);
+    const vector<int> sample_shape(feature_blob->shape().begin() + 1,
+        feature_blob->shape().end());
+    const int num_samples = FLAGS_num_samples > 0 ? FLAGS_num_samples :
+        num_mini_batches * feature_blob->num();
+    FeatureWriter<Dtype>* writer;
+    if (db_type == "hdf5") {
+      writer = new Hdf5FeatureWriter<Dtype>(blob_names[i], dataset_names[i],
+          sample_shape, num_samples);
+    } else if (db_type == "raw") {
+      writer = new RawFeatureWriter<Dtype>(blob_names[i], dataset_names[i],
+          sample_shape, num_samples);
+    } else {
+      writer = new DBFeatureWriter<Dtype>(blob_names[i], dataset_names[i],
+          sample_shape, num_samples, db_type);
+    }
+    feature_blobs.push_back(feature_blob);
+    writers.push_back(shared_ptr<FeatureWriter<Dtype> >(writer));
+    writers.back()->Start();
   }
 
   LOG(ERROR)<< "Extacting Features";
 
-  Datum datum;
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
+  // This thread runs the forward passes and copies the features out, while
+  // the writers serialize and store the previous mini-batches.
+  caffe::CPUTimer timer;
+  timer.Start();
   std::vector<Blob<float>*> input_vec;
   std::vector<int> image_indices(num_features, 0);
-  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
+  bool done = true;
+  for (int i = 0; i < num_features; ++i) {
+    done = done && writers[i]->num_samples() == 0;
+  }
+  while (!done) {
     feature_extraction_net->Forward(input_vec);
+    done = true;
     for (int i = 0; i < num_features; ++i) {
-      const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
-          ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(dim_features);
-        datum.set_width(1);
-        datum.set_channels(1);
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        int length = snprintf(key_str, kMaxKeyStrLength, "%d",
-            image_indices[i]);
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(std::string(key_str, length), out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
-  for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
+      const Blob<Dtype>& feature_blob = *feature_blobs[i];
+      FeatureWriter<Dtype>& writer = *writers[i];
+      CHECK_EQ(feature_blob.count() / feature_blob.num(),
+          writer.sample_count()) << "The shape of feature blob "
+          << blob_names[i] << " changed";
+      shared_ptr<FeatureBatch<Dtype> > batch(new FeatureBatch<Dtype>());
+      batch->start = image_indices[i];
+      batch->num = std::min(feature_blob.num(),
+          writer.num_samples() - image_indices[i]);
+      const Dtype* feature_blob_data = feature_blob.cpu_data();
+      batch->data.assign(feature_blob_data,
+          feature_blob_data + batch->num * writer.sample_count());
+      if (batch->num > 0) {
+        writer.Push(batch);
+      }
+      image_indices[i] += batch->num;
+      done = done && image_indices[i] == writer.num_samples();
     }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-        " query images for feature blob " << blob_names[i];
-    feature_dbs.at(i)->Close();
+  }  // while (!done)
+  for (int i = 0; i < num_features; ++i) {
+    writers[i]->Finish();
   }
 
+  const float seconds = timer.MicroSeconds() / 1e6;
+  LOG(ERROR) << "Extracted " << image_indices[0] << " samples in " << seconds
+      << " s (" << image_indices[0] / seconds << " samples/s)";
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
 }
-
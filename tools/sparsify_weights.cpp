@@ -0,0 +1,74 @@
+// This program stores the pruned weights of a .caffemodel as sparse blobs
+// (BlobProto.sparse_index): each blob with at most max_density of its values
+// nonzero keeps only those and their indices. Prune the weights first, e.g.
+// by thresholding them; the SPARSE InnerProduct engine then computes with
+// the nonzero weights only. Half precision weights stay half precision.
+// Usage:
+//    sparsify_weights input_weights output_weights [max_density]
+// max_density defaults to 0.5, past which sparse blobs are no smaller.
+
+#include <cstdlib>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/raw_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+static int CountBlobs(const NetParameter& net_param, bool sparse_only) {
+  int count = 0;
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    for (int j = 0; j < net_param.layer(i).blobs_size(); ++j) {
+      const BlobProto& blob = net_param.layer(i).blobs(j);
+      count += !sparse_only || blob.sparse_index_size() > 0;
+    }
+  }
+  return count;
+}
+
+static bool HasHalfData(const NetParameter& net_param) {
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    for (int j = 0; j < net_param.layer(i).blobs_size(); ++j) {
+      if (net_param.layer(i).blobs(j).has_half_data()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3 && argc != 4) {
+    LOG(ERROR) << "Usage: "
+        << "sparsify_weights input_weights output_weights [max_density]";
+    return 1;
+  }
+  const string input_filename(argv[1]);
+  const string output_filename(argv[2]);
+  const float max_density = argc == 4 ? atof(argv[3]) : 0.5;
+  CHECK(max_density >= 0 && max_density <= 1)
+      << "max_density must be between 0 and 1.";
+  NetParameter net_param;
+  if (IsRawWeightsFile(input_filename)) {
+    RawWeights weights(input_filename);
+    RawWeightsToNetParameter(weights, &net_param);
+  } else {
+    ReadNetParamsFromBinaryFileOrDie(input_filename, &net_param);
+  }
+  const bool half = HasHalfData(net_param);
+  if (half) {
+    ConvertNetParameterToFloat(&net_param);
+  }
+  ConvertNetParameterToSparse(&net_param, max_density);
+  if (half) {
+    ConvertNetParameterToHalf(&net_param);
+  }
+  WriteProtoToBinaryFile(net_param, output_filename);
+  LOG(ERROR) << "Wrote " << output_filename << " with "
+      << CountBlobs(net_param, true) << " of " << CountBlobs(net_param, false)
+      << " blobs sparse.";
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::CPUTimer;
+using caffe::DataTransformer;
+using caffe::Datum;
+using caffe::TransformationParameter;
+using std::string;
+using std::vector;
+
+DEFINE_int32(batch_size, 64, "Number of items per batch.");
+DEFINE_int32(channels, 3, "Channels of the synthetic images.");
+DEFINE_int32(height, 256, "Height of the synthetic images.");
+DEFINE_int32(width, 256, "Width of the synthetic images.");
+DEFINE_int32(crop_size, 227, "Crop size; 0 disables cropping.");
+DEFINE_bool(mirror, true, "Randomly mirror the items.");
+DEFINE_int32(threads, 1, "transform_param.num_threads for the batched path.");
+DEFINE_int32(iterations, 50, "The number of batches to time.");
+
+// Compares transforming a batch of uint8 Datums one item at a time (the way
+// the data layers used to) with the planned, batched DataTransformer path.
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Time DataTransformer on synthetic uint8 data\n"
+        "Usage:\n"
+        "    transform_speed_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_batch_size, 0);
+  CHECK_GT(FLAGS_iterations, 0);
+
+  Caffe::set_random_seed(1701);
+  vector<Datum> datums(FLAGS_batch_size);
+  for (int n = 0; n < FLAGS_batch_size; ++n) {
+    Datum& datum = datums[n];
+    datum.set_channels(FLAGS_channels);
+    datum.set_height(FLAGS_height);
+    datum.set_width(FLAGS_width);
+    string buffer(FLAGS_channels * FLAGS_height * FLAGS_width, ' ');
+    for (int i = 0; i < buffer.size(); ++i) {
+      buffer[i] = static_cast<char>((i * 7 + n * 13) % 256);
+    }
+    datum.set_data(buffer);
+  }
+
+  TransformationParameter param;
+  param.set_crop_size(FLAGS_crop_size);
+  param.set_mirror(FLAGS_mirror);
+  param.set_scale(0.00390625);
+  for (int c = 0; c < FLAGS_channels; ++c) {
+    param.add_mean_value(100 + c);
+  }
+  const int height = FLAGS_crop_size ? FLAGS_crop_size : FLAGS_height;
+  const int width = FLAGS_crop_size ? FLAGS_crop_size : FLAGS_width;
+  Blob<float> blob(FLAGS_batch_size, FLAGS_channels, height, width);
+
+  DataTransformer<float> item_transformer(param, caffe::TRAIN);
+  item_transformer.InitRand();
+  Blob<float> uni_blob(1, FLAGS_channels, height, width);
+  CPUTimer timer;
+  timer.Start();
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    float* top_data = blob.mutable_cpu_data();
+    for (int n = 0; n < FLAGS_batch_size; ++n) {
+      uni_blob.set_cpu_data(top_data + blob.offset(n));
+      item_transformer.Transform(datums[n], &uni_blob);
+    }
+  }
+  timer.Stop();
+  const float item_ms = timer.MilliSeconds() / FLAGS_iterations;
+  LOG(INFO) << "Per-item transform: " << item_ms << " ms/batch.";
+
+  param.set_num_threads(FLAGS_threads);
+  DataTransformer<float> batch_transformer(param, caffe::TRAIN);
+  batch_transformer.InitRand();
+  timer.Start();
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    batch_transformer.Transform(datums, &blob);
+  }
+  timer.Stop();
+  const float batch_ms = timer.MilliSeconds() / FLAGS_iterations;
+  LOG(INFO) << "Batched transform (" << FLAGS_threads << " threads): "
+            << batch_ms << " ms/batch.";
+  LOG(INFO) << "Speedup: " << item_ms / batch_ms << "x";
+  return 0;
+}